@@ -0,0 +1,62 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_ALIGNEDALLOCATOR_H
+#define PIXY_ROIMUX_ALIGNEDALLOCATOR_H
+
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+
+namespace pixy_roimux {
+    ///
+    /// Standard allocator returning memory aligned to t_alignment bytes.
+    /// Used for the sample buffers so that every channel starts on a cache line and can be loaded with aligned vector
+    /// instructions.
+    ///
+    template <typename T, std::size_t t_alignment>
+    class AlignedAllocator {
+    public:
+        typedef T value_type;
+
+        template <typename U>
+        struct rebind {
+            typedef AlignedAllocator<U, t_alignment> other;
+        };
+
+        AlignedAllocator() {}
+
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, t_alignment> &) {}
+
+        T *allocate(const std::size_t t_n) {
+            void *ptr = nullptr;
+            if (posix_memalign(&ptr, t_alignment, t_n * sizeof(T))) {
+                throw std::bad_alloc();
+            }
+            return static_cast<T *>(ptr);
+        }
+
+        void deallocate(T *const t_ptr, const std::size_t) {
+            free(t_ptr);
+        }
+    };
+
+
+    template <typename T, typename U, std::size_t t_alignment>
+    bool operator==(const AlignedAllocator<T, t_alignment> &, const AlignedAllocator<U, t_alignment> &) {
+        return true;
+    }
+
+
+    template <typename T, typename U, std::size_t t_alignment>
+    bool operator!=(const AlignedAllocator<T, t_alignment> &, const AlignedAllocator<U, t_alignment> &) {
+        return false;
+    }
+}
+
+
+#endif //PIXY_ROIMUX_ALIGNEDALLOCATOR_H
@@ -0,0 +1,158 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_BATCHEDFFT_H
+#define PIXY_ROIMUX_BATCHEDFFT_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+#if defined(PIXY_USE_FFTW)
+#include <fftw3.h>
+#endif
+#include "EventWaveforms.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Batched real FFT of all channels of a plane.
+    /// load() copies the samples of a plane into a buffer holding all channels, forward() transforms them with a single
+    /// batched real-to-complex FFT, multiply() applies a filter to the spectra of all channels, inverse() transforms them
+    /// back in place and store() rounds the result back into the plane. The FFT plans and the buffer are created on the
+    /// first plane of each geometry and reused for all further planes of the same number of channels and samples, so
+    /// none of the steps allocate afterwards. Requires pixy to be built with FFTW.
+    ///
+    class BatchedFft {
+    public:
+
+        ///
+        /// Constructor. Exits if pixy was built without FFTW.
+        ///
+        BatchedFft();
+
+        ///
+        /// Destructor freeing the plans and buffers.
+        ///
+        ~BatchedFft();
+
+        BatchedFft(const BatchedFft &) = delete;
+        BatchedFft &operator=(const BatchedFft &) = delete;
+
+        ///
+        /// Get the number of complex frequency bins of a channel of t_nSamples samples.
+        ///
+        static unsigned getNBins(const unsigned t_nSamples) {
+            return t_nSamples / 2 + 1;
+        }
+
+        ///
+        /// Select the geometry of a plane, creating its plans if needed, and copy its samples into the buffer.
+        ///
+        void load(const PlaneWaveforms &t_plane);
+
+        ///
+        /// Transform all channels of the loaded plane to the frequency domain.
+        ///
+        void forward();
+
+        ///
+        /// Multiply the spectrum of every channel bin by bin with a real filter of getNBins() entries.
+        ///
+        void multiply(const std::vector<double> &t_filter);
+
+        ///
+        /// Multiply the spectrum of every channel bin by bin with a complex filter of getNBins() entries.
+        ///
+        void multiply(const std::vector<std::complex<double>> &t_filter);
+
+        ///
+        /// Transform all channels back to the time domain. Like FFTW, the result is not normalised, so the filter must
+        /// include a factor of 1 / nSamples.
+        ///
+        void inverse();
+
+        ///
+        /// Round the samples in the buffer back into a plane of the loaded geometry.
+        ///
+        void store(PlaneWaveforms &t_plane) const;
+
+        ///
+        /// Get the number of geometries plans were created for.
+        ///
+        unsigned long getNGeometries() const {
+            return m_batches.size();
+        }
+
+        ///
+        /// Get the time spent creating plans.
+        ///
+        std::chrono::duration<double> getPlanTime() const {
+            return m_planTime;
+        }
+
+
+    private:
+
+        ///
+        /// FFT plans and buffer of one plane geometry.
+        ///
+        struct Batch {
+            ///
+            /// Number of channels.
+            ///
+            unsigned nChannels = 0;
+
+            ///
+            /// Number of samples per channel.
+            ///
+            unsigned nSamples = 0;
+
+            ///
+            /// Number of complex frequency bins per channel.
+            ///
+            unsigned nBins = 0;
+
+#if defined(PIXY_USE_FFTW)
+            ///
+            /// Buffer holding the samples of all channels, each channel padded to 2 * nBins doubles so its spectrum
+            /// fits in place.
+            ///
+            double *buffer = nullptr;
+
+            ///
+            /// Batched forward and inverse transforms of all channels.
+            ///
+            fftw_plan forward = nullptr;
+            fftw_plan inverse = nullptr;
+#endif
+        };
+
+        ///
+        /// Batches by number of channels and number of samples.
+        ///
+        std::map<std::pair<unsigned, unsigned>, Batch> m_batches;
+
+        ///
+        /// Batch of the loaded plane.
+        ///
+        Batch *m_batch = nullptr;
+
+        ///
+        /// Time spent creating plans.
+        ///
+        std::chrono::duration<double> m_planTime{0.};
+    };
+}
+
+
+#endif //PIXY_ROIMUX_BATCHEDFFT_H
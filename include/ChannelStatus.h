@@ -0,0 +1,224 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_CHANNELSTATUS_H
+#define PIXY_ROIMUX_CHANNELSTATUS_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "EventWaveforms.h"
+#include "RunParams.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// State of a readout channel.
+    ///
+    enum class ChannelState {
+        ///
+        /// Working channel.
+        ///
+        good,
+
+        ///
+        /// Noise far below the expected level, the channel sees no input.
+        ///
+        dead,
+
+        ///
+        /// Noise far above the median of the plane.
+        ///
+        noisy,
+
+        ///
+        /// All samples identical, the ADC is frozen or saturated.
+        ///
+        stuck
+    };
+
+
+    ///
+    /// Status map of the readout channels of a run.
+    /// After the raw noise of a plane has been estimated, update() classifies each channel. A channel is stuck if all
+    /// its samples are identical, dead if its noise standard deviation is below deadSigma and noisy if it's above
+    /// noisySigmaFactor times the median of the plane. A channel flagged in minEvents consecutive events is masked for
+    /// the rest of the run. Masked channels skip the noise estimation, stay out of the common mode sums, get
+    /// thresholds no sample can reach in the noise model and are skipped by the hit finder. The map is kept by run ID in
+    /// a text file, so later passes over a run mask its bad channels from the first event. Forked workers each save their
+    /// map of the current run to a shard file with saveShard(), which the driver adds to its map in shard order with
+    /// addShard() before saving it.
+    ///
+    class ChannelStatus {
+    public:
+
+        ///
+        /// Constructor loading the status file given in the run parameters, if any.
+        ///
+        explicit ChannelStatus(const RunParams &t_runParams);
+
+        ///
+        /// Check whether a readout channel (pixels first, then ROIs) is masked.
+        ///
+        bool isMasked(const unsigned t_channel) const {
+            const auto channel = m_channels.find(t_channel);
+            return (channel != m_channels.cend()) && channel->second.masked;
+        }
+
+        ///
+        /// Update the running statistics of the unmasked channels of a plane with the raw noise of the current event.
+        /// t_firstChannel is the readout channel of the first channel of the plane, t_noiseParams holds the baseline
+        /// and the noise standard deviation of every channel. Entries of masked channels are ignored.
+        ///
+        void update(
+                const PlaneWaveforms &t_plane,
+                const unsigned t_firstChannel,
+                const std::vector<std::pair<double, double>> &t_noiseParams);
+
+        ///
+        /// Record the time spent estimating the noise of t_nChannels unmasked channels and the number of masked
+        /// channels skipped, to report the time saved.
+        ///
+        void addNoiseTime(
+                const unsigned long t_nChannels,
+                const unsigned long t_nSkipped,
+                const std::chrono::duration<double> t_time);
+
+        ///
+        /// Record channels skipped by the hit finder.
+        ///
+        void addSkippedHitChannels(const unsigned long t_nSkipped) {
+            m_nSkippedHitChannels += t_nSkipped;
+        }
+
+        ///
+        /// Write the map to its file, if any.
+        ///
+        void save() const;
+
+        ///
+        /// Write the state of every channel seen in the current run to a shard file.
+        ///
+        void saveShard(const std::string &t_fileName) const;
+
+        ///
+        /// Add the channel states of a shard file written by saveShard(). Masked channels stay masked, the states of all
+        /// others are replaced, so the shards must be added in the order of their events. Returns false if the shard
+        /// file doesn't exist.
+        ///
+        bool addShard(const std::string &t_fileName);
+
+        ///
+        /// Print the masked channels and an estimate of the time saved.
+        ///
+        void printStats() const;
+
+
+    private:
+
+        ///
+        /// Running statistics of one channel.
+        ///
+        struct Channel {
+            ///
+            /// State of the channel in the last events.
+            ///
+            ChannelState state = ChannelState::good;
+
+            ///
+            /// Number of consecutive events the channel was flagged with state.
+            ///
+            unsigned long nFlagged = 0;
+
+            ///
+            /// Whether the channel is masked.
+            ///
+            bool masked = false;
+        };
+
+        ///
+        /// Get the name of a state in the status file.
+        ///
+        static const char *getStateName(const ChannelState t_state);
+
+        ///
+        /// Load a status file, or add a shard file. Returns false if it doesn't exist. Dies if it's corrupt.
+        ///
+        bool load(
+                const std::string &t_fileName,
+                const bool t_shard);
+
+        ///
+        /// Write the map to a file, either together with the other runs and only the flagged channels, or as a shard with
+        /// all channels of the current run.
+        ///
+        void write(
+                const std::string &t_fileName,
+                const bool t_shard) const;
+
+        ///
+        /// Name of the status file. Empty if the map isn't persisted.
+        ///
+        const std::string m_fileName;
+
+        ///
+        /// Current run ID.
+        ///
+        const unsigned m_runId;
+
+        ///
+        /// Noise standard deviation in ADC counts below which a channel is dead.
+        ///
+        const double m_deadSigma;
+
+        ///
+        /// Factor on the median noise standard deviation of the plane above which a channel is noisy.
+        ///
+        const double m_noisySigmaFactor;
+
+        ///
+        /// Number of consecutive flagged events after which a channel is masked.
+        ///
+        const unsigned m_minEvents;
+
+        ///
+        /// Statistics of the current run by readout channel.
+        ///
+        std::map<unsigned, Channel> m_channels;
+
+        ///
+        /// Entries of other runs in the status file, kept to write them back. Lines by run ID.
+        ///
+        std::multimap<unsigned, std::string> m_otherRuns;
+
+        ///
+        /// Number of channels masked from the start by the status file.
+        ///
+        unsigned long m_nLoadedMasked = 0;
+
+        ///
+        /// Number of noise estimations done and skipped, and the time spent on the ones done.
+        ///
+        unsigned long m_nNoiseChannels = 0;
+        unsigned long m_nSkippedNoiseChannels = 0;
+        std::chrono::duration<double> m_noiseTime{0.};
+
+        ///
+        /// Number of channels skipped by the hit finder.
+        ///
+        unsigned long m_nSkippedHitChannels = 0;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_CHANNELSTATUS_H
@@ -5,25 +5,37 @@
 #ifndef PIXY_ROIMUX_CHARGEDATA_H
 #define PIXY_ROIMUX_CHARGEDATA_H
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <utility>
 #include <vector>
 #include "TFile.h"
 #include "TH2S.h"
+#include "CompressedWaveforms.h"
+#include "DaqKeyIndex.h"
+#include "EventWaveforms.h"
+#include "MatchedFilter.h"
+#include "NativeRawFile.h"
+#include "NoiseModel.h"
 #include "RunParams.h"
+#include "SparseWaveforms.h"
 
 
 namespace pixy_roimux {
 ///
-/// This class converts the two DAQ histograms of each event to a pixel and an ROI histogram.
+/// This class converts the two DAQ histograms of each event to a pixel and an ROI waveform plane.
 /// The constructor can either read from a single pair of DAQ histograms passed by const pointers, read from a vector of
 /// pairs of const pointers to DAQ histograms, read an entire ROOT file of DAQ histograms, or read a specific subset of
-/// DAQ histograms from a ROOT file using a vector of event numbers. The resulting histograms are stored as pairs in a
-/// vector again. They can be accessed individually or using the vector both by reference and const reference. This
-/// allows to pass an instance of this class containing all the relevant data by reference and const reference,
-/// respectively. Futhermore, the histograms are cut after the number of samples passed on to the respective constructor
-/// in order to reduce the amount of unused data.
+/// DAQ histograms from a ROOT file using a vector of event numbers. The resulting waveforms are stored as one
+/// EventWaveforms per event in a vector. They can be accessed individually or using the vector both by reference and
+/// const reference. This allows to pass an instance of this class containing all the relevant data by reference and
+/// const reference, respectively. Futhermore, the waveforms are cut after the number of samples passed on to the
+/// respective constructor in order to reduce the amount of unused data.
+/// When many events have to be held at once, compress() replaces the waveforms by their compressed counterparts. The
+/// hit finder decodes them channel by channel, everything else needs the decompressed waveforms. Alternatively,
+/// zeroSuppress() replaces the waveforms by the zero-suppressed segments around the pulses, which the hit finder and
+/// the histogram output can use directly.
 ///
     class ChargeData {
     public:
@@ -43,7 +55,7 @@ namespace pixy_roimux {
         /// Constructor reading a subset of events from a ROOT file.
         /// Reads all the events contained in eventIds. Needs the map to assign the DAQ channels to the corresponding
         /// readout channels. The histograms are cut after nSamples samples. The subrun ID and the event IDs are stored with
-        /// the data for later use.
+        /// the data for later use. The events are read in the order they are stored in the file, using a DaqKeyIndex.
         ///
         ChargeData(
                 const std::string t_rootFileName,
@@ -75,45 +87,144 @@ namespace pixy_roimux {
                 const pixy_roimux::RunParams &t_map);
 
         ///
-        /// Get the vector containing the readout histograms.
+        /// Constructor loading a subset of events from a memory-mapped native raw waveform file.
+        /// The waveforms are copied out of the mapping, nothing is converted. The subrun ID and the event IDs are stored
+        /// with the data for later use.
         ///
-        std::vector<std::pair<TH2S, TH2S>> &getReadoutHistos() {
-            return m_readoutHistos;
+        ChargeData(
+                const NativeRawFile &t_nativeFile,
+                const std::vector<unsigned> &t_eventIds,
+                const unsigned t_subrunId,
+                const pixy_roimux::RunParams &t_map);
+
+        ///
+        /// Constructor taking over already converted readout waveforms, e.g. from the EventReader.
+        /// The event IDs are taken from the waveforms. The subrun ID is stored with the data for later use.
+        ///
+        ChargeData(
+                std::vector<EventWaveforms> &&t_waveforms,
+                const unsigned t_subrunId,
+                const pixy_roimux::RunParams &t_map);
+
+        ///
+        /// Get the vector containing the readout waveforms.
+        ///
+        std::vector<EventWaveforms> &getWaveforms() {
+            return m_waveforms;
         }
 
         ///
-        /// Get the vector containing the readout histograms as const reference.
+        /// Get the vector containing the readout waveforms as const reference.
         ///
-        const std::vector<std::pair<TH2S, TH2S>> &getReadoutHistos() const {
-            return m_readoutHistos;
+        const std::vector<EventWaveforms> &getWaveforms() const {
+            return m_waveforms;
         }
 
         ///
-        /// Get the pixel histogram of a particular event.
+        /// Get the pixel waveforms of a particular event.
         ///
-        TH2S &getPixelHisto(const unsigned t_eventIdx) {
-            return m_readoutHistos.at(t_eventIdx).first;
+        PlaneWaveforms &getPixelPlane(const unsigned t_eventIdx) {
+            return m_waveforms.at(t_eventIdx).getPixelPlane();
         }
 
         ///
-        /// Get the pixel histogram of a particular event as const reference.
+        /// Get the pixel waveforms of a particular event as const reference.
         ///
-        const TH2S &getPixelHisto(const unsigned t_eventIdx) const {
-            return m_readoutHistos.at(t_eventIdx).first;
+        const PlaneWaveforms &getPixelPlane(const unsigned t_eventIdx) const {
+            return m_waveforms.at(t_eventIdx).getPixelPlane();
         }
 
         ///
-        /// Get the ROI histogram of a particular event.
+        /// Get the ROI waveforms of a particular event.
         ///
-        TH2S &getRoiHisto(const unsigned t_eventIdx) {
-            return m_readoutHistos.at(t_eventIdx).second;
+        PlaneWaveforms &getRoiPlane(const unsigned t_eventIdx) {
+            return m_waveforms.at(t_eventIdx).getRoiPlane();
         }
 
         ///
-        /// Get the ROI histogram of a particular event as const reference.
+        /// Get the ROI waveforms of a particular event as const reference.
+        ///
+        const PlaneWaveforms &getRoiPlane(const unsigned t_eventIdx) const {
+            return m_waveforms.at(t_eventIdx).getRoiPlane();
+        }
+
+        ///
+        /// Estimate the noise model of every event from the current waveforms, optionally using a pedestal database and
+        /// masking the channels masked in a channel status map.
+        /// Meant to be called once after the common mode removal, compress() and zeroSuppress() call it if it hasn't been
+        /// called yet.
+        ///
+        void computeNoiseModels(
+                PedestalDatabase *const t_pedestals = nullptr,
+                ChannelStatus *const t_channelStatus = nullptr);
+
+        ///
+        /// Get the noise models of all events as const reference. Empty until computeNoiseModels() is called.
+        ///
+        const std::vector<NoiseModel> &getNoiseModels() const {
+            return m_noiseModels;
+        }
+
+        ///
+        /// Filter a copy of the pixel plane of every event with the matched filter and estimate the noise of the copies
+        /// in the noise models, computing the noise models first if needed. The hit finder and the zero suppression
+        /// take the pixel peak candidates from these seed planes, while the hits are still measured on the unfiltered
+        /// waveforms. Has to be called on the full waveforms, the seed planes stay uncompressed afterwards.
+        ///
+        void computePixelSeeds(
+                MatchedFilter &t_filter,
+                ChannelStatus *const t_channelStatus = nullptr);
+
+        ///
+        /// Get the matched-filtered pixel planes of all events as const reference. Empty unless computePixelSeeds()
+        /// was called.
+        ///
+        const std::vector<PlaneWaveforms> &getPixelSeedPlanes() const {
+            return m_pixelSeedPlanes;
+        }
+
+        ///
+        /// Compress the waveforms of all events to save memory. getWaveforms() is empty until decompress() is called.
+        ///
+        void compress();
+
+        ///
+        /// Restore the waveforms of all events from the compressed waveforms.
+        ///
+        void decompress();
+
+        ///
+        /// Check whether the waveforms are compressed.
         ///
-        const TH2S &getRoiHisto(const unsigned t_eventIdx) const {
-            return m_readoutHistos.at(t_eventIdx).second;
+        bool isCompressed() const {
+            return m_compressed;
+        }
+
+        ///
+        /// Zero suppress the waveforms of all events. getWaveforms() is empty afterwards. The zero suppression depends
+        /// on the hit finder settings, so t_bipolarRoiHits must match the one passed to ChargeHits::findHits.
+        ///
+        void zeroSuppress(const bool t_bipolarRoiHits = true);
+
+        ///
+        /// Check whether the waveforms are zero suppressed.
+        ///
+        bool isZeroSuppressed() const {
+            return m_zeroSuppressed;
+        }
+
+        ///
+        /// Get the vector containing the zero-suppressed waveforms as const reference.
+        ///
+        const std::vector<SparseWaveforms> &getSparseWaveforms() const {
+            return m_sparseWaveforms;
+        }
+
+        ///
+        /// Get the vector containing the compressed waveforms as const reference.
+        ///
+        const std::vector<CompressedWaveforms> &getCompressedWaveforms() const {
+            return m_compressedWaveforms;
         }
 
         ///
@@ -130,6 +241,18 @@ namespace pixy_roimux {
             return m_subrunId;
         }
 
+        ///
+        /// Convert a single pair of DAQ histograms to the readout waveforms of one event.
+        /// t_waveforms needs to be allocated with the dimensions given by the run parameters. Each channel is copied as a
+        /// whole row from the bin array of the DAQ histogram using the gather plan of the run parameters. Only reads from
+        /// the histograms and the run parameters, so it may be called concurrently on different events.
+        ///
+        static void convertEvent(
+                const TH2S &t_indHisto,
+                const TH2S &t_colHisto,
+                const pixy_roimux::RunParams &t_runParams,
+                EventWaveforms &t_waveforms);
+
 
     private:
 
@@ -159,9 +282,39 @@ namespace pixy_roimux {
         std::vector<std::pair<const TH2S *, const TH2S *>> m_daqHistos;
 
         ///
-        /// Vector of readout histograms.
+        /// Vector of readout waveforms.
+        ///
+        std::vector<EventWaveforms> m_waveforms;
+
+        ///
+        /// Vector of noise models, one per event.
+        ///
+        std::vector<NoiseModel> m_noiseModels;
+
+        ///
+        /// Vector of matched-filtered pixel planes, one per event if computePixelSeeds() was called.
+        ///
+        std::vector<PlaneWaveforms> m_pixelSeedPlanes;
+
+        ///
+        /// Vector of compressed readout waveforms, only filled while compressed.
+        ///
+        std::vector<CompressedWaveforms> m_compressedWaveforms;
+
+        ///
+        /// Whether the waveforms are compressed.
+        ///
+        bool m_compressed = false;
+
+        ///
+        /// Vector of zero-suppressed readout waveforms, only filled while zero suppressed.
+        ///
+        std::vector<SparseWaveforms> m_sparseWaveforms;
+
+        ///
+        /// Whether the waveforms are zero suppressed.
         ///
-        std::vector<std::pair<TH2S, TH2S>> m_readoutHistos;
+        bool m_zeroSuppressed = false;
     };
 }
 
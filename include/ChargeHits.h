@@ -6,20 +6,32 @@
 #define PIXY_ROIMUX_CHARGEHITS_H
 
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <numeric>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
-#include "TH1D.h"
-#include "TH2S.h"
 #include "TSpectrum.h"
+#include <chrono>
 #include "ChargeData.h"
+#include "CompressedWaveforms.h"
+#include "CrossingDetector.h"
+#include "DiscriminatorParams.h"
+#include "EnvelopePyramid.h"
 #include "Event.h"
-#include "NoiseFilter.h"
+#include "EventWaveforms.h"
+#include "HitDiagnostics.h"
+#include "NoiseModel.h"
+#include "PulseTemplateFit.h"
 #include "RunParams.h"
+#include "SparseWaveforms.h"
+#include "ThreadPool.h"
 
 
 namespace pixy_roimux {
@@ -39,13 +51,18 @@ namespace pixy_roimux {
 
         ///
         /// Constructor reading raw data from a viperData object.
-        /// Needs a viperMap object for the pixel and ROI coordinates.
+        /// Needs a viperMap object for the pixel and ROI coordinates. The diagnostics of all found hits are added to
+        /// t_diagnostics, which may outlive this object.
         ///
         ChargeHits(
                 const ChargeData &t_chargeData,
-                const RunParams &t_runParams) :
+                const RunParams &t_runParams,
+                HitDiagnostics &t_diagnostics) :
                 m_chargeData(t_chargeData),
-                m_runParams(t_runParams) {
+                m_runParams(t_runParams),
+                m_discParams(t_runParams),
+                m_diagnostics(t_diagnostics),
+                m_threadPool(t_runParams.getHitFinderThreads()) {
         }
 
         ///
@@ -53,6 +70,14 @@ namespace pixy_roimux {
         ///
         void findHits(const bool t_bipolarRoiHits = true);
 
+        ///
+        /// Set the pulse template fit refining the times of the pixel hits before the 3D hits are built. nullptr
+        /// skips it.
+        ///
+        void setPulseTemplateFit(PulseTemplateFit *const t_pulseTemplateFit) {
+            m_pulseTemplateFit = t_pulseTemplateFit;
+        }
+
         ///
         /// Get the vector containing all the hits of all events.
         ///
@@ -67,32 +92,46 @@ namespace pixy_roimux {
             return m_events;
         }
 
+        ///
+        /// Get the time spent in the 2D hit finder on the ROI planes of all events, summed over all threads.
+        ///
+        std::chrono::duration<double> getRoiHitTime() const {
+            return m_roiHitTime;
+        }
+
+        ///
+        /// Get the number of masked channels skipped by the 2D hit finder in all events.
+        ///
+        unsigned long getNMaskedChannels() const {
+            return m_nMaskedChannels;
+        }
+
 
     private:
 
         ///
-        /// Private method used internally to find all the 2D hits in a histrogram using ROOT's TSpectrum class.
-        /// discFracLow and discFracHigh are the fractions used for the constant fraction discrimination. The hits are
-        /// stored in a vector of viper2dHits passed by reference. Besides hitOrderLow(High) map the time of the first(last)
-        /// pulse sample to the index of the hit. This allows to simply loop through the ROI hits and the pixel hits using
-        /// these maps to match them.
-        ///
-        void find2dHits(
-                const TH2S &t_histo,
-                std::vector<Hit2d> &t_hits,
-                std::multimap<unsigned, unsigned> &t_hitOrderLead,
-                std::multimap<unsigned, unsigned> &t_hitOrderTrail,
-                unsigned &t_nMissed,
-                const bool t_bipolar,
-                const double t_discSigmaPosLead,
-                const double t_discSigmaPosPeak,
-                const double t_discAbsPosPeak,
-                const double t_discSigmaPosTrail,
-                const double t_discSigmaNegLead,
-                const double t_discSigmaNegPeak,
-                const double t_discAbsNegPeak,
-                const double t_discSigmaNegTrail
-        );
+        /// Private method used internally to find all the 2D hits in the waveforms of the pixel and the ROI plane of one
+        /// event. discFracLow and discFracHigh are the fractions used for the constant fraction discrimination. The hits
+        /// are stored in the pixel and ROI hit vectors of the event. Besides hitOrderLow(High) map the time of the
+        /// first(last) pulse sample to the index of the hit. This allows to simply loop through the ROI hits and the
+        /// pixel hits using these maps to match them. The waveforms are either EventWaveforms, CompressedWaveforms or
+        /// SparseWaveforms, each channel is copied or decoded into a scratch buffer before it's searched. For a
+        /// SparsePlane, only the segments are searched, which gives the same hits as searching the full waveforms. The
+        /// baseline and the thresholds of each channel are taken from the noise model. An EnvelopePyramid of each
+        /// segment finds the blocks reaching the peak threshold, only the samples around them are evaluated by a
+        /// CrossingDetector. The channels of both planes are searched in parallel by the thread pool and
+        /// their hits merged in channel order, so the hits are the same for any number of threads. If a
+        /// matched-filtered pixel plane is given, the pixel peak candidates are taken from it with the seed thresholds
+        /// of the noise model, while the edges, the peak, the integral and the raw pulse of each hit are taken from the
+        /// unfiltered waveforms.
+        ///
+        template <typename Waveforms>
+        void findPlaneHits(
+                const Waveforms &t_waveforms,
+                const NoiseModel &t_noiseModel,
+                Event &t_event,
+                const bool t_bipolarRoiHits,
+                const PlaneWaveforms *const t_pixelSeedPlane = nullptr);
 
         ///
         /// Private method used internally to find the 3D hits using the 2D hits found in both readout histos by the 2D hit
@@ -107,6 +146,7 @@ namespace pixy_roimux {
         /// Find hit candidates.
         /// This method builds viper3dHits using the matches found by Find3dHits. It reads the vectors mapping pixels to
         /// ROIs from the viperEvent passed by reference, builds viper3dEvents and writes them back to the event struct.
+        /// The z coordinate is computed from the time of the pixel hit, Hit2d::posPeakTime.
         ///
         void buildHitCandidates(Event &t_event);
 
@@ -125,57 +165,51 @@ namespace pixy_roimux {
         ///
         const RunParams &m_runParams;
 
-	///
-        /// Vector to help draw ambiguity histogram
         ///
-	std::vector<unsigned> ambiguities;
-
-	///
-        /// Vector to help draw unmatched histogram
+        /// Search ranges of the 2D hit finder.
         ///
-	std::vector<unsigned> unmatched;
+        const DiscriminatorParams m_discParams;
 
-	///
-        /// Vector to help draw difference in peak sample histogram
         ///
-	std::vector<int> timePeakAcceptance;
-
-	///
-        /// Vector to help draw difference in firstsample histogram
+        /// Diagnostic histograms filled while finding hits.
         ///
-	std::vector<int> timeFirstSampleAcceptance;	
+        HitDiagnostics &m_diagnostics;
 
-	///
-        /// Vector to help draw posPulseHeight for pixel histogram
         ///
-	std::vector<unsigned> posPulsePixelMax;
-
-	///
-        /// Vector to help draw posPulseHeight for ROI histogram
+        /// Time spent copying or decoding channels into the scratch buffer.
         ///
-	std::vector<unsigned> posPulseROIMax;
+        std::chrono::duration<double> m_loadTime{0.};
 
-	///
-        /// Vector to help draw thrPosPeak for Pixel histogram
         ///
-	std::vector<double> thrPosPeakVec;
+        /// Number of samples copied or decoded into the scratch buffer.
+        ///
+        unsigned long m_nLoadedSamples = 0;
 
-	///
-        /// Vector to help draw transparency histogram
         ///
-	std::vector<double> transparencyVec;
+        /// Number of loaded samples within the discrimination ranges of envelope blocks reaching the peak threshold,
+        /// the only ones compared against the thresholds at full resolution.
+        ///
+        unsigned long m_nScannedSamples = 0;
 
-	///
-        /// Vector to help draw pixel widths histogram
         ///
-	std::vector<double> pixelWidthsVec;
+        /// Time spent in the 2D hit finder on the ROI planes, summed over all threads.
+        ///
+        std::chrono::duration<double> m_roiHitTime{0.};
 
-	///
-        /// Vector to help draw roi widths histogram
         ///
-	std::vector<double> roiWidthsVec;
+        /// Number of masked channels skipped by the 2D hit finder.
+        ///
+        unsigned long m_nMaskedChannels = 0;
 
+        ///
+        /// Pulse template fit, not owned. May be nullptr.
+        ///
+        PulseTemplateFit *m_pulseTemplateFit = nullptr;
 
+        ///
+        /// Threads of the 2D hit finder.
+        ///
+        ThreadPool m_threadPool;
     };
 }
 
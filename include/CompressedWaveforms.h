@@ -0,0 +1,206 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_COMPRESSEDWAVEFORMS_H
+#define PIXY_ROIMUX_COMPRESSEDWAVEFORMS_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "EventWaveforms.h"
+#include "Span.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Compressed sample buffer of a single readout plane.
+    /// Each channel is split into blocks of kBlockSize samples. A block stores its first sample verbatim followed by the
+    /// differences between consecutive samples, zigzag encoded and bit-packed with the smallest width fitting all
+    /// differences of the block. Baseline noise thus costs a few bits per sample. Channels are decoded on demand with
+    /// decodeChannel(), which only touches the blocks of that channel.
+    ///
+    class CompressedPlane {
+    public:
+
+        ///
+        /// Number of samples per block.
+        ///
+        static const unsigned kBlockSize = 64;
+
+        ///
+        /// Constructor for an empty plane.
+        ///
+        CompressedPlane() : m_nChannels(0), m_nSamples(0), m_nBlocksPerChannel(0) {}
+
+        ///
+        /// Constructor compressing a plane.
+        ///
+        explicit CompressedPlane(const PlaneWaveforms &t_plane);
+
+        ///
+        /// Get the number of channels.
+        ///
+        unsigned getNChannels() const {
+            return m_nChannels;
+        }
+
+        ///
+        /// Get the number of samples per channel.
+        ///
+        unsigned getNSamples() const {
+            return m_nSamples;
+        }
+
+        ///
+        /// Decode a channel into t_samples, which must hold getNSamples() samples.
+        ///
+        void decodeChannel(
+                const unsigned t_channel,
+                const Span<int16_t> t_samples) const;
+
+        ///
+        /// Same as decodeChannel. Together with PlaneWaveforms::copyChannel, this allows to run the hit finder on both.
+        ///
+        void copyChannel(
+                const unsigned t_channel,
+                const Span<int16_t> t_samples) const {
+            decodeChannel(t_channel, t_samples);
+        }
+
+        ///
+        /// Decode the whole plane.
+        ///
+        PlaneWaveforms decode() const;
+
+        ///
+        /// Get the number of bytes used by the compressed data.
+        ///
+        unsigned long getNBytes() const {
+            return m_blocks.capacity() * sizeof(Block) + m_words.capacity() * sizeof(uint64_t);
+        }
+
+
+    private:
+
+        ///
+        /// Header of one block.
+        ///
+        struct Block {
+            ///
+            /// Index of the first word of the block in m_words.
+            ///
+            uint32_t wordOffset;
+
+            ///
+            /// First sample of the block.
+            ///
+            int16_t firstSample;
+
+            ///
+            /// Number of bits per difference.
+            ///
+            uint8_t width;
+        };
+
+        ///
+        /// Number of channels.
+        ///
+        unsigned m_nChannels;
+
+        ///
+        /// Number of samples per channel.
+        ///
+        unsigned m_nSamples;
+
+        ///
+        /// Number of blocks per channel.
+        ///
+        unsigned m_nBlocksPerChannel;
+
+        ///
+        /// Block headers, channel after channel.
+        ///
+        std::vector<Block> m_blocks;
+
+        ///
+        /// Bit-packed differences of all blocks.
+        ///
+        std::vector<uint64_t> m_words;
+    };
+
+
+    ///
+    /// Compressed waveforms of a single event.
+    /// Counterpart of EventWaveforms holding a CompressedPlane for the pixels and one for the ROIs.
+    ///
+    class CompressedWaveforms {
+    public:
+
+        ///
+        /// Constructor compressing the waveforms of an event.
+        ///
+        explicit CompressedWaveforms(const EventWaveforms &t_waveforms) :
+                m_eventId(t_waveforms.getEventId()),
+                m_pixelPlane(t_waveforms.getPixelPlane()),
+                m_roiPlane(t_waveforms.getRoiPlane()) {
+        }
+
+        ///
+        /// Get the event ID.
+        ///
+        unsigned getEventId() const {
+            return m_eventId;
+        }
+
+        ///
+        /// Get the compressed pixel plane.
+        ///
+        const CompressedPlane &getPixelPlane() const {
+            return m_pixelPlane;
+        }
+
+        ///
+        /// Get the compressed ROI plane.
+        ///
+        const CompressedPlane &getRoiPlane() const {
+            return m_roiPlane;
+        }
+
+        ///
+        /// Decode the whole event.
+        ///
+        EventWaveforms decode() const {
+            return EventWaveforms(m_eventId, m_pixelPlane.decode(), m_roiPlane.decode());
+        }
+
+        ///
+        /// Get the number of bytes used by the compressed data.
+        ///
+        unsigned long getNBytes() const {
+            return m_pixelPlane.getNBytes() + m_roiPlane.getNBytes();
+        }
+
+
+    private:
+
+        ///
+        /// Event ID.
+        ///
+        unsigned m_eventId;
+
+        ///
+        /// Compressed pixel waveforms.
+        ///
+        CompressedPlane m_pixelPlane;
+
+        ///
+        /// Compressed ROI waveforms.
+        ///
+        CompressedPlane m_roiPlane;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_COMPRESSEDWAVEFORMS_H
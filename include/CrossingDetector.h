@@ -0,0 +1,229 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_CROSSINGDETECTOR_H
+#define PIXY_ROIMUX_CROSSINGDETECTOR_H
+
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "NoiseModel.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Threshold crossing detector of the 2D hit finder.
+    /// scan() compares the samples of a channel against all discriminator thresholds of the channel in a single pass
+    /// and stores one bit per sample and condition. The comparisons run 16 samples at a time with AVX2 or 8 with SSE2,
+    /// depending on the target, with a scalar fallback. The hit finder then finds the pulse edges with bit scans over
+    /// these bitmaps instead of comparing one sample at a time, and enumerates the peak candidates from the set bits.
+    /// The thresholds are doubles, so makeThresholds() turns each condition into an inclusive integer band giving the
+    /// same decision for every ADC value. The kernels are specialised for unipolar and bipolar channels, unipolar
+    /// channels only evaluate the positive lobe conditions.
+    ///
+    class CrossingDetector {
+    public:
+
+        ///
+        /// Discriminator conditions.
+        ///
+        enum Condition {
+            ///
+            /// Sample >= thrPosPeak.
+            ///
+            kAbovePeak,
+
+            ///
+            /// Sample < thrPosLead.
+            ///
+            kBelowLead,
+
+            ///
+            /// Sample < thrPosTrail.
+            ///
+            kBelowTrail,
+
+            ///
+            /// Sample < mean. Bipolar only.
+            ///
+            kBelowBaseline,
+
+            ///
+            /// Sample <= thrNegPeak. Bipolar only.
+            ///
+            kBelowNegPeak,
+
+            ///
+            /// Sample > thrNegTrail. Bipolar only.
+            ///
+            kAboveNegTrail,
+
+            ///
+            /// Number of conditions.
+            ///
+            kNConditions
+        };
+
+        ///
+        /// Inclusive band of sample values meeting a condition. Empty bands have low > high.
+        ///
+        struct Band {
+            int16_t low;
+            int16_t high;
+        };
+
+        ///
+        /// Discriminator thresholds of a channel rounded to ADC counts.
+        ///
+        struct Thresholds {
+            ///
+            /// Band of each condition.
+            ///
+            std::array<Band, kNConditions> bands;
+
+            ///
+            /// Baseline truncated to ADC counts. Found pulses are overwritten with it.
+            ///
+            int16_t baseline;
+        };
+
+        ///
+        /// Number of samples per bitmap word. Partial words at the edges of a scan are set one sample at a time.
+        ///
+        static const unsigned kWordSamples = 64;
+
+        ///
+        /// Get the number of conditions evaluated for unipolar or bipolar channels.
+        ///
+        static constexpr unsigned getNConditions(const bool t_bipolar) {
+            return t_bipolar ? kNConditions : (kBelowTrail + 1);
+        }
+
+        ///
+        /// Round the thresholds of a channel.
+        ///
+        static Thresholds makeThresholds(const ChannelNoise &t_noise);
+
+        ///
+        /// Constructor for channels of up to t_nSamples samples.
+        ///
+        explicit CrossingDetector(const unsigned t_nSamples);
+
+        ///
+        /// Set the thresholds of the next channel.
+        ///
+        void setThresholds(const Thresholds &t_thresholds) {
+            m_thresholds = t_thresholds;
+        }
+
+        ///
+        /// Evaluate all conditions for the samples [t_start, t_stop) of a channel. Bits outside this range are kept.
+        /// Only the positive lobe conditions are evaluated unless Bipolar is set. kAbovePeak is evaluated on
+        /// t_peakSamples, which are either t_samples or the matched-filtered samples of the channel.
+        ///
+        template <bool Bipolar>
+        void scan(
+                const int16_t *const t_samples,
+                const int16_t *const t_peakSamples,
+                const unsigned t_start,
+                const unsigned t_stop);
+
+        ///
+        /// Same as scan() without SIMD.
+        ///
+        template <bool Bipolar>
+        void scanScalar(
+                const int16_t *const t_samples,
+                const int16_t *const t_peakSamples,
+                const unsigned t_start,
+                const unsigned t_stop);
+
+        ///
+        /// Set the bits of the samples [t_first, t_last] as if they all had the value t_value.
+        ///
+        template <bool Bipolar>
+        void assign(
+                const unsigned t_first,
+                const unsigned t_last,
+                const int16_t t_value);
+
+        ///
+        /// Get the index of the first sample in [t_first, t_last] meeting a condition, or -1 if there is none.
+        ///
+        int findFirst(
+                const Condition t_condition,
+                const int t_first,
+                const int t_last) const;
+
+        ///
+        /// Get the index of the last sample in [t_first, t_last] meeting a condition, or -1 if there is none.
+        ///
+        int findLast(
+                const Condition t_condition,
+                const int t_first,
+                const int t_last) const;
+
+        ///
+        /// Append the indices of all samples in [t_first, t_last] meeting a condition to t_samples in ascending order.
+        ///
+        void findAll(
+                const Condition t_condition,
+                const unsigned t_first,
+                const unsigned t_last,
+                std::vector<unsigned> &t_samples) const;
+
+
+    private:
+
+        ///
+        /// Get the band of integer values v with t_low <= v <= t_high, clamped to the int16_t range.
+        ///
+        static Band makeBand(
+                const double t_low,
+                const double t_high);
+
+        ///
+        /// Check whether a value is within a band.
+        ///
+        static bool inBand(
+                const Band &t_band,
+                const int16_t t_value) {
+            return (t_value >= t_band.low) && (t_value <= t_band.high);
+        }
+
+        ///
+        /// Set or clear a single bit.
+        ///
+        void setBit(
+                const unsigned t_condition,
+                const unsigned t_sample,
+                const bool t_value) {
+            uint64_t &word = m_bits[t_condition][t_sample >> 6];
+            const uint64_t bit = static_cast<uint64_t>(1) << (t_sample & 63);
+            word = t_value ? (word | bit) : (word & ~bit);
+        }
+
+        ///
+        /// Thresholds of the current channel.
+        ///
+        Thresholds m_thresholds;
+
+        ///
+        /// Bitmap of each condition, bit i of word j is sample 64 * j + i.
+        ///
+        std::array<std::vector<uint64_t>, kNConditions> m_bits;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_CROSSINGDETECTOR_H
@@ -0,0 +1,173 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_DAQKEYINDEX_H
+#define PIXY_ROIMUX_DAQKEYINDEX_H
+
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "TFile.h"
+#include "TH2S.h"
+#include "TKey.h"
+#include "TList.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Keys of the DAQ histograms of one event.
+    ///
+    struct DaqKeyEntry {
+        ///
+        /// Key of the "Ind_x" histogram.
+        ///
+        TKey *indKey = nullptr;
+
+        ///
+        /// Key of the "Col_x" histogram.
+        ///
+        TKey *colKey = nullptr;
+
+        ///
+        /// Offset in the file of the first of the two keys.
+        ///
+        Long64_t seekKey = 0;
+    };
+
+
+    ///
+    /// Index of the DAQ histograms in a raw data ROOT file.
+    /// The key list of the file is scanned once on construction and the keys of the "Ind_x" and "Col_x" histograms are
+    /// stored by event ID, using the highest cycle if there are several. Looking up an event is then a hash map access
+    /// instead of a directory lookup by name. read() fetches the histograms of a list of events with as few vectored
+    /// reads as the byte budget kMaxReadBytes allows, with the keys sorted by their position in the file, so ROOT can
+    /// merge adjacent keys into one request. getReadOrder() orders events as they are stored in the file, so reading
+    /// them in that order avoids random seeks. The keys belong to the file, so the index must not outlive it.
+    ///
+    class DaqKeyIndex {
+    public:
+
+        ///
+        /// Maximum number of bytes fetched by a single vectored read. A key larger than this is read on its own.
+        ///
+        static const std::size_t kMaxReadBytes;
+
+        ///
+        /// Constructor scanning the key list of an open file.
+        ///
+        explicit DaqKeyIndex(TFile &t_rootFile);
+
+        ///
+        /// Check whether both histograms of an event are in the file.
+        ///
+        bool hasEvent(const unsigned t_eventId) const {
+            const auto entry = m_entries.find(t_eventId);
+            return (entry != m_entries.cend()) && entry->second.indKey && entry->second.colKey;
+        }
+
+        ///
+        /// Get the file offset of an event, or -1 if the event is not in the file.
+        ///
+        Long64_t getSeekKey(const unsigned t_eventId) const {
+            return hasEvent(t_eventId) ? m_entries.at(t_eventId).seekKey : -1;
+        }
+
+        ///
+        /// Get the IDs of all events in the file in ascending order.
+        ///
+        std::vector<unsigned> getEventIds() const;
+
+        ///
+        /// Get the order in which to read a list of events, as indices into t_eventIds. The list is split into windows of
+        /// t_window events and the events of each window are sorted by their position in the file, so a reader holding
+        /// t_window events in memory can still hand them out in the original order. Events not in the file go last within
+        /// their window.
+        ///
+        std::vector<unsigned long> getReadOrder(
+                const std::vector<unsigned> &t_eventIds,
+                const unsigned long t_window) const;
+
+        ///
+        /// Read both histograms of an event with a single vectored read. Returns a pair of null pointers if the event is
+        /// not in the file or reading fails. Like GetObject, the histograms are owned by the file. Reuses an internal
+        /// buffer, so each thread needs its own file and index.
+        ///
+        std::pair<TH2S *, TH2S *> read(const unsigned t_eventId);
+
+        ///
+        /// Read the histograms of a list of events. The keys of all events are read in the order they are stored in the
+        /// file, in vectored reads of up to kMaxReadBytes, and each histogram is unstreamed from its part of the buffer.
+        /// t_histos is resized to the number of events and holds the histograms of each event, or a pair of null pointers
+        /// if the event is not in the file or reading fails. Ownership and threading are as for reading a single event.
+        ///
+        void read(
+                const std::vector<unsigned> &t_eventIds,
+                std::vector<std::pair<TH2S *, TH2S *>> &t_histos);
+
+        ///
+        /// Get the number of vectored reads issued so far.
+        ///
+        unsigned long getNReads() const {
+            return m_nReads;
+        }
+
+
+    private:
+
+        ///
+        /// Parse a key name of the form "<t_prefix><event ID>". Returns false if it doesn't match.
+        ///
+        static bool parseKeyName(
+                const std::string &t_keyName,
+                const std::string &t_prefix,
+                unsigned &t_eventId);
+
+        ///
+        /// File the keys belong to.
+        ///
+        TFile &m_rootFile;
+
+        ///
+        /// Keys by event ID.
+        ///
+        std::unordered_map<unsigned, DaqKeyEntry> m_entries;
+
+        ///
+        /// Keys of the events being read in file order, each with its slot in m_objects: 2 * event index for "Ind_x" and
+        /// 2 * event index + 1 for "Col_x". Reused across reads.
+        ///
+        std::vector<std::pair<TKey *, unsigned long>> m_batchKeys;
+
+        ///
+        /// Objects unstreamed from the keys of the events being read. Reused across reads.
+        ///
+        std::vector<TObject *> m_objects;
+
+        ///
+        /// Positions and sizes of the keys of one vectored read. Reused across reads.
+        ///
+        std::vector<Long64_t> m_positions;
+        std::vector<Int_t> m_lengths;
+
+        ///
+        /// Buffer for the vectored reads, reused across reads.
+        ///
+        std::vector<char> m_buffer;
+
+        ///
+        /// Number of vectored reads issued.
+        ///
+        unsigned long m_nReads = 0;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_DAQKEYINDEX_H
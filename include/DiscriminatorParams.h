@@ -0,0 +1,39 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_DISCRIMINATORPARAMS_H
+#define PIXY_ROIMUX_DISCRIMINATORPARAMS_H
+
+
+#include "RunParams.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Search ranges of the 2D hit finder in samples, built once from the run parameters. The thresholds of each
+    /// channel are rounded separately by CrossingDetector::makeThresholds().
+    ///
+    struct DiscriminatorParams {
+        ///
+        /// Constructor reading the ranges from the run parameters.
+        ///
+        explicit DiscriminatorParams(const RunParams &t_runParams) :
+                discRange(static_cast<int>(t_runParams.getDiscRange())),
+                negLobeRange(3 * discRange) {
+        }
+
+        ///
+        /// Maximum distance of the first and the last sample of the positive lobe from the positive peak.
+        ///
+        const int discRange;
+
+        ///
+        /// Maximum distance of the last sample of the negative lobe of bipolar pulses from the positive peak.
+        ///
+        const int negLobeRange;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_DISCRIMINATORPARAMS_H
@@ -0,0 +1,132 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_ENVELOPEPYRAMID_H
+#define PIXY_ROIMUX_ENVELOPEPYRAMID_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "Span.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Max/min envelope pyramid of a waveform.
+    /// Level 0 holds the maximum and the minimum of every block of kBlockSize samples, each higher level those of
+    /// kBlockSize blocks of the level below, up to a single block covering the whole waveform. The last block of each
+    /// level may be shorter. Building the pyramid costs little more than a single pass over the samples. Afterwards,
+    /// the extrema of the waveform are known at once and findBlocksAbove() only descends into blocks reaching a
+    /// threshold, so quiet waveforms are dismissed at the top of the pyramid. The storage is kept across build() calls.
+    ///
+    class EnvelopePyramid {
+    public:
+
+        ///
+        /// Number of samples per block on level 0 and number of blocks per block on the higher levels.
+        ///
+        static const unsigned kBlockSize = 8;
+
+        ///
+        /// Build the pyramid of a waveform. Empty waveforms have no levels.
+        ///
+        void build(const Span<const int16_t> t_samples);
+
+        ///
+        /// Get the number of samples of the waveform.
+        ///
+        unsigned getNSamples() const {
+            return m_nSamples;
+        }
+
+        ///
+        /// Get the number of levels.
+        ///
+        unsigned getNLevels() const {
+            return m_nLevels;
+        }
+
+        ///
+        /// Get the number of blocks of a level.
+        ///
+        unsigned getNBlocks(const unsigned t_level) const {
+            return static_cast<unsigned>(m_max.at(t_level).size());
+        }
+
+        ///
+        /// Get the maximum of a block of a level.
+        ///
+        int16_t getMax(
+                const unsigned t_level,
+                const unsigned t_block) const {
+            return m_max.at(t_level).at(t_block);
+        }
+
+        ///
+        /// Get the minimum of a block of a level.
+        ///
+        int16_t getMin(
+                const unsigned t_level,
+                const unsigned t_block) const {
+            return m_min.at(t_level).at(t_block);
+        }
+
+        ///
+        /// Get the maximum of the waveform. The waveform must not be empty.
+        ///
+        int16_t getMax() const {
+            return m_max.at(m_nLevels - 1).front();
+        }
+
+        ///
+        /// Get the minimum of the waveform. The waveform must not be empty.
+        ///
+        int16_t getMin() const {
+            return m_min.at(m_nLevels - 1).front();
+        }
+
+        ///
+        /// Append the level 0 blocks with a maximum of at least t_threshold to t_blocks in ascending order. Block b
+        /// covers the samples [kBlockSize * b, kBlockSize * (b + 1)).
+        ///
+        void findBlocksAbove(
+                const int16_t t_threshold,
+                std::vector<unsigned> &t_blocks) const;
+
+
+    private:
+
+        ///
+        /// Append the level 0 blocks below a block of a level with a maximum of at least t_threshold.
+        ///
+        void findBlocksAbove(
+                const unsigned t_level,
+                const unsigned t_block,
+                const int16_t t_threshold,
+                std::vector<unsigned> &t_blocks) const;
+
+        ///
+        /// Number of samples of the waveform.
+        ///
+        unsigned m_nSamples = 0;
+
+        ///
+        /// Number of levels of the current waveform. m_max and m_min may hold more from earlier waveforms.
+        ///
+        unsigned m_nLevels = 0;
+
+        ///
+        /// Block maxima and minima by level.
+        ///
+        std::vector<std::vector<int16_t>> m_max;
+        std::vector<std::vector<int16_t>> m_min;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_ENVELOPEPYRAMID_H
@@ -6,8 +6,10 @@
 #define PIXY_ROIMUX_EVENT_H
 
 
+#include <cstdint>
 #include <map>
 #include <vector>
+#include "Span.h"
 
 
 namespace pixy_roimux {
@@ -31,6 +33,12 @@ namespace pixy_roimux {
         ///
         unsigned posPeakSample;
 
+        ///
+        /// Time of the positive peak of the pulse in samples. Refined below the sample spacing by the
+        /// PulseTemplateFit, otherwise equal to posPeakSample.
+        ///
+        float posPeakTime;
+
         ///
         /// Index in the raw histogram of the first negative sample of the pulse.
         ///
@@ -73,10 +81,15 @@ namespace pixy_roimux {
         int pulseIntegral;
 
         ///
-        /// Raw pulse data extracted from histogram from firstSample until and including lastSample.
-        /// Size is equal to pulseWidth.
+        /// Index of the first raw pulse sample in Event::pulseSamples. The raw pulse runs from firstSample until and
+        /// including lastSample, use Event::getPulse() to access it.
+        ///
+        unsigned pulseOffset;
+
+        ///
+        /// Number of raw pulse samples. Equal to posPulseWidth + negPulseWidth.
         ///
-        std::vector<int> pulseRaw;
+        unsigned pulseLength;
     };
 
 
@@ -174,6 +187,11 @@ namespace pixy_roimux {
         ///
         std::multimap<unsigned, unsigned> roiHitOrderTrail;
 
+        ///
+        /// Raw pulses of all pixel and ROI hits, the pixel pulses first, each in the order of its hits.
+        ///
+        std::vector<int16_t> pulseSamples;
+
         ///
         /// Vector of indices of all matched roiHits for each pixelHit entry.
         ///
@@ -193,6 +211,13 @@ namespace pixy_roimux {
         std::vector<int> pcaIds;
 
         PrincipalComponents principalComponents;
+
+        ///
+        /// Get the raw pulse of a pixel or ROI hit of this event. The span is invalidated if pulseSamples changes.
+        ///
+        Span<const int16_t> getPulse(const Hit2d &t_hit) const {
+            return Span<const int16_t>(pulseSamples.data() + t_hit.pulseOffset, t_hit.pulseLength);
+        }
     };
 }
 
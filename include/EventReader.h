@@ -0,0 +1,217 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_EVENTREADER_H
+#define PIXY_ROIMUX_EVENTREADER_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TFile.h"
+#include "TH2S.h"
+#include "TROOT.h"
+#include "ChargeData.h"
+#include "DaqKeyIndex.h"
+#include "EventWaveforms.h"
+#include "NativeRawFile.h"
+#include "RunParams.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Prefetching reader for the DAQ histograms of a list of events.
+    /// A number of background threads, each with its own TFile handle, read, decompress and convert the upcoming events
+    /// while the main thread is busy with the current one. Events are handed out by next() in the order of the event ID
+    /// vector. At most queueSize events are held ahead of the last event handed out, which bounds the memory used by the
+    /// reader. With 0 threads, next() reads the event itself. Time spent reading and time spent by the consumer waiting
+    /// for data are recorded, so printStats() shows whether the I/O is hidden behind the processing.
+    /// Each file handle is indexed once with a DaqKeyIndex. Within every window of queueSize events, the events are read
+    /// in the order they are stored in the file, so the reads follow the file instead of seeking back and forth. Each
+    /// thread claims up to its share of a window at once, as far as the queue allows, and fetches the histograms of all
+    /// claimed events with one batched read of the index.
+    /// If the file is a native raw waveform file (see NativeRawFile), it is memory-mapped instead and next() copies the
+    /// waveforms out of the mapping without any background threads.
+    ///
+    class EventReader {
+    public:
+
+        ///
+        /// Constructor starting the background threads.
+        ///
+        EventReader(
+                const std::string t_rootFileName,
+                const std::vector<unsigned> &t_eventIds,
+                const RunParams &t_runParams,
+                const unsigned t_nThreads,
+                const unsigned t_queueSize);
+
+        ///
+        /// Destructor stopping and joining the background threads.
+        ///
+        ~EventReader();
+
+        EventReader(const EventReader &) = delete;
+
+        EventReader &operator=(const EventReader &) = delete;
+
+        ///
+        /// Get the next event. Blocks until it is available. Returns false once all events have been handed out.
+        ///
+        bool next(EventWaveforms &t_waveforms);
+
+        ///
+        /// Print the reader statistics.
+        ///
+        void printStats() const;
+
+
+    private:
+
+        ///
+        /// Loop run by each background thread.
+        ///
+        void readLoop();
+
+        ///
+        /// Convert the DAQ histograms of an event read through the index of an open file and delete them. Returns false
+        /// if the event was not read. The time spent converting the histograms is added to t_convertTime.
+        ///
+        bool convertEvent(
+                const unsigned t_eventId,
+                const std::pair<TH2S *, TH2S *> &t_histos,
+                EventWaveforms &t_waveforms,
+                std::chrono::duration<double> &t_convertTime) const;
+
+        ///
+        /// Name of the raw data file.
+        ///
+        const std::string m_rootFileName;
+
+        ///
+        /// Event IDs to read, in order.
+        ///
+        const std::vector<unsigned> m_eventIds;
+
+        ///
+        /// Run parameters used for the conversion.
+        ///
+        const RunParams &m_runParams;
+
+        ///
+        /// Maximum number of events held ahead of the consumer.
+        ///
+        const unsigned m_queueSize;
+
+        ///
+        /// Maximum number of events a background thread reads at once, its share of a window.
+        ///
+        const unsigned m_batchSize;
+
+        ///
+        /// Background threads.
+        ///
+        std::vector<std::thread> m_threads;
+
+        ///
+        /// File handle used if there are no background threads.
+        ///
+        std::unique_ptr<TFile> m_syncFile;
+
+        ///
+        /// Key index of m_syncFile.
+        ///
+        std::unique_ptr<DaqKeyIndex> m_syncIndex;
+
+        ///
+        /// Mapped file if the input is a native raw waveform file.
+        ///
+        std::unique_ptr<NativeRawFile> m_nativeFile;
+
+        ///
+        /// Mutex protecting everything below.
+        ///
+        mutable std::mutex m_mutex;
+
+        ///
+        /// Signalled whenever an event was read.
+        ///
+        std::condition_variable m_produced;
+
+        ///
+        /// Signalled whenever an event was handed out.
+        ///
+        std::condition_variable m_consumed;
+
+        ///
+        /// Order in which the background threads read the events, as indices into m_eventIds.
+        ///
+        std::vector<unsigned long> m_readOrder;
+
+        ///
+        /// Index in m_readOrder of the next event to be read.
+        ///
+        unsigned long m_nextRead = 0;
+
+        ///
+        /// Index in m_eventIds of the next event to be handed out.
+        ///
+        unsigned long m_nextDeliver = 0;
+
+        ///
+        /// Events read but not handed out yet, by index in m_eventIds.
+        ///
+        std::map<unsigned long, EventWaveforms> m_ready;
+
+        ///
+        /// Set to stop the background threads.
+        ///
+        bool m_stop = false;
+
+        ///
+        /// Event ID that failed to load, if m_failed is set.
+        ///
+        unsigned m_failedEventId = 0;
+
+        ///
+        /// Set if an event failed to load.
+        ///
+        bool m_failed = false;
+
+        ///
+        /// Accumulated time spent reading and converting, summed over all threads.
+        ///
+        std::chrono::duration<double> m_readTime{0.};
+
+        ///
+        /// Accumulated time spent converting the DAQ histograms to waveforms, summed over all threads.
+        ///
+        std::chrono::duration<double> m_convertTime{0.};
+
+        ///
+        /// Number of vectored reads, summed over all threads.
+        ///
+        unsigned long m_nReads = 0;
+
+        ///
+        /// Accumulated time the consumer spent waiting in next().
+        ///
+        std::chrono::duration<double> m_waitTime{0.};
+
+        ///
+        /// Time of construction.
+        ///
+        const std::chrono::steady_clock::time_point m_startTime;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_EVENTREADER_H
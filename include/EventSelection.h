@@ -0,0 +1,105 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_EVENTSELECTION_H
+#define PIXY_ROIMUX_EVENTSELECTION_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "TBranch.h"
+#include "TFile.h"
+#include "TTree.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Selection of events by ranking.
+    /// The ranking of every event is taken from the "Ranking" branch of the "RankingTime" tree, which is the only branch
+    /// read. The event IDs are grouped by ranking value and stored in a sidecar index file next to the ranking file
+    /// (<rankingFileName>.idx). Subsequent runs load the index instead of scanning the tree, so selecting a different
+    /// ranking window is instant. The index stores the size and modification time of the ranking file and is rebuilt if
+    /// either has changed.
+    ///
+    class EventSelection {
+    public:
+
+        ///
+        /// Constructor loading the index or building it from the ranking tree if it's missing or stale.
+        ///
+        explicit EventSelection(const std::string &t_rankingFileName);
+
+        ///
+        /// Get the IDs of all events with minRanking <= ranking <= maxRanking in ascending order.
+        ///
+        std::vector<unsigned> select(
+                const int t_minRanking,
+                const int t_maxRanking) const;
+
+        ///
+        /// Number of entries in the ranking tree.
+        ///
+        unsigned long getNEvents() const {
+            return m_nEvents;
+        }
+
+
+    private:
+
+        ///
+        /// Load the sidecar index. Returns false if it doesn't exist, is corrupt or doesn't match the ranking file.
+        ///
+        bool loadIndex();
+
+        ///
+        /// Build the index by scanning the Ranking branch of the ranking tree.
+        ///
+        void buildIndex();
+
+        ///
+        /// Write the sidecar index. Failing to write it is not fatal, the next run simply rebuilds it.
+        ///
+        void writeIndex() const;
+
+        ///
+        /// Name of the ranking file.
+        ///
+        const std::string m_rankingFileName;
+
+        ///
+        /// Name of the sidecar index file.
+        ///
+        const std::string m_indexFileName;
+
+        ///
+        /// Size of the ranking file in bytes.
+        ///
+        uint64_t m_rankingFileSize = 0;
+
+        ///
+        /// Modification time of the ranking file.
+        ///
+        int64_t m_rankingFileMtime = 0;
+
+        ///
+        /// Number of entries in the ranking tree.
+        ///
+        unsigned long m_nEvents = 0;
+
+        ///
+        /// Event IDs by ranking value, each vector sorted in ascending order.
+        ///
+        std::map<int, std::vector<unsigned>> m_index;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_EVENTSELECTION_H
@@ -0,0 +1,284 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_EVENTWAVEFORMS_H
+#define PIXY_ROIMUX_EVENTWAVEFORMS_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TH1D.h"
+#include "TH2S.h"
+#include "AlignedAllocator.h"
+#include "Span.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Sample buffer of a single readout plane (pixels or ROIs).
+    /// All channels are stored in one contiguous int16_t buffer, channel after channel. Each channel occupies getStride()
+    /// samples of which the first getNSamples() are valid; the stride is padded such that every channel starts on a cache
+    /// line. Channels are accessed as spans of getNSamples() samples. Sample and channel indices start at 0.
+    /// The samples either live in a buffer owned by the plane or in external storage, e.g. a memory-mapped file, which is
+    /// kept alive by a shared pointer. Copying a plane always creates an owned buffer.
+    ///
+    class PlaneWaveforms {
+    public:
+
+        ///
+        /// Alignment of the buffer and of every channel in bytes.
+        ///
+        static const unsigned kAlignment = 64;
+
+        ///
+        /// Constructor for an empty plane.
+        ///
+        PlaneWaveforms() : m_nChannels(0), m_nSamples(0), m_stride(0), m_data(nullptr) {}
+
+        ///
+        /// Constructor allocating a zero-initialised plane of t_nChannels channels with t_nSamples samples each.
+        ///
+        PlaneWaveforms(
+                const unsigned t_nChannels,
+                const unsigned t_nSamples);
+
+        ///
+        /// Constructor for a plane using external storage without copying.
+        /// t_data must be aligned to kAlignment and hold t_nChannels channels spaced by t_stride samples, where t_stride
+        /// is a multiple of the stride computed for t_nSamples. t_storage keeps the memory alive as long as the plane or
+        /// any of its moved-to instances exists.
+        ///
+        PlaneWaveforms(
+                const unsigned t_nChannels,
+                const unsigned t_nSamples,
+                const unsigned t_stride,
+                int16_t *const t_data,
+                std::shared_ptr<void> t_storage);
+
+        PlaneWaveforms(const PlaneWaveforms &t_other);
+
+        PlaneWaveforms(PlaneWaveforms &&t_other) noexcept;
+
+        PlaneWaveforms &operator=(const PlaneWaveforms &t_other);
+
+        PlaneWaveforms &operator=(PlaneWaveforms &&t_other) noexcept;
+
+        ///
+        /// Get the number of channels.
+        ///
+        unsigned getNChannels() const {
+            return m_nChannels;
+        }
+
+        ///
+        /// Get the number of valid samples per channel.
+        ///
+        unsigned getNSamples() const {
+            return m_nSamples;
+        }
+
+        ///
+        /// Get the distance in samples between the first samples of two adjacent channels.
+        ///
+        unsigned getStride() const {
+            return m_stride;
+        }
+
+        ///
+        /// Get the samples of a channel.
+        ///
+        Span<int16_t> getChannel(const unsigned t_channel) {
+            return Span<int16_t>(m_data + t_channel * m_stride, m_nSamples);
+        }
+
+        ///
+        /// Get the samples of a channel as const.
+        ///
+        Span<const int16_t> getChannel(const unsigned t_channel) const {
+            return Span<const int16_t>(m_data + t_channel * m_stride, m_nSamples);
+        }
+
+        ///
+        /// Copy the samples of a channel to t_samples, which must hold getNSamples() samples.
+        ///
+        void copyChannel(
+                const unsigned t_channel,
+                const Span<int16_t> t_samples) const {
+            const auto samples = getChannel(t_channel);
+            std::copy(samples.begin(), samples.end(), t_samples.begin());
+        }
+
+        ///
+        /// Get the pointer to the first sample of the first channel.
+        ///
+        int16_t *data() {
+            return m_data;
+        }
+
+        ///
+        /// Get the pointer to the first sample of the first channel as const.
+        ///
+        const int16_t *data() const {
+            return m_data;
+        }
+
+        ///
+        /// Check whether the samples live in external storage.
+        ///
+        bool isExternal() const {
+            return static_cast<bool>(m_storage);
+        }
+
+        ///
+        /// Build a TH2S with samples on the x axis and channels on the y axis, i.e. the layout of the former readout
+        /// histograms. Only meant for writing ROOT output.
+        ///
+        std::unique_ptr<TH2S> makeHisto(const std::string &t_name) const;
+
+        ///
+        /// Build a TH1D of a single channel, equivalent to the ProjectionX of the TH2S. Only meant for writing ROOT output.
+        ///
+        std::unique_ptr<TH1D> makeChannelHisto(
+                const std::string &t_name,
+                const unsigned t_channel) const;
+
+        ///
+        /// Compute the padded stride for a given number of samples.
+        ///
+        static unsigned computeStride(const unsigned t_nSamples);
+
+
+    private:
+
+        ///
+        /// Number of channels.
+        ///
+        unsigned m_nChannels;
+
+        ///
+        /// Number of valid samples per channel.
+        ///
+        unsigned m_nSamples;
+
+        ///
+        /// Padded number of samples per channel.
+        ///
+        unsigned m_stride;
+
+        ///
+        /// Sample buffer, channel-major. Empty if the plane uses external storage.
+        ///
+        std::vector<int16_t, AlignedAllocator<int16_t, kAlignment>> m_buffer;
+
+        ///
+        /// Owner of the external storage, null if the plane owns its buffer.
+        ///
+        std::shared_ptr<void> m_storage;
+
+        ///
+        /// Pointer to the first sample, either into m_buffer or into the external storage.
+        ///
+        int16_t *m_data;
+    };
+
+
+    ///
+    /// Waveforms of a single event.
+    /// Holds one PlaneWaveforms for the pixels and one for the ROIs, both already in readout channel order.
+    ///
+    class EventWaveforms {
+    public:
+
+        ///
+        /// Constructor for an empty event.
+        ///
+        EventWaveforms() : m_eventId(0) {}
+
+        ///
+        /// Constructor allocating zero-initialised pixel and ROI planes.
+        ///
+        EventWaveforms(
+                const unsigned t_eventId,
+                const unsigned t_nPixels,
+                const unsigned t_nRois,
+                const unsigned t_nSamples) :
+                m_eventId(t_eventId),
+                m_pixelPlane(t_nPixels, t_nSamples),
+                m_roiPlane(t_nRois, t_nSamples) {
+        }
+
+        ///
+        /// Constructor taking over existing pixel and ROI planes.
+        ///
+        EventWaveforms(
+                const unsigned t_eventId,
+                PlaneWaveforms &&t_pixelPlane,
+                PlaneWaveforms &&t_roiPlane) :
+                m_eventId(t_eventId),
+                m_pixelPlane(std::move(t_pixelPlane)),
+                m_roiPlane(std::move(t_roiPlane)) {
+        }
+
+        ///
+        /// Get the event ID.
+        ///
+        unsigned getEventId() const {
+            return m_eventId;
+        }
+
+        ///
+        /// Get the pixel plane.
+        ///
+        PlaneWaveforms &getPixelPlane() {
+            return m_pixelPlane;
+        }
+
+        ///
+        /// Get the pixel plane as const reference.
+        ///
+        const PlaneWaveforms &getPixelPlane() const {
+            return m_pixelPlane;
+        }
+
+        ///
+        /// Get the ROI plane.
+        ///
+        PlaneWaveforms &getRoiPlane() {
+            return m_roiPlane;
+        }
+
+        ///
+        /// Get the ROI plane as const reference.
+        ///
+        const PlaneWaveforms &getRoiPlane() const {
+            return m_roiPlane;
+        }
+
+
+    private:
+
+        ///
+        /// Event ID.
+        ///
+        unsigned m_eventId;
+
+        ///
+        /// Pixel waveforms.
+        ///
+        PlaneWaveforms m_pixelPlane;
+
+        ///
+        /// ROI waveforms.
+        ///
+        PlaneWaveforms m_roiPlane;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_EVENTWAVEFORMS_H
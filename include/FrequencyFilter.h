@@ -0,0 +1,103 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_FREQUENCYFILTER_H
+#define PIXY_ROIMUX_FREQUENCYFILTER_H
+
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <vector>
+#include "BatchedFft.h"
+#include "EventWaveforms.h"
+#include "RunParams.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Frequency domain filter removing narrow-band pickup.
+    /// All channels of a plane are transformed with a single BatchedFft, the spectra are multiplied with a mask and
+    /// transformed back. The mask cuts everything above the low-pass cutoff and everything within half the notch width
+    /// of each notch frequency. The DC component is always kept, so the baselines are unchanged. Masks are computed once
+    /// per number of samples. Requires pixy to be built with FFTW.
+    ///
+    class FrequencyFilter {
+    public:
+
+        ///
+        /// Constructor reading the mask from the run parameters.
+        ///
+        explicit FrequencyFilter(const RunParams &t_runParams);
+
+        ///
+        /// Filter all channels of a plane. The filtered samples are rounded to the nearest integer.
+        ///
+        void filterPlane(PlaneWaveforms &t_plane);
+
+        ///
+        /// Print the number of filtered planes and the time spent in each step.
+        ///
+        void printStats() const;
+
+
+    private:
+
+        ///
+        /// Get the mask for channels of t_nSamples samples, computing it if needed. The mask is already divided by the
+        /// number of samples to normalise the inverse transform.
+        ///
+        const std::vector<double> &getMask(const unsigned t_nSamples);
+
+        ///
+        /// Sample time in us.
+        ///
+        double m_sampleTime;
+
+        ///
+        /// Low-pass cutoff in MHz. 0 disables the low-pass filter.
+        ///
+        double m_lowPassCutoff;
+
+        ///
+        /// Notch centre frequencies in MHz.
+        ///
+        std::vector<double> m_notchFrequencies;
+
+        ///
+        /// Full width of each notch in MHz.
+        ///
+        double m_notchWidth;
+
+        ///
+        /// Masks by number of samples.
+        ///
+        std::map<unsigned, std::vector<double>> m_masks;
+
+        ///
+        /// Transforms of all planes.
+        ///
+        BatchedFft m_fft;
+
+        ///
+        /// Number of filtered planes.
+        ///
+        unsigned long m_nPlanes = 0;
+
+        ///
+        /// Time spent converting the samples, in the forward transform, applying the mask, in the inverse transform and
+        /// rounding the samples.
+        ///
+        std::chrono::duration<double> m_loadTime{0.};
+        std::chrono::duration<double> m_forwardTime{0.};
+        std::chrono::duration<double> m_maskTime{0.};
+        std::chrono::duration<double> m_inverseTime{0.};
+        std::chrono::duration<double> m_storeTime{0.};
+    };
+}
+
+
+#endif //PIXY_ROIMUX_FREQUENCYFILTER_H
@@ -0,0 +1,144 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_HITDIAGNOSTICS_H
+#define PIXY_ROIMUX_HITDIAGNOSTICS_H
+
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "TFile.h"
+#include "TH1S.h"
+#include "Event.h"
+#include "NoiseModel.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Diagnostic histograms of the hit finder.
+    /// The histograms are filled while the hits are found and are kept independently of the events, so one instance can
+    /// accumulate the diagnostics of a whole run even if the events are processed and released in batches. Only the
+    /// number of ambiguities and unmatched pixel hits is stored per event. The histograms are written to a ROOT file by
+    /// write(). Files written by other instances, e.g. by worker processes, can be merged into this one by add().
+    ///
+    class HitDiagnostics {
+    public:
+
+        ///
+        /// Constructor creating the empty histograms.
+        ///
+        HitDiagnostics();
+
+        ///
+        /// Add the noise model of an event.
+        ///
+        void addNoiseModel(const NoiseModel &t_noiseModel);
+
+        ///
+        /// Add a found pixel hit and the peak threshold used to find it.
+        ///
+        void addPixelHit(
+                const Hit2d &t_hit,
+                const double t_thrPosPeak);
+
+        ///
+        /// Add a found ROI hit.
+        ///
+        void addRoiHit(const Hit2d &t_hit);
+
+        ///
+        /// Add a match between a pixel and a ROI hit. The transparency is only filled for pixel hits ending within the
+        /// ROI pulse.
+        ///
+        void addMatch(
+                const Hit2d &t_pixelHit,
+                const Hit2d &t_roiHit,
+                const bool t_fillTransparency);
+
+        ///
+        /// Add the statistics of a processed event.
+        ///
+        void addEvent(
+                const unsigned t_nAmbiguities,
+                const unsigned t_nUnmatchedPixelHits);
+
+        ///
+        /// Write all histograms to a ROOT file.
+        ///
+        void write(const std::string &t_fileName) const;
+
+        ///
+        /// Add the diagnostics written to a ROOT file by write(). The per-event statistics are appended after the events
+        /// already added, all other histograms are summed.
+        ///
+        void add(const std::string &t_fileName);
+
+
+    private:
+
+        ///
+        /// Number of ambiguities per event.
+        ///
+        std::vector<unsigned> m_ambiguities;
+
+        ///
+        /// Number of unmatched pixel hits per event.
+        ///
+        std::vector<unsigned> m_unmatched;
+
+        ///
+        /// Difference in peak sample between matched pixel and ROI hits.
+        ///
+        TH1S m_timePeakAcceptance;
+
+        ///
+        /// Difference in first sample between matched pixel and ROI hits.
+        ///
+        TH1S m_timeFirstSampleAcceptance;
+
+        ///
+        /// Positive pulse height of ROI hits.
+        ///
+        TH1S m_roiMaxPulses;
+
+        ///
+        /// Pulse height of pixel hits.
+        ///
+        TH1S m_pixelMaxPulses;
+
+        ///
+        /// Peak threshold of pixel hits.
+        ///
+        TH1S m_thresholdPosPixelPeaks;
+
+        ///
+        /// Transparency of the induction grid.
+        ///
+        TH1S m_transparency;
+
+        ///
+        /// Pixel pulse widths.
+        ///
+        TH1S m_pixelPulseWidths;
+
+        ///
+        /// ROI pulse widths.
+        ///
+        TH1S m_roiPulseWidths;
+
+        ///
+        /// Noise standard deviation of the pixel channels.
+        ///
+        TH1S m_pixelNoiseSigmas;
+
+        ///
+        /// Noise standard deviation of the ROI channels.
+        ///
+        TH1S m_roiNoiseSigmas;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_HITDIAGNOSTICS_H
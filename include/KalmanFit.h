@@ -47,6 +47,22 @@ namespace pixy_roimux {
                 const ChargeHits &t_chargeHits,
                 const std::string t_treeFileName);
 
+        ///
+        /// Create the output tree file. Together with fitEvents and closeTree, this allows to fit the events batch by
+        /// batch into one tree.
+        ///
+        void openTree(const std::string t_treeFileName);
+
+        ///
+        /// Fit all events of t_chargeHits and fill them into the tree opened by openTree.
+        ///
+        void fitEvents(const ChargeHits &t_chargeHits);
+
+        ///
+        /// Write the tree and close its file.
+        ///
+        void closeTree();
+
         void openEventDisplay() {
             if (m_display) {
                 m_display->open();
@@ -74,6 +90,8 @@ namespace pixy_roimux {
 
         const int m_detId = 1;
 
+        std::unique_ptr<TFile> m_treeFile;
+
         std::unique_ptr<TTree> m_tree;
 
         TClonesArray m_hits;
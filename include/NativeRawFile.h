@@ -0,0 +1,150 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_NATIVERAWFILE_H
+#define PIXY_ROIMUX_NATIVERAWFILE_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "EventWaveforms.h"
+#include "RunParams.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Header of a native raw waveform file.
+    /// The file starts with this header, followed by the event data and the event offset table at tableOffset. The event
+    /// data of each event consists of the pixel plane followed by the ROI plane, both stored channel-major in readout
+    /// channel order with stride samples per channel, exactly as in PlaneWaveforms. Every event starts at a multiple of
+    /// PlaneWaveforms::kAlignment bytes. All values are stored in host byte order.
+    ///
+    struct NativeRawHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t nPixels;
+        uint32_t nRois;
+        uint32_t nSamples;
+        uint32_t stride;
+        uint32_t reserved;
+        uint64_t nEvents;
+        uint64_t tableOffset;
+    };
+
+
+    ///
+    /// Entry of the event offset table of a native raw waveform file.
+    ///
+    struct NativeRawEntry {
+        uint32_t eventId;
+        uint32_t reserved;
+        uint64_t offset;
+    };
+
+
+    ///
+    /// Native raw waveform file.
+    /// Holds the readout waveforms of a run already converted from the DAQ histograms, so they can be loaded without ROOT
+    /// deserialisation. The file is mapped into memory read-only: getEvent() copies the planes of an event out of the
+    /// mapping into owned buffers with a plain memory copy and then releases the pages of the event again. The waveforms
+    /// can thus be modified, e.g. by the noise filter, and the resident memory stays bounded by the events in flight
+    /// instead of growing with every event loaded from the mapping. Use convert() or the pixy-convert tool to create a
+    /// file from the DAQ ROOT file.
+    ///
+    class NativeRawFile {
+    public:
+
+        ///
+        /// Constructor mapping the file. The number of pixels and ROIs must match the run parameters and the file must
+        /// contain at least as many samples per channel as the run parameters ask for.
+        ///
+        NativeRawFile(
+                const std::string &t_fileName,
+                const RunParams &t_runParams);
+
+        ///
+        /// Check whether the event is contained in the file.
+        ///
+        bool hasEvent(const unsigned t_eventId) const {
+            return m_offsets.count(t_eventId) > 0;
+        }
+
+        ///
+        /// Get the waveforms of an event, copied from the mapping into owned buffers.
+        ///
+        EventWaveforms getEvent(const unsigned t_eventId) const;
+
+        ///
+        /// Get the IDs of all events in the file in ascending order.
+        ///
+        std::vector<unsigned> getEventIds() const;
+
+        ///
+        /// Check whether a file is a native raw waveform file by its magic number.
+        ///
+        static bool isNativeFile(const std::string &t_fileName);
+
+        ///
+        /// Convert all events of a DAQ ROOT file to a native raw waveform file. Events are read counting up from event
+        /// ID 0 until the first missing one, as done by ChargeData. Returns the number of converted events.
+        ///
+        static unsigned long convert(
+                const std::string &t_rootFileName,
+                const std::string &t_nativeFileName,
+                const RunParams &t_runParams);
+
+        ///
+        /// Current version of the file format.
+        ///
+        static const uint32_t kVersion = 1;
+
+
+    private:
+
+        ///
+        /// Name of the file.
+        ///
+        const std::string m_fileName;
+
+        ///
+        /// Number of samples per channel used for the waveforms, taken from the run parameters.
+        ///
+        const unsigned m_nSamples;
+
+        ///
+        /// File header.
+        ///
+        NativeRawHeader m_header;
+
+        ///
+        /// Read-only memory mapping of the whole file, unmapped when the last user is gone.
+        ///
+        std::shared_ptr<void> m_mapping;
+
+        ///
+        /// Size of the mapping in bytes.
+        ///
+        uint64_t m_mappingSize;
+
+        ///
+        /// Event data offsets by event ID.
+        ///
+        std::map<unsigned, uint64_t> m_offsets;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_NATIVERAWFILE_H
@@ -6,14 +6,29 @@
 #define PIXY_ROIMUX_NOISEFILTER_H
 
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 #include <utility>
 #include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "TF1.h"
-#include "TH1D.h"
-#include "TH2S.h"
+#include "TH1S.h"
+#include "ChannelStatus.h"
 #include "ChargeData.h"
+#include "EnvelopePyramid.h"
+#include "EventWaveforms.h"
+#include "FrequencyFilter.h"
+#include "NoiseValidationStats.h"
+#include "PedestalDatabase.h"
+#include "RoiDeconvolution.h"
+#include "RunParams.h"
+#include "Span.h"
 
 
 namespace pixy_roimux {
@@ -35,30 +50,165 @@ namespace pixy_roimux {
             m_thrSigma = t_thrSigma;
         }
 
+        ///
+        /// Set the method used to estimate the noise of each channel before the common mode removal.
+        ///
+        void setNoiseEstimator(const NoiseEstimator t_noiseEstimator) {
+            m_noiseEstimator = t_noiseEstimator;
+        }
+
+        ///
+        /// Set the implementation of the common mode removal.
+        ///
+        void setCommonModeKernel(const CommonModeKernel t_commonModeKernel) {
+            m_commonModeKernel = t_commonModeKernel;
+        }
+
+        ///
+        /// Set the pedestal database used for the noise of each channel, both before and after the common mode removal.
+        /// nullptr estimates the noise of every channel from the event.
+        ///
+        void setPedestalDatabase(PedestalDatabase *const t_pedestals) {
+            m_pedestals = t_pedestals;
+        }
+
+        ///
+        /// Set the channel status map. Masked channels skip the noise estimation and stay out of the common mode.
+        /// nullptr uses all channels.
+        ///
+        void setChannelStatus(ChannelStatus *const t_channelStatus) {
+            m_channelStatus = t_channelStatus;
+        }
+
+        ///
+        /// Set the frequency filter applied after the common mode removal. nullptr skips it.
+        ///
+        void setFrequencyFilter(FrequencyFilter *const t_frequencyFilter) {
+            m_frequencyFilter = t_frequencyFilter;
+        }
+
+        ///
+        /// Set the deconvolution applied to the ROI plane after the frequency filter. nullptr skips it.
+        ///
+        void setRoiDeconvolution(RoiDeconvolution *const t_roiDeconvolution) {
+            m_roiDeconvolution = t_roiDeconvolution;
+        }
+
         ///
         /// Compute mean and standard deviation of the noise by fitting a Gaussian to the amplitude distribution of the
-        /// 2D histogram of a single channel.
+        /// samples of a single channel.
         ///
-        static std::pair<double, double> computeNoiseParams(std::shared_ptr<TH1D> t_channelHisto,
+        static std::pair<double, double> computeNoiseParams(const Span<const int16_t> t_samples,
                                                             const bool t_fit);
 
         ///
-        /// Filter data.
+        /// Compute mean and standard deviation of the noise of a single channel with the given method. In validation
+        /// mode, the fit result is returned and the deviation of the fast estimator from it is added to
+        /// t_validationStats, if given.
+        ///
+        static std::pair<double, double> computeNoiseParams(const Span<const int16_t> t_samples,
+                                                            const NoiseEstimator t_noiseEstimator,
+                                                            NoiseValidationStats *const t_validationStats = nullptr);
+
+        ///
+        /// Estimate mean and standard deviation of the noise without ROOT.
+        /// The samples are filled into an integer histogram spanning their range. The median and the median absolute
+        /// deviation give a first estimate. Then a parabola is fitted to the logarithm of the bin contents around the mode
+        /// by weighted least squares, which is the closed-form maximum likelihood fit of a Gaussian for large counts.
+        /// Falls back to the median and the scaled MAD if the parabola doesn't open downwards.
+        ///
+        static std::pair<double, double> estimateNoiseParams(const Span<const int16_t> t_samples);
+
+        ///
+        /// Get the deviation of the fast estimator from the fit recorded in validation mode for the raw waveforms.
+        ///
+        const NoiseValidationStats &getValidationStats() const {
+            return m_validationStats;
+        }
+
+        ///
+        /// Filter data, then compute the noise models of the filtered events. The frequency filter, if any, runs on each
+        /// plane after the common mode removal, followed by the ROI deconvolution, if any.
         ///
         void filterData(ChargeData &t_data);
 
+        ///
+        /// Reference common mode removal. For each sample, the mean of all channels within their noise band
+        /// [t_thresholds.first, t_thresholds.second] is rounded and subtracted from all channels, saturating at the limits
+        /// of int16_t. Samples at which no channel is within its noise band are left untouched.
+        ///
+        static void removeCommonModeScalar(
+                PlaneWaveforms &t_plane,
+                const std::vector<std::pair<double, double>> &t_thresholds);
+
+        ///
+        /// Same as removeCommonModeScalar with identical results, but working on tiles of kTileSize samples. For each
+        /// tile, the in-band samples of every channel are added to per-sample accumulators with SIMD compares and masked
+        /// adds, then the rounded means are subtracted from every channel of the tile. The plane stays channel-major, so
+        /// the vectors run along the samples and no transposition or horizontal reduction is needed.
+        ///
+        static void removeCommonModeTiled(
+                PlaneWaveforms &t_plane,
+                const std::vector<std::pair<double, double>> &t_thresholds);
+
 
     private:
 
         ///
-        /// Filter a single TH2S from a dataset.
+        /// Number of samples per tile of the SIMD common mode kernel. The accumulators of a tile and the tile itself stay
+        /// in the L1 cache while looping over the channels.
         ///
-        void filterHisto(TH2S &t_histo);
+        static const unsigned kTileSize = 256;
+
+        ///
+        /// Filter a single readout plane from a dataset. t_firstChannel is the readout channel of its first channel. The
+        /// time spent removing the common mode is added to t_scalarTime or t_simdTime, depending on the kernel.
+        ///
+        void filterPlane(
+                PlaneWaveforms &t_plane,
+                const unsigned t_firstChannel,
+                std::chrono::duration<double> &t_scalarTime,
+                std::chrono::duration<double> &t_simdTime);
 
         ///
         /// Threshold in sigma of the Gaussian fit to the noise below which a sample is considered to be noise.
         ///
         double m_thrSigma = 1.;
+
+        ///
+        /// Noise estimation method.
+        ///
+        NoiseEstimator m_noiseEstimator = NoiseEstimator::fit;
+
+        ///
+        /// Common mode removal implementation.
+        ///
+        CommonModeKernel m_commonModeKernel = CommonModeKernel::simd;
+
+        ///
+        /// Pedestal database, not owned. May be nullptr.
+        ///
+        PedestalDatabase *m_pedestals = nullptr;
+
+        ///
+        /// Channel status map, not owned. May be nullptr.
+        ///
+        ChannelStatus *m_channelStatus = nullptr;
+
+        ///
+        /// Frequency filter, not owned. May be nullptr.
+        ///
+        FrequencyFilter *m_frequencyFilter = nullptr;
+
+        ///
+        /// ROI deconvolution, not owned. May be nullptr.
+        ///
+        RoiDeconvolution *m_roiDeconvolution = nullptr;
+
+        ///
+        /// Validation statistics of the noise estimates of the raw waveforms.
+        ///
+        NoiseValidationStats m_validationStats;
     };
 }
 
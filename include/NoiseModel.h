@@ -0,0 +1,195 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_NOISEMODEL_H
+#define PIXY_ROIMUX_NOISEMODEL_H
+
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ChannelStatus.h"
+#include "EventWaveforms.h"
+#include "NoiseValidationStats.h"
+#include "PedestalDatabase.h"
+#include "RunParams.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Noise parameters of a single channel and the hit finder thresholds derived from them.
+    ///
+    struct ChannelNoise {
+        ///
+        /// Baseline in ADC counts.
+        ///
+        double mean;
+
+        ///
+        /// Standard deviation of the noise in ADC counts.
+        ///
+        double sigma;
+
+        ///
+        /// Threshold for the rising edge of the positive lobe.
+        ///
+        double thrPosLead;
+
+        ///
+        /// Threshold a positive peak must reach.
+        ///
+        double thrPosPeak;
+
+        ///
+        /// Threshold for the falling edge of the positive lobe.
+        ///
+        double thrPosTrail;
+
+        ///
+        /// Threshold a negative peak must reach.
+        ///
+        double thrNegPeak;
+
+        ///
+        /// Threshold for the end of the negative lobe.
+        ///
+        double thrNegTrail;
+
+        ///
+        /// Whether the channel is masked. Masked channels have no noise estimate and thresholds no sample can reach.
+        ///
+        bool masked;
+    };
+
+
+    ///
+    /// Noise model of a single event.
+    /// Holds the baseline, the standard deviation of the noise and the hit finder thresholds of every pixel and ROI
+    /// channel. It is computed once from the waveforms after the common mode removal, using the noise estimator and the
+    /// discriminator settings of the run parameters or from a PedestalDatabase, and then shared by the zero suppression, the hit finder, the
+    /// diagnostics and the output files.
+    ///
+    class NoiseModel {
+    public:
+
+        ///
+        /// Constructor for an empty model.
+        ///
+        NoiseModel() : m_eventId(0) {}
+
+        ///
+        /// Constructor estimating the noise of every channel of an event. If a pedestal database is given, the noise is
+        /// taken from it and only estimated from the event for channels out of tolerance. Channels masked in the channel
+        /// status map, if given, are not estimated.
+        ///
+        NoiseModel(
+                const EventWaveforms &t_waveforms,
+                const RunParams &t_runParams,
+                PedestalDatabase *const t_pedestals = nullptr,
+                const ChannelStatus *const t_channelStatus = nullptr);
+
+        ///
+        /// Get the event ID.
+        ///
+        unsigned getEventId() const {
+            return m_eventId;
+        }
+
+        ///
+        /// Get the noise of the pixel channels.
+        ///
+        const std::vector<ChannelNoise> &getPixelNoise() const {
+            return m_pixelNoise;
+        }
+
+        ///
+        /// Get the noise of the ROI channels.
+        ///
+        const std::vector<ChannelNoise> &getRoiNoise() const {
+            return m_roiNoise;
+        }
+
+        ///
+        /// Get the noise of the matched-filtered pixel channels. Empty unless estimatePixelSeedNoise() was called.
+        ///
+        const std::vector<ChannelNoise> &getPixelSeedNoise() const {
+            return m_pixelSeedNoise;
+        }
+
+        ///
+        /// Estimate the noise of the matched-filtered pixel plane of the event. Filtering lowers the noise, so the
+        /// pixel peak candidates are taken from the filtered waveforms with their own peak thresholds. The lead and
+        /// trail thresholds are derived the same way as for the unfiltered pixel plane.
+        ///
+        void estimatePixelSeedNoise(
+                const PlaneWaveforms &t_seedPlane,
+                const RunParams &t_runParams,
+                const ChannelStatus *const t_channelStatus = nullptr);
+
+        ///
+        /// Get the deviation of the fast estimator from the fit recorded in validation mode for this event.
+        ///
+        const NoiseValidationStats &getValidationStats() const {
+            return m_validationStats;
+        }
+
+        ///
+        /// Write the model to a CSV file with one line per channel.
+        ///
+        void writeCsv(const std::string &t_fileName) const;
+
+
+    private:
+
+        ///
+        /// Derive the thresholds of a channel from its noise parameters, the same way for both planes.
+        ///
+        static ChannelNoise makeChannelNoise(
+                const std::pair<double, double> &t_noiseParams,
+                const double t_discSigmaPosLead,
+                const double t_discSigmaPosPeak,
+                const double t_discAbsPosPeak,
+                const double t_discSigmaPosTrail,
+                const double t_discSigmaNegPeak,
+                const double t_discAbsNegPeak,
+                const double t_discSigmaNegTrail);
+
+        ///
+        /// Get the noise of a masked channel.
+        ///
+        static ChannelNoise makeMaskedNoise();
+
+        ///
+        /// Event ID.
+        ///
+        unsigned m_eventId;
+
+        ///
+        /// Noise by pixel channel.
+        ///
+        std::vector<ChannelNoise> m_pixelNoise;
+
+        ///
+        /// Noise by ROI channel.
+        ///
+        std::vector<ChannelNoise> m_roiNoise;
+
+        ///
+        /// Noise by matched-filtered pixel channel.
+        ///
+        std::vector<ChannelNoise> m_pixelSeedNoise;
+
+        ///
+        /// Validation statistics of the noise estimates of this event.
+        ///
+        NoiseValidationStats m_validationStats;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_NOISEMODEL_H
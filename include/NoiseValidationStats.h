@@ -0,0 +1,57 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_NOISEVALIDATIONSTATS_H
+#define PIXY_ROIMUX_NOISEVALIDATIONSTATS_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+
+namespace pixy_roimux {
+    ///
+    /// Comparison of the fast noise estimator with the fit, accumulated in validation mode.
+    /// Every instance estimating noise keeps its own statistics, which are added up at the end of the run, so no state is
+    /// shared between threads or forked workers.
+    ///
+    struct NoiseValidationStats {
+        ///
+        /// Number of channels compared.
+        ///
+        unsigned long nChannels = 0;
+
+        ///
+        /// Sum and maximum of the absolute deviation of the mean in ADC counts.
+        ///
+        double sumMeanDev = 0.;
+        double maxMeanDev = 0.;
+
+        ///
+        /// Sum and maximum of the relative deviation of the standard deviation.
+        ///
+        double sumSigmaDev = 0.;
+        double maxSigmaDev = 0.;
+
+        ///
+        /// Time spent in the fit and in the fast estimator.
+        ///
+        std::chrono::duration<double> fitTime{0.};
+        std::chrono::duration<double> fastTime{0.};
+
+        ///
+        /// Add the statistics of another instance.
+        ///
+        void add(const NoiseValidationStats &t_other);
+
+        ///
+        /// Print the deviation of the fast estimator from the fit, if any channels were compared.
+        ///
+        void print() const;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_NOISEVALIDATIONSTATS_H
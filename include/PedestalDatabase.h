@@ -0,0 +1,195 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_PEDESTALDATABASE_H
+#define PIXY_ROIMUX_PEDESTALDATABASE_H
+
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include "NoiseValidationStats.h"
+#include "RunParams.h"
+#include "Span.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Stage of the processing a pedestal applies to.
+    ///
+    enum class PedestalStage {
+        ///
+        /// Raw waveforms before the common mode removal.
+        ///
+        raw,
+
+        ///
+        /// Waveforms after the common mode removal.
+        ///
+        filtered
+    };
+
+
+    ///
+    /// Persistent database of channel pedestals.
+    /// Keeps an exponentially weighted running estimate of the baseline and the noise standard deviation of every
+    /// readout channel, keyed by run ID, stage and channel. For each event, a channel is first checked with the fast
+    /// estimator of NoiseFilter. If the result is within tolerance of the stored pedestal, the stored pedestal is used and
+    /// updated with weight alpha. Otherwise, or if the channel has no pedestal yet, the noise is estimated from the event
+    /// with the configured estimator and the pedestal is reset to the result. Channels of a run not in the database start
+    /// from the pedestal of the latest run that has them. The database is loaded from and saved to a text file, so the
+    /// next run starts warm. Forked workers each save the pedestals they updated to a shard file with saveShard(), which
+    /// the driver adds to its database in shard order with addShard() before saving it.
+    ///
+    class PedestalDatabase {
+    public:
+
+        ///
+        /// Constructor loading the database file given in the run parameters, if it exists.
+        ///
+        explicit PedestalDatabase(const RunParams &t_runParams);
+
+        ///
+        /// Get the baseline and the noise standard deviation of a readout channel (pixels first, then ROIs) for the
+        /// samples of the current event, updating the database. Estimates from the event in validation mode are
+        /// recorded in t_validationStats, if given.
+        ///
+        std::pair<double, double> getNoiseParams(
+                const PedestalStage t_stage,
+                const unsigned t_channel,
+                const Span<const int16_t> t_samples,
+                NoiseValidationStats *const t_validationStats = nullptr);
+
+        ///
+        /// Write the database to its file.
+        ///
+        void save() const;
+
+        ///
+        /// Write the pedestals updated since the database was loaded to a shard file.
+        ///
+        void saveShard(const std::string &t_fileName) const;
+
+        ///
+        /// Add the pedestals of a shard file written by saveShard(). They replace the ones already in the database, so
+        /// the shards must be added in the order of their events. Returns false if the shard file doesn't exist.
+        ///
+        bool addShard(const std::string &t_fileName);
+
+        ///
+        /// Print how often the stored pedestals were used and how often the noise had to be estimated from the event.
+        ///
+        void printStats() const;
+
+
+    private:
+
+        ///
+        /// Pedestal of one channel.
+        ///
+        struct Pedestal {
+            ///
+            /// Baseline in ADC counts.
+            ///
+            double mean;
+
+            ///
+            /// Noise standard deviation in ADC counts.
+            ///
+            double sigma;
+
+            ///
+            /// Number of events the pedestal was updated with since it was last reset.
+            ///
+            unsigned long nUpdates;
+        };
+
+        ///
+        /// Key of a pedestal: run ID, stage and readout channel.
+        ///
+        typedef std::tuple<unsigned, unsigned, unsigned> Key;
+
+        ///
+        /// Load a database file, replacing the pedestals already in the database. Returns false if it doesn't exist.
+        /// Dies if it's corrupt.
+        ///
+        bool load(const std::string &t_fileName);
+
+        ///
+        /// Write the pedestals to a file, either all of them or only the updated ones.
+        ///
+        void write(
+                const std::string &t_fileName,
+                const bool t_updatedOnly) const;
+
+        ///
+        /// Find the pedestal of a channel for the current run, seeding it from the latest earlier run if needed.
+        /// Returns nullptr if there is none.
+        ///
+        Pedestal *findPedestal(
+                const unsigned t_stage,
+                const unsigned t_channel);
+
+        ///
+        /// Name of the database file.
+        ///
+        const std::string m_fileName;
+
+        ///
+        /// Current run ID.
+        ///
+        const unsigned m_runId;
+
+        ///
+        /// Noise estimator used if a channel is out of tolerance.
+        ///
+        const NoiseEstimator m_noiseEstimator;
+
+        ///
+        /// Weight of the current event in the running estimate.
+        ///
+        const double m_alpha;
+
+        ///
+        /// Tolerated deviation of the baseline in units of the stored noise standard deviation.
+        ///
+        const double m_meanTolerance;
+
+        ///
+        /// Tolerated relative deviation of the noise standard deviation.
+        ///
+        const double m_sigmaTolerance;
+
+        ///
+        /// Pedestals by key.
+        ///
+        std::map<Key, Pedestal> m_pedestals;
+
+        ///
+        /// Keys of the pedestals updated since the database was loaded.
+        ///
+        std::set<Key> m_updatedKeys;
+
+        ///
+        /// Number of channels that used the stored pedestal.
+        ///
+        unsigned long m_nWarm = 0;
+
+        ///
+        /// Number of channels that were estimated from the event.
+        ///
+        unsigned long m_nEstimated = 0;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_PEDESTALDATABASE_H
@@ -0,0 +1,130 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_PULSETEMPLATEFIT_H
+#define PIXY_ROIMUX_PULSETEMPLATEFIT_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "Event.h"
+#include "RunParams.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Batched template fit of the pixel pulses for sub-sample timing.
+    /// The amplitude and the time of the pixel pulse template from the run parameters are fitted to the raw pulse of
+    /// every pixel hit of an event by least squares. Between its samples, the template is interpolated with a
+    /// Catmull-Rom spline, which has a continuous derivative with respect to the time. The raw pulses of all hits are
+    /// gathered into one sample pool with the fit parameters of each hit in separate arrays. Every Gauss-Newton step
+    /// goes through all hits that haven't converged yet. The sums of the normal equations of a hit are accumulated 8
+    /// samples at a time with AVX2 or 4 with SSE2, depending on the target, with a scalar fallback. The fitted time
+    /// is stored in Hit2d::posPeakTime. Hits whose fit fails keep the peak sample.
+    ///
+    class PulseTemplateFit {
+    public:
+
+        ///
+        /// Constructor reading the template, its origin and the number of iterations from the run parameters.
+        ///
+        explicit PulseTemplateFit(const RunParams &t_runParams);
+
+        ///
+        /// Fit the template to the raw pulses of the pixel hits of an event and store the fitted times.
+        ///
+        void fitHits(Event &t_event);
+
+        ///
+        /// Print the number of fitted hits and the time spent.
+        ///
+        void printStats() const;
+
+
+    private:
+
+        ///
+        /// Do a Gauss-Newton step for a hit of the current batch. Returns false if the fit of the hit has converged
+        /// or failed. Failed fits have an amplitude of 0.
+        ///
+        bool step(const unsigned t_hitIdx);
+
+        ///
+        /// Template normalised to a maximum of 1, with 3 zeros before and after it for the interpolation.
+        ///
+        std::vector<float> m_template;
+
+        ///
+        /// Number of template samples without the zeros.
+        ///
+        unsigned m_nTemplateSamples;
+
+        ///
+        /// Index of the template sample giving the time of a hit.
+        ///
+        unsigned m_origin;
+
+        ///
+        /// Index of the template maximum.
+        ///
+        unsigned m_peak;
+
+        ///
+        /// Maximum number of Gauss-Newton steps per hit.
+        ///
+        unsigned m_nIterations;
+
+        ///
+        /// Raw pulses of the current batch of hits, one after the other.
+        ///
+        std::vector<float> m_samples;
+
+        ///
+        /// Index of the first sample of each hit of the batch in m_samples and its number of samples.
+        ///
+        std::vector<unsigned> m_offsets;
+        std::vector<unsigned> m_lengths;
+
+        ///
+        /// Fitted amplitude of each hit of the batch.
+        ///
+        std::vector<float> m_amplitudes;
+
+        ///
+        /// Fitted time of each hit of the batch in samples after its first sample.
+        ///
+        std::vector<float> m_times;
+
+        ///
+        /// Indices of the hits of the batch still being fitted.
+        ///
+        std::vector<unsigned> m_activeHits;
+
+        ///
+        /// Number of events, of pixel hits, of fitted pixel hits and of Gauss-Newton steps.
+        ///
+        unsigned long m_nEvents = 0;
+        unsigned long m_nHits = 0;
+        unsigned long m_nFittedHits = 0;
+        unsigned long m_nSteps = 0;
+
+        ///
+        /// Time spent fitting.
+        ///
+        std::chrono::duration<double> m_time{0.};
+    };
+}
+
+
+#endif //PIXY_ROIMUX_PULSETEMPLATEFIT_H
@@ -0,0 +1,109 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_ROIDECONVOLUTION_H
+#define PIXY_ROIMUX_ROIDECONVOLUTION_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <vector>
+#include "BatchedFft.h"
+#include "EventWaveforms.h"
+#include "RunParams.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Deconvolution of the bipolar ROI signals to unipolar pulses.
+    /// The ROI waveforms are the arriving charge convolved with the bipolar field and electronics response from the run
+    /// parameters. All channels of a plane are transformed with a single BatchedFft and divided by the response in the
+    /// frequency domain. The response carries no charge, so its low frequencies vanish, and the division is regularised
+    /// like a Wiener filter with a white noise level relative to the peak power of the response. A Gaussian low-pass
+    /// filter keeps the noise at high frequencies in check. The response is normalised to a peak of 1, so a signal of
+    /// the response shape with amplitude A becomes a pulse with integral A at the origin of the response. The DC
+    /// component is kept, so the baselines are unchanged. Afterwards the ROI plane can go through the unipolar hit finder
+    /// like the pixels. Requires pixy to be built with FFTW.
+    ///
+    class RoiDeconvolution {
+    public:
+
+        ///
+        /// Constructor reading the response and the filter parameters from the run parameters.
+        ///
+        explicit RoiDeconvolution(const RunParams &t_runParams);
+
+        ///
+        /// Deconvolve all channels of a plane. The results are rounded to the nearest integer.
+        ///
+        void filterPlane(PlaneWaveforms &t_plane);
+
+        ///
+        /// Print the number of deconvolved planes and the time spent.
+        ///
+        void printStats() const;
+
+
+    private:
+
+        ///
+        /// Get the deconvolution filter for channels of t_nSamples samples, computing it if needed. The filter is
+        /// already divided by the number of samples to normalise the inverse transform.
+        ///
+        const std::vector<std::complex<double>> &getFilter(const unsigned t_nSamples);
+
+        ///
+        /// Sample time in us.
+        ///
+        double m_sampleTime;
+
+        ///
+        /// Response, one value per sample, normalised to a peak of 1.
+        ///
+        std::vector<double> m_response;
+
+        ///
+        /// Index of the response sample the deconvolved pulses are aligned to.
+        ///
+        unsigned m_responseOrigin;
+
+        ///
+        /// Standard deviation of the Gaussian low-pass filter in MHz.
+        ///
+        double m_cutoff;
+
+        ///
+        /// Noise power relative to the peak power of the response.
+        ///
+        double m_noiseLevel;
+
+        ///
+        /// Filters by number of samples.
+        ///
+        std::map<unsigned, std::vector<std::complex<double>>> m_filters;
+
+        ///
+        /// Transforms of all planes.
+        ///
+        BatchedFft m_fft;
+
+        ///
+        /// Number of deconvolved planes.
+        ///
+        unsigned long m_nPlanes = 0;
+
+        ///
+        /// Time spent deconvolving, including the transforms.
+        ///
+        std::chrono::duration<double> m_time{0.};
+    };
+}
+
+
+#endif //PIXY_ROIMUX_ROIDECONVOLUTION_H
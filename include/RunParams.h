@@ -9,6 +9,7 @@
 #include <array>
 #include <cstdio>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <vector>
 #include "rapidjson/document.h"
@@ -17,6 +18,64 @@
 
 
 namespace pixy_roimux {
+///
+/// Location of the samples of one readout channel in the DAQ histograms.
+///
+    struct ChannelGather {
+        ///
+        /// DAQ histogram holding the channel: 0 for "Ind_x", 1 for "Col_x".
+        ///
+        unsigned daqHisto;
+
+        ///
+        /// Channel index within that DAQ histogram, starting at 0.
+        ///
+        unsigned daqRow;
+    };
+
+
+///
+/// Method used to estimate the baseline and the standard deviation of the noise of a channel.
+///
+    enum class NoiseEstimator {
+        ///
+        /// Gaussian fit to the amplitude spectrum with MINUIT.
+        ///
+        fit,
+
+        ///
+        /// Closed-form log-parabola fit around the mode of an integer amplitude histogram.
+        ///
+        fast,
+
+        ///
+        /// Run both, use the fit and record the deviation of the fast estimator from it.
+        ///
+        validate
+    };
+
+
+///
+/// Implementation of the common mode removal.
+///
+    enum class CommonModeKernel {
+        ///
+        /// Reference loop over samples and channels.
+        ///
+        scalar,
+
+        ///
+        /// SIMD kernel working on tiles of samples.
+        ///
+        simd,
+
+        ///
+        /// Run both, use the SIMD result and check that they agree.
+        ///
+        compare
+    };
+
+
 ///
 /// This class contains all the maps required for the VIPER pixel readout reconstruction.
 /// Namely, the map from DAQ channels to readout channels and vice versa, and the mechanical coordinates of the pixels
@@ -64,6 +123,15 @@ namespace pixy_roimux {
             return m_readout2daq.at(t_roiInd + m_nPixels);
         }
 
+        ///
+        /// Get the location of a readout channel in the DAQ histograms.
+        /// Readout channels are numbered with the pixels first, followed by the ROIs. The plan is built once when the run
+        /// parameters are loaded, so converting an event doesn't need to evaluate the channel maps per sample.
+        ///
+        const ChannelGather &getChannelGather(const unsigned t_readoutChan) const {
+            return m_gatherPlan[t_readoutChan];
+        }
+
         ///
         /// Get pixel coordinates in units of pixel pitch.
         /// Pixel number 0 has the coordinates (0, 0). These are just relative offsets within one ROI. To get absolute
@@ -354,6 +422,266 @@ namespace pixy_roimux {
             return m_kalmanPdgCode;
         }
 
+        ///
+        /// Get the number of events read and processed at once in streaming mode.
+        /// 0 disables streaming, i.e. all selected events are loaded at once.
+        ///
+        unsigned getStreamWindow() const {
+            return m_streamWindow;
+        }
+
+        ///
+        /// Get the number of background threads prefetching events from the raw data file.
+        /// 0 disables prefetching, i.e. events are read on demand by the main thread.
+        ///
+        unsigned getReaderThreads() const {
+            return m_readerThreads;
+        }
+
+        ///
+        /// Get the maximum number of events held by the prefetching reader ahead of the event being processed.
+        ///
+        unsigned getReaderQueueSize() const {
+            return m_readerQueueSize;
+        }
+
+        ///
+        /// Get whether the filtered waveforms are compressed in memory before running the hit finder.
+        ///
+        bool getCompressWaveforms() const {
+            return m_compressWaveforms;
+        }
+
+        ///
+        /// Get whether the filtered waveforms are zero suppressed before running the hit finder.
+        ///
+        bool getZeroSuppress() const {
+            return m_zeroSuppress;
+        }
+
+        ///
+        /// Get the number of worker processes the selected events are split across.
+        /// 1 processes all events in a single process, 0 uses one worker per core.
+        ///
+        unsigned getNWorkers() const {
+            return m_nWorkers;
+        }
+
+        ///
+        /// Get the method used to estimate the noise of a channel.
+        ///
+        NoiseEstimator getNoiseEstimator() const {
+            return m_noiseEstimator;
+        }
+
+        ///
+        /// Get the implementation of the common mode removal.
+        ///
+        CommonModeKernel getCommonModeKernel() const {
+            return m_commonModeKernel;
+        }
+
+        ///
+        /// Get the file name of the pedestal database. Empty if no database is used.
+        ///
+        const std::string &getPedestalDatabase() const {
+            return m_pedestalDatabase;
+        }
+
+        ///
+        /// Get the weight of each event in the running pedestal estimates.
+        ///
+        double getPedestalAlpha() const {
+            return m_pedestalAlpha;
+        }
+
+        ///
+        /// Get the tolerated baseline drift in units of the stored noise standard deviation.
+        ///
+        double getPedestalMeanTolerance() const {
+            return m_pedestalMeanTolerance;
+        }
+
+        ///
+        /// Get the tolerated relative drift of the noise standard deviation.
+        ///
+        double getPedestalSigmaTolerance() const {
+            return m_pedestalSigmaTolerance;
+        }
+
+        ///
+        /// Get whether the frequency filter is applied after the common mode removal.
+        ///
+        bool getFrequencyFilter() const {
+            return m_frequencyFilter;
+        }
+
+        ///
+        /// Get the cutoff of the low-pass filter in MHz. 0 disables the low-pass filter.
+        ///
+        double getLowPassCutoff() const {
+            return m_lowPassCutoff;
+        }
+
+        ///
+        /// Get the centre frequencies of the notch filters in MHz.
+        ///
+        const std::vector<double> &getNotchFrequencies() const {
+            return m_notchFrequencies;
+        }
+
+        ///
+        /// Get the full width of each notch filter in MHz.
+        ///
+        double getNotchWidth() const {
+            return m_notchWidth;
+        }
+
+        ///
+        /// Get whether the ROI waveforms are deconvolved to unipolar pulses. The ROI hits are then found like the pixel
+        /// hits.
+        ///
+        bool getRoiDeconvolution() const {
+            return m_roiDeconvolution;
+        }
+
+        ///
+        /// Get the field and electronics response of the ROIs, one value per sample.
+        ///
+        const std::vector<double> &getRoiResponse() const {
+            return m_roiResponse;
+        }
+
+        ///
+        /// Get the index of the ROI response sample the deconvolved pulses are aligned to.
+        ///
+        unsigned getRoiResponseOrigin() const {
+            return m_roiResponseOrigin;
+        }
+
+        ///
+        /// Get the standard deviation of the Gaussian low-pass filter of the ROI deconvolution in MHz.
+        ///
+        double getDeconvolutionCutoff() const {
+            return m_deconvolutionCutoff;
+        }
+
+        ///
+        /// Get the noise power of the ROI deconvolution relative to the peak power of the response.
+        ///
+        double getDeconvolutionNoise() const {
+            return m_deconvolutionNoise;
+        }
+
+        ///
+        /// Get whether dead, noisy and stuck channels are masked.
+        ///
+        bool getChannelMasking() const {
+            return m_channelMasking;
+        }
+
+        ///
+        /// Get the file name of the channel status map. Empty if the map isn't persisted.
+        ///
+        const std::string &getChannelStatusFile() const {
+            return m_channelStatusFile;
+        }
+
+        ///
+        /// Get the noise standard deviation in ADC counts below which a channel is dead.
+        ///
+        double getDeadSigma() const {
+            return m_deadSigma;
+        }
+
+        ///
+        /// Get the factor on the median noise standard deviation of a plane above which a channel is noisy.
+        ///
+        double getNoisySigmaFactor() const {
+            return m_noisySigmaFactor;
+        }
+
+        ///
+        /// Get the number of consecutive events a channel must be flagged in before it's masked.
+        ///
+        unsigned getChannelStatusMinEvents() const {
+            return m_channelStatusMinEvents;
+        }
+
+        ///
+        /// Get the number of threads finding the 2D hits of an event in parallel, including the main thread.
+        /// 0 and 1 find them on the main thread only.
+        ///
+        unsigned getHitFinderThreads() const {
+            return m_hitFinderThreads;
+        }
+
+        ///
+        /// Get whether the pixel peak candidates are taken from a matched-filtered copy of the pixel waveforms. The
+        /// pulse edges, timing and integrals are still taken from the unfiltered waveforms.
+        ///
+        bool getPixelMatchedFilter() const {
+            return m_pixelMatchedFilter;
+        }
+
+        ///
+        /// Get the FIR kernel of the pixel matched filter, i.e. the expected pixel pulse shape, one value per sample.
+        ///
+        const std::vector<double> &getPixelFilterKernel() const {
+            return m_pixelFilterKernel;
+        }
+
+        ///
+        /// Get the index of the pixel filter kernel sample the filtered pulses are aligned to.
+        ///
+        unsigned getPixelFilterOrigin() const {
+            return m_pixelFilterOrigin;
+        }
+
+        ///
+        /// Get the threshold in sigma of the filtered noise Gaussian a matched-filtered pixel peak candidate must
+        /// reach.
+        ///
+        double getDiscSigmaPixelSeedPeak() const {
+            return m_discSigmaPixelSeedPeak;
+        }
+
+        ///
+        /// Get the absolute threshold a matched-filtered pixel peak candidate must reach.
+        ///
+        double getDiscAbsPixelSeedPeak() const {
+            return m_discAbsPixelSeedPeak;
+        }
+
+        ///
+        /// Get whether the time of each pixel hit is refined by fitting the pixel pulse template to its raw pulse. The
+        /// z coordinate of the 3D hits is then computed from the fitted time instead of the peak sample.
+        ///
+        bool getPulseTemplateFit() const {
+            return m_pulseTemplateFit;
+        }
+
+        ///
+        /// Get the expected pixel pulse shape fitted to the pixel hits, one value per sample. Only the shape matters.
+        ///
+        const std::vector<double> &getPixelPulseTemplate() const {
+            return m_pixelPulseTemplate;
+        }
+
+        ///
+        /// Get the index of the pixel pulse template sample giving the time of a pixel hit.
+        ///
+        unsigned getPixelPulseTemplateOrigin() const {
+            return m_pixelPulseTemplateOrigin;
+        }
+
+        ///
+        /// Get the maximum number of Gauss-Newton iterations of the pulse template fit.
+        ///
+        unsigned getPulseTemplateFitIterations() const {
+            return m_pulseTemplateFitIterations;
+        }
+
 
     private:
 
@@ -363,6 +691,11 @@ namespace pixy_roimux {
                 const unsigned t_arraySize = 0,
                 const rapidjson::Type t_arrayType = rapidjson::kNullType);
 
+        ///
+        /// Array size passed to getJsonMember to accept arrays of any size.
+        ///
+        static const unsigned kAnyArraySize = std::numeric_limits<unsigned>::max();
+
         const std::array<std::string, 7> m_jsonTypes = {{"Null", "False", "True", "Object", "Array", "String", "Number"}};
 
         rapidjson::Document m_jsonDoc;
@@ -439,6 +772,11 @@ namespace pixy_roimux {
         ///
         std::vector<unsigned> m_readout2daq;
 
+        ///
+        /// Location of each readout channel in the DAQ histograms.
+        ///
+        std::vector<ChannelGather> m_gatherPlan;
+
         ///
         /// Array containing the 2D pixel coordinates.
         ///
@@ -573,6 +911,186 @@ namespace pixy_roimux {
         /// PDG code of the Kalman fitter particle hypothesis.
         ///
         int m_kalmanPdgCode;
+
+        ///
+        /// Number of events read and processed at once in streaming mode. 0 disables streaming.
+        ///
+        unsigned m_streamWindow;
+
+        ///
+        /// Number of background threads prefetching events. 0 disables prefetching.
+        ///
+        unsigned m_readerThreads;
+
+        ///
+        /// Maximum number of prefetched events.
+        ///
+        unsigned m_readerQueueSize;
+
+        ///
+        /// Compress the filtered waveforms in memory.
+        ///
+        bool m_compressWaveforms;
+
+        ///
+        /// Zero suppress the filtered waveforms.
+        ///
+        bool m_zeroSuppress;
+
+        ///
+        /// Number of worker processes. 0 uses one per core.
+        ///
+        unsigned m_nWorkers;
+
+        ///
+        /// Noise estimation method.
+        ///
+        NoiseEstimator m_noiseEstimator;
+
+        ///
+        /// Common mode removal implementation.
+        ///
+        CommonModeKernel m_commonModeKernel;
+
+        ///
+        /// Pedestal database file name.
+        ///
+        std::string m_pedestalDatabase;
+
+        ///
+        /// Weight of each event in the running pedestal estimates.
+        ///
+        double m_pedestalAlpha;
+
+        ///
+        /// Tolerated baseline drift in sigma.
+        ///
+        double m_pedestalMeanTolerance;
+
+        ///
+        /// Tolerated relative sigma drift.
+        ///
+        double m_pedestalSigmaTolerance;
+
+        ///
+        /// Apply the frequency filter.
+        ///
+        bool m_frequencyFilter;
+
+        ///
+        /// Low-pass cutoff in MHz.
+        ///
+        double m_lowPassCutoff;
+
+        ///
+        /// Notch centre frequencies in MHz.
+        ///
+        std::vector<double> m_notchFrequencies;
+
+        ///
+        /// Notch width in MHz.
+        ///
+        double m_notchWidth;
+
+        ///
+        /// Deconvolve the ROI waveforms.
+        ///
+        bool m_roiDeconvolution;
+
+        ///
+        /// ROI response.
+        ///
+        std::vector<double> m_roiResponse;
+
+        ///
+        /// ROI response origin.
+        ///
+        unsigned m_roiResponseOrigin;
+
+        ///
+        /// ROI deconvolution low-pass filter width in MHz.
+        ///
+        double m_deconvolutionCutoff;
+
+        ///
+        /// ROI deconvolution relative noise power.
+        ///
+        double m_deconvolutionNoise;
+
+        ///
+        /// Mask bad channels.
+        ///
+        bool m_channelMasking;
+
+        ///
+        /// Channel status file name.
+        ///
+        std::string m_channelStatusFile;
+
+        ///
+        /// Dead channel noise limit in ADC counts.
+        ///
+        double m_deadSigma;
+
+        ///
+        /// Noisy channel factor on the median noise.
+        ///
+        double m_noisySigmaFactor;
+
+        ///
+        /// Consecutive flagged events before masking.
+        ///
+        unsigned m_channelStatusMinEvents;
+
+        ///
+        /// Number of threads of the 2D hit finder.
+        ///
+        unsigned m_hitFinderThreads;
+
+        ///
+        /// Seed the pixel hits with the matched filter.
+        ///
+        bool m_pixelMatchedFilter;
+
+        ///
+        /// Pixel matched filter kernel.
+        ///
+        std::vector<double> m_pixelFilterKernel;
+
+        ///
+        /// Pixel matched filter kernel origin.
+        ///
+        unsigned m_pixelFilterOrigin;
+
+        ///
+        /// Matched-filtered pixel peak threshold in sigma of the filtered noise.
+        ///
+        double m_discSigmaPixelSeedPeak;
+
+        ///
+        /// Absolute matched-filtered pixel peak threshold.
+        ///
+        double m_discAbsPixelSeedPeak;
+
+        ///
+        /// Fit the pixel pulse template to the pixel hits.
+        ///
+        bool m_pulseTemplateFit;
+
+        ///
+        /// Pixel pulse template.
+        ///
+        std::vector<double> m_pixelPulseTemplate;
+
+        ///
+        /// Pixel pulse template origin.
+        ///
+        unsigned m_pixelPulseTemplateOrigin;
+
+        ///
+        /// Maximum number of iterations of the pulse template fit.
+        ///
+        unsigned m_pulseTemplateFitIterations;
     };
 }
 
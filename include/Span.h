@@ -0,0 +1,92 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_SPAN_H
+#define PIXY_ROIMUX_SPAN_H
+
+
+#include <cstddef>
+#include <type_traits>
+
+
+namespace pixy_roimux {
+    ///
+    /// Non-owning view of a contiguous range of elements.
+    /// Minimal stand-in for std::span, which is not available with the C++11 standard used by pixy. A Span<T> converts
+    /// implicitly to a Span<const T>. Element access is not bounds checked.
+    ///
+    template <typename T>
+    class Span {
+    public:
+
+        ///
+        /// Constructor for an empty span.
+        ///
+        Span() : m_data(nullptr), m_size(0) {}
+
+        ///
+        /// Constructor from a pointer to the first element and the number of elements.
+        ///
+        Span(T *const t_data, const std::size_t t_size) : m_data(t_data), m_size(t_size) {}
+
+        ///
+        /// Converting constructor, e.g. from Span<T> to Span<const T>.
+        ///
+        template <typename U, typename = typename std::enable_if<std::is_convertible<U *, T *>::value>::type>
+        Span(const Span<U> &t_other) : m_data(t_other.data()), m_size(t_other.size()) {}
+
+        ///
+        /// Get the pointer to the first element.
+        ///
+        T *data() const {
+            return m_data;
+        }
+
+        ///
+        /// Get the number of elements.
+        ///
+        std::size_t size() const {
+            return m_size;
+        }
+
+        ///
+        /// Check whether the span is empty.
+        ///
+        bool empty() const {
+            return m_size == 0;
+        }
+
+        ///
+        /// Access an element.
+        ///
+        T &operator[](const std::size_t t_idx) const {
+            return m_data[t_idx];
+        }
+
+        T *begin() const {
+            return m_data;
+        }
+
+        T *end() const {
+            return m_data + m_size;
+        }
+
+        ///
+        /// Get a view of t_count elements starting at t_offset.
+        ///
+        Span<T> subspan(const std::size_t t_offset, const std::size_t t_count) const {
+            return Span<T>(m_data + t_offset, t_count);
+        }
+
+
+    private:
+
+        T *m_data;
+
+        std::size_t m_size;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_SPAN_H
@@ -0,0 +1,232 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_SPARSEWAVEFORMS_H
+#define PIXY_ROIMUX_SPARSEWAVEFORMS_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "TH1D.h"
+#include "EventWaveforms.h"
+#include "NoiseModel.h"
+#include "RunParams.h"
+#include "Span.h"
+
+
+namespace pixy_roimux {
+    ///
+    /// Contiguous range of samples kept by the zero suppression.
+    ///
+    struct WaveformSegment {
+        ///
+        /// Index of the first sample within the channel.
+        ///
+        unsigned start;
+
+        ///
+        /// Number of samples.
+        ///
+        unsigned length;
+
+        ///
+        /// Index of the first sample within the sample pool of the plane.
+        ///
+        unsigned offset;
+    };
+
+
+    ///
+    /// Zero-suppressed samples of a single readout plane.
+    /// Every sample at or above the peak threshold of its channel in the noise model, the same threshold the hit finder
+    /// uses, seeds a segment reaching padBefore samples before and padAfter samples after it. Overlapping segments are
+    /// merged. With the padding set to the search ranges of the hit finder, every sample the hit
+    /// finder may look at for a pulse lies in the same segment as its peak, so hits can be found on the segments alone.
+    /// Samples outside the segments are not stored. If a seed plane is given, the seeds are taken from its samples
+    /// instead, so pulses only found in the matched-filtered waveforms are kept as well, while the stored samples are
+    /// still those of the plane itself.
+    ///
+    class SparsePlane {
+    public:
+
+        ///
+        /// Constructor for an empty plane.
+        ///
+        SparsePlane() : m_nChannels(0), m_nSamples(0), m_channelSegments(1, 0) {}
+
+        ///
+        /// Constructor zero suppressing a plane. t_noise is the noise of the seed plane if one is given.
+        ///
+        SparsePlane(
+                const PlaneWaveforms &t_plane,
+                const std::vector<ChannelNoise> &t_noise,
+                const unsigned t_padBefore,
+                const unsigned t_padAfter,
+                const PlaneWaveforms *const t_seedPlane = nullptr);
+
+        ///
+        /// Get the number of channels.
+        ///
+        unsigned getNChannels() const {
+            return m_nChannels;
+        }
+
+        ///
+        /// Get the number of samples per channel of the original plane.
+        ///
+        unsigned getNSamples() const {
+            return m_nSamples;
+        }
+
+        ///
+        /// Get the number of stored samples.
+        ///
+        unsigned long getNStoredSamples() const {
+            return m_samples.size();
+        }
+
+        ///
+        /// Get the segments of a channel in ascending order.
+        ///
+        Span<const WaveformSegment> getSegments(const unsigned t_channel) const {
+            return Span<const WaveformSegment>(m_segments.data() + m_channelSegments.at(t_channel),
+                                               m_channelSegments.at(t_channel + 1) - m_channelSegments.at(t_channel));
+        }
+
+        ///
+        /// Get the samples of a segment.
+        ///
+        Span<const int16_t> getSamples(const WaveformSegment &t_segment) const {
+            return Span<const int16_t>(m_samples.data() + t_segment.offset, t_segment.length);
+        }
+
+        ///
+        /// Build a TH1D of a single channel. Samples outside the segments are 0. Only meant for writing ROOT output.
+        ///
+        std::unique_ptr<TH1D> makeChannelHisto(
+                const std::string &t_name,
+                const unsigned t_channel) const;
+
+
+    private:
+
+        ///
+        /// Number of channels.
+        ///
+        unsigned m_nChannels;
+
+        ///
+        /// Number of samples per channel of the original plane.
+        ///
+        unsigned m_nSamples;
+
+        ///
+        /// Index of the first segment of each channel in m_segments, plus the total number of segments at the end.
+        ///
+        std::vector<unsigned> m_channelSegments;
+
+        ///
+        /// Segments of all channels, channel after channel.
+        ///
+        std::vector<WaveformSegment> m_segments;
+
+        ///
+        /// Samples of all segments.
+        ///
+        std::vector<int16_t> m_samples;
+    };
+
+
+    ///
+    /// Zero-suppressed waveforms of a single event.
+    /// Counterpart of EventWaveforms holding a SparsePlane for the pixels and one for the ROIs. The thresholds are the
+    /// peak thresholds of the noise model of the event. Pixel segments are padded by discRange on both sides. ROI segments are padded
+    /// by discRange before and by 3 * discRange after the seeds for bipolar ROI hits, as the hit finder follows the
+    /// negative lobe up to that far. If the matched-filtered pixel plane of ChargeData::computePixelSeeds() is given,
+    /// the pixel seeds are taken from it with the seed thresholds of the noise model.
+    ///
+    class SparseWaveforms {
+    public:
+
+        ///
+        /// Constructor zero suppressing the waveforms of an event.
+        ///
+        SparseWaveforms(
+                const EventWaveforms &t_waveforms,
+                const NoiseModel &t_noiseModel,
+                const RunParams &t_runParams,
+                const bool t_bipolarRoiHits,
+                const PlaneWaveforms *const t_pixelSeedPlane = nullptr) :
+                m_eventId(t_waveforms.getEventId()),
+                m_bipolarRoiHits(t_bipolarRoiHits),
+                m_pixelPlane(t_waveforms.getPixelPlane(),
+                             t_pixelSeedPlane ? t_noiseModel.getPixelSeedNoise() : t_noiseModel.getPixelNoise(),
+                             t_runParams.getDiscRange(),
+                             t_runParams.getDiscRange(),
+                             t_pixelSeedPlane),
+                m_roiPlane(t_waveforms.getRoiPlane(),
+                           t_noiseModel.getRoiNoise(),
+                           t_runParams.getDiscRange(),
+                           (t_bipolarRoiHits ? 3 : 1) * t_runParams.getDiscRange()) {
+        }
+
+        ///
+        /// Get the event ID.
+        ///
+        unsigned getEventId() const {
+            return m_eventId;
+        }
+
+        ///
+        /// Check whether the ROI segments were padded for bipolar ROI hits.
+        ///
+        bool getBipolarRoiHits() const {
+            return m_bipolarRoiHits;
+        }
+
+        ///
+        /// Get the zero-suppressed pixel plane.
+        ///
+        const SparsePlane &getPixelPlane() const {
+            return m_pixelPlane;
+        }
+
+        ///
+        /// Get the zero-suppressed ROI plane.
+        ///
+        const SparsePlane &getRoiPlane() const {
+            return m_roiPlane;
+        }
+
+
+    private:
+
+        ///
+        /// Event ID.
+        ///
+        unsigned m_eventId;
+
+        ///
+        /// Whether the ROI segments were padded for bipolar ROI hits.
+        ///
+        bool m_bipolarRoiHits;
+
+        ///
+        /// Zero-suppressed pixel waveforms.
+        ///
+        SparsePlane m_pixelPlane;
+
+        ///
+        /// Zero-suppressed ROI waveforms.
+        ///
+        SparsePlane m_roiPlane;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_SPARSEWAVEFORMS_H
@@ -0,0 +1,124 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#ifndef PIXY_ROIMUX_THREADPOOL_H
+#define PIXY_ROIMUX_THREADPOOL_H
+
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace pixy_roimux {
+    ///
+    /// Fixed pool of threads running batches of independent tasks.
+    /// run() hands out the task indices of a batch one by one to the background threads and the calling thread and
+    /// returns once all tasks are done. Each task gets the index of the worker running it, so workers can keep their
+    /// own scratch buffers and statistics. Which worker runs a task is not deterministic, callers must store the
+    /// results by task index to get the same output for any number of threads.
+    ///
+    class ThreadPool {
+    public:
+
+        ///
+        /// Constructor starting t_nThreads - 1 background threads. With 0 or 1 threads, run() runs all tasks on the
+        /// calling thread.
+        ///
+        explicit ThreadPool(const unsigned t_nThreads);
+
+        ///
+        /// Destructor stopping and joining the background threads.
+        ///
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        ///
+        /// Get the number of workers, i.e. the background threads and the calling thread. Worker indices passed to the
+        /// tasks are below this number.
+        ///
+        unsigned getNWorkers() const {
+            return static_cast<unsigned>(m_threads.size()) + 1;
+        }
+
+        ///
+        /// Run t_task(task, worker) for all tasks in [0, t_nTasks). Blocks until all tasks are done.
+        ///
+        void run(
+                const unsigned t_nTasks,
+                const std::function<void(unsigned, unsigned)> &t_task);
+
+
+    private:
+
+        ///
+        /// Loop run by each background thread.
+        ///
+        void workLoop(const unsigned t_worker);
+
+        ///
+        /// Run tasks of the current batch until there are none left.
+        ///
+        void work(const unsigned t_worker);
+
+        ///
+        /// Background threads.
+        ///
+        std::vector<std::thread> m_threads;
+
+        ///
+        /// Index of the next task of the current batch to hand out.
+        ///
+        std::atomic<unsigned> m_nextTask{0};
+
+        ///
+        /// Mutex protecting everything below.
+        ///
+        std::mutex m_mutex;
+
+        ///
+        /// Signalled when a batch starts or the pool stops.
+        ///
+        std::condition_variable m_started;
+
+        ///
+        /// Signalled when a background thread finished its share of a batch.
+        ///
+        std::condition_variable m_finished;
+
+        ///
+        /// Task of the current batch.
+        ///
+        const std::function<void(unsigned, unsigned)> *m_task = nullptr;
+
+        ///
+        /// Number of tasks of the current batch.
+        ///
+        unsigned m_nTasks = 0;
+
+        ///
+        /// Number of batches started, so the background threads notice a new one.
+        ///
+        unsigned long m_nBatches = 0;
+
+        ///
+        /// Number of background threads still working on the current batch.
+        ///
+        unsigned m_nBusy = 0;
+
+        ///
+        /// Set to stop the background threads.
+        ///
+        bool m_stop = false;
+    };
+}
+
+
+#endif //PIXY_ROIMUX_THREADPOOL_H
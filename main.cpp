@@ -1,160 +1,118 @@
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "TFile.h"
-#include "TTree.h"
+#include "TFileMerger.h"
+#include "ChannelStatus.h"
 #include "ChargeData.h"
 #include "ChargeHits.h"
+#include "EventReader.h"
+#include "EventSelection.h"
+#include "HitDiagnostics.h"
+#include "MatchedFilter.h"
 #include "NoiseFilter.h"
+#include "NoiseValidationStats.h"
+#include "FrequencyFilter.h"
+#include "PedestalDatabase.h"
+#include "RoiDeconvolution.h"
 #include "PrincipalComponentsCluster.h"
+#include "PulseTemplateFit.h"
 #include "RunParams.h"
 #include "KalmanFit.h"
 
 
-int main(int argc, char** argv) {
-    
-    ///Start time point for timer.
-    auto clkStart = std::chrono::high_resolution_clock::now();
-    
-    ///Handle Runtime Arguments
-    if (argc < 7) {
-        std::cerr << "Usage: " << argv[0] << " runParamsFileName dataFileName rankingFileName geoFileName genfitTreeFileName csvBaseFileName [minRanking] [maxRanking]" << std::endl;
-        exit(1);
-    }
-    const std::string runParamsFileName = std::string(argv[1]);
-    const std::string dataFileName = std::string(argv[2]);
-    const std::string rankingFileName = std::string(argv[3]);
-    const std::string geoFileName = std::string(argv[4]);
-    const std::string genfitTreeFileName = std::string(argv[5]);
-    const std::string csvBaseFileName = std::string(argv[6]);
-    int minRanking = 4;
-    if (argc > 7) {
-        minRanking = std::stoi(argv[7]);
-    }
-    int maxRanking = 4;
-    if (argc > 8) {
-        maxRanking = std::stoi(argv[8]);
-    }
-    const unsigned subrunId = 0;
+///
+/// Statistics accumulated over all processed events for the stats file.
+///
+struct RunStats {
+    unsigned long nEvents = 0;
+    unsigned nHitCandidates = 0;
+    unsigned nAmbiguities = 0;
+    unsigned nUnmatchedPixelHits = 0;
+    double roiHitTime = 0.;
+    pixy_roimux::NoiseValidationStats noiseValidation;
+};
 
-    ///Get Ranking TTree from ROOT input file
-    TFile rankingFile(rankingFileName.c_str(), "READ");
-    if (!rankingFile.IsOpen()) {
-        std::cerr << "ERROR: Failed to open ranking file " << rankingFileName << '!' << std::endl;
-        exit(1);
-    }
-    TTree* rankingTree = nullptr;
-    rankingFile.GetObject("RankingTime", rankingTree);
-    if (!rankingTree) {
-        std::cerr << "ERROR: Failed to find \"RankingTime\" tree in ranking file " << rankingFileName << '!' << std::endl;
-        exit(1);
-    }
-    
-    ///Set ranking branch address to store variable 'ranking'
-    ///Ranking has to meet a standard to be considered, if yes, push into eventIds vector
-    int ranking;
-    rankingTree->SetBranchAddress("Ranking", &ranking);
-    std::vector<unsigned> eventIds;
-    for (unsigned event = 0; event < rankingTree->GetEntries(); ++event) {
-        rankingTree->GetEvent(event);
-        if ((ranking >= minRanking) && (ranking <= maxRanking)) {
-            eventIds.push_back(event);
-        }
-    }
-    rankingFile.Close();
 
-    ///Create the pixy runParams containing all the needed run parameters.
-    const pixy_roimux::RunParams runParams(runParamsFileName);
-	
-    for (int i = 0; i < eventIds.size(); i++) {
-    	std::cout << "Accepted Event #" << eventIds.at(i) << std::endl;
-    }
+///
+/// Output files of one run of the pipeline.
+///
+struct OutputFiles {
+    std::string genfitTreeFileName;
+    std::string csvBaseFileName;
+    std::string unfilteredFileName;
+    std::string filteredFileName;
+    std::string resultsFileName;
+    // Shard files for the pedestal database and the channel status map of a worker. If empty, both are saved directly.
+    std::string pedestalShardFileName;
+    std::string channelStatusShardFileName;
+};
 
-    // Load events directly from ROOT file.
-    std::cout << "Extracting chargeData...\n";
-    pixy_roimux::ChargeData chargeData(dataFileName, eventIds, subrunId, runParams);
-
-    // Write unfiltered histograms to a root file
-    std::cout << "Writing readout histos to UnfilteredHistograms\n";
-    TFile UnfilteredData("../data/UnfilteredHistograms.root", "RECREATE");
-    auto eventId = chargeData.getEventIds().cbegin();
-    for (auto &&histos : chargeData.getReadoutHistos()) {
-	///Pixels
-	for (int channel = 0; channel < histos.first.GetNbinsY(); channel++) {
-		std::string channelName;
-		channelName = "Event" + std::to_string(*eventId) + "_PixelChannel" + std::to_string(channel);
-		auto channelHisto = histos.first.ProjectionX(channelName.c_str(), (channel + 1), (channel + 1));
-		channelHisto->Write();
-	}
-        for (int channel = 0; channel < histos.second.GetNbinsY(); channel++) {
-                std::string channelName;
-                channelName = "Event" + std::to_string(*eventId) + "_ROIChannel" + std::to_string(channel);
-                auto channelHisto = histos.second.ProjectionX(channelName.c_str(), (channel + 1), (channel + 1));
-                channelHisto->Write();
-        }
-
-	eventId++;
-    
-    }
-    UnfilteredData.Close();
-
-    // Noise filter
-    std::cout << "Filtering chargeData...\n";
-    pixy_roimux::NoiseFilter noiseFilter;
-    noiseFilter.filterData(chargeData);
 
-    // Write filtered histograms to a root file
-    std::cout << "Writing readout histos to FilteredHistograms\n";
-    TFile FilteredData("../data/FilteredHistograms.root", "RECREATE");
-    eventId = chargeData.getEventIds().cbegin();
-    for (auto &&histos : chargeData.getReadoutHistos()) {
+///
+/// Write the waveform of every channel of every event to an open ROOT file as a TH1D.
+///
+template <typename Waveforms>
+void writeChannelHistos(
+        TFile &t_rootFile,
+        const std::vector<Waveforms> &t_waveforms) {
+    // Other files may have been opened in the meantime, so make sure we write to the right one.
+    t_rootFile.cd();
+    for (const auto &waveforms : t_waveforms) {
+        const std::string eventName = "Event" + std::to_string(waveforms.getEventId());
         ///Pixels
-        for (int channel = 0; channel < histos.first.GetNbinsY(); channel++) {
-                std::string channelName;
-                channelName = "Event" + std::to_string(*eventId) + "_PixelChannel" + std::to_string(channel);
-                auto channelHisto = histos.first.ProjectionX(channelName.c_str(), (channel + 1), (channel + 1));
-                channelHisto->Write();
+        const auto &pixelPlane = waveforms.getPixelPlane();
+        for (unsigned channel = 0; channel < pixelPlane.getNChannels(); ++channel) {
+            const std::string channelName = eventName + "_PixelChannel" + std::to_string(channel);
+            pixelPlane.makeChannelHisto(channelName, channel)->Write();
         }
-        for (int channel = 0; channel < histos.second.GetNbinsY(); channel++) {
-                std::string channelName;
-                channelName = "Event" + std::to_string(*eventId) + "_ROIChannel" + std::to_string(channel);
-                auto channelHisto = histos.second.ProjectionX(channelName.c_str(), (channel + 1), (channel + 1));
-                channelHisto->Write();
+        ///ROIs
+        const auto &roiPlane = waveforms.getRoiPlane();
+        for (unsigned channel = 0; channel < roiPlane.getNChannels(); ++channel) {
+            const std::string channelName = eventName + "_ROIChannel" + std::to_string(channel);
+            roiPlane.makeChannelHisto(channelName, channel)->Write();
         }
-
-        eventId++;
-    
     }
-    FilteredData.Close();
+}
 
-    // Find the chargeHits.
-    std::cout << "Initialising hit finder...\n";
-    pixy_roimux::ChargeHits chargeHits(chargeData, runParams);
-    // Set up TSpectrum.
-    std::cout << "Running hit finder...\n";
-    chargeHits.findHits();
 
-    std::cout << "Initialising principle components analysis...\n";
-    pixy_roimux::PrincipalComponentsCluster principalComponentsCluster(runParams);
-    std::cout << "Running principle components analysis...\n";
-    principalComponentsCluster.analyseEvents(chargeHits);
+///
+/// Write the waveforms of all events to an open ROOT file. Zero-suppressed events only contain the segments.
+///
+void writeChannelHistos(
+        TFile &t_rootFile,
+        const pixy_roimux::ChargeData &t_chargeData) {
+    if (t_chargeData.isZeroSuppressed()) {
+        writeChannelHistos(t_rootFile, t_chargeData.getSparseWaveforms());
+    }
+    else {
+        writeChannelHistos(t_rootFile, t_chargeData.getWaveforms());
+    }
+}
 
-    std::cout << "Initialising Kalman Fitter...\n";
-    pixy_roimux::KalmanFit kalmanFit(runParams, geoFileName, true);
-    std::cout << "Running Kalman Fitter...\n";
-    kalmanFit.fit(chargeHits, genfitTreeFileName);
 
-    // Write chargeHits of events in eventIds vector to CSV files so we can plot them with viper3Dplot.py afterwards.
-    unsigned nHitCandidates = 0;
-    unsigned nAmbiguities = 0;
-    unsigned nUnmatchedPixelHits = 0;
+///
+/// Write the hits and principal components of every event to CSV files so we can plot them with viper3Dplot.py
+/// afterwards, and add the events to the run statistics.
+///
+void writeEvents(
+        const pixy_roimux::ChargeHits &t_chargeHits,
+        const std::string &t_csvBaseFileName,
+        RunStats &t_stats) {
     // Loop through events.
-    for (const auto& event : chargeHits.getEvents()) {
+    for (const auto& event : t_chargeHits.getEvents()) {
         std::cout << "Writing event number " << event.eventId << " to file...\n";
         // Compose CSV filename and open file stream.
-        const std::string csvEventBaseFileName = csvBaseFileName + "_event" + std::to_string(event.eventId);
+        const std::string csvEventBaseFileName = t_csvBaseFileName + "_event" + std::to_string(event.eventId);
         const std::string csvHitsFileName = csvEventBaseFileName + "_hits.csv";
         std::ofstream csvHitsFile(csvHitsFileName, std::ofstream::out);
         csvHitsFile << "X,Y,Z,Q,A" << std::endl;
@@ -200,28 +158,495 @@ int main(int argc, char** argv) {
         // Loop over all pixel chargeHits using the pixel to ROI hit runParams.
         for (const auto &candidateRoiHitIds : event.pixel2roi) {
             // Add number of ROI hit candidates for current pixel hit.
-            nHitCandidates += candidateRoiHitIds.size();
+            t_stats.nHitCandidates += candidateRoiHitIds.size();
             // If there's no ROI hit candidates, increment the unmatched counter.
             if (candidateRoiHitIds.empty()) {
-                ++nUnmatchedPixelHits;
+                ++t_stats.nUnmatchedPixelHits;
             }
                 // If there's more than one ROI hit candidate, increment the ambiguity counter.
             else if (candidateRoiHitIds.size() > 1) {
-                ++nAmbiguities;
+                ++t_stats.nAmbiguities;
             }
         }
+        ++t_stats.nEvents;
+    }
+}
+
+
+///
+/// Write the noise model of every event to a CSV file next to its hits, so downstream tools don't need to estimate the
+/// noise again.
+///
+void writeNoiseModels(
+        const pixy_roimux::ChargeData &t_chargeData,
+        const std::string &t_csvBaseFileName) {
+    for (const auto &noiseModel : t_chargeData.getNoiseModels()) {
+        noiseModel.writeCsv(t_csvBaseFileName + "_event" + std::to_string(noiseModel.getEventId()) + "_noise.csv");
+    }
+}
+
+
+///
+/// Run the whole pipeline on the events in t_eventIds and write the results to t_outputFiles. The Kalman fitter is
+/// passed in so the caller can open the event display afterwards. The updated pedestal database and channel status map,
+/// if any, are saved to their files, or to the shard files in t_outputFiles if given.
+///
+RunStats runPipeline(
+        const pixy_roimux::RunParams &t_runParams,
+        const std::string &t_dataFileName,
+        const std::vector<unsigned> &t_eventIds,
+        const unsigned t_subrunId,
+        const OutputFiles &t_outputFiles,
+        pixy_roimux::KalmanFit &t_kalmanFit) {
+    // In streaming mode the events are read, processed, written and released streamWindow events at a time, so the
+    // memory footprint doesn't depend on the number of selected events. Otherwise all events are processed at once.
+    const bool streaming = t_runParams.getStreamWindow() > 0;
+    const unsigned long streamWindow = streaming ? t_runParams.getStreamWindow() : t_eventIds.size();
+
+    // Prefetch events in the background while the current ones are processed.
+    pixy_roimux::EventReader eventReader(t_dataFileName, t_eventIds, t_runParams,
+                                         t_runParams.getReaderThreads(), t_runParams.getReaderQueueSize());
+
+    std::cout << "Initialising noise filter...\n";
+    pixy_roimux::NoiseFilter noiseFilter;
+    noiseFilter.setNoiseEstimator(t_runParams.getNoiseEstimator());
+    noiseFilter.setCommonModeKernel(t_runParams.getCommonModeKernel());
+    // Running pedestal estimates, warm started from previous runs.
+    std::unique_ptr<pixy_roimux::PedestalDatabase> pedestals;
+    if (!t_runParams.getPedestalDatabase().empty()) {
+        pedestals = std::unique_ptr<pixy_roimux::PedestalDatabase>(new pixy_roimux::PedestalDatabase(t_runParams));
+        noiseFilter.setPedestalDatabase(pedestals.get());
+    }
+    // Dead, noisy and stuck channels, persisted per run.
+    std::unique_ptr<pixy_roimux::ChannelStatus> channelStatus;
+    if (t_runParams.getChannelMasking()) {
+        channelStatus = std::unique_ptr<pixy_roimux::ChannelStatus>(new pixy_roimux::ChannelStatus(t_runParams));
+        noiseFilter.setChannelStatus(channelStatus.get());
+    }
+    // Optional notch and low-pass filter against narrow-band pickup.
+    std::unique_ptr<pixy_roimux::FrequencyFilter> frequencyFilter;
+    if (t_runParams.getFrequencyFilter()) {
+        frequencyFilter = std::unique_ptr<pixy_roimux::FrequencyFilter>(new pixy_roimux::FrequencyFilter(t_runParams));
+        noiseFilter.setFrequencyFilter(frequencyFilter.get());
+    }
+    // Optional deconvolution of the ROI waveforms. The ROI hits are unipolar afterwards.
+    std::unique_ptr<pixy_roimux::RoiDeconvolution> roiDeconvolution;
+    if (t_runParams.getRoiDeconvolution()) {
+        roiDeconvolution = std::unique_ptr<pixy_roimux::RoiDeconvolution>(
+                new pixy_roimux::RoiDeconvolution(t_runParams));
+        noiseFilter.setRoiDeconvolution(roiDeconvolution.get());
+    }
+    // Optional matched filter of the pixel waveforms. Only used to seed the pixel hits.
+    std::unique_ptr<pixy_roimux::MatchedFilter> matchedFilter;
+    if (t_runParams.getPixelMatchedFilter()) {
+        matchedFilter = std::unique_ptr<pixy_roimux::MatchedFilter>(new pixy_roimux::MatchedFilter(t_runParams));
+    }
+    // Optional template fit of the pixel pulses for sub-sample timing.
+    std::unique_ptr<pixy_roimux::PulseTemplateFit> pulseTemplateFit;
+    if (t_runParams.getPulseTemplateFit()) {
+        pulseTemplateFit = std::unique_ptr<pixy_roimux::PulseTemplateFit>(
+                new pixy_roimux::PulseTemplateFit(t_runParams));
+    }
+    const bool bipolarRoiHits = !t_runParams.getRoiDeconvolution();
+    std::cout << "Initialising principle components analysis...\n";
+    pixy_roimux::PrincipalComponentsCluster principalComponentsCluster(t_runParams);
+    t_kalmanFit.openTree(t_outputFiles.genfitTreeFileName);
+    pixy_roimux::HitDiagnostics hitDiagnostics;
+    RunStats stats;
+
+    // Files for the unfiltered and filtered readout histograms.
+    TFile unfilteredData(t_outputFiles.unfilteredFileName.c_str(), "RECREATE");
+    TFile filteredData(t_outputFiles.filteredFileName.c_str(), "RECREATE");
+
+    for (unsigned long windowStart = 0; windowStart < t_eventIds.size(); windowStart += streamWindow) {
+        const unsigned long windowStop = std::min(windowStart + streamWindow, static_cast<unsigned long>(t_eventIds.size()));
+
+        // Get the events of this window from the reader.
+        std::cout << "Extracting chargeData...\n";
+        std::vector<pixy_roimux::EventWaveforms> windowWaveforms(windowStop - windowStart);
+        for (auto &&waveforms : windowWaveforms) {
+            eventReader.next(waveforms);
+        }
+        pixy_roimux::ChargeData chargeData(std::move(windowWaveforms), t_subrunId, t_runParams);
+
+        // Write unfiltered histograms to a root file
+        std::cout << "Writing readout histos to UnfilteredHistograms\n";
+        writeChannelHistos(unfilteredData, chargeData);
+
+        // Noise filter
+        std::cout << "Filtering chargeData...\n";
+        noiseFilter.filterData(chargeData);
+
+        // Seed the pixel hits from the matched-filtered pixel waveforms.
+        if (matchedFilter) {
+            std::cout << "Matched filtering pixel chargeData...\n";
+            chargeData.computePixelSeeds(*matchedFilter, channelStatus.get());
+        }
+
+        // Keep only the samples around the pulses from here on.
+        if (t_runParams.getZeroSuppress()) {
+            std::cout << "Zero suppressing chargeData...\n";
+            chargeData.zeroSuppress(bipolarRoiHits);
+        }
+
+        // Write filtered histograms to a root file
+        std::cout << "Writing readout histos to FilteredHistograms\n";
+        writeChannelHistos(filteredData, chargeData);
+
+        // Keep only the compressed waveforms from here on, the hit finder decodes them channel by channel.
+        if (t_runParams.getCompressWaveforms() && !chargeData.isZeroSuppressed()) {
+            chargeData.compress();
+        }
+
+        // Find the chargeHits.
+        std::cout << "Initialising hit finder...\n";
+        pixy_roimux::ChargeHits chargeHits(chargeData, t_runParams, hitDiagnostics);
+        chargeHits.setPulseTemplateFit(pulseTemplateFit.get());
+        std::cout << "Running hit finder...\n";
+        chargeHits.findHits(bipolarRoiHits);
+        stats.roiHitTime += chargeHits.getRoiHitTime().count();
+        if (channelStatus) {
+            channelStatus->addSkippedHitChannels(chargeHits.getNMaskedChannels());
+        }
+
+        std::cout << "Running principle components analysis...\n";
+        principalComponentsCluster.analyseEvents(chargeHits);
+
+        std::cout << "Running Kalman Fitter...\n";
+        t_kalmanFit.fitEvents(chargeHits);
+
+        // Write chargeHits of events in t_eventIds vector to CSV files so we can plot them with viper3Dplot.py afterwards.
+        writeEvents(chargeHits, t_outputFiles.csvBaseFileName, stats);
+        writeNoiseModels(chargeData, t_outputFiles.csvBaseFileName);
+        for (const auto &noiseModel : chargeData.getNoiseModels()) {
+            stats.noiseValidation.add(noiseModel.getValidationStats());
+        }
+    }
+
+    eventReader.printStats();
+    stats.noiseValidation.add(noiseFilter.getValidationStats());
+    if (frequencyFilter) {
+        frequencyFilter->printStats();
+    }
+    if (roiDeconvolution) {
+        roiDeconvolution->printStats();
+    }
+    if (matchedFilter) {
+        matchedFilter->printStats();
+    }
+    if (pulseTemplateFit) {
+        pulseTemplateFit->printStats();
+    }
+    if (pedestals) {
+        pedestals->printStats();
+        if (t_outputFiles.pedestalShardFileName.empty()) {
+            pedestals->save();
+        }
+        else {
+            pedestals->saveShard(t_outputFiles.pedestalShardFileName);
+        }
+    }
+    if (channelStatus) {
+        channelStatus->printStats();
+        if (t_outputFiles.channelStatusShardFileName.empty()) {
+            channelStatus->save();
+        }
+        else {
+            channelStatus->saveShard(t_outputFiles.channelStatusShardFileName);
+        }
     }
-    unsigned long nEvents = chargeHits.getEvents().size();
-    float averageHitCandidates = static_cast<float>(nHitCandidates) / static_cast<float>(nEvents);
-    float averageAmbiguities = static_cast<float>(nAmbiguities) / static_cast<float>(nEvents);
-    float averageUnmatchedPixelHits = static_cast<float>(nUnmatchedPixelHits) / static_cast<float>(nEvents);
-    const std::string statsFileName = csvBaseFileName + "_stats.txt";
+    unfilteredData.Close();
+    filteredData.Close();
+    t_kalmanFit.closeTree();
+    hitDiagnostics.write(t_outputFiles.resultsFileName);
+
+    return stats;
+}
+
+
+///
+/// Write the averages of the run statistics to the stats file.
+///
+void writeStats(
+        const RunStats &t_stats,
+        const std::string &t_csvBaseFileName,
+        const bool t_roiDeconvolution) {
+    const unsigned long nEvents = t_stats.nEvents;
+    float averageHitCandidates = static_cast<float>(t_stats.nHitCandidates) / static_cast<float>(nEvents);
+    float averageAmbiguities = static_cast<float>(t_stats.nAmbiguities) / static_cast<float>(nEvents);
+    float averageUnmatchedPixelHits = static_cast<float>(t_stats.nUnmatchedPixelHits) / static_cast<float>(nEvents);
+    const std::string statsFileName = t_csvBaseFileName + "_stats.txt";
     std::ofstream statsFile(statsFileName, std::ofstream::out);
     statsFile << "Number of events processed: " << nEvents << std::endl;
     statsFile << "Average number of hit candidates per event: " << averageHitCandidates << std::endl;
     statsFile << "Average number of ambiguities per event: " << averageAmbiguities << std::endl;
     statsFile << "Average number of unmatched pixel chargeHits per event: " << averageUnmatchedPixelHits << std::endl;
+    // Compare these with and without the ROI deconvolution.
+    statsFile << "ROI hits: " << (t_roiDeconvolution ? "unipolar (deconvolved)" : "bipolar") << std::endl;
+    statsFile << "Average ROI hit finding time per event: " << t_stats.roiHitTime * 1e6 / nEvents << " us" << std::endl;
     statsFile.close();
+}
+
+
+///
+/// Insert the shard number into a file name, before the extension if there is one.
+///
+std::string shardFileName(
+        const std::string &t_fileName,
+        const unsigned t_shard) {
+    const std::string shardSuffix = "_shard" + std::to_string(t_shard);
+    const auto extension = t_fileName.find_last_of('.');
+    const auto directory = t_fileName.find_last_of('/');
+    if ((extension == std::string::npos) || ((directory != std::string::npos) && (extension < directory))) {
+        return t_fileName + shardSuffix;
+    }
+    return t_fileName.substr(0, extension) + shardSuffix + t_fileName.substr(extension);
+}
+
+
+///
+/// Merge the pedestal database and channel status shards of the workers into their files. The shards are added in shard
+/// order, so later events take precedence as in a single process run. If a shard is missing, the file is left as it was.
+///
+void mergeDatabases(
+        const pixy_roimux::RunParams &t_runParams,
+        const std::vector<OutputFiles> &t_shardOutputFiles) {
+    if (!t_runParams.getPedestalDatabase().empty()) {
+        pixy_roimux::PedestalDatabase pedestals(t_runParams);
+        bool complete = true;
+        for (const auto &outputFiles : t_shardOutputFiles) {
+            complete = pedestals.addShard(outputFiles.pedestalShardFileName) && complete;
+        }
+        if (complete) {
+            pedestals.save();
+        }
+        else {
+            std::cerr << "WARNING: Missing pedestal database shards, not updating "
+                      << t_runParams.getPedestalDatabase() << '.' << std::endl;
+        }
+    }
+    if (t_runParams.getChannelMasking() && !t_runParams.getChannelStatusFile().empty()) {
+        pixy_roimux::ChannelStatus channelStatus(t_runParams);
+        bool complete = true;
+        for (const auto &outputFiles : t_shardOutputFiles) {
+            complete = channelStatus.addShard(outputFiles.channelStatusShardFileName) && complete;
+        }
+        if (complete) {
+            channelStatus.save();
+        }
+        else {
+            std::cerr << "WARNING: Missing channel status shards, not updating " << t_runParams.getChannelStatusFile()
+                      << '.' << std::endl;
+        }
+    }
+}
+
+
+///
+/// Split the events into contiguous shards, run the pipeline on each shard in a forked worker process and merge the
+/// outputs of the workers into t_outputFiles. As the shards are merged in order, the merged files are the same as those
+/// of a single process run. The per-event CSV files are written by the workers directly. The pedestal database and the
+/// channel status map are saved by each worker to a shard file and merged into their files in shard order as well.
+///
+RunStats runSharded(
+        const pixy_roimux::RunParams &t_runParams,
+        const std::string &t_dataFileName,
+        const std::string &t_geoFileName,
+        const std::vector<unsigned> &t_eventIds,
+        const unsigned t_subrunId,
+        const OutputFiles &t_outputFiles,
+        const unsigned t_nWorkers) {
+    const unsigned long nShards = std::min(static_cast<unsigned long>(t_nWorkers),
+                                           static_cast<unsigned long>(t_eventIds.size()));
+    std::vector<OutputFiles> shardOutputFiles(nShards);
+    std::vector<std::string> shardStatsFileNames(nShards);
+    std::vector<pid_t> workers;
+    // Don't let the workers inherit unflushed output.
+    std::cout.flush();
+    std::cerr.flush();
+    for (unsigned shard = 0; shard < nShards; ++shard) {
+        const unsigned long shardStart = (t_eventIds.size() * shard) / nShards;
+        const unsigned long shardStop = (t_eventIds.size() * (shard + 1)) / nShards;
+        OutputFiles &outputFiles = shardOutputFiles.at(shard);
+        outputFiles.genfitTreeFileName = shardFileName(t_outputFiles.genfitTreeFileName, shard);
+        outputFiles.csvBaseFileName = t_outputFiles.csvBaseFileName;
+        outputFiles.unfilteredFileName = shardFileName(t_outputFiles.unfilteredFileName, shard);
+        outputFiles.filteredFileName = shardFileName(t_outputFiles.filteredFileName, shard);
+        outputFiles.resultsFileName = shardFileName(t_outputFiles.resultsFileName, shard);
+        if (!t_runParams.getPedestalDatabase().empty()) {
+            outputFiles.pedestalShardFileName = shardFileName(t_runParams.getPedestalDatabase(), shard);
+        }
+        if (t_runParams.getChannelMasking() && !t_runParams.getChannelStatusFile().empty()) {
+            outputFiles.channelStatusShardFileName = shardFileName(t_runParams.getChannelStatusFile(), shard);
+        }
+        shardStatsFileNames.at(shard) = shardFileName(t_outputFiles.csvBaseFileName + "_counts.txt", shard);
+        const pid_t pid = fork();
+        if (pid < 0) {
+            std::cerr << "ERROR: Failed to fork worker process for shard " << shard << '!' << std::endl;
+            exit(1);
+        }
+        if (pid == 0) {
+            // Worker process. Each one has its own copy of the genfit and ROOT global state.
+            const std::vector<unsigned> shardEventIds(t_eventIds.cbegin() + shardStart,
+                                                      t_eventIds.cbegin() + shardStop);
+            std::cout << "Initialising Kalman Fitter...\n";
+            pixy_roimux::KalmanFit kalmanFit(t_runParams, t_geoFileName, false);
+            const RunStats stats = runPipeline(t_runParams, t_dataFileName, shardEventIds, t_subrunId, outputFiles,
+                                               kalmanFit);
+            std::ofstream statsFile(shardStatsFileNames.at(shard), std::ofstream::out);
+            const pixy_roimux::NoiseValidationStats &validation = stats.noiseValidation;
+            statsFile.precision(17);
+            statsFile << stats.nEvents << ' ' << stats.nHitCandidates << ' ' << stats.nAmbiguities << ' '
+                      << stats.nUnmatchedPixelHits << ' ' << stats.roiHitTime << ' ' << validation.nChannels << ' '
+                      << validation.sumMeanDev << ' ' << validation.maxMeanDev << ' ' << validation.sumSigmaDev << ' '
+                      << validation.maxSigmaDev << ' ' << validation.fitTime.count() << ' '
+                      << validation.fastTime.count() << std::endl;
+            statsFile.close();
+            // All output files of the worker are closed by now. Leave without running the static destructors and exit
+            // handlers inherited from the driver, i.e. the ROOT and genfit global cleanup.
+            std::cout.flush();
+            std::cerr.flush();
+            std::fflush(nullptr);
+            _exit(statsFile ? 0 : 1);
+        }
+        workers.push_back(pid);
+    }
+
+    // Wait for all workers.
+    bool failed = false;
+    for (unsigned shard = 0; shard < workers.size(); ++shard) {
+        int status;
+        if ((waitpid(workers.at(shard), &status, 0) < 0) || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            std::cerr << "ERROR: Worker process for shard " << shard << " failed!" << std::endl;
+            failed = true;
+        }
+    }
+    if (failed) {
+        exit(1);
+    }
+
+    // Merge the outputs of the workers in shard order.
+    std::cout << "Merging " << nShards << " shards...\n";
+    TFileMerger treeMerger(false);
+    TFileMerger unfilteredMerger(false);
+    TFileMerger filteredMerger(false);
+    treeMerger.OutputFile(t_outputFiles.genfitTreeFileName.c_str(), "RECREATE");
+    unfilteredMerger.OutputFile(t_outputFiles.unfilteredFileName.c_str(), "RECREATE");
+    filteredMerger.OutputFile(t_outputFiles.filteredFileName.c_str(), "RECREATE");
+    pixy_roimux::HitDiagnostics hitDiagnostics;
+    RunStats stats;
+    for (unsigned shard = 0; shard < nShards; ++shard) {
+        const OutputFiles &outputFiles = shardOutputFiles.at(shard);
+        treeMerger.AddFile(outputFiles.genfitTreeFileName.c_str(), false);
+        unfilteredMerger.AddFile(outputFiles.unfilteredFileName.c_str(), false);
+        filteredMerger.AddFile(outputFiles.filteredFileName.c_str(), false);
+        hitDiagnostics.add(outputFiles.resultsFileName);
+        std::ifstream statsFile(shardStatsFileNames.at(shard), std::ifstream::in);
+        RunStats shardStats;
+        pixy_roimux::NoiseValidationStats &validation = shardStats.noiseValidation;
+        double fitTime;
+        double fastTime;
+        statsFile >> shardStats.nEvents >> shardStats.nHitCandidates >> shardStats.nAmbiguities
+                  >> shardStats.nUnmatchedPixelHits >> shardStats.roiHitTime >> validation.nChannels
+                  >> validation.sumMeanDev >> validation.maxMeanDev >> validation.sumSigmaDev >> validation.maxSigmaDev
+                  >> fitTime >> fastTime;
+        validation.fitTime = std::chrono::duration<double>(fitTime);
+        validation.fastTime = std::chrono::duration<double>(fastTime);
+        if (!statsFile) {
+            std::cerr << "ERROR: Failed to read " << shardStatsFileNames.at(shard) << '!' << std::endl;
+            exit(1);
+        }
+        stats.nEvents += shardStats.nEvents;
+        stats.nHitCandidates += shardStats.nHitCandidates;
+        stats.nAmbiguities += shardStats.nAmbiguities;
+        stats.nUnmatchedPixelHits += shardStats.nUnmatchedPixelHits;
+        stats.roiHitTime += shardStats.roiHitTime;
+        stats.noiseValidation.add(shardStats.noiseValidation);
+    }
+    if (!treeMerger.Merge() || !unfilteredMerger.Merge() || !filteredMerger.Merge()) {
+        std::cerr << "ERROR: Failed to merge the shard outputs!" << std::endl;
+        exit(1);
+    }
+    hitDiagnostics.write(t_outputFiles.resultsFileName);
+    mergeDatabases(t_runParams, shardOutputFiles);
+    for (unsigned shard = 0; shard < nShards; ++shard) {
+        const OutputFiles &outputFiles = shardOutputFiles.at(shard);
+        std::remove(outputFiles.genfitTreeFileName.c_str());
+        std::remove(outputFiles.unfilteredFileName.c_str());
+        std::remove(outputFiles.filteredFileName.c_str());
+        std::remove(outputFiles.resultsFileName.c_str());
+        std::remove(shardStatsFileNames.at(shard).c_str());
+        if (!outputFiles.pedestalShardFileName.empty()) {
+            std::remove(outputFiles.pedestalShardFileName.c_str());
+        }
+        if (!outputFiles.channelStatusShardFileName.empty()) {
+            std::remove(outputFiles.channelStatusShardFileName.c_str());
+        }
+    }
+    return stats;
+}
+
+
+int main(int argc, char** argv) {
+    
+    ///Start time point for timer.
+    auto clkStart = std::chrono::high_resolution_clock::now();
+    
+    ///Handle Runtime Arguments
+    if (argc < 7) {
+        std::cerr << "Usage: " << argv[0] << " runParamsFileName dataFileName rankingFileName geoFileName genfitTreeFileName csvBaseFileName [minRanking] [maxRanking]" << std::endl;
+        exit(1);
+    }
+    const std::string runParamsFileName = std::string(argv[1]);
+    const std::string dataFileName = std::string(argv[2]);
+    const std::string rankingFileName = std::string(argv[3]);
+    const std::string geoFileName = std::string(argv[4]);
+    const std::string genfitTreeFileName = std::string(argv[5]);
+    const std::string csvBaseFileName = std::string(argv[6]);
+    int minRanking = 4;
+    if (argc > 7) {
+        minRanking = std::stoi(argv[7]);
+    }
+    int maxRanking = 4;
+    if (argc > 8) {
+        maxRanking = std::stoi(argv[8]);
+    }
+    const unsigned subrunId = 0;
+
+    ///Select the events with minRanking <= ranking <= maxRanking.
+    ///The ranking index is built on the first run and reused as long as the ranking file doesn't change.
+    const pixy_roimux::EventSelection eventSelection(rankingFileName);
+    const std::vector<unsigned> eventIds = eventSelection.select(minRanking, maxRanking);
+
+    ///Create the pixy runParams containing all the needed run parameters.
+    const pixy_roimux::RunParams runParams(runParamsFileName);
+	
+    for (int i = 0; i < eventIds.size(); i++) {
+    	std::cout << "Accepted Event #" << eventIds.at(i) << std::endl;
+    }
+
+    const OutputFiles outputFiles = {genfitTreeFileName, csvBaseFileName, "../data/UnfilteredHistograms.root",
+                                     "../data/FilteredHistograms.root", "../data/Results.root", "", ""};
+    // With more than one worker, the events are split into shards which are processed by forked worker processes.
+    const unsigned nWorkers = runParams.getNWorkers() ? runParams.getNWorkers()
+                                                      : std::max(std::thread::hardware_concurrency(), 1u);
+    const bool sharded = (nWorkers > 1) && (eventIds.size() > 1);
+    // The event display keeps a copy of every fitted track, so it's only used if we don't stream.
+    const bool openDisplay = !sharded && (runParams.getStreamWindow() == 0);
+    std::unique_ptr<pixy_roimux::KalmanFit> kalmanFit;
+    RunStats stats;
+    if (sharded) {
+        stats = runSharded(runParams, dataFileName, geoFileName, eventIds, subrunId, outputFiles, nWorkers);
+    }
+    else {
+        std::cout << "Initialising Kalman Fitter...\n";
+        kalmanFit = std::unique_ptr<pixy_roimux::KalmanFit>(
+                new pixy_roimux::KalmanFit(runParams, geoFileName, openDisplay));
+        stats = runPipeline(runParams, dataFileName, eventIds, subrunId, outputFiles, *kalmanFit);
+    }
+    stats.noiseValidation.print();
+    writeStats(stats, csvBaseFileName, runParams.getRoiDeconvolution());
+    const unsigned long nEvents = stats.nEvents;
 
     std::cout << "Done.\n";
 
@@ -229,10 +654,20 @@ int main(int argc, char** argv) {
     auto clkStop = std::chrono::high_resolution_clock::now();
     // Calculate difference between timer start and stop.
     auto clkDuration = std::chrono::duration_cast<std::chrono::milliseconds>(clkStop - clkStart);
-    std::cout << "Elapsed time for " << chargeHits.getEvents().size() << " processed events is: "
+    std::cout << "Elapsed time for " << nEvents << " processed events is: "
               << clkDuration.count() << "ms\n";
+    // Peak resident set size in kB, should stay flat with the number of events in streaming mode.
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::cout << "Peak resident set size: " << usage.ru_maxrss << " kB\n";
+    if (sharded) {
+        getrusage(RUSAGE_CHILDREN, &usage);
+        std::cout << "Peak resident set size of the largest worker: " << usage.ru_maxrss << " kB\n";
+    }
 
-    kalmanFit.openEventDisplay();
+    if (openDisplay) {
+        kalmanFit->openEventDisplay();
+    }
 
     return 0;
 }
@@ -0,0 +1,129 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "BatchedFft.h"
+
+
+namespace pixy_roimux {
+    BatchedFft::BatchedFft() {
+#if !defined(PIXY_USE_FFTW)
+        std::cerr << "ERROR: pixy was built without FFTW, can't use frequency domain filters!" << std::endl;
+        exit(1);
+#endif
+    }
+
+
+    BatchedFft::~BatchedFft() {
+#if defined(PIXY_USE_FFTW)
+        for (auto &&batch : m_batches) {
+            fftw_destroy_plan(batch.second.forward);
+            fftw_destroy_plan(batch.second.inverse);
+            fftw_free(batch.second.buffer);
+        }
+#endif
+    }
+
+
+    void BatchedFft::load(const PlaneWaveforms &t_plane) {
+        const std::pair<unsigned, unsigned> geometry(t_plane.getNChannels(), t_plane.getNSamples());
+        auto batchItr = m_batches.find(geometry);
+        if (batchItr == m_batches.end()) {
+            const auto planStart = std::chrono::steady_clock::now();
+            Batch &batch = m_batches[geometry];
+            batch.nChannels = geometry.first;
+            batch.nSamples = geometry.second;
+            batch.nBins = getNBins(batch.nSamples);
+#if defined(PIXY_USE_FFTW)
+            const int nSamples = static_cast<int>(batch.nSamples);
+            const int nChannels = static_cast<int>(batch.nChannels);
+            const int realDist = 2 * static_cast<int>(batch.nBins);
+            const int complexDist = static_cast<int>(batch.nBins);
+            batch.buffer = static_cast<double *>(fftw_malloc(sizeof(double) * realDist * batch.nChannels));
+            if (!batch.buffer) {
+                std::cerr << "ERROR: Failed to allocate the FFT buffer!" << std::endl;
+                exit(1);
+            }
+            fftw_complex *const spectra = reinterpret_cast<fftw_complex *>(batch.buffer);
+            // Planning with FFTW_MEASURE overwrites the buffer, which only holds scratch data here.
+            batch.forward = fftw_plan_many_dft_r2c(1, &nSamples, nChannels, batch.buffer, nullptr, 1, realDist,
+                                                   spectra, nullptr, 1, complexDist, FFTW_MEASURE);
+            batch.inverse = fftw_plan_many_dft_c2r(1, &nSamples, nChannels, spectra, nullptr, 1, complexDist,
+                                                   batch.buffer, nullptr, 1, realDist, FFTW_MEASURE);
+            if (!batch.forward || !batch.inverse) {
+                std::cerr << "ERROR: Failed to create the FFT plans!" << std::endl;
+                exit(1);
+            }
+#endif
+            m_planTime += std::chrono::steady_clock::now() - planStart;
+            batchItr = m_batches.find(geometry);
+        }
+        m_batch = &batchItr->second;
+#if defined(PIXY_USE_FFTW)
+        const unsigned realDist = 2 * m_batch->nBins;
+        for (unsigned channel = 0; channel < m_batch->nChannels; ++channel) {
+            const auto samples = t_plane.getChannel(channel);
+            std::copy(samples.begin(), samples.end(), m_batch->buffer + channel * realDist);
+        }
+#endif
+    }
+
+
+    void BatchedFft::forward() {
+#if defined(PIXY_USE_FFTW)
+        fftw_execute(m_batch->forward);
+#endif
+    }
+
+
+    void BatchedFft::multiply(const std::vector<double> &t_filter) {
+#if defined(PIXY_USE_FFTW)
+        fftw_complex *const spectra = reinterpret_cast<fftw_complex *>(m_batch->buffer);
+        for (unsigned channel = 0; channel < m_batch->nChannels; ++channel) {
+            fftw_complex *const spectrum = spectra + channel * m_batch->nBins;
+            for (unsigned bin = 0; bin < m_batch->nBins; ++bin) {
+                spectrum[bin][0] *= t_filter[bin];
+                spectrum[bin][1] *= t_filter[bin];
+            }
+        }
+#endif
+    }
+
+
+    void BatchedFft::multiply(const std::vector<std::complex<double>> &t_filter) {
+#if defined(PIXY_USE_FFTW)
+        // fftw_complex has the same layout as std::complex<double>.
+        std::complex<double> *const spectra = reinterpret_cast<std::complex<double> *>(m_batch->buffer);
+        for (unsigned channel = 0; channel < m_batch->nChannels; ++channel) {
+            std::complex<double> *const spectrum = spectra + channel * m_batch->nBins;
+            for (unsigned bin = 0; bin < m_batch->nBins; ++bin) {
+                spectrum[bin] *= t_filter[bin];
+            }
+        }
+#endif
+    }
+
+
+    void BatchedFft::inverse() {
+#if defined(PIXY_USE_FFTW)
+        fftw_execute(m_batch->inverse);
+#endif
+    }
+
+
+    void BatchedFft::store(PlaneWaveforms &t_plane) const {
+#if defined(PIXY_USE_FFTW)
+        const unsigned realDist = 2 * m_batch->nBins;
+        const double sampleMin = std::numeric_limits<int16_t>::min();
+        const double sampleMax = std::numeric_limits<int16_t>::max();
+        for (unsigned channel = 0; channel < m_batch->nChannels; ++channel) {
+            const double *const filtered = m_batch->buffer + channel * realDist;
+            auto samples = t_plane.getChannel(channel);
+            for (unsigned sample = 0; sample < m_batch->nSamples; ++sample) {
+                samples[sample] = static_cast<int16_t>(std::round(std::min(std::max(filtered[sample], sampleMin),
+                                                                           sampleMax)));
+            }
+        }
+#endif
+    }
+}
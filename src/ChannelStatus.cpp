@@ -0,0 +1,221 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "ChannelStatus.h"
+
+
+namespace pixy_roimux {
+    ChannelStatus::ChannelStatus(const RunParams &t_runParams) :
+            m_fileName(t_runParams.getChannelStatusFile()),
+            m_runId(t_runParams.getRunId()),
+            m_deadSigma(t_runParams.getDeadSigma()),
+            m_noisySigmaFactor(t_runParams.getNoisySigmaFactor()),
+            m_minEvents(std::max(t_runParams.getChannelStatusMinEvents(), 1u)) {
+        if (m_fileName.empty()) {
+            return;
+        }
+        if (load(m_fileName, false)) {
+            std::cout << "Loaded channel status of run " << m_runId << " from " << m_fileName << ", "
+                      << m_nLoadedMasked << " channels masked.\n";
+        }
+        else {
+            std::cout << "Channel status file " << m_fileName << " not found, starting with all channels.\n";
+        }
+    }
+
+
+    void ChannelStatus::update(
+            const PlaneWaveforms &t_plane,
+            const unsigned t_firstChannel,
+            const std::vector<std::pair<double, double>> &t_noiseParams) {
+        // Median noise of the unmasked channels as the reference for noisy ones.
+        std::vector<double> sigmas;
+        sigmas.reserve(t_noiseParams.size());
+        for (unsigned channel = 0; channel < t_plane.getNChannels(); ++channel) {
+            if (!isMasked(t_firstChannel + channel)) {
+                sigmas.push_back(t_noiseParams.at(channel).second);
+            }
+        }
+        if (sigmas.empty()) {
+            return;
+        }
+        std::nth_element(sigmas.begin(), sigmas.begin() + sigmas.size() / 2, sigmas.end());
+        const double medianSigma = sigmas.at(sigmas.size() / 2);
+
+        for (unsigned channel = 0; channel < t_plane.getNChannels(); ++channel) {
+            Channel &status = m_channels[t_firstChannel + channel];
+            if (status.masked) {
+                continue;
+            }
+            const auto samples = t_plane.getChannel(channel);
+            const double sigma = t_noiseParams.at(channel).second;
+            ChannelState state = ChannelState::good;
+            if (std::all_of(samples.begin(), samples.end(), [&](const int16_t t_sample) {
+                return t_sample == samples[0];
+            })) {
+                state = ChannelState::stuck;
+            }
+            else if (sigma < m_deadSigma) {
+                state = ChannelState::dead;
+            }
+            else if (sigma > m_noisySigmaFactor * medianSigma) {
+                state = ChannelState::noisy;
+            }
+            status.nFlagged = ((state != ChannelState::good) && (state == status.state)) ? (status.nFlagged + 1) :
+                              (state != ChannelState::good);
+            status.state = state;
+            if (status.nFlagged >= m_minEvents) {
+                status.masked = true;
+                std::cout << "Masking " << getStateName(state) << " channel " << t_firstChannel + channel << ".\n";
+            }
+        }
+    }
+
+
+    void ChannelStatus::addNoiseTime(
+            const unsigned long t_nChannels,
+            const unsigned long t_nSkipped,
+            const std::chrono::duration<double> t_time) {
+        m_nNoiseChannels += t_nChannels;
+        m_nSkippedNoiseChannels += t_nSkipped;
+        m_noiseTime += t_time;
+    }
+
+
+    void ChannelStatus::save() const {
+        if (m_fileName.empty()) {
+            return;
+        }
+        write(m_fileName, false);
+    }
+
+
+    void ChannelStatus::saveShard(const std::string &t_fileName) const {
+        write(t_fileName, true);
+    }
+
+
+    bool ChannelStatus::addShard(const std::string &t_fileName) {
+        return load(t_fileName, true);
+    }
+
+
+    void ChannelStatus::printStats() const {
+        unsigned long nMasked = 0;
+        for (const auto &channel : m_channels) {
+            if (channel.second.masked) {
+                std::cout << "Channel status: channel " << channel.first << " masked as "
+                          << getStateName(channel.second.state) << ".\n";
+                ++nMasked;
+            }
+        }
+        std::cout << "Channel status: " << nMasked << " channels masked, " << m_nLoadedMasked
+                  << " of them from the status file.\n";
+        if (m_nNoiseChannels) {
+            const double channelTime = m_noiseTime.count() / m_nNoiseChannels;
+            std::cout << "Channel status: skipped " << m_nSkippedNoiseChannels << " noise estimations at "
+                      << channelTime * 1e6 << "us per channel, saving about "
+                      << m_nSkippedNoiseChannels * channelTime * 1e3 << "ms.\n";
+        }
+        std::cout << "Channel status: skipped " << m_nSkippedHitChannels << " channels in the hit finder.\n";
+    }
+
+
+    const char *ChannelStatus::getStateName(const ChannelState t_state) {
+        switch (t_state) {
+            case ChannelState::dead:
+                return "dead";
+            case ChannelState::noisy:
+                return "noisy";
+            case ChannelState::stuck:
+                return "stuck";
+            default:
+                return "good";
+        }
+    }
+
+
+    bool ChannelStatus::load(
+            const std::string &t_fileName,
+            const bool t_shard) {
+        std::ifstream statusFile(t_fileName);
+        if (!statusFile.is_open()) {
+            return false;
+        }
+        std::string line;
+        unsigned long lineNumber = 0;
+        while (std::getline(statusFile, line)) {
+            ++lineNumber;
+            if (line.empty() || (line.front() == '#')) {
+                continue;
+            }
+            std::istringstream lineStream(line);
+            unsigned runId;
+            unsigned channel;
+            std::string state;
+            Channel status;
+            lineStream >> runId >> channel >> state >> status.nFlagged >> status.masked;
+            if (!lineStream ||
+                ((state != "good") && (state != "dead") && (state != "noisy") && (state != "stuck"))) {
+                std::cerr << "ERROR: Malformed line " << lineNumber << " in channel status file " << t_fileName << '!'
+                          << std::endl;
+                exit(1);
+            }
+            if (runId != m_runId) {
+                if (!t_shard) {
+                    m_otherRuns.insert(std::pair<unsigned, std::string>(runId, line));
+                }
+                continue;
+            }
+            status.state = (state == "dead") ? ChannelState::dead :
+                           (state == "noisy") ? ChannelState::noisy :
+                           (state == "stuck") ? ChannelState::stuck : ChannelState::good;
+            if (t_shard) {
+                // A channel masked by an earlier shard stays masked, as it would in a single process.
+                Channel &merged = m_channels[channel];
+                if (!merged.masked) {
+                    merged = status;
+                }
+                continue;
+            }
+            m_channels[channel] = status;
+            m_nLoadedMasked += status.masked;
+        }
+        return true;
+    }
+
+
+    void ChannelStatus::write(
+            const std::string &t_fileName,
+            const bool t_shard) const {
+        // Write to a temporary file first and move it into place, so a crash never leaves a partial map.
+        const std::string tmpFileName = t_fileName + ".tmp";
+        std::ofstream statusFile(tmpFileName, std::ofstream::trunc);
+        if (!statusFile.is_open()) {
+            std::cerr << "WARNING: Failed to write channel status file " << t_fileName << '.' << std::endl;
+            return;
+        }
+        statusFile << "# runId channel state nFlagged masked\n";
+        auto otherRun = m_otherRuns.cbegin();
+        for (; !t_shard && (otherRun != m_otherRuns.cend()) && (otherRun->first < m_runId); ++otherRun) {
+            statusFile << otherRun->second << '\n';
+        }
+        // Good channels are the default, so only flagged ones are written. A shard also has to reset the channels
+        // flagged by earlier shards, so it writes all of them.
+        for (const auto &channel : m_channels) {
+            if (t_shard || (channel.second.state != ChannelState::good)) {
+                statusFile << m_runId << ' ' << channel.first << ' ' << getStateName(channel.second.state) << ' '
+                           << channel.second.nFlagged << ' ' << channel.second.masked << '\n';
+            }
+        }
+        for (; !t_shard && (otherRun != m_otherRuns.cend()); ++otherRun) {
+            statusFile << otherRun->second << '\n';
+        }
+        statusFile.close();
+        if (!statusFile || std::rename(tmpFileName.c_str(), t_fileName.c_str())) {
+            std::cerr << "WARNING: Failed to write channel status file " << t_fileName << '.' << std::endl;
+            std::remove(tmpFileName.c_str());
+        }
+    }
+}
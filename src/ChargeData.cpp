@@ -59,35 +59,28 @@ namespace pixy_roimux {
         m_daqHistos.resize(m_eventIds.size());
         // Open ROOT file read-only.
         TFile rootFile(t_rootFileName.c_str(), "READ");
-        // DAQ histo vector iterator.
-        //daqHisto is a point to the first element of m_daqHistos, will iterate through the vector addresses
-        auto daqHisto = m_daqHistos.begin();
         for (int i = 0; i < m_eventIds.size(); i++) {
 		std::cout << "Event " << m_eventIds.at(i) << std::endl;
 	}
+        // Index the keys once and read the histograms of all events in the order they are stored in the file instead
+        // of seeking back and forth.
+        DaqKeyIndex keyIndex(rootFile);
+        std::cout << "Reading " << m_eventIds.size() << " events...\n";
+        std::vector<std::pair<TH2S *, TH2S *>> histos;
+        keyIndex.read(m_eventIds, histos);
         // Loop over event IDs.
-        for (const auto &eventId : m_eventIds) {
-            // Get the histogram pointers from the ROOT file using the GetObject method which performs basic sanity checks.
-            std::cout << "Reading event number " << eventId << "...\n";
-            std::string histoName;
-            histoName = "Ind_" + std::to_string(eventId);
-            const TH2S *indHisto = nullptr;
-            rootFile.GetObject(histoName.c_str(), indHisto);
-            histoName = "Col_" + std::to_string(eventId);
-            const TH2S *colHisto = nullptr;
-            rootFile.GetObject(histoName.c_str(), colHisto);
+        for (unsigned long eventIdx = 0; eventIdx < m_eventIds.size(); ++eventIdx) {
             // If we got something from the file, add its pointer to the DAQ histo vector.
-            if (indHisto && colHisto) {
-                *daqHisto = std::pair<const TH2S *, const TH2S *>(indHisto, colHisto);
+            if (histos.at(eventIdx).first && histos.at(eventIdx).second) {
+                m_daqHistos.at(eventIdx) = std::pair<const TH2S *, const TH2S *>(histos.at(eventIdx).first,
+                                                                                 histos.at(eventIdx).second);
             }
                 // Else die.
             else {
-                std::cerr << "ERROR: Failed to load event ID " << eventId
+                std::cerr << "ERROR: Failed to load event ID " << m_eventIds.at(eventIdx)
                           << " from file " << t_rootFileName << '!' << std::endl;
                 exit(1);
             }
-            // Increment the DAQ histo vector iterator.
-            ++daqHisto;
         }
 
         // Convert the DAQ histos to readout histos.
@@ -136,68 +129,202 @@ namespace pixy_roimux {
     }
 
 
+    ChargeData::ChargeData(
+            const NativeRawFile &t_nativeFile,
+            const std::vector<unsigned> &t_eventIds,
+            const unsigned t_subrunId,
+            const pixy_roimux::RunParams &t_map) :
+            m_eventIds(t_eventIds),
+            m_subrunId(t_subrunId),
+            m_runParams(t_map) {
+        m_waveforms.reserve(m_eventIds.size());
+        for (const auto &eventId : m_eventIds) {
+            m_waveforms.push_back(t_nativeFile.getEvent(eventId));
+        }
+    }
+
+
+    ChargeData::ChargeData(
+            std::vector<EventWaveforms> &&t_waveforms,
+            const unsigned t_subrunId,
+            const pixy_roimux::RunParams &t_map) :
+            m_subrunId(t_subrunId),
+            m_runParams(t_map),
+            m_waveforms(std::move(t_waveforms)) {
+        // The waveforms are already converted, we only need to collect the event IDs.
+        m_eventIds.reserve(m_waveforms.size());
+        for (const auto &waveforms : m_waveforms) {
+            m_eventIds.push_back(waveforms.getEventId());
+        }
+    }
+
+
+    void ChargeData::computeNoiseModels(
+            PedestalDatabase *const t_pedestals,
+            ChannelStatus *const t_channelStatus) {
+        if (m_compressed || m_zeroSuppressed) {
+            std::cerr << "ERROR: Can only compute the noise models from full waveforms!" << std::endl;
+            exit(1);
+        }
+        m_noiseModels.clear();
+        m_noiseModels.reserve(m_waveforms.size());
+        for (const auto &waveforms : m_waveforms) {
+            m_noiseModels.emplace_back(waveforms, m_runParams, t_pedestals, t_channelStatus);
+        }
+    }
+
+
+    void ChargeData::computePixelSeeds(
+            MatchedFilter &t_filter,
+            ChannelStatus *const t_channelStatus) {
+        if (m_compressed || m_zeroSuppressed) {
+            std::cerr << "ERROR: Can only compute the pixel seeds from full waveforms!" << std::endl;
+            exit(1);
+        }
+        if (m_noiseModels.size() != m_waveforms.size()) {
+            computeNoiseModels(nullptr, t_channelStatus);
+        }
+        m_pixelSeedPlanes.clear();
+        m_pixelSeedPlanes.reserve(m_waveforms.size());
+        for (unsigned long eventIdx = 0; eventIdx < m_waveforms.size(); ++eventIdx) {
+            // The copy owns its samples, so the filter can work in place even on memory-mapped waveforms.
+            m_pixelSeedPlanes.push_back(m_waveforms.at(eventIdx).getPixelPlane());
+            t_filter.filterPlane(m_pixelSeedPlanes.back());
+            m_noiseModels.at(eventIdx).estimatePixelSeedNoise(m_pixelSeedPlanes.back(), m_runParams, t_channelStatus);
+        }
+    }
+
+
+    void ChargeData::compress() {
+        if (m_compressed) {
+            return;
+        }
+        if (m_zeroSuppressed) {
+            std::cerr << "ERROR: Can't compress zero-suppressed waveforms!" << std::endl;
+            exit(1);
+        }
+        // The full waveforms are needed for the noise estimation.
+        if (m_noiseModels.size() != m_waveforms.size()) {
+            computeNoiseModels();
+        }
+        unsigned long rawBytes = 0;
+        unsigned long compressedBytes = 0;
+        m_compressedWaveforms.clear();
+        m_compressedWaveforms.reserve(m_waveforms.size());
+        for (const auto &waveforms : m_waveforms) {
+            for (const PlaneWaveforms *plane : {&waveforms.getPixelPlane(), &waveforms.getRoiPlane()}) {
+                rawBytes += static_cast<unsigned long>(plane->getNChannels()) * plane->getStride() * sizeof(int16_t);
+            }
+            m_compressedWaveforms.emplace_back(waveforms);
+            compressedBytes += m_compressedWaveforms.back().getNBytes();
+        }
+        // Release the uncompressed waveforms.
+        std::vector<EventWaveforms>().swap(m_waveforms);
+        m_compressed = true;
+        if (!m_compressedWaveforms.empty()) {
+            std::cout << "Compressed " << m_compressedWaveforms.size() << " events from "
+                      << rawBytes / m_compressedWaveforms.size() / 1024 << " kB to "
+                      << compressedBytes / m_compressedWaveforms.size() / 1024 << " kB per event.\n";
+        }
+    }
+
+
+    void ChargeData::decompress() {
+        if (!m_compressed) {
+            return;
+        }
+        m_waveforms.clear();
+        m_waveforms.reserve(m_compressedWaveforms.size());
+        for (const auto &compressedWaveforms : m_compressedWaveforms) {
+            m_waveforms.push_back(compressedWaveforms.decode());
+        }
+        std::vector<CompressedWaveforms>().swap(m_compressedWaveforms);
+        m_compressed = false;
+    }
+
+
+    void ChargeData::zeroSuppress(const bool t_bipolarRoiHits) {
+        if (m_zeroSuppressed) {
+            return;
+        }
+        if (m_compressed) {
+            std::cerr << "ERROR: Can't zero suppress compressed waveforms, decompress them first!" << std::endl;
+            exit(1);
+        }
+        // The thresholds of the zero suppression come from the noise models.
+        if (m_noiseModels.size() != m_waveforms.size()) {
+            computeNoiseModels();
+        }
+        unsigned long nSamples = 0;
+        unsigned long nStoredSamples = 0;
+        m_sparseWaveforms.clear();
+        m_sparseWaveforms.reserve(m_waveforms.size());
+        for (unsigned long eventIdx = 0; eventIdx < m_waveforms.size(); ++eventIdx) {
+            m_sparseWaveforms.emplace_back(m_waveforms.at(eventIdx), m_noiseModels.at(eventIdx), m_runParams,
+                                           t_bipolarRoiHits,
+                                           m_pixelSeedPlanes.empty() ? nullptr : &m_pixelSeedPlanes.at(eventIdx));
+            const auto &sparseWaveforms = m_sparseWaveforms.back();
+            for (const SparsePlane *plane : {&sparseWaveforms.getPixelPlane(), &sparseWaveforms.getRoiPlane()}) {
+                nSamples += static_cast<unsigned long>(plane->getNChannels()) * plane->getNSamples();
+                nStoredSamples += plane->getNStoredSamples();
+            }
+        }
+        // Release the full waveforms.
+        std::vector<EventWaveforms>().swap(m_waveforms);
+        m_zeroSuppressed = true;
+        if (nSamples) {
+            std::cout << "Zero suppression kept " << nStoredSamples << " of " << nSamples << " samples ("
+                      << 100. * nStoredSamples / nSamples << "%).\n";
+        }
+    }
+
+
     void ChargeData::convertHistos() {
-        // Preallocate the readout histo vector for speed.
-        m_readoutHistos.resize(m_daqHistos.size());
+        // Preallocate the readout waveform vector for speed.
+        m_waveforms.clear();
+        m_waveforms.reserve(m_daqHistos.size());
 
         // DAQ histo vector const iterator.
         // daqHisto is a point to the first element of m_daqHistos, will iterate through the vector addresses
         auto daqHisto = m_daqHistos.cbegin();
-        // Readout histo vector iterator.
-        auto readoutHisto = m_readoutHistos.begin();
         // Loop over events.
         for (const auto &eventId : m_eventIds) { //const reference to not copy and to make it immutable, eventId iterator taking on various values in vector
             std::cout << "Converting event number " << eventId << "...\n";
-            const std::string pixelHistoName = "pixelHisto_" + std::to_string(eventId);
-            const std::string roiHistoName = "roiHisto_" + std::to_string(eventId);
-            // Create the readout histos.
-            *readoutHisto = std::pair<TH2S, TH2S>(
-                    TH2S(pixelHistoName.c_str(), pixelHistoName.c_str(),
-                         m_runParams.getNSamples(), 0, m_runParams.getNSamples(), m_runParams.getNPixels(), 0,
-                         m_runParams.getNPixels()),
-                    TH2S(roiHistoName.c_str(), roiHistoName.c_str(),
-                         m_runParams.getNSamples(), 0, m_runParams.getNSamples(), m_runParams.getNRois(), 0,
-                         m_runParams.getNRois()));
-            // Assign the histo pointers.
-            // DAQ histo pointers for simplicity.
-            const TH2S &indHisto = *(daqHisto->first);
-            const TH2S &colHisto = *(daqHisto->second);
-            // Readout histo pointers for simplicity.
-            TH2S &pixelHisto = readoutHisto->first;
-            TH2S &roiHisto = readoutHisto->second;
-            // Pay attention to the histo bin numbering!!! Loops (as everything else) start at 0, histos start at 1!!!
-            // We use the pixel2daq and roi2daq methods of the viperMap to match the desired readout channels to DAQ
-            // channels. Samples are copied 1 by 1 up to m_nSamples.
-            // Loop through pixels.
-            for (unsigned pixel = 0; pixel < m_runParams.getNPixels(); ++pixel) {
-                // Loop through samples.
-                for (unsigned sample = 0; sample < m_runParams.getNSamples(); ++sample) {
-                    // Current pixel is in first DAQ histo (indHisto).
-                    if (m_runParams.pixel2daq(pixel) < (m_runParams.getNChans() / 2)) {
-                        // Fill pixel histo.
-                        pixelHisto.SetBinContent((sample + 1), (pixel + 1), indHisto.GetBinContent(
-                                (sample + 1), (m_runParams.pixel2daq(pixel) + 1)));
-                    }
-                        // Current pixel is in second DAQ histo (colHisto).
-                    else {
-                        // Fill ROI histo.
-                        pixelHisto.SetBinContent((sample + 1), (pixel + 1), colHisto.GetBinContent(
-                                (sample + 1), (m_runParams.pixel2daq(pixel) - m_runParams.getNChans() / 2 + 1)));
-                    }
-                }
-            }
-            // Loop through ROIs.
-            for (unsigned roi = 0; roi < m_runParams.getNRois(); ++roi) {
-                // Loop through samples.
-                for (unsigned sample = 0; sample < m_runParams.getNSamples(); ++sample) {
-                    // Fill ROI histo.
-                    roiHisto.SetBinContent((sample + 1), (roi + 1), colHisto.GetBinContent(
-                            (sample + 1), (m_runParams.roi2daq(roi) - m_runParams.getNChans() / 2 + 1)));
-                }
-            }
-            // Increment DAQ and readout histo vector iterators.
+            // Create the readout waveforms.
+            m_waveforms.emplace_back(eventId, m_runParams.getNPixels(), m_runParams.getNRois(),
+                                     m_runParams.getNSamples());
+            convertEvent(*(daqHisto->first), *(daqHisto->second), m_runParams, m_waveforms.back());
+            // Increment DAQ histo vector iterator.
             ++daqHisto;
-            ++readoutHisto;
+        }
+    }
+
+
+    void ChargeData::convertEvent(
+            const TH2S &t_indHisto,
+            const TH2S &t_colHisto,
+            const pixy_roimux::RunParams &t_runParams,
+            EventWaveforms &t_waveforms) {
+        const TH2S *const daqHistos[2] = {&t_indHisto, &t_colHisto};
+        const unsigned nSamples = t_runParams.getNSamples();
+        const unsigned nPixels = t_runParams.getNPixels();
+        // Loop through readout channels, pixels first, then ROIs.
+        for (unsigned readoutChan = 0; readoutChan < t_runParams.getNChans(); ++readoutChan) {
+            const ChannelGather &gather = t_runParams.getChannelGather(readoutChan);
+            const TH2S &daqHisto = *daqHistos[gather.daqHisto];
+            auto samples = (readoutChan < nPixels) ? t_waveforms.getPixelPlane().getChannel(readoutChan)
+                                                   : t_waveforms.getRoiPlane().getChannel(readoutChan - nPixels);
+            const unsigned nDaqSamples = static_cast<unsigned>(daqHisto.GetNbinsX());
+            if (gather.daqRow >= static_cast<unsigned>(daqHisto.GetNbinsY())) {
+                std::cerr << "ERROR: DAQ histogram " << daqHisto.GetName() << " has no channel " << gather.daqRow
+                          << '!' << std::endl;
+                exit(1);
+            }
+            // Pay attention to the histo bin numbering!!! The bin array of a TH2 includes the underflow and overflow
+            // bins, i.e. each row has nBinsX + 2 entries and sample 0 of channel x is at (x + 1) * (nBinsX + 2) + 1.
+            const Short_t *const daqRow = daqHisto.GetArray() + (gather.daqRow + 1) * (nDaqSamples + 2) + 1;
+            // Copy the samples up to nSamples in one go. If the DAQ histogram is shorter, the rest stays 0.
+            std::copy(daqRow, daqRow + std::min(nSamples, nDaqSamples), samples.begin());
         }
     }
 }
@@ -6,184 +6,536 @@
 
 
 namespace pixy_roimux {
-    void ChargeHits::find2dHits(
-            const TH2S &t_histo,
-            std::vector<Hit2d> &t_hits,
-            std::multimap<unsigned, unsigned> &t_hitOrderLead,
-            std::multimap<unsigned, unsigned> &t_hitOrderTrail,
-            unsigned &t_nMissed,
-            const bool t_bipolar,
-            const double t_discSigmaPosLead,
-            const double t_discSigmaPosPeak,
-            const double t_discAbsPosPeak,
-            const double t_discSigmaPosTrail,
-            const double t_discSigmaNegLead,
-            const double t_discSigmaNegPeak,
-            const double t_discAbsNegPeak,
-            const double t_discSigmaNegTrail) {
-        // Clear the hit vector and maps from potential old data.
-        t_hits.clear();
-        t_hitOrderLead.clear();
-        t_hitOrderTrail.clear();
-        // Index of the hits vector needed for the ordered maps.
-        unsigned hitId = 0;
-        // Loop over all channels of the input histo.
-        // Pay attention to bin numbers!!! Loops (and everything else) start at 0, histos start at 1!!!
-        for (unsigned channel = 0; channel < t_histo.GetNbinsY(); ++channel) {
-            // Get the histo of a single channel using the ProjectionX method of TH2.
-            auto channelHisto = std::shared_ptr<TH1D>(
-                    t_histo.ProjectionX("channelHisto", (channel + 1), (channel + 1)));
-            std::pair<double, double> noiseParams = NoiseFilter::computeNoiseParams(channelHisto, true);
-            //if (noiseParams.first < 1.) {
-            //    noiseParams.first = 1.;
-            //}
-            double noiseBaseline    = noiseParams.first;
-            double thrPosLead       = noiseParams.first + t_discSigmaPosLead * noiseParams.second;
-            double thrPosPeak       = noiseParams.first + std::max(t_discSigmaPosPeak * noiseParams.second, t_discAbsPosPeak);
-            double thrPosTrail      = noiseParams.first + t_discSigmaPosTrail * noiseParams.second;
-            //double thrNegLead       = noiseParams.first - t_discSigmaNegLead * noiseParams.second;
-            double thrNegPeak       = noiseParams.first - std::max(t_discSigmaNegPeak * noiseParams.second, t_discAbsNegPeak);
-            double thrNegTrail      = noiseParams.first - t_discSigmaNegTrail * noiseParams.second;
-          // std::cout << "noiseBaseline " << noiseBaseline << std::endl;
-            //std::cout << "thrPosLead " << thrPosLead << std::endl;
-            //std::cout << "thrPosPeak " << thrPosPeak << std::endl;
-            //std::cout << "thrPosTrail " << thrPosTrail << std::endl;
-            //std::cout << "thrNegPeak " << thrNegPeak << std::endl;
-            //std::cout << "thrNegTrail " << thrNegTrail << std::endl;
-            unsigned posPeakSample = static_cast<unsigned>(channelHisto->GetMaximumBin()) - 1;
-            int posPeakValue = static_cast<int>(channelHisto->GetBinContent(posPeakSample + 1));
-	    if(posPeakValue < thrPosPeak){
-		std::cout << "Didn't meet threshold!!!!\n";
-	    }
-	    // Find all hits in this channel
-            while (posPeakValue >= thrPosPeak) {
+    namespace {
+        ///
+        /// Copy or decode a channel of a dense plane into t_samples. The whole channel is one segment.
+        ///
+        template <typename Plane>
+        void loadChannel(
+                const Plane &t_plane,
+                const unsigned t_channel,
+                const Span<int16_t> t_samples,
+                std::vector<WaveformSegment> &t_segments) {
+            t_plane.copyChannel(t_channel, t_samples);
+            t_segments.assign(1, WaveformSegment{0, t_plane.getNSamples(), 0});
+        }
+
+        ///
+        /// Copy the segments of a channel of a zero-suppressed plane to their positions in t_samples. Samples outside
+        /// the segments are left untouched.
+        ///
+        void loadChannel(
+                const SparsePlane &t_plane,
+                const unsigned t_channel,
+                const Span<int16_t> t_samples,
+                std::vector<WaveformSegment> &t_segments) {
+            const auto segments = t_plane.getSegments(t_channel);
+            t_segments.assign(segments.begin(), segments.end());
+            for (const auto &segment : segments) {
+                const auto samples = t_plane.getSamples(segment);
+                std::copy(samples.begin(), samples.end(), t_samples.begin() + segment.start);
+            }
+        }
+
+        ///
+        /// Sample that may become the peak of a pulse.
+        ///
+        struct PeakCandidate {
+            ///
+            /// Sample value when the channel was loaded.
+            ///
+            int16_t value;
+
+            ///
+            /// Index of the sample within the channel.
+            ///
+            unsigned sample;
+
+            ///
+            /// Index of the segment holding the sample.
+            ///
+            unsigned segment;
+        };
+
+        ///
+        /// Heap order of the peak candidates: the largest value first and the earliest sample among equal values, like
+        /// TH1::GetMaximumBin.
+        ///
+        bool comparePeakCandidates(
+                const PeakCandidate &t_lhs,
+                const PeakCandidate &t_rhs) {
+            return (t_lhs.value < t_rhs.value) || ((t_lhs.value == t_rhs.value) && (t_lhs.sample > t_rhs.sample));
+        }
+
+        ///
+        /// Hits found in a single channel by the 2D hit finder.
+        ///
+        struct ChannelHits {
+            ///
+            /// Hits in the order they were found.
+            ///
+            std::vector<Hit2d> hits;
+
+            ///
+            /// Raw pulses of the hits, one after the other. Until the merge, Hit2d::pulseOffset indexes this vector.
+            ///
+            std::vector<int16_t> pulseSamples;
+
+            ///
+            /// Number of peaks without both pulse edges.
+            ///
+            unsigned nMissed = 0;
+
+            ///
+            /// Whether no sample reached the peak threshold.
+            ///
+            bool belowThreshold = false;
+        };
+
+        ///
+        /// Scratch buffers and statistics of one thread of the 2D hit finder.
+        ///
+        struct HitFinderWorker {
+            ///
+            /// Constructor for channels of up to t_nSamples samples.
+            ///
+            explicit HitFinderWorker(const unsigned t_nSamples) :
+                    channelSamples(t_nSamples),
+                    seedSamples(t_nSamples),
+                    crossings(t_nSamples) {
+            }
+
+            ///
+            /// Scratch copy of the current channel. Found pulses are overwritten with the baseline, so we can't work on
+            /// the plane directly. Only the samples within the segments of the channel are valid. Dense planes have a
+            /// single segment spanning the whole channel.
+            ///
+            std::vector<int16_t> channelSamples;
+
+            ///
+            /// Scratch copy of the matched-filtered current channel if the channel is seeded. Found pulses are
+            /// overwritten with the minimum of int16_t.
+            ///
+            std::vector<int16_t> seedSamples;
+
+            ///
+            /// Segments of the current channel.
+            ///
+            std::vector<WaveformSegment> segments;
+
+            ///
+            /// Threshold crossings of the current channel, one bit per sample and discriminator condition.
+            ///
+            CrossingDetector crossings;
+
+            ///
+            /// Samples of the current search window at or above the peak threshold.
+            ///
+            std::vector<unsigned> peakSamples;
+
+            ///
+            /// Max/min envelope of the current segment.
+            ///
+            EnvelopePyramid envelope;
+
+            ///
+            /// Envelope blocks of the current segment reaching the peak threshold.
+            ///
+            std::vector<unsigned> hotBlocks;
+
+            ///
+            /// Max-heap of the samples at or above the peak threshold.
+            ///
+            std::vector<PeakCandidate> candidates;
+
+            ///
+            /// Time spent copying or decoding channels and the number of samples copied or decoded.
+            ///
+            std::chrono::duration<double> loadTime{0.};
+            unsigned long nLoadedSamples = 0;
+
+            ///
+            /// Number of samples compared against the thresholds at full resolution.
+            ///
+            unsigned long nScannedSamples = 0;
+
+            ///
+            /// Time spent on ROI channels.
+            ///
+            std::chrono::duration<double> roiTime{0.};
+        };
+
+        ///
+        /// Find all hits in a channel of a plane with the scratch buffers of a worker. Masked channels must be skipped
+        /// by the caller. The kernel is specialised for unipolar pixel and bipolar ROI pulses and works on ADC counts
+        /// only, the thresholds of the channel are rounded beforehand. If a seed plane is given, the peak candidates
+        /// are the samples of the seed channel reaching the peak band of t_thresholds and the peak of each hit is the
+        /// first maximum of the unfiltered samples between its edges.
+        ///
+        template <bool Bipolar, typename Plane>
+        void findChannelHits(
+                const Plane &t_plane,
+                const PlaneWaveforms *const t_seedPlane,
+                const unsigned t_channel,
+                const CrossingDetector::Thresholds &t_thresholds,
+                const DiscriminatorParams &t_params,
+                HitFinderWorker &t_worker,
+                ChannelHits &t_channelHits) {
+            std::vector<int16_t> &channelSamples = t_worker.channelSamples;
+            // Without a seed plane, the peak candidates are the samples themselves.
+            int16_t *const seeds = t_seedPlane ? t_worker.seedSamples.data() : channelSamples.data();
+            std::vector<WaveformSegment> &segments = t_worker.segments;
+            CrossingDetector &crossings = t_worker.crossings;
+            std::vector<unsigned> &peakSamples = t_worker.peakSamples;
+            EnvelopePyramid &envelope = t_worker.envelope;
+            std::vector<unsigned> &hotBlocks = t_worker.hotBlocks;
+            std::vector<PeakCandidate> &candidates = t_worker.candidates;
+            const auto loadStart = std::chrono::steady_clock::now();
+            loadChannel(t_plane, t_channel, Span<int16_t>(channelSamples.data(), channelSamples.size()), segments);
+            if (t_seedPlane) {
+                t_seedPlane->copyChannel(t_channel, Span<int16_t>(seeds, t_seedPlane->getNSamples()));
+            }
+            t_worker.loadTime += std::chrono::steady_clock::now() - loadStart;
+            for (const auto &segment : segments) {
+                t_worker.nLoadedSamples += segment.length;
+            }
+            // Found pulses are overwritten with the baseline truncated to ADC counts.
+            const int16_t baselineSample = t_thresholds.baseline;
+            crossings.setThresholds(t_thresholds);
+            // Samples the discrimination may look at before and after a peak.
+            const unsigned leadRange = static_cast<unsigned>(std::max(t_params.discRange, 0));
+            const unsigned trailRange = static_cast<unsigned>(std::max(Bipolar ? t_params.negLobeRange :
+                                                                       t_params.discRange, 0));
+            // The peaks are searched in the order of the first maximum of the whole channel. Masking a pulse only
+            // lowers samples to the baseline, below the peak threshold, so the next peak is always the largest
+            // candidate that is still unmasked. Collecting the candidates in a single pass and keeping them in a heap
+            // replaces a scan of the whole segment after every hit.
+            candidates.clear();
+            for (unsigned segmentIdx = 0; segmentIdx < segments.size(); ++segmentIdx) {
+                const unsigned segmentStart = segments[segmentIdx].start;
+                const unsigned segmentStop = segments[segmentIdx].start + segments[segmentIdx].length;
+                if (segmentStart == segmentStop) {
+                    continue;
+                }
+                // Coarse search: only envelope blocks reaching the peak threshold can hold a peak, quiet segments are
+                // dismissed at the top of the pyramid. The crossing detector compares the samples within the
+                // discrimination ranges around these blocks against all thresholds of the channel in one pass, the
+                // discrimination below only looks up its bitmaps.
+                envelope.build(Span<const int16_t>(seeds + segmentStart, segmentStop - segmentStart));
+                hotBlocks.clear();
+                envelope.findBlocksAbove(t_thresholds.bands[CrossingDetector::kAbovePeak].low, hotBlocks);
+                // The windows are widened to whole bitmap words within the segment, overlapping and adjacent windows
+                // are merged into one scan. All peaks lie in hot blocks and all samples of a window outside of them are
+                // below the peak threshold, so the candidates are collected from the whole window.
+                const unsigned wordSamples = CrossingDetector::kWordSamples;
+                unsigned windowStart = segmentStart;
+                unsigned windowStop = segmentStart;
+                const auto searchWindow = [&]() {
+                    if (windowStart < windowStop) {
+                        crossings.scan<Bipolar>(channelSamples.data(), seeds, windowStart, windowStop);
+                        t_worker.nScannedSamples += windowStop - windowStart;
+                        peakSamples.clear();
+                        crossings.findAll(CrossingDetector::kAbovePeak, windowStart, windowStop - 1, peakSamples);
+                        for (const auto sample : peakSamples) {
+                            candidates.push_back(PeakCandidate{seeds[sample], sample, segmentIdx});
+                        }
+                    }
+                };
+                for (const auto block : hotBlocks) {
+                    const unsigned blockStart = segmentStart + block * EnvelopePyramid::kBlockSize;
+                    const unsigned blockStop = std::min(blockStart + EnvelopePyramid::kBlockSize, segmentStop);
+                    const unsigned start = std::max(
+                            (blockStart - std::min(leadRange, blockStart - segmentStart)) / wordSamples * wordSamples,
+                            segmentStart);
+                    if (start > windowStop) {
+                        searchWindow();
+                        windowStart = start;
+                    }
+                    windowStop = std::min((std::min(blockStop + trailRange, segmentStop) + wordSamples - 1) /
+                                          wordSamples * wordSamples, segmentStop);
+                }
+                searchWindow();
+            }
+            std::make_heap(candidates.begin(), candidates.end(), comparePeakCandidates);
+            t_channelHits.belowThreshold = candidates.empty();
+            // Find all hits in this channel
+            while (!candidates.empty()) {
+                const PeakCandidate peak = candidates.front();
+                std::pop_heap(candidates.begin(), candidates.end(), comparePeakCandidates);
+                candidates.pop_back();
+                // Skip candidates masked by an earlier pulse.
+                if (seeds[peak.sample] != peak.value) {
+                    continue;
+                }
+                unsigned posPeakSample = peak.sample;
+                int posPeakValue = peak.value;
+                const unsigned peakSegment = peak.segment;
+                // The pulse search never leaves the segment of the peak. For dense planes, these are the channel
+                // bounds.
+                const int segmentStart = static_cast<int>(segments[peakSegment].start);
+                const int segmentStop = static_cast<int>(segments[peakSegment].start + segments[peakSegment].length);
+                const int peakSample = static_cast<int>(posPeakSample);
                 // Start and end of the pulse.
-                int firstSample;
                 int zeroCrossSample;
                 int negPeakSample;
                 int negPeakValue = 0;
-                int lastSample;
-                bool foundFirstSample = false;
-                bool foundZeroCrossSample = false;
-                bool crossedThrNegPeak = false;
-                bool foundLastSample = false;
-                // Loop to find the first/last sample of the pulse using constant fraction discrimination.
-                // We only search in the specified range.
-                for (int sampleOffset = 1; sampleOffset <= m_runParams.getDiscRange(); ++sampleOffset) {
-                    // First sample. Only look if we haven't found it yet.
-                    if (!foundFirstSample) {
-                        firstSample = posPeakSample - sampleOffset;
-                        // Check whether we've crossed the constant fraction threshold.
-                        if ((firstSample >= 0) &&
-                            (channelHisto->GetBinContent(firstSample + 1) < thrPosLead)) {
-                            foundFirstSample = true;
+                // Constant fraction discrimination: the first sample is the last one below the leading edge threshold
+                // before the peak, the last sample the first one below the trailing edge threshold after it. We only
+                // search in the specified range.
+                int firstSample = crossings.findLast(CrossingDetector::kBelowLead,
+                                                     std::max(peakSample - t_params.discRange, segmentStart),
+                                                     peakSample - 1);
+                const bool foundFirstSample = (firstSample >= 0);
+                if (!foundFirstSample) {
+                    firstSample = peakSample - t_params.discRange;
+                }
+                int lastSample = crossings.findFirst(CrossingDetector::kBelowTrail,
+                                                     peakSample + 1,
+                                                     std::min(peakSample + t_params.discRange, segmentStop - 1));
+                bool foundLastSample = (lastSample >= 0);
+                if (!foundLastSample) {
+                    lastSample = peakSample + t_params.discRange;
+                }
+                if (Bipolar && foundLastSample) {
+                    // The negative lobe follows within three times the range: the signal crosses the baseline, reaches
+                    // the negative peak threshold and ends above the negative trailing edge threshold.
+                    const int searchStart = lastSample;
+                    const int searchStop = std::min(peakSample + t_params.negLobeRange, segmentStop - 1);
+                    foundLastSample = false;
+                    zeroCrossSample = crossings.findFirst(CrossingDetector::kBelowBaseline, searchStart, searchStop);
+                    if (zeroCrossSample >= 0) {
+                        const int negPeakCrossSample =
+                                crossings.findFirst(CrossingDetector::kBelowNegPeak, zeroCrossSample + 1, searchStop);
+                        if (negPeakCrossSample >= 0) {
+                            lastSample = crossings.findFirst(CrossingDetector::kAboveNegTrail,
+                                                             negPeakCrossSample,
+                                                             searchStop);
+                            foundLastSample = (lastSample >= 0);
                         }
-
                     }
-                    // Last sample. Only look if we haven't found it yet.
                     if (!foundLastSample) {
-                        lastSample = posPeakSample + sampleOffset;
-                        // Check whether we've crossed the constant fraction threshold.
-                        if ((lastSample < channelHisto->GetNbinsX()) &&
-                            (channelHisto->GetBinContent(lastSample + 1) < thrPosTrail)) {
-                            foundLastSample = true;
-                        }
+                        lastSample = searchStop;
                     }
-                }
-                if (t_bipolar && foundLastSample) {
-                    foundLastSample = false;
-                    for (int sample = lastSample;
-                         (sample <= (posPeakSample + 3 * m_runParams.getDiscRange())) && (sample < channelHisto->GetNbinsX());
-                         ++sample) {
-                        int binContent = static_cast<int>(channelHisto->GetBinContent(sample + 1));
-                        if (!foundZeroCrossSample) {
-                            if (binContent < noiseBaseline) {
-                                zeroCrossSample = sample;
-                                foundZeroCrossSample = true;
-                            }
-                        } else if (!crossedThrNegPeak) {
-                            if (binContent <= thrNegPeak) {
-                                crossedThrNegPeak = true;
-                            }
-                        }
-                        // Last sample. Only look if we haven't found it yet.
-                        if (!foundLastSample) {
-                            lastSample = sample;
-                            // Check whether we've crossed the constant fraction threshold.
-                            if (crossedThrNegPeak &&
-                                (binContent > thrNegTrail)) {
-                                foundLastSample = true;
-                            } else if (binContent < negPeakValue) {
-                                negPeakSample = sample;
-                                negPeakValue = binContent;
-                            }
+                    // The negative peak is the first minimum below 0 before the end of the pulse.
+                    const int negPeakStop = foundLastSample ? (lastSample - 1) : searchStop;
+                    for (int sample = searchStart; sample <= negPeakStop; ++sample) {
+                        if (channelSamples[sample] < negPeakValue) {
+                            negPeakSample = sample;
+                            negPeakValue = channelSamples[sample];
                         }
                     }
                 }
                 // If we detected both the rising and the falling edge, build a 2D hit.
                 if (foundFirstSample && foundLastSample) {
+                    if (t_seedPlane) {
+                        // The filtered peak is only shifted by the noise, the pulse height is measured without it.
+                        posPeakValue = std::numeric_limits<int>::min();
+                        for (int sample = firstSample + 1; sample < lastSample; ++sample) {
+                            if (channelSamples[sample] > posPeakValue) {
+                                posPeakSample = static_cast<unsigned>(sample);
+                                posPeakValue = channelSamples[sample];
+                            }
+                        }
+                    }
                     Hit2d hit;
-                    hit.channel = channel;
+                    hit.channel = t_channel;
                     hit.firstSample = static_cast<unsigned>(firstSample);
                     hit.lastSample = static_cast<unsigned>(lastSample);
                     hit.posPeakSample = posPeakSample;
+                    hit.posPeakTime = static_cast<float>(posPeakSample);
                     hit.posPulseHeight = posPeakValue;
-                    if (t_bipolar) {
+                    if (Bipolar) {
                         hit.zeroCrossSample = static_cast<unsigned>(zeroCrossSample);
                         hit.negPeakSample = static_cast<unsigned>(negPeakSample);
                         hit.negPulseHeight = negPeakValue;
                         hit.posPulseWidth = hit.zeroCrossSample - hit.firstSample;
                         hit.negPulseWidth = hit.lastSample - hit.zeroCrossSample + 1;
-			posPulseROIMax.push_back(posPeakValue);
-			roiWidthsVec.push_back(hit.posPulseWidth + hit.negPulseWidth);
                     } else {
                         hit.zeroCrossSample = 0;
                         hit.negPeakSample = 0;
                         hit.negPulseHeight = 0;
                         hit.posPulseWidth = hit.lastSample - hit.firstSample + 1;
                         hit.negPulseWidth = 0;
-			posPulsePixelMax.push_back(posPeakValue);
-			thrPosPeakVec.push_back(thrPosPeak);
-			pixelWidthsVec.push_back(hit.posPulseWidth);
                        // std::cout << " posPulseWidth " << hit.posPulseWidth << std::endl;
                     }
-                    hit.pulseIntegral = 0;
-                    hit.pulseRaw.clear();
-                    hit.pulseRaw.resize(hit.posPulseWidth + hit.negPulseWidth);
-                    // Raw pulse data vector iterator.
-                    auto pulseRaw = hit.pulseRaw.begin();
-                    // Loop over all pulse samples to store and integrate them.
-                    for (unsigned sample = hit.firstSample; sample <= hit.lastSample; ++sample) {
-                        const int pulseData = static_cast<int>(channelHisto->GetBinContent(sample + 1));
-                        hit.pulseIntegral += pulseData;
-                        *pulseRaw = pulseData;
-                        // Increment the raw pulse data vector iterator.
-                        ++pulseRaw;
+                    // Append the raw pulse to the pulses of the channel and integrate it in place.
+                    const auto pulseBegin = channelSamples.cbegin() + firstSample;
+                    const auto pulseEnd = channelSamples.cbegin() + lastSample + 1;
+                    hit.pulseOffset = static_cast<unsigned>(t_channelHits.pulseSamples.size());
+                    hit.pulseLength = hit.lastSample - hit.firstSample + 1;
+                    t_channelHits.pulseSamples.insert(t_channelHits.pulseSamples.end(), pulseBegin, pulseEnd);
+                    hit.pulseIntegral = std::accumulate(pulseBegin, pulseEnd, 0);
+                    // Push the hit to the hits of the channel.
+                    t_channelHits.hits.push_back(hit);
+                } else {
+                    ++t_channelHits.nMissed;
+                }
+                if (firstSample < segmentStart) {
+                    firstSample = segmentStart;
+                }
+                if (lastSample >= segmentStop) {
+                    lastSample = segmentStop - 1;
+                }
+                for (unsigned sample = firstSample; sample <= lastSample; ++sample) {
+                    channelSamples[sample] = baselineSample;
+                }
+                // The filter spreads a pulse beyond its edges, so all seeds of the pulse above the peak threshold are
+                // masked too. Masked seeds stay below any peak threshold.
+                if (t_seedPlane) {
+                    const int16_t seedThreshold = t_thresholds.bands[CrossingDetector::kAbovePeak].low;
+                    int seedStart = firstSample;
+                    while ((seedStart > segmentStart) && (seeds[seedStart - 1] >= seedThreshold)) {
+                        --seedStart;
+                    }
+                    int seedStop = lastSample;
+                    while ((seedStop < segmentStop - 1) && (seeds[seedStop + 1] >= seedThreshold)) {
+                        ++seedStop;
+                    }
+                    std::fill(seeds + seedStart, seeds + seedStop + 1, std::numeric_limits<int16_t>::min());
+                }
+                crossings.assign<Bipolar>(static_cast<unsigned>(firstSample), static_cast<unsigned>(lastSample), baselineSample);
+            }
+        }
+
+        ///
+        /// Merge the hits found in the t_nChannels channels of a plane in channel order and fill the diagnostics. The
+        /// hits are moved out of t_channelHits. The hits, the hit IDs and the hit orders are the same for any number of
+        /// threads. The raw pulses of each channel are appended to t_pulseSamples and the pulse offsets of its hits are
+        /// moved by the number of samples before them. Returns the number of missed hits.
+        ///
+        unsigned mergeHits(
+                ChannelHits *const t_channelHits,
+                const unsigned t_nChannels,
+                const std::vector<ChannelNoise> &t_noise,
+                const bool t_roiPlane,
+                HitDiagnostics &t_diagnostics,
+                std::vector<Hit2d> &t_hits,
+                std::multimap<unsigned, unsigned> &t_hitOrderLead,
+                std::multimap<unsigned, unsigned> &t_hitOrderTrail,
+                std::vector<int16_t> &t_pulseSamples) {
+            // Clear the hit vector and maps from potential old data.
+            t_hits.clear();
+            t_hitOrderLead.clear();
+            t_hitOrderTrail.clear();
+            unsigned nMissed = 0;
+            // Index of the hits vector needed for the ordered maps.
+            unsigned hitId = 0;
+            for (unsigned channel = 0; channel < t_nChannels; ++channel) {
+                ChannelHits &channelHits = t_channelHits[channel];
+                if (channelHits.belowThreshold) {
+                    std::cout << "Didn't meet threshold!!!!\n";
+                }
+                const unsigned pulseOffset = static_cast<unsigned>(t_pulseSamples.size());
+                t_pulseSamples.insert(t_pulseSamples.end(), channelHits.pulseSamples.cbegin(),
+                                      channelHits.pulseSamples.cend());
+                for (auto &&hit : channelHits.hits) {
+                    if (t_roiPlane) {
+                        t_diagnostics.addRoiHit(hit);
+                    }
+                    else {
+                        t_diagnostics.addPixelHit(hit, t_noise.at(channel).thrPosPeak);
                     }
-                    // Push the hit to the hits vector.
-                    t_hits.push_back(hit);
                     // Insert the hit ID into the hit order maps. The key is the sample where the signal rises/falls
                     // above/below the constant fraction.
-                    t_hitOrderLead.insert(std::pair<unsigned, unsigned>(firstSample, hitId));
-                    t_hitOrderTrail.insert(std::pair<unsigned, unsigned>(lastSample, hitId));
+                    t_hitOrderLead.insert(std::pair<unsigned, unsigned>(hit.firstSample, hitId));
+                    t_hitOrderTrail.insert(std::pair<unsigned, unsigned>(hit.lastSample, hitId));
+                    hit.pulseOffset += pulseOffset;
+                    t_hits.push_back(std::move(hit));
                     // Increment the hit ID.
                     ++hitId;
-                } else {
-                    ++t_nMissed;
                 }
-                if (firstSample < 0) {
-                    firstSample = 0;
+                nMissed += channelHits.nMissed;
+            }
+            return nMissed;
+        }
+    }
+
+
+    template <typename Waveforms>
+    void ChargeHits::findPlaneHits(
+            const Waveforms &t_waveforms,
+            const NoiseModel &t_noiseModel,
+            Event &t_event,
+            const bool t_bipolarRoiHits,
+            const PlaneWaveforms *const t_pixelSeedPlane) {
+        const auto &pixelPlane = t_waveforms.getPixelPlane();
+        const auto &roiPlane = t_waveforms.getRoiPlane();
+        const std::vector<ChannelNoise> &pixelNoise = t_noiseModel.getPixelNoise();
+        const std::vector<ChannelNoise> &roiNoise = t_noiseModel.getRoiNoise();
+        const unsigned nPixels = pixelPlane.getNChannels();
+        const unsigned nRois = roiPlane.getNChannels();
+        // One task per channel of both planes, pixels first. Each task stores its hits in its own slot, so the merge
+        // below doesn't depend on which thread found them.
+        std::vector<ChannelHits> channelHits(nPixels + nRois);
+        std::vector<HitFinderWorker> workers;
+        workers.reserve(m_threadPool.getNWorkers());
+        for (unsigned worker = 0; worker < m_threadPool.getNWorkers(); ++worker) {
+            workers.emplace_back(std::max(pixelPlane.getNSamples(), roiPlane.getNSamples()));
+        }
+        m_threadPool.run(nPixels + nRois, [&](const unsigned t_task, const unsigned t_worker) {
+            HitFinderWorker &worker = workers.at(t_worker);
+            // Masked channels can't have hits, don't even load them.
+            if (t_task < nPixels) {
+                if (!pixelNoise.at(t_task).masked) {
+                    CrossingDetector::Thresholds thresholds = CrossingDetector::makeThresholds(pixelNoise.at(t_task));
+                    if (t_pixelSeedPlane) {
+                        thresholds.bands[CrossingDetector::kAbovePeak] = CrossingDetector::makeThresholds(
+                                t_noiseModel.getPixelSeedNoise().at(t_task)).bands[CrossingDetector::kAbovePeak];
+                    }
+                    findChannelHits<false>(pixelPlane, t_pixelSeedPlane, t_task, thresholds, m_discParams, worker,
+                                           channelHits.at(t_task));
                 }
-                if (lastSample >= channelHisto->GetNbinsX()) {
-                    lastSample = channelHisto->GetNbinsX() - 1;
+            }
+            else if (!roiNoise.at(t_task - nPixels).masked) {
+                const unsigned channel = t_task - nPixels;
+                const CrossingDetector::Thresholds thresholds = CrossingDetector::makeThresholds(roiNoise.at(channel));
+                const auto roiStart = std::chrono::steady_clock::now();
+                if (t_bipolarRoiHits) {
+                    findChannelHits<true>(roiPlane, nullptr, channel, thresholds, m_discParams, worker,
+                                          channelHits.at(t_task));
                 }
-                for (unsigned sample = firstSample; sample <= lastSample; ++sample) {
-                    channelHisto->SetBinContent((sample + 1), noiseBaseline);
+                else {
+                    findChannelHits<false>(roiPlane, nullptr, channel, thresholds, m_discParams, worker,
+                                           channelHits.at(t_task));
                 }
-                posPeakSample = static_cast<unsigned>(channelHisto->GetMaximumBin()) - 1;
-                posPeakValue = static_cast<int>(channelHisto->GetBinContent(posPeakSample + 1));
+                worker.roiTime += std::chrono::steady_clock::now() - roiStart;
             }
+        });
+        std::chrono::duration<double> roiTime(0.);
+        for (const auto &worker : workers) {
+            m_loadTime += worker.loadTime;
+            m_nLoadedSamples += worker.nLoadedSamples;
+            m_nScannedSamples += worker.nScannedSamples;
+            roiTime += worker.roiTime;
         }
+        for (unsigned channel = 0; channel < nPixels; ++channel) {
+            m_nMaskedChannels += pixelNoise.at(channel).masked;
+        }
+        for (unsigned channel = 0; channel < nRois; ++channel) {
+            m_nMaskedChannels += roiNoise.at(channel).masked;
+        }
+        // Merge pixel hits.
+        t_event.pulseSamples.clear();
+        const unsigned nMissedPixelHits = mergeHits(channelHits.data(), nPixels, pixelNoise, false, m_diagnostics,
+                                                    t_event.pixelHits,
+                                                    t_event.pixelHitOrderLead,
+                                                    t_event.pixelHitOrderTrail,
+                                                    t_event.pulseSamples);
+        std::cout << "Found " << t_event.pixelHits.size() << " pixel hits.\n";
+        std::cout << "Missed " << nMissedPixelHits << " pixel hits.\n";
+        // Merge ROI hits.
+        const auto mergeStart = std::chrono::steady_clock::now();
+        const unsigned nMissedRoiHits = mergeHits(channelHits.data() + nPixels, nRois, roiNoise, true, m_diagnostics,
+                                                  t_event.roiHits,
+                                                  t_event.roiHitOrderLead,
+                                                  t_event.roiHitOrderTrail,
+                                                  t_event.pulseSamples);
+        roiTime += std::chrono::steady_clock::now() - mergeStart;
+        m_roiHitTime += roiTime;
+        std::cout << "Found " << t_event.roiHits.size() << " ROI hits.\n";
+        std::cout << "Missed " << nMissedRoiHits << " ROI hits.\n";
+        std::cout << "Found the " << (t_bipolarRoiHits ? "bipolar" : "unipolar") << " ROI hits in "
+                  << roiTime.count() * 1e6 << "us.\n";
     }
 
 
@@ -210,10 +562,7 @@ namespace pixy_roimux {
                 // Because we're currently inside the ROI pulse, we're sure this is an actual match.
                 t_event.pixel2roi.at(pixelHitId).push_back(roiHitId);
                 t_event.roi2pixel.at(roiHitId).push_back(pixelHitId);
-		double transparency = (100.0*t_event.pixelHits.at(pixelHitId).pulseIntegral)/(t_event.pixelHits.at(pixelHitId).pulseIntegral + 				t_event.roiHits.at(roiHitId).pulseIntegral);
-		transparencyVec.push_back(transparency);
-		timePeakAcceptance.push_back(t_event.pixelHits.at(pixelHitId).posPeakSample - t_event.roiHits.at(roiHitId).posPeakSample);
-		timeFirstSampleAcceptance.push_back(t_event.pixelHits.at(pixelHitId).firstSample - t_event.roiHits.at(roiHitId).firstSample);
+                m_diagnostics.addMatch(t_event.pixelHits.at(pixelHitId), t_event.roiHits.at(roiHitId), true);
             }
             // Now loop from the end of the ROI pulse until twice the peak finding range m_discRange after the end of the
             // pulse. This is the maximum length a pixel pulse can have. Thus, outside this range, a match to this ROI hit
@@ -231,8 +580,7 @@ namespace pixy_roimux {
                     // If they actually overlap, append the match to the match vectors.
                     t_event.pixel2roi.at(pixelHitId).push_back(roiHitId);
                     t_event.roi2pixel.at(roiHitId).push_back(pixelHitId);
-		    timePeakAcceptance.push_back(t_event.pixelHits.at(pixelHitId).posPeakSample - t_event.roiHits.at(roiHitId).posPeakSample);
-		    timeFirstSampleAcceptance.push_back(t_event.pixelHits.at(pixelHitId).firstSample - t_event.roiHits.at(roiHitId).firstSample);
+                    m_diagnostics.addMatch(t_event.pixelHits.at(pixelHitId), t_event.roiHits.at(roiHitId), false);
                 }
             }
         }
@@ -272,7 +620,7 @@ namespace pixy_roimux {
                 hit.y = static_cast<float>((m_runParams.getRoiCoor(roiId, 1) + m_runParams.getPixelCoor(pixelId, 1))
                                            * m_runParams.getPixelPitch() + m_runParams.getTpcOrigin().at(1));
                 hit.z = static_cast<float>(m_runParams.getDriftLength() / 2. + m_runParams.getTpcOrigin().at(2)
-                                           - (pixelHit->posPeakSample - m_runParams.getAnodeSample())
+                                           - (pixelHit->posPeakTime - static_cast<double>(m_runParams.getAnodeSample()))
                                              * m_runParams.getSampleTime() * m_runParams.getDriftSpeed());
                 // Calculate charge in C.
                 hit.charge = static_cast<float>(pixelHit->pulseIntegral *
@@ -293,52 +641,47 @@ namespace pixy_roimux {
         // Clear events vector in case there's old data in it.
         m_events.clear();
         // Preallocate fHits for speed.
-        m_events.resize(m_chargeData.getReadoutHistos().size());
-        // Raw data vector const iterator. We'll read the raw data from there event by event.
-        // Gives us access to a pair of histos containing the pixel (first) and the ROI (second) data.
-        auto eventData = m_chargeData.getReadoutHistos().cbegin();
+        m_events.resize(m_chargeData.getEventIds().size());
+        if (m_chargeData.getNoiseModels().size() != m_chargeData.getEventIds().size()) {
+            std::cerr << "ERROR: Hit finder needs the noise models of all events, filter the data first!" << std::endl;
+            exit(1);
+        }
+        // Index of the raw data of the current event. Gives us access to the pixel and the ROI waveforms, either
+        // compressed or not.
+        unsigned long eventIdx = 0;
         // Events vector iterator. We'll store the events we built from the raw data in there.
         auto event = m_events.begin();
         // Loop over all events using the event IDs vector.
         for (const auto &eventId : m_chargeData.getEventIds()) {
             std::cout << "Processing event number " << eventId << ":\n";
             std::cout << "Running 2D hit finder...\n";
-            unsigned nMissedPixelHits = 0;
-            unsigned nMissedRoiHits = 0;
-            // Find pixel hits.
-            find2dHits(eventData->first,
-                       event->pixelHits,
-                       event->pixelHitOrderLead,
-                       event->pixelHitOrderTrail,
-                       nMissedPixelHits,
-                       false,
-                       m_runParams.getDiscSigmaPixelLead(),
-                       m_runParams.getDiscSigmaPixelPeak(),
-                       m_runParams.getDiscAbsPixelPeak(),
-                       m_runParams.getDiscSigmaPixelTrail(),
-                       0,
-                       0,
-                       0,
-                       0);
-            std::cout << "Found " << event->pixelHits.size() << " pixel hits.\n";
-            std::cout << "Missed " << nMissedPixelHits << " pixel hits.\n";
-            // Find ROI hits.
-            find2dHits(eventData->second,
-                       event->roiHits,
-                       event->roiHitOrderLead,
-                       event->roiHitOrderTrail,
-                       nMissedRoiHits,
-                       t_bipolarRoiHits,
-                       m_runParams.getDiscSigmaRoiPosLead(),
-                       m_runParams.getDiscSigmaRoiPosPeak(),
-                       m_runParams.getDiscAbsRoiPosPeak(),
-                       m_runParams.getDiscSigmaRoiPosTrail(),
-                       m_runParams.getDiscSigmaRoiNegLead(),
-                       m_runParams.getDiscSigmaRoiNegPeak(),
-                       m_runParams.getDiscAbsRoiNegPeak(),
-                       m_runParams.getDiscSigmaRoiNegTrail());
-            std::cout << "Found " << event->roiHits.size() << " ROI hits.\n";
-            std::cout << "Missed " << nMissedRoiHits << " ROI hits.\n";
+            const NoiseModel &noiseModel = m_chargeData.getNoiseModels().at(eventIdx);
+            m_diagnostics.addNoiseModel(noiseModel);
+            // Matched-filtered pixel plane, if the pixel hits are seeded.
+            const std::vector<PlaneWaveforms> &pixelSeedPlanes = m_chargeData.getPixelSeedPlanes();
+            const PlaneWaveforms *const pixelSeedPlane = pixelSeedPlanes.empty() ? nullptr
+                                                                                 : &pixelSeedPlanes.at(eventIdx);
+            if (m_chargeData.isZeroSuppressed()) {
+                const auto &sparseWaveforms = m_chargeData.getSparseWaveforms().at(eventIdx);
+                if (sparseWaveforms.getBipolarRoiHits() != t_bipolarRoiHits) {
+                    std::cerr << "ERROR: Zero suppression and hit finder disagree on bipolar ROI hits!" << std::endl;
+                    exit(1);
+                }
+                findPlaneHits(sparseWaveforms, noiseModel, *event, t_bipolarRoiHits, pixelSeedPlane);
+            }
+            else if (m_chargeData.isCompressed()) {
+                findPlaneHits(m_chargeData.getCompressedWaveforms().at(eventIdx), noiseModel, *event, t_bipolarRoiHits,
+                              pixelSeedPlane);
+            }
+            else {
+                findPlaneHits(m_chargeData.getWaveforms().at(eventIdx), noiseModel, *event, t_bipolarRoiHits,
+                              pixelSeedPlane);
+            }
+
+            // Refine the times of the pixel hits the z coordinates are computed from.
+            if (m_pulseTemplateFit) {
+                m_pulseTemplateFit->fitHits(*event);
+            }
 
             std::cout << "Running 3D hit finder...\n";
             // Search for matches between pixel and ROI 2D hits.
@@ -367,9 +710,8 @@ namespace pixy_roimux {
             }
             std::cout << "Found " << nHitCandidates << " 3D hit candidates.\n";
             std::cout << "Found " << nAmbiguities << " ambiguities.\n";
-	    ambiguities.push_back(nAmbiguities);
             std::cout << "Failed to match " << nUnmatchedPixelHits << " pixel hits.\n";
-	    unmatched.push_back(nUnmatchedPixelHits);
+            m_diagnostics.addEvent(nAmbiguities, nUnmatchedPixelHits);
 
             // Store run, subrun and event ID to the event struct.
             event->runId = m_runParams.getRunId();
@@ -377,75 +719,14 @@ namespace pixy_roimux {
             event->eventId = eventId;
 
             // Increment raw data and events vector iterators.
-            ++eventData;
+            ++eventIdx;
             ++event;
         }
-	
-	// Create histograms for ambiguities and unmatched pixels
-	// Write to root file 
-	TH1S Ambiguities("Ambiguities", "Ambiguities", ambiguities.size(), 0, ambiguities.size());
-	Ambiguities.GetXaxis()->SetTitle("Event #");
-	for(int i = 0; i < ambiguities.size(); i++) {
-		Ambiguities.SetBinContent(i + 1, ambiguities.at(i));
-	}
-	TH1S Unmatched("Unmatched", "Unmatched", unmatched.size(), 0, unmatched.size());
-	Unmatched.GetXaxis()->SetTitle("Event #");
-	for(int i = 0; i < unmatched.size(); i++) {
-		Unmatched.SetBinContent(i + 1, unmatched.at(i));
-	}
-	TH1S TimePeakAcceptance("TimePeakAcceptance", "Time Difference in Peaks", 100, -400, 400);
-	TimePeakAcceptance.GetXaxis()->SetTitle("Samples (1 sample = 210 ns)");
-	for(int i = 0; i < timePeakAcceptance.size(); i++) {
-		TimePeakAcceptance.Fill(timePeakAcceptance.at(i));
-	}
-	TH1S TimeFirstSampleAcceptance("TimeFirstSampleAcceptance", "Time Difference in Rising Edge", 100, -400, 400);
-	TimeFirstSampleAcceptance.GetXaxis()->SetTitle("Samples (1 sample = 210 ns)");
-	for(int i = 0; i < timeFirstSampleAcceptance.size(); i++) {
-		TimeFirstSampleAcceptance.Fill(timeFirstSampleAcceptance.at(i));
-	}
-	TH1S ROIMaxPulses("ROIMaxPulses", "ROI (Positive) Pulse Peaks", 100, 0, 800);
-	ROIMaxPulses.GetXaxis()->SetTitle("ADC Value");
-	for(int i = 0; i < posPulseROIMax.size(); i++) {
-		ROIMaxPulses.Fill(posPulseROIMax.at(i));
-	}
-	TH1S PixelMaxPulses("PixelMaxPulses", "Pixel Pulse Peaks", 100, 0, 1500);
-	PixelMaxPulses.GetXaxis()->SetTitle("ADC Value");
-	for(int i = 0; i < posPulsePixelMax.size(); i++) {
-		PixelMaxPulses.Fill(posPulsePixelMax.at(i));
-	}
-	TH1S ThresholdPosPixelPeaks("ThresholdPosPixelPeaks", "Threshold for Positive Pixel Peaks", 100, 0, 1500);
-	ThresholdPosPixelPeaks.GetXaxis()->SetTitle("ADC Value");
-	for(int i = 0; i < thrPosPeakVec.size(); i++) {
-		ThresholdPosPixelPeaks.Fill(thrPosPeakVec.at(i));
-	}
-	TH1S Transparency("Transparency", "Transparency of Induction Grid", 100, 0, 140);
-	Transparency.GetXaxis()->SetTitle("Transparency (%)");
-	for(int i = 0; i < transparencyVec.size(); i++) {
-		Transparency.Fill(transparencyVec.at(i));
-	}
-	TH1S PixelPulseWidths("PixelPulseWidths", "Pixel Pulse Widths", 100, 0, 300);
-	PixelPulseWidths.GetXaxis()->SetTitle("Samples (1 sample = 210 ns)");
-	for(int i = 0; i < pixelWidthsVec.size(); i++) {
-		PixelPulseWidths.Fill(pixelWidthsVec.at(i));
-	}
-	TH1S ROIPulseWidths("ROIPulseWidths", "ROI Pulse Widths", 100, 0, 400);
-	ROIPulseWidths.GetXaxis()->SetTitle("Samples (1 sample = 210 ns)");
-	for(int i = 0; i < roiWidthsVec.size(); i++) {
-		ROIPulseWidths.Fill(roiWidthsVec.at(i));
-	}
-
-	TFile Results("../data/Results.root", "RECREATE");
-	Ambiguities.Write();
-	Unmatched.Write();
-	TimePeakAcceptance.Write();
-	TimeFirstSampleAcceptance.Write();
-	ROIMaxPulses.Write();
-	PixelMaxPulses.Write();
-	ThresholdPosPixelPeaks.Write();
-	Transparency.Write();
-	PixelPulseWidths.Write();
-	ROIPulseWidths.Write();	
-	Results.Close();
-	
+        if (m_nLoadedSamples) {
+            std::cout << (m_chargeData.isCompressed() ? "Decoded " : "Copied ") << m_nLoadedSamples
+                      << " samples for the hit finder at " << m_nLoadedSamples / m_loadTime.count() / 1e6
+                      << " MSamples/s.\n";
+            std::cout << "Searched " << m_nScannedSamples << " of them at full resolution.\n";
+        }
     }
 }
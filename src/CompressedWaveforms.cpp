@@ -0,0 +1,103 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "CompressedWaveforms.h"
+
+
+namespace pixy_roimux {
+    const unsigned CompressedPlane::kBlockSize;
+
+
+    CompressedPlane::CompressedPlane(const PlaneWaveforms &t_plane) :
+            m_nChannels(t_plane.getNChannels()),
+            m_nSamples(t_plane.getNSamples()),
+            m_nBlocksPerChannel((t_plane.getNSamples() + kBlockSize - 1) / kBlockSize) {
+        m_blocks.reserve(m_nChannels * m_nBlocksPerChannel);
+        uint32_t zigzags[kBlockSize];
+        for (unsigned channel = 0; channel < m_nChannels; ++channel) {
+            const auto samples = t_plane.getChannel(channel);
+            for (unsigned blockStart = 0; blockStart < m_nSamples; blockStart += kBlockSize) {
+                const unsigned blockLength = std::min(kBlockSize, m_nSamples - blockStart);
+                // Zigzag encode the differences so small negative differences become small positive numbers.
+                uint32_t maxZigzag = 0;
+                for (unsigned sample = 1; sample < blockLength; ++sample) {
+                    const int32_t delta = static_cast<int32_t>(samples[blockStart + sample]) -
+                                          static_cast<int32_t>(samples[blockStart + sample - 1]);
+                    zigzags[sample] = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+                    maxZigzag = std::max(maxZigzag, zigzags[sample]);
+                }
+                uint8_t width = 0;
+                while (maxZigzag >> width) {
+                    ++width;
+                }
+                Block block;
+                block.wordOffset = static_cast<uint32_t>(m_words.size());
+                block.firstSample = samples[blockStart];
+                block.width = width;
+                m_blocks.push_back(block);
+                // Pack the differences starting with the least significant bit.
+                uint64_t bitPos = 0;
+                if (width) {
+                    m_words.resize(m_words.size() + ((blockLength - 1) * width + 63) / 64, 0);
+                }
+                for (unsigned sample = 1; sample < blockLength; ++sample) {
+                    const uint64_t word = block.wordOffset + (bitPos >> 6);
+                    const unsigned shift = bitPos & 63;
+                    m_words[word] |= static_cast<uint64_t>(zigzags[sample]) << shift;
+                    if (shift + width > 64) {
+                        m_words[word + 1] |= static_cast<uint64_t>(zigzags[sample]) >> (64 - shift);
+                    }
+                    bitPos += width;
+                }
+            }
+        }
+        // One extra word so the decoder can always read two consecutive words.
+        m_words.push_back(0);
+        m_blocks.shrink_to_fit();
+        m_words.shrink_to_fit();
+    }
+
+
+    void CompressedPlane::decodeChannel(
+            const unsigned t_channel,
+            const Span<int16_t> t_samples) const {
+        const Block *block = m_blocks.data() + t_channel * m_nBlocksPerChannel;
+        int16_t *sample = t_samples.data();
+        for (unsigned blockStart = 0; blockStart < m_nSamples; blockStart += kBlockSize, ++block) {
+            const unsigned blockLength = std::min(kBlockSize, m_nSamples - blockStart);
+            int16_t *const blockStop = sample + blockLength;
+            int32_t value = block->firstSample;
+            *sample++ = static_cast<int16_t>(value);
+            // Flat blocks have no differences stored.
+            if (!block->width) {
+                std::fill(sample, blockStop, static_cast<int16_t>(value));
+                sample = blockStop;
+                continue;
+            }
+            const unsigned width = block->width;
+            const uint64_t mask = (static_cast<uint64_t>(1) << width) - 1;
+            const uint64_t *const words = m_words.data() + block->wordOffset;
+            uint64_t bitPos = 0;
+            while (sample != blockStop) {
+                const unsigned shift = bitPos & 63;
+                const uint64_t *const word = words + (bitPos >> 6);
+                // The shift by 64 - shift is split in two so it's well defined for shift == 0.
+                const uint64_t bits = (word[0] >> shift) | ((word[1] << 1) << (63 - shift));
+                const uint32_t zigzag = static_cast<uint32_t>(bits & mask);
+                value += static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+                *sample++ = static_cast<int16_t>(value);
+                bitPos += width;
+            }
+        }
+    }
+
+
+    PlaneWaveforms CompressedPlane::decode() const {
+        PlaneWaveforms plane(m_nChannels, m_nSamples);
+        for (unsigned channel = 0; channel < m_nChannels; ++channel) {
+            decodeChannel(channel, plane.getChannel(channel));
+        }
+        return plane;
+    }
+}
@@ -0,0 +1,256 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "CrossingDetector.h"
+
+
+namespace pixy_roimux {
+    namespace {
+        ///
+        /// Get the mask of the bits [t_first, t_last] of a word, with 0 <= t_first <= t_last < 64.
+        ///
+        uint64_t bitRange(
+                const unsigned t_first,
+                const unsigned t_last) {
+            return (~static_cast<uint64_t>(0) << t_first) & (~static_cast<uint64_t>(0) >> (63 - t_last));
+        }
+    }
+
+
+    CrossingDetector::Thresholds CrossingDetector::makeThresholds(const ChannelNoise &t_noise) {
+        const double min = std::numeric_limits<int16_t>::min();
+        const double max = std::numeric_limits<int16_t>::max();
+        Thresholds thresholds;
+        // The samples are integers, so v >= t is v >= ceil(t), v < t is v <= ceil(t) - 1, v <= t is v <= floor(t) and
+        // v > t is v >= floor(t) + 1.
+        thresholds.bands[kAbovePeak] = makeBand(std::ceil(t_noise.thrPosPeak), max);
+        thresholds.bands[kBelowLead] = makeBand(min, std::ceil(t_noise.thrPosLead) - 1.);
+        thresholds.bands[kBelowTrail] = makeBand(min, std::ceil(t_noise.thrPosTrail) - 1.);
+        thresholds.bands[kBelowBaseline] = makeBand(min, std::ceil(t_noise.mean) - 1.);
+        thresholds.bands[kBelowNegPeak] = makeBand(min, std::floor(t_noise.thrNegPeak));
+        thresholds.bands[kAboveNegTrail] = makeBand(std::floor(t_noise.thrNegTrail) + 1., max);
+        thresholds.baseline = static_cast<int16_t>(t_noise.mean);
+        return thresholds;
+    }
+
+
+    CrossingDetector::CrossingDetector(const unsigned t_nSamples) {
+        for (auto &&bits : m_bits) {
+            bits.assign((t_nSamples + kWordSamples - 1) / kWordSamples, 0);
+        }
+    }
+
+
+    template <bool Bipolar>
+    void CrossingDetector::scan(
+            const int16_t *const t_samples,
+            const int16_t *const t_peakSamples,
+            const unsigned t_start,
+            const unsigned t_stop) {
+        const unsigned nConditions = getNConditions(Bipolar);
+        if (t_start >= t_stop) {
+            return;
+        }
+        // Partial words at the edges are set bit by bit, so bits of neighbouring segments sharing the word are kept.
+        const unsigned firstWordSample = std::min(t_stop, (t_start + kWordSamples - 1) / kWordSamples * kWordSamples);
+        scanScalar<Bipolar>(t_samples, t_peakSamples, t_start, firstWordSample);
+        unsigned sample = firstWordSample;
+        for (; sample + kWordSamples <= t_stop; sample += kWordSamples) {
+            const int16_t *const wordSamples = t_samples + sample;
+            const int16_t *const wordPeakSamples = t_peakSamples + sample;
+            uint64_t words[kNConditions] = {};
+#if defined(__AVX2__)
+            // 32 samples per step: compare two registers of 16, pack the 16 bit masks to bytes and restore the sample
+            // order, packs_epi16 interleaves the 128 bit lanes of its inputs.
+            for (unsigned offset = 0; offset < kWordSamples; offset += 32) {
+                const __m256i low =
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(wordSamples + offset));
+                const __m256i high =
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(wordSamples + offset + 16));
+                const __m256i peakLow =
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(wordPeakSamples + offset));
+                const __m256i peakHigh =
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(wordPeakSamples + offset + 16));
+                for (unsigned condition = 0; condition < nConditions; ++condition) {
+                    const __m256i valuesLow = (condition == kAbovePeak) ? peakLow : low;
+                    const __m256i valuesHigh = (condition == kAbovePeak) ? peakHigh : high;
+                    const __m256i bandLow = _mm256_set1_epi16(m_thresholds.bands[condition].low);
+                    const __m256i bandHigh = _mm256_set1_epi16(m_thresholds.bands[condition].high);
+                    const __m256i outLow = _mm256_or_si256(_mm256_cmpgt_epi16(bandLow, valuesLow),
+                                                           _mm256_cmpgt_epi16(valuesLow, bandHigh));
+                    const __m256i outHigh = _mm256_or_si256(_mm256_cmpgt_epi16(bandLow, valuesHigh),
+                                                            _mm256_cmpgt_epi16(valuesHigh, bandHigh));
+                    const __m256i out = _mm256_permute4x64_epi64(_mm256_packs_epi16(outLow, outHigh), 0xD8);
+                    const uint32_t inBits = ~static_cast<uint32_t>(_mm256_movemask_epi8(out));
+                    words[condition] |= static_cast<uint64_t>(inBits) << offset;
+                }
+            }
+#elif defined(__SSE2__)
+            // 16 samples per step: compare two registers of 8 and pack the 16 bit masks to bytes.
+            for (unsigned offset = 0; offset < kWordSamples; offset += 16) {
+                const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i *>(wordSamples + offset));
+                const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i *>(wordSamples + offset + 8));
+                const __m128i peakLow = _mm_loadu_si128(reinterpret_cast<const __m128i *>(wordPeakSamples + offset));
+                const __m128i peakHigh =
+                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(wordPeakSamples + offset + 8));
+                for (unsigned condition = 0; condition < nConditions; ++condition) {
+                    const __m128i valuesLow = (condition == kAbovePeak) ? peakLow : low;
+                    const __m128i valuesHigh = (condition == kAbovePeak) ? peakHigh : high;
+                    const __m128i bandLow = _mm_set1_epi16(m_thresholds.bands[condition].low);
+                    const __m128i bandHigh = _mm_set1_epi16(m_thresholds.bands[condition].high);
+                    const __m128i outLow = _mm_or_si128(_mm_cmpgt_epi16(bandLow, valuesLow),
+                                                        _mm_cmpgt_epi16(valuesLow, bandHigh));
+                    const __m128i outHigh = _mm_or_si128(_mm_cmpgt_epi16(bandLow, valuesHigh),
+                                                         _mm_cmpgt_epi16(valuesHigh, bandHigh));
+                    const uint32_t inBits = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(outLow, outHigh)))
+                                            & 0xFFFF;
+                    words[condition] |= static_cast<uint64_t>(inBits) << offset;
+                }
+            }
+#else
+            for (unsigned offset = 0; offset < kWordSamples; ++offset) {
+                for (unsigned condition = 0; condition < nConditions; ++condition) {
+                    const int16_t value = (condition == kAbovePeak) ? wordPeakSamples[offset] : wordSamples[offset];
+                    const bool in = inBand(m_thresholds.bands[condition], value);
+                    words[condition] |= static_cast<uint64_t>(in) << offset;
+                }
+            }
+#endif
+            for (unsigned condition = 0; condition < nConditions; ++condition) {
+                m_bits[condition][sample / kWordSamples] = words[condition];
+            }
+        }
+        scanScalar<Bipolar>(t_samples, t_peakSamples, sample, t_stop);
+    }
+
+
+    template <bool Bipolar>
+    void CrossingDetector::scanScalar(
+            const int16_t *const t_samples,
+            const int16_t *const t_peakSamples,
+            const unsigned t_start,
+            const unsigned t_stop) {
+        const unsigned nConditions = getNConditions(Bipolar);
+        for (unsigned sample = t_start; sample < t_stop; ++sample) {
+            for (unsigned condition = 0; condition < nConditions; ++condition) {
+                const int16_t value = (condition == kAbovePeak) ? t_peakSamples[sample] : t_samples[sample];
+                setBit(condition, sample, inBand(m_thresholds.bands[condition], value));
+            }
+        }
+    }
+
+
+    template <bool Bipolar>
+    void CrossingDetector::assign(
+            const unsigned t_first,
+            const unsigned t_last,
+            const int16_t t_value) {
+        const unsigned nConditions = getNConditions(Bipolar);
+        if (t_first > t_last) {
+            return;
+        }
+        const unsigned firstWord = t_first / kWordSamples;
+        const unsigned lastWord = t_last / kWordSamples;
+        for (unsigned condition = 0; condition < nConditions; ++condition) {
+            const bool value = inBand(m_thresholds.bands[condition], t_value);
+            for (unsigned word = firstWord; word <= lastWord; ++word) {
+                const uint64_t mask = bitRange((word == firstWord) ? (t_first % kWordSamples) : 0,
+                                               (word == lastWord) ? (t_last % kWordSamples) : (kWordSamples - 1));
+                m_bits[condition][word] = value ? (m_bits[condition][word] | mask) : (m_bits[condition][word] & ~mask);
+            }
+        }
+    }
+
+
+    int CrossingDetector::findFirst(
+            const Condition t_condition,
+            const int t_first,
+            const int t_last) const {
+        const int first = std::max(t_first, 0);
+        if (first > t_last) {
+            return -1;
+        }
+        const unsigned lastWord = static_cast<unsigned>(t_last) / kWordSamples;
+        for (unsigned word = static_cast<unsigned>(first) / kWordSamples; word <= lastWord; ++word) {
+            const uint64_t mask = bitRange((word == static_cast<unsigned>(first) / kWordSamples) ?
+                                           (static_cast<unsigned>(first) % kWordSamples) : 0,
+                                           (word == lastWord) ?
+                                           (static_cast<unsigned>(t_last) % kWordSamples) : (kWordSamples - 1));
+            const uint64_t bits = m_bits[t_condition][word] & mask;
+            if (bits) {
+                return static_cast<int>(word * kWordSamples + __builtin_ctzll(bits));
+            }
+        }
+        return -1;
+    }
+
+
+    int CrossingDetector::findLast(
+            const Condition t_condition,
+            const int t_first,
+            const int t_last) const {
+        const int first = std::max(t_first, 0);
+        if (first > t_last) {
+            return -1;
+        }
+        const unsigned firstWord = static_cast<unsigned>(first) / kWordSamples;
+        for (unsigned word = static_cast<unsigned>(t_last) / kWordSamples + 1; word-- > firstWord;) {
+            const uint64_t mask = bitRange((word == firstWord) ? (static_cast<unsigned>(first) % kWordSamples) : 0,
+                                           (word == static_cast<unsigned>(t_last) / kWordSamples) ?
+                                           (static_cast<unsigned>(t_last) % kWordSamples) : (kWordSamples - 1));
+            const uint64_t bits = m_bits[t_condition][word] & mask;
+            if (bits) {
+                return static_cast<int>(word * kWordSamples + 63 - __builtin_clzll(bits));
+            }
+        }
+        return -1;
+    }
+
+
+    void CrossingDetector::findAll(
+            const Condition t_condition,
+            const unsigned t_first,
+            const unsigned t_last,
+            std::vector<unsigned> &t_samples) const {
+        if (t_first > t_last) {
+            return;
+        }
+        const unsigned firstWord = t_first / kWordSamples;
+        const unsigned lastWord = t_last / kWordSamples;
+        for (unsigned word = firstWord; word <= lastWord; ++word) {
+            uint64_t bits = m_bits[t_condition][word] &
+                            bitRange((word == firstWord) ? (t_first % kWordSamples) : 0,
+                                     (word == lastWord) ? (t_last % kWordSamples) : (kWordSamples - 1));
+            while (bits) {
+                t_samples.push_back(word * kWordSamples + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+        }
+    }
+
+
+    CrossingDetector::Band CrossingDetector::makeBand(
+            const double t_low,
+            const double t_high) {
+        const double min = std::numeric_limits<int16_t>::min();
+        const double max = std::numeric_limits<int16_t>::max();
+        // Also catches NaN thresholds, which no sample meets.
+        if (!(t_low <= t_high) || (t_low > max) || (t_high < min)) {
+            return Band{std::numeric_limits<int16_t>::max(), std::numeric_limits<int16_t>::min()};
+        }
+        return Band{static_cast<int16_t>(std::max(t_low, min)), static_cast<int16_t>(std::min(t_high, max))};
+    }
+
+
+    template void CrossingDetector::scan<false>(const int16_t *const, const int16_t *const, const unsigned,
+                                                const unsigned);
+    template void CrossingDetector::scan<true>(const int16_t *const, const int16_t *const, const unsigned,
+                                               const unsigned);
+    template void CrossingDetector::scanScalar<false>(const int16_t *const, const int16_t *const, const unsigned,
+                                                      const unsigned);
+    template void CrossingDetector::scanScalar<true>(const int16_t *const, const int16_t *const, const unsigned,
+                                                     const unsigned);
+    template void CrossingDetector::assign<false>(const unsigned, const unsigned, const int16_t);
+    template void CrossingDetector::assign<true>(const unsigned, const unsigned, const int16_t);
+}
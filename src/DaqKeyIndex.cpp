@@ -0,0 +1,161 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "DaqKeyIndex.h"
+
+
+namespace pixy_roimux {
+    const std::size_t DaqKeyIndex::kMaxReadBytes = 16 * 1024 * 1024;
+
+
+    DaqKeyIndex::DaqKeyIndex(TFile &t_rootFile) :
+            m_rootFile(t_rootFile) {
+        const TList *const keys = m_rootFile.GetListOfKeys();
+        if (!keys) {
+            return;
+        }
+        TIter nextKey(keys);
+        while (TKey *const key = static_cast<TKey *>(nextKey())) {
+            const std::string keyName = key->GetName();
+            unsigned eventId;
+            TKey *DaqKeyEntry::*slot = nullptr;
+            if (parseKeyName(keyName, "Ind_", eventId)) {
+                slot = &DaqKeyEntry::indKey;
+            }
+            else if (parseKeyName(keyName, "Col_", eventId)) {
+                slot = &DaqKeyEntry::colKey;
+            }
+            else {
+                continue;
+            }
+            DaqKeyEntry &entry = m_entries[eventId];
+            // Only keep the highest cycle, like GetObject does.
+            if (!(entry.*slot) || ((entry.*slot)->GetCycle() < key->GetCycle())) {
+                entry.*slot = key;
+            }
+        }
+        for (auto &&entry : m_entries) {
+            if (entry.second.indKey && entry.second.colKey) {
+                entry.second.seekKey = std::min(entry.second.indKey->GetSeekKey(), entry.second.colKey->GetSeekKey());
+            }
+        }
+    }
+
+
+    std::vector<unsigned> DaqKeyIndex::getEventIds() const {
+        std::vector<unsigned> eventIds;
+        eventIds.reserve(m_entries.size());
+        for (const auto &entry : m_entries) {
+            if (hasEvent(entry.first)) {
+                eventIds.push_back(entry.first);
+            }
+        }
+        std::sort(eventIds.begin(), eventIds.end());
+        return eventIds;
+    }
+
+
+    std::vector<unsigned long> DaqKeyIndex::getReadOrder(
+            const std::vector<unsigned> &t_eventIds,
+            const unsigned long t_window) const {
+        std::vector<unsigned long> readOrder(t_eventIds.size());
+        std::iota(readOrder.begin(), readOrder.end(), 0);
+        const unsigned long window = std::max(t_window, 1ul);
+        for (auto windowStart = readOrder.begin(); windowStart != readOrder.end();) {
+            const auto windowStop = windowStart + std::min(window,
+                                                           static_cast<unsigned long>(readOrder.end() - windowStart));
+            std::stable_sort(windowStart, windowStop, [&](const unsigned long t_lhs, const unsigned long t_rhs) {
+                const Long64_t lhsSeekKey = getSeekKey(t_eventIds.at(t_lhs));
+                const Long64_t rhsSeekKey = getSeekKey(t_eventIds.at(t_rhs));
+                // Missing events have a negative offset and go last.
+                return (lhsSeekKey >= 0) && ((rhsSeekKey < 0) || (lhsSeekKey < rhsSeekKey));
+            });
+            windowStart = windowStop;
+        }
+        return readOrder;
+    }
+
+
+    std::pair<TH2S *, TH2S *> DaqKeyIndex::read(const unsigned t_eventId) {
+        std::vector<std::pair<TH2S *, TH2S *>> histos;
+        read(std::vector<unsigned>(1, t_eventId), histos);
+        return histos.front();
+    }
+
+
+    void DaqKeyIndex::read(
+            const std::vector<unsigned> &t_eventIds,
+            std::vector<std::pair<TH2S *, TH2S *>> &t_histos) {
+        t_histos.assign(t_eventIds.size(), std::pair<TH2S *, TH2S *>(nullptr, nullptr));
+        // Gather the keys of all events and sort them by their position in the file.
+        m_batchKeys.clear();
+        for (unsigned long eventIdx = 0; eventIdx < t_eventIds.size(); ++eventIdx) {
+            if (hasEvent(t_eventIds.at(eventIdx))) {
+                const DaqKeyEntry &entry = m_entries.at(t_eventIds.at(eventIdx));
+                m_batchKeys.emplace_back(entry.indKey, 2 * eventIdx);
+                m_batchKeys.emplace_back(entry.colKey, 2 * eventIdx + 1);
+            }
+        }
+        std::sort(m_batchKeys.begin(), m_batchKeys.end(),
+                  [](const std::pair<TKey *, unsigned long> &t_lhs, const std::pair<TKey *, unsigned long> &t_rhs) {
+                      return t_lhs.first->GetSeekKey() < t_rhs.first->GetSeekKey();
+                  });
+        m_objects.assign(2 * t_eventIds.size(), nullptr);
+        for (auto batchStart = m_batchKeys.cbegin(); batchStart != m_batchKeys.cend();) {
+            // Read the following keys including their headers in one go until the byte budget is used up.
+            m_positions.clear();
+            m_lengths.clear();
+            std::size_t nBytes = 0;
+            auto batchStop = batchStart;
+            while ((batchStop != m_batchKeys.cend()) && ((batchStop == batchStart) ||
+                    (nBytes + batchStop->first->GetNbytes() <= kMaxReadBytes))) {
+                m_positions.push_back(batchStop->first->GetSeekKey());
+                m_lengths.push_back(batchStop->first->GetNbytes());
+                nBytes += m_lengths.back();
+                ++batchStop;
+            }
+            m_buffer.resize(nBytes);
+            ++m_nReads;
+            // ReadBuffers returns true on failure. The events of a failed read stay incomplete and are dropped below.
+            if (!m_rootFile.ReadBuffers(m_buffer.data(), m_positions.data(), m_lengths.data(),
+                                        static_cast<Int_t>(m_lengths.size()))) {
+                std::size_t offset = 0;
+                for (auto key = batchStart; key != batchStop; ++key) {
+                    m_objects.at(key->second) = key->first->ReadObjWithBuffer(m_buffer.data() + offset);
+                    offset += key->first->GetNbytes();
+                }
+            }
+            batchStart = batchStop;
+        }
+        for (unsigned long eventIdx = 0; eventIdx < t_eventIds.size(); ++eventIdx) {
+            TObject *const indObject = m_objects.at(2 * eventIdx);
+            TObject *const colObject = m_objects.at(2 * eventIdx + 1);
+            TH2S *const indHisto = dynamic_cast<TH2S *>(indObject);
+            TH2S *const colHisto = dynamic_cast<TH2S *>(colObject);
+            if (indHisto && colHisto) {
+                t_histos.at(eventIdx) = std::pair<TH2S *, TH2S *>(indHisto, colHisto);
+            }
+            else {
+                delete indObject;
+                delete colObject;
+            }
+        }
+    }
+
+
+    bool DaqKeyIndex::parseKeyName(
+            const std::string &t_keyName,
+            const std::string &t_prefix,
+            unsigned &t_eventId) {
+        if ((t_keyName.size() <= t_prefix.size()) || t_keyName.compare(0, t_prefix.size(), t_prefix)) {
+            return false;
+        }
+        const std::string number = t_keyName.substr(t_prefix.size());
+        if (number.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        t_eventId = static_cast<unsigned>(std::strtoul(number.c_str(), nullptr, 10));
+        return true;
+    }
+}
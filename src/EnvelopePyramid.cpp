@@ -0,0 +1,130 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "EnvelopePyramid.h"
+
+
+namespace pixy_roimux {
+    namespace {
+        ///
+        /// Write the maximum of each block of EnvelopePyramid::kBlockSize values of t_maxValues to t_max and the
+        /// minimum of each block of t_minValues to t_min. The last block may be shorter.
+        ///
+        void reduceBlocks(
+                const int16_t *const t_maxValues,
+                const int16_t *const t_minValues,
+                const unsigned t_nValues,
+                int16_t *const t_max,
+                int16_t *const t_min) {
+            const unsigned blockSize = EnvelopePyramid::kBlockSize;
+            const unsigned nBlocks = (t_nValues + blockSize - 1) / blockSize;
+            unsigned block = 0;
+#if defined(__SSE2__)
+            // Eight blocks per step, one per register. Interleaving pairs of registers and reducing them halves the
+            // number of registers while keeping the lanes of the blocks apart, until one register holds all eight.
+            for (; (block + blockSize) * blockSize <= t_nValues; block += blockSize) {
+                const __m128i *const maxValues = reinterpret_cast<const __m128i *>(t_maxValues + block * blockSize);
+                const __m128i *const minValues = reinterpret_cast<const __m128i *>(t_minValues + block * blockSize);
+                __m128i max[blockSize / 2];
+                __m128i min[blockSize / 2];
+                for (unsigned pair = 0; pair < blockSize / 2; ++pair) {
+                    const __m128i evenMax = _mm_loadu_si128(maxValues + 2 * pair);
+                    const __m128i oddMax = _mm_loadu_si128(maxValues + 2 * pair + 1);
+                    const __m128i evenMin = _mm_loadu_si128(minValues + 2 * pair);
+                    const __m128i oddMin = _mm_loadu_si128(minValues + 2 * pair + 1);
+                    max[pair] = _mm_max_epi16(_mm_unpacklo_epi16(evenMax, oddMax), _mm_unpackhi_epi16(evenMax, oddMax));
+                    min[pair] = _mm_min_epi16(_mm_unpacklo_epi16(evenMin, oddMin), _mm_unpackhi_epi16(evenMin, oddMin));
+                }
+                for (unsigned pair = 0; pair < blockSize / 4; ++pair) {
+                    max[pair] = _mm_max_epi16(_mm_unpacklo_epi32(max[2 * pair], max[2 * pair + 1]),
+                                              _mm_unpackhi_epi32(max[2 * pair], max[2 * pair + 1]));
+                    min[pair] = _mm_min_epi16(_mm_unpacklo_epi32(min[2 * pair], min[2 * pair + 1]),
+                                              _mm_unpackhi_epi32(min[2 * pair], min[2 * pair + 1]));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(t_max + block),
+                                 _mm_max_epi16(_mm_unpacklo_epi64(max[0], max[1]), _mm_unpackhi_epi64(max[0], max[1])));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(t_min + block),
+                                 _mm_min_epi16(_mm_unpacklo_epi64(min[0], min[1]), _mm_unpackhi_epi64(min[0], min[1])));
+            }
+#endif
+            for (; block < nBlocks; ++block) {
+                const unsigned last = std::min((block + 1) * blockSize, t_nValues);
+                int16_t blockMax = t_maxValues[block * blockSize];
+                int16_t blockMin = t_minValues[block * blockSize];
+                for (unsigned value = block * blockSize + 1; value < last; ++value) {
+                    blockMax = std::max(blockMax, t_maxValues[value]);
+                    blockMin = std::min(blockMin, t_minValues[value]);
+                }
+                t_max[block] = blockMax;
+                t_min[block] = blockMin;
+            }
+        }
+    }
+
+
+    void EnvelopePyramid::build(const Span<const int16_t> t_samples) {
+        m_nSamples = static_cast<unsigned>(t_samples.size());
+        m_nLevels = 0;
+        if (!m_nSamples) {
+            return;
+        }
+        // Level 0 from the samples, each higher level from the level below until a single block is left.
+        unsigned nLowerBlocks = m_nSamples;
+        do {
+            if (m_max.size() <= m_nLevels) {
+                m_max.emplace_back();
+                m_min.emplace_back();
+            }
+            const unsigned nBlocks = (nLowerBlocks + kBlockSize - 1) / kBlockSize;
+            m_max[m_nLevels].resize(nBlocks);
+            m_min[m_nLevels].resize(nBlocks);
+            if (m_nLevels) {
+                reduceBlocks(m_max[m_nLevels - 1].data(), m_min[m_nLevels - 1].data(), nLowerBlocks,
+                             m_max[m_nLevels].data(), m_min[m_nLevels].data());
+            }
+            else {
+                reduceBlocks(t_samples.data(), t_samples.data(), nLowerBlocks, m_max.front().data(),
+                             m_min.front().data());
+            }
+            nLowerBlocks = nBlocks;
+            ++m_nLevels;
+        } while (nLowerBlocks > 1);
+    }
+
+
+    void EnvelopePyramid::findBlocksAbove(
+            const int16_t t_threshold,
+            std::vector<unsigned> &t_blocks) const {
+        if (m_nLevels) {
+            findBlocksAbove(m_nLevels - 1, 0, t_threshold, t_blocks);
+        }
+    }
+
+
+    void EnvelopePyramid::findBlocksAbove(
+            const unsigned t_level,
+            const unsigned t_block,
+            const int16_t t_threshold,
+            std::vector<unsigned> &t_blocks) const {
+        if (m_max[t_level][t_block] < t_threshold) {
+            return;
+        }
+        if (!t_level) {
+            t_blocks.push_back(t_block);
+            return;
+        }
+        const std::vector<int16_t> &childMax = m_max[t_level - 1];
+        const unsigned firstChild = t_block * kBlockSize;
+        const unsigned lastChild = std::min(firstChild + kBlockSize, static_cast<unsigned>(childMax.size()));
+        for (unsigned child = firstChild; child < lastChild; ++child) {
+            // Level 0 children are checked here rather than by another call.
+            if (t_level > 1) {
+                findBlocksAbove(t_level - 1, child, t_threshold, t_blocks);
+            }
+            else if (childMax[child] >= t_threshold) {
+                t_blocks.push_back(child);
+            }
+        }
+    }
+}
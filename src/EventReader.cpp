@@ -0,0 +1,232 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "EventReader.h"
+
+
+namespace pixy_roimux {
+    EventReader::EventReader(
+            const std::string t_rootFileName,
+            const std::vector<unsigned> &t_eventIds,
+            const RunParams &t_runParams,
+            const unsigned t_nThreads,
+            const unsigned t_queueSize) :
+            m_rootFileName(t_rootFileName),
+            m_eventIds(t_eventIds),
+            m_runParams(t_runParams),
+            m_queueSize(std::max(t_queueSize, 1u)),
+            m_batchSize((m_queueSize + std::max(t_nThreads, 1u) - 1) / std::max(t_nThreads, 1u)),
+            m_startTime(std::chrono::steady_clock::now()) {
+        if (NativeRawFile::isNativeFile(m_rootFileName)) {
+            // Loading from the mapping is only a page fault, there's nothing to prefetch.
+            m_nativeFile = std::unique_ptr<NativeRawFile>(new NativeRawFile(m_rootFileName, m_runParams));
+        }
+        else if (t_nThreads) {
+            // Each thread uses its own TFile, but ROOT still needs to protect its global state.
+            ROOT::EnableThreadSafety();
+            {
+                TFile rootFile(m_rootFileName.c_str(), "READ");
+                if (!rootFile.IsOpen()) {
+                    std::cerr << "ERROR: Failed to open raw data file " << m_rootFileName << '!' << std::endl;
+                    exit(1);
+                }
+                // Only whole windows of queueSize events can be reordered without holding more events in memory.
+                m_readOrder = DaqKeyIndex(rootFile).getReadOrder(m_eventIds, m_queueSize);
+                rootFile.Close();
+            }
+            for (unsigned thread = 0; thread < t_nThreads; ++thread) {
+                m_threads.emplace_back(&EventReader::readLoop, this);
+            }
+        }
+        else {
+            m_syncFile = std::unique_ptr<TFile>(new TFile(m_rootFileName.c_str(), "READ"));
+            if (!m_syncFile->IsOpen()) {
+                std::cerr << "ERROR: Failed to open raw data file " << m_rootFileName << '!' << std::endl;
+                exit(1);
+            }
+            m_syncIndex = std::unique_ptr<DaqKeyIndex>(new DaqKeyIndex(*m_syncFile));
+        }
+    }
+
+
+    EventReader::~EventReader() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_consumed.notify_all();
+        for (auto &&thread : m_threads) {
+            thread.join();
+        }
+    }
+
+
+    bool EventReader::next(EventWaveforms &t_waveforms) {
+        const auto waitStart = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_nextDeliver >= m_eventIds.size()) {
+            return false;
+        }
+        if (m_nativeFile) {
+            const unsigned eventId = m_eventIds.at(m_nextDeliver);
+            if (!m_nativeFile->hasEvent(eventId)) {
+                std::cerr << "ERROR: Failed to load event ID " << eventId
+                          << " from file " << m_rootFileName << '!' << std::endl;
+                exit(1);
+            }
+            t_waveforms = m_nativeFile->getEvent(eventId);
+            m_readTime += std::chrono::steady_clock::now() - waitStart;
+            m_waitTime += std::chrono::steady_clock::now() - waitStart;
+            ++m_nextDeliver;
+            return true;
+        }
+        // Without background threads, read the event ourselves.
+        if (m_threads.empty()) {
+            const unsigned eventId = m_eventIds.at(m_nextDeliver);
+            const bool success = convertEvent(eventId, m_syncIndex->read(eventId), t_waveforms, m_convertTime);
+            m_nReads = m_syncIndex->getNReads();
+            if (!success) {
+                std::cerr << "ERROR: Failed to load event ID " << eventId
+                          << " from file " << m_rootFileName << '!' << std::endl;
+                exit(1);
+            }
+            // The consumer waits for the whole read.
+            m_readTime += std::chrono::steady_clock::now() - waitStart;
+            m_waitTime += std::chrono::steady_clock::now() - waitStart;
+            ++m_nextDeliver;
+            return true;
+        }
+        m_produced.wait(lock, [this] { return m_failed || m_ready.count(m_nextDeliver); });
+        if (m_failed) {
+            std::cerr << "ERROR: Failed to load event ID " << m_failedEventId
+                      << " from file " << m_rootFileName << '!' << std::endl;
+            exit(1);
+        }
+        auto readyEvent = m_ready.find(m_nextDeliver);
+        t_waveforms = std::move(readyEvent->second);
+        m_ready.erase(readyEvent);
+        ++m_nextDeliver;
+        m_waitTime += std::chrono::steady_clock::now() - waitStart;
+        lock.unlock();
+        // A slot in the queue became free.
+        m_consumed.notify_all();
+        return true;
+    }
+
+
+    void EventReader::readLoop() {
+        TFile rootFile(m_rootFileName.c_str(), "READ");
+        if (!rootFile.IsOpen()) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_failed) {
+                m_failed = true;
+                m_failedEventId = m_eventIds.empty() ? 0 : m_eventIds.front();
+            }
+            m_produced.notify_all();
+            return;
+        }
+        DaqKeyIndex keyIndex(rootFile);
+        std::vector<unsigned long> eventIdxs;
+        std::vector<unsigned> eventIds;
+        std::vector<std::pair<TH2S *, TH2S *>> histos;
+        while (true) {
+            eventIdxs.clear();
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                // Wait for a free slot in the queue for the next event in read order.
+                m_consumed.wait(lock, [this] {
+                    return m_stop || m_failed || (m_nextRead >= m_readOrder.size()) ||
+                           (m_readOrder.at(m_nextRead) < m_nextDeliver + m_queueSize);
+                });
+                if (m_stop || m_failed || (m_nextRead >= m_readOrder.size())) {
+                    break;
+                }
+                // Claim the following events of the window as long as they fit into the queue.
+                const unsigned long windowStop = std::min((m_nextRead / m_queueSize + 1) * m_queueSize,
+                                                          static_cast<unsigned long>(m_readOrder.size()));
+                while ((m_nextRead < windowStop) && (eventIdxs.size() < m_batchSize) &&
+                       (m_readOrder.at(m_nextRead) < m_nextDeliver + m_queueSize)) {
+                    eventIdxs.push_back(m_readOrder.at(m_nextRead));
+                    ++m_nextRead;
+                }
+            }
+            const auto readStart = std::chrono::steady_clock::now();
+            eventIds.clear();
+            for (const auto eventIdx : eventIdxs) {
+                eventIds.push_back(m_eventIds.at(eventIdx));
+            }
+            keyIndex.read(eventIds, histos);
+            const auto readStop = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_readTime += readStop - readStart;
+            }
+            for (unsigned long batchIdx = 0; batchIdx < eventIdxs.size(); ++batchIdx) {
+                const auto convertStart = std::chrono::steady_clock::now();
+                EventWaveforms waveforms;
+                std::chrono::duration<double> convertTime(0.);
+                const bool success = convertEvent(eventIds.at(batchIdx), histos.at(batchIdx), waveforms, convertTime);
+                const auto convertStop = std::chrono::steady_clock::now();
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_readTime += convertStop - convertStart;
+                    m_convertTime += convertTime;
+                    if (success) {
+                        m_ready.emplace(eventIdxs.at(batchIdx), std::move(waveforms));
+                    }
+                    else if (!m_failed) {
+                        m_failed = true;
+                        m_failedEventId = eventIds.at(batchIdx);
+                    }
+                }
+                m_produced.notify_all();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_nReads += keyIndex.getNReads();
+        }
+        rootFile.Close();
+    }
+
+
+    bool EventReader::convertEvent(
+            const unsigned t_eventId,
+            const std::pair<TH2S *, TH2S *> &t_histos,
+            EventWaveforms &t_waveforms,
+            std::chrono::duration<double> &t_convertTime) const {
+        TH2S *const indHisto = t_histos.first;
+        TH2S *const colHisto = t_histos.second;
+        bool success = false;
+        if (indHisto && colHisto) {
+            const auto convertStart = std::chrono::steady_clock::now();
+            t_waveforms = EventWaveforms(t_eventId, m_runParams.getNPixels(), m_runParams.getNRois(),
+                                         m_runParams.getNSamples());
+            ChargeData::convertEvent(*indHisto, *colHisto, m_runParams, t_waveforms);
+            t_convertTime += std::chrono::steady_clock::now() - convertStart;
+            success = true;
+        }
+        // The histograms are owned by the file, delete them right away so they don't pile up until it's closed.
+        delete indHisto;
+        delete colHisto;
+        return success;
+    }
+
+
+    void EventReader::printStats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const std::chrono::duration<double> wallTime = std::chrono::steady_clock::now() - m_startTime;
+        std::cout << "Event reader: " << m_nextDeliver << " events with " << m_threads.size()
+                  << " prefetching threads, " << m_nReads << " vectored reads.\n";
+        std::cout << "Event reader: read time " << m_readTime.count() * 1e3 << "ms, consumer wait time "
+                  << m_waitTime.count() * 1e3 << "ms, wall time " << wallTime.count() * 1e3 << "ms.\n";
+        if (m_nextDeliver) {
+            std::cout << "Event reader: conversion " << m_convertTime.count() * 1e6 / m_nextDeliver
+                      << "us per event.\n";
+            std::cout << "Event reader: throughput " << m_nextDeliver / wallTime.count() << " events/s, "
+                      << 100. * std::max(0., 1. - m_waitTime.count() / std::max(m_readTime.count(), 1e-9))
+                      << "% of the read time hidden behind processing.\n";
+        }
+    }
+}
@@ -0,0 +1,164 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "EventSelection.h"
+
+
+namespace pixy_roimux {
+    namespace {
+        ///
+        /// Identifies the index file format. Bump the version whenever the layout changes.
+        ///
+        const char kIndexMagic[8] = {'P', 'X', 'R', 'N', 'K', 'I', 'D', '1'};
+    }
+
+
+    EventSelection::EventSelection(const std::string &t_rankingFileName) :
+            m_rankingFileName(t_rankingFileName),
+            m_indexFileName(t_rankingFileName + ".idx") {
+        struct stat rankingFileStat;
+        if (stat(m_rankingFileName.c_str(), &rankingFileStat)) {
+            std::cerr << "ERROR: Failed to open ranking file " << m_rankingFileName << '!' << std::endl;
+            exit(1);
+        }
+        m_rankingFileSize = static_cast<uint64_t>(rankingFileStat.st_size);
+        m_rankingFileMtime = static_cast<int64_t>(rankingFileStat.st_mtime);
+        if (loadIndex()) {
+            std::cout << "Loaded ranking index " << m_indexFileName << ".\n";
+        }
+        else {
+            std::cout << "Building ranking index " << m_indexFileName << "...\n";
+            buildIndex();
+            writeIndex();
+        }
+    }
+
+
+    std::vector<unsigned> EventSelection::select(
+            const int t_minRanking,
+            const int t_maxRanking) const {
+        std::vector<unsigned> eventIds;
+        if (t_minRanking > t_maxRanking) {
+            return eventIds;
+        }
+        const auto rankingStop = m_index.upper_bound(t_maxRanking);
+        for (auto ranking = m_index.lower_bound(t_minRanking); ranking != rankingStop; ++ranking) {
+            eventIds.insert(eventIds.end(), ranking->second.cbegin(), ranking->second.cend());
+        }
+        // Restore the order of the ranking tree as events of different ranking values are interleaved.
+        std::sort(eventIds.begin(), eventIds.end());
+        return eventIds;
+    }
+
+
+    bool EventSelection::loadIndex() {
+        std::ifstream indexFile(m_indexFileName, std::ifstream::binary);
+        if (!indexFile.is_open()) {
+            return false;
+        }
+        char magic[sizeof(kIndexMagic)];
+        uint64_t rankingFileSize;
+        int64_t rankingFileMtime;
+        uint64_t nEvents;
+        uint32_t nValues;
+        indexFile.read(magic, sizeof(magic));
+        indexFile.read(reinterpret_cast<char *>(&rankingFileSize), sizeof(rankingFileSize));
+        indexFile.read(reinterpret_cast<char *>(&rankingFileMtime), sizeof(rankingFileMtime));
+        indexFile.read(reinterpret_cast<char *>(&nEvents), sizeof(nEvents));
+        indexFile.read(reinterpret_cast<char *>(&nValues), sizeof(nValues));
+        if (!indexFile || !std::equal(magic, magic + sizeof(magic), kIndexMagic)
+            || (rankingFileSize != m_rankingFileSize) || (rankingFileMtime != m_rankingFileMtime)) {
+            return false;
+        }
+        std::map<int, std::vector<unsigned>> index;
+        unsigned long nIndexedEvents = 0;
+        for (uint32_t value = 0; value < nValues; ++value) {
+            int32_t ranking;
+            uint32_t nIds;
+            indexFile.read(reinterpret_cast<char *>(&ranking), sizeof(ranking));
+            indexFile.read(reinterpret_cast<char *>(&nIds), sizeof(nIds));
+            if (!indexFile || (nIndexedEvents + nIds > nEvents)) {
+                return false;
+            }
+            std::vector<uint32_t> ids(nIds);
+            indexFile.read(reinterpret_cast<char *>(ids.data()), nIds * sizeof(uint32_t));
+            if (!indexFile) {
+                return false;
+            }
+            index[ranking].assign(ids.cbegin(), ids.cend());
+            nIndexedEvents += nIds;
+        }
+        if (nIndexedEvents != nEvents) {
+            return false;
+        }
+        m_nEvents = nEvents;
+        m_index = std::move(index);
+        return true;
+    }
+
+
+    void EventSelection::buildIndex() {
+        TFile rankingFile(m_rankingFileName.c_str(), "READ");
+        if (!rankingFile.IsOpen()) {
+            std::cerr << "ERROR: Failed to open ranking file " << m_rankingFileName << '!' << std::endl;
+            exit(1);
+        }
+        TTree *rankingTree = nullptr;
+        rankingFile.GetObject("RankingTime", rankingTree);
+        if (!rankingTree) {
+            std::cerr << "ERROR: Failed to find \"RankingTime\" tree in ranking file " << m_rankingFileName << '!'
+                      << std::endl;
+            exit(1);
+        }
+        TBranch *rankingBranch = rankingTree->GetBranch("Ranking");
+        if (!rankingBranch) {
+            std::cerr << "ERROR: Failed to find \"Ranking\" branch in ranking file " << m_rankingFileName << '!'
+                      << std::endl;
+            exit(1);
+        }
+        // Only the baskets of the Ranking branch are read and decompressed.
+        rankingTree->SetBranchStatus("*", false);
+        rankingTree->SetBranchStatus("Ranking", true);
+        int ranking;
+        rankingTree->SetBranchAddress("Ranking", &ranking);
+        m_nEvents = static_cast<unsigned long>(rankingTree->GetEntries());
+        m_index.clear();
+        for (unsigned event = 0; event < m_nEvents; ++event) {
+            rankingBranch->GetEntry(event);
+            m_index[ranking].push_back(event);
+        }
+        rankingFile.Close();
+    }
+
+
+    void EventSelection::writeIndex() const {
+        // Write to a temporary file first and move it into place, so concurrent runs never see a partial index.
+        const std::string tmpFileName = m_indexFileName + ".tmp";
+        std::ofstream indexFile(tmpFileName, std::ofstream::binary | std::ofstream::trunc);
+        if (!indexFile.is_open()) {
+            std::cerr << "WARNING: Failed to write ranking index " << m_indexFileName << '.' << std::endl;
+            return;
+        }
+        const uint64_t nEvents = m_nEvents;
+        const uint32_t nValues = m_index.size();
+        indexFile.write(kIndexMagic, sizeof(kIndexMagic));
+        indexFile.write(reinterpret_cast<const char *>(&m_rankingFileSize), sizeof(m_rankingFileSize));
+        indexFile.write(reinterpret_cast<const char *>(&m_rankingFileMtime), sizeof(m_rankingFileMtime));
+        indexFile.write(reinterpret_cast<const char *>(&nEvents), sizeof(nEvents));
+        indexFile.write(reinterpret_cast<const char *>(&nValues), sizeof(nValues));
+        for (const auto &ranking : m_index) {
+            const int32_t value = ranking.first;
+            const uint32_t nIds = ranking.second.size();
+            const std::vector<uint32_t> ids(ranking.second.cbegin(), ranking.second.cend());
+            indexFile.write(reinterpret_cast<const char *>(&value), sizeof(value));
+            indexFile.write(reinterpret_cast<const char *>(&nIds), sizeof(nIds));
+            indexFile.write(reinterpret_cast<const char *>(ids.data()), nIds * sizeof(uint32_t));
+        }
+        indexFile.close();
+        if (!indexFile || std::rename(tmpFileName.c_str(), m_indexFileName.c_str())) {
+            std::cerr << "WARNING: Failed to write ranking index " << m_indexFileName << '.' << std::endl;
+            std::remove(tmpFileName.c_str());
+        }
+    }
+}
@@ -0,0 +1,124 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "EventWaveforms.h"
+
+
+namespace pixy_roimux {
+    const unsigned PlaneWaveforms::kAlignment;
+
+
+    PlaneWaveforms::PlaneWaveforms(
+            const unsigned t_nChannels,
+            const unsigned t_nSamples) :
+            m_nChannels(t_nChannels),
+            m_nSamples(t_nSamples),
+            m_stride(computeStride(t_nSamples)),
+            m_buffer(t_nChannels * computeStride(t_nSamples), 0),
+            m_data(m_buffer.data()) {
+    }
+
+
+    PlaneWaveforms::PlaneWaveforms(
+            const unsigned t_nChannels,
+            const unsigned t_nSamples,
+            const unsigned t_stride,
+            int16_t *const t_data,
+            std::shared_ptr<void> t_storage) :
+            m_nChannels(t_nChannels),
+            m_nSamples(t_nSamples),
+            m_stride(t_stride),
+            m_storage(std::move(t_storage)),
+            m_data(t_data) {
+        if ((t_stride < t_nSamples) || (t_stride % computeStride(1))
+            || (reinterpret_cast<std::uintptr_t>(t_data) % kAlignment)) {
+            std::cerr << "ERROR: External waveform storage is not aligned to " << kAlignment << " bytes!" << std::endl;
+            exit(1);
+        }
+    }
+
+
+    PlaneWaveforms::PlaneWaveforms(const PlaneWaveforms &t_other) :
+            m_nChannels(t_other.m_nChannels),
+            m_nSamples(t_other.m_nSamples),
+            m_stride(t_other.m_stride),
+            m_buffer(t_other.m_data, t_other.m_data + t_other.m_nChannels * t_other.m_stride),
+            m_data(m_buffer.data()) {
+    }
+
+
+    PlaneWaveforms::PlaneWaveforms(PlaneWaveforms &&t_other) noexcept :
+            m_nChannels(t_other.m_nChannels),
+            m_nSamples(t_other.m_nSamples),
+            m_stride(t_other.m_stride),
+            m_buffer(std::move(t_other.m_buffer)),
+            m_storage(std::move(t_other.m_storage)),
+            m_data(t_other.m_data) {
+        t_other.m_nChannels = 0;
+        t_other.m_nSamples = 0;
+        t_other.m_stride = 0;
+        t_other.m_buffer.clear();
+        t_other.m_data = nullptr;
+    }
+
+
+    PlaneWaveforms &PlaneWaveforms::operator=(const PlaneWaveforms &t_other) {
+        if (this != &t_other) {
+            PlaneWaveforms copy(t_other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+
+    PlaneWaveforms &PlaneWaveforms::operator=(PlaneWaveforms &&t_other) noexcept {
+        if (this != &t_other) {
+            m_nChannels = t_other.m_nChannels;
+            m_nSamples = t_other.m_nSamples;
+            m_stride = t_other.m_stride;
+            m_buffer = std::move(t_other.m_buffer);
+            m_storage = std::move(t_other.m_storage);
+            m_data = t_other.m_data;
+            t_other.m_nChannels = 0;
+            t_other.m_nSamples = 0;
+            t_other.m_stride = 0;
+            t_other.m_buffer.clear();
+            t_other.m_data = nullptr;
+        }
+        return *this;
+    }
+
+
+    std::unique_ptr<TH2S> PlaneWaveforms::makeHisto(const std::string &t_name) const {
+        std::unique_ptr<TH2S> histo(new TH2S(t_name.c_str(), t_name.c_str(),
+                                             m_nSamples, 0, m_nSamples, m_nChannels, 0, m_nChannels));
+        // Pay attention to the histo bin numbering!!! Loops (as everything else) start at 0, histos start at 1!!!
+        for (unsigned channel = 0; channel < m_nChannels; ++channel) {
+            const auto samples = getChannel(channel);
+            for (unsigned sample = 0; sample < m_nSamples; ++sample) {
+                histo->SetBinContent((sample + 1), (channel + 1), samples[sample]);
+            }
+        }
+        return histo;
+    }
+
+
+    std::unique_ptr<TH1D> PlaneWaveforms::makeChannelHisto(
+            const std::string &t_name,
+            const unsigned t_channel) const {
+        std::unique_ptr<TH1D> histo(new TH1D(t_name.c_str(), t_name.c_str(), m_nSamples, 0, m_nSamples));
+        const auto samples = getChannel(t_channel);
+        for (unsigned sample = 0; sample < m_nSamples; ++sample) {
+            histo->SetBinContent((sample + 1), samples[sample]);
+        }
+        return histo;
+    }
+
+
+    unsigned PlaneWaveforms::computeStride(const unsigned t_nSamples) {
+        // Round up to a multiple of the number of samples fitting in one aligned block.
+        const unsigned blockSamples = kAlignment / sizeof(int16_t);
+        return ((t_nSamples + blockSamples - 1) / blockSamples) * blockSamples;
+    }
+}
@@ -0,0 +1,85 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "FrequencyFilter.h"
+
+
+namespace pixy_roimux {
+    FrequencyFilter::FrequencyFilter(const RunParams &t_runParams) :
+            m_sampleTime(t_runParams.getSampleTime()),
+            m_lowPassCutoff(t_runParams.getLowPassCutoff()),
+            m_notchFrequencies(t_runParams.getNotchFrequencies()),
+            m_notchWidth(t_runParams.getNotchWidth()) {
+        if (m_sampleTime <= 0.) {
+            std::cerr << "ERROR: Frequency filter needs a positive sample time!" << std::endl;
+            exit(1);
+        }
+    }
+
+
+    const std::vector<double> &FrequencyFilter::getMask(const unsigned t_nSamples) {
+        auto maskItr = m_masks.find(t_nSamples);
+        if (maskItr != m_masks.end()) {
+            return maskItr->second;
+        }
+        const unsigned nBins = BatchedFft::getNBins(t_nSamples);
+        std::vector<double> &mask = m_masks[t_nSamples];
+        mask.assign(nBins, 1. / t_nSamples);
+        // Bin k is at k / (nSamples * sampleTime) MHz with the sample time in us.
+        const double binWidth = 1. / (t_nSamples * m_sampleTime);
+        for (unsigned bin = 1; bin < nBins; ++bin) {
+            const double frequency = bin * binWidth;
+            if ((m_lowPassCutoff > 0.) && (frequency > m_lowPassCutoff)) {
+                mask.at(bin) = 0.;
+            }
+            for (const auto &notchFrequency : m_notchFrequencies) {
+                if (std::abs(frequency - notchFrequency) <= m_notchWidth / 2.) {
+                    mask.at(bin) = 0.;
+                }
+            }
+        }
+        return mask;
+    }
+
+
+    void FrequencyFilter::filterPlane(PlaneWaveforms &t_plane) {
+        if (!t_plane.getNChannels() || !t_plane.getNSamples()) {
+            return;
+        }
+        const std::vector<double> &mask = getMask(t_plane.getNSamples());
+
+        const auto loadStart = std::chrono::steady_clock::now();
+        m_fft.load(t_plane);
+        const auto forwardStart = std::chrono::steady_clock::now();
+        m_fft.forward();
+        const auto maskStart = std::chrono::steady_clock::now();
+        m_fft.multiply(mask);
+        const auto inverseStart = std::chrono::steady_clock::now();
+        m_fft.inverse();
+        const auto storeStart = std::chrono::steady_clock::now();
+        m_fft.store(t_plane);
+        const auto storeStop = std::chrono::steady_clock::now();
+
+        ++m_nPlanes;
+        m_loadTime += forwardStart - loadStart;
+        m_forwardTime += maskStart - forwardStart;
+        m_maskTime += inverseStart - maskStart;
+        m_inverseTime += storeStart - inverseStart;
+        m_storeTime += storeStop - storeStart;
+    }
+
+
+    void FrequencyFilter::printStats() const {
+        if (!m_nPlanes) {
+            return;
+        }
+        const double nPlanes = m_nPlanes;
+        std::cout << "Frequency filter: " << m_nPlanes << " planes, " << m_fft.getNGeometries()
+                  << " geometries, planning " << m_fft.getPlanTime().count() * 1e3 << "ms.\n";
+        std::cout << "Frequency filter per plane: load " << m_loadTime.count() * 1e6 / nPlanes << "us, forward "
+                  << m_forwardTime.count() * 1e6 / nPlanes << "us, mask " << m_maskTime.count() * 1e6 / nPlanes
+                  << "us, inverse " << m_inverseTime.count() * 1e6 / nPlanes << "us, store "
+                  << m_storeTime.count() * 1e6 / nPlanes << "us.\n";
+    }
+}
@@ -0,0 +1,156 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "HitDiagnostics.h"
+
+
+namespace pixy_roimux {
+    HitDiagnostics::HitDiagnostics() :
+            m_timePeakAcceptance("TimePeakAcceptance", "Time Difference in Peaks", 100, -400, 400),
+            m_timeFirstSampleAcceptance("TimeFirstSampleAcceptance", "Time Difference in Rising Edge", 100, -400, 400),
+            m_roiMaxPulses("ROIMaxPulses", "ROI (Positive) Pulse Peaks", 100, 0, 800),
+            m_pixelMaxPulses("PixelMaxPulses", "Pixel Pulse Peaks", 100, 0, 1500),
+            m_thresholdPosPixelPeaks("ThresholdPosPixelPeaks", "Threshold for Positive Pixel Peaks", 100, 0, 1500),
+            m_transparency("Transparency", "Transparency of Induction Grid", 100, 0, 140),
+            m_pixelPulseWidths("PixelPulseWidths", "Pixel Pulse Widths", 100, 0, 300),
+            m_roiPulseWidths("ROIPulseWidths", "ROI Pulse Widths", 100, 0, 400),
+            m_pixelNoiseSigmas("PixelNoiseSigmas", "Pixel Noise Standard Deviations", 100, 0, 50),
+            m_roiNoiseSigmas("ROINoiseSigmas", "ROI Noise Standard Deviations", 100, 0, 50) {
+        // The histograms live as long as this object, so they must not be owned by whatever file is open right now.
+        for (auto histo : {&m_timePeakAcceptance, &m_timeFirstSampleAcceptance, &m_roiMaxPulses, &m_pixelMaxPulses,
+                           &m_thresholdPosPixelPeaks, &m_transparency, &m_pixelPulseWidths, &m_roiPulseWidths,
+                           &m_pixelNoiseSigmas, &m_roiNoiseSigmas}) {
+            histo->SetDirectory(nullptr);
+        }
+        m_timePeakAcceptance.GetXaxis()->SetTitle("Samples (1 sample = 210 ns)");
+        m_timeFirstSampleAcceptance.GetXaxis()->SetTitle("Samples (1 sample = 210 ns)");
+        m_roiMaxPulses.GetXaxis()->SetTitle("ADC Value");
+        m_pixelMaxPulses.GetXaxis()->SetTitle("ADC Value");
+        m_thresholdPosPixelPeaks.GetXaxis()->SetTitle("ADC Value");
+        m_transparency.GetXaxis()->SetTitle("Transparency (%)");
+        m_pixelPulseWidths.GetXaxis()->SetTitle("Samples (1 sample = 210 ns)");
+        m_roiPulseWidths.GetXaxis()->SetTitle("Samples (1 sample = 210 ns)");
+        m_pixelNoiseSigmas.GetXaxis()->SetTitle("ADC Value");
+        m_roiNoiseSigmas.GetXaxis()->SetTitle("ADC Value");
+    }
+
+
+    void HitDiagnostics::addNoiseModel(const NoiseModel &t_noiseModel) {
+        // Masked channels have no noise estimate.
+        for (const auto &noise : t_noiseModel.getPixelNoise()) {
+            if (!noise.masked) {
+                m_pixelNoiseSigmas.Fill(noise.sigma);
+            }
+        }
+        for (const auto &noise : t_noiseModel.getRoiNoise()) {
+            if (!noise.masked) {
+                m_roiNoiseSigmas.Fill(noise.sigma);
+            }
+        }
+    }
+
+
+    void HitDiagnostics::addPixelHit(
+            const Hit2d &t_hit,
+            const double t_thrPosPeak) {
+        m_pixelMaxPulses.Fill(t_hit.posPulseHeight);
+        m_thresholdPosPixelPeaks.Fill(t_thrPosPeak);
+        m_pixelPulseWidths.Fill(t_hit.posPulseWidth);
+    }
+
+
+    void HitDiagnostics::addRoiHit(const Hit2d &t_hit) {
+        m_roiMaxPulses.Fill(t_hit.posPulseHeight);
+        m_roiPulseWidths.Fill(t_hit.posPulseWidth + t_hit.negPulseWidth);
+    }
+
+
+    void HitDiagnostics::addMatch(
+            const Hit2d &t_pixelHit,
+            const Hit2d &t_roiHit,
+            const bool t_fillTransparency) {
+        if (t_fillTransparency) {
+            m_transparency.Fill((100.0 * t_pixelHit.pulseIntegral) / (t_pixelHit.pulseIntegral + t_roiHit.pulseIntegral));
+        }
+        m_timePeakAcceptance.Fill(static_cast<int>(t_pixelHit.posPeakSample - t_roiHit.posPeakSample));
+        m_timeFirstSampleAcceptance.Fill(static_cast<int>(t_pixelHit.firstSample - t_roiHit.firstSample));
+    }
+
+
+    void HitDiagnostics::addEvent(
+            const unsigned t_nAmbiguities,
+            const unsigned t_nUnmatchedPixelHits) {
+        m_ambiguities.push_back(t_nAmbiguities);
+        m_unmatched.push_back(t_nUnmatchedPixelHits);
+    }
+
+
+    void HitDiagnostics::write(const std::string &t_fileName) const {
+        // Create histograms for ambiguities and unmatched pixels.
+        // They live on the stack, so they must not be owned by any file.
+        TH1S ambiguities("Ambiguities", "Ambiguities", m_ambiguities.size(), 0, m_ambiguities.size());
+        ambiguities.SetDirectory(nullptr);
+        ambiguities.GetXaxis()->SetTitle("Event #");
+        for (unsigned i = 0; i < m_ambiguities.size(); ++i) {
+            ambiguities.SetBinContent(i + 1, m_ambiguities.at(i));
+        }
+        TH1S unmatched("Unmatched", "Unmatched", m_unmatched.size(), 0, m_unmatched.size());
+        unmatched.SetDirectory(nullptr);
+        unmatched.GetXaxis()->SetTitle("Event #");
+        for (unsigned i = 0; i < m_unmatched.size(); ++i) {
+            unmatched.SetBinContent(i + 1, m_unmatched.at(i));
+        }
+        TFile results(t_fileName.c_str(), "RECREATE");
+        ambiguities.Write();
+        unmatched.Write();
+        m_timePeakAcceptance.Write();
+        m_timeFirstSampleAcceptance.Write();
+        m_roiMaxPulses.Write();
+        m_pixelMaxPulses.Write();
+        m_thresholdPosPixelPeaks.Write();
+        m_transparency.Write();
+        m_pixelPulseWidths.Write();
+        m_roiPulseWidths.Write();
+        m_pixelNoiseSigmas.Write();
+        m_roiNoiseSigmas.Write();
+        results.Close();
+    }
+
+
+    void HitDiagnostics::add(const std::string &t_fileName) {
+        TFile results(t_fileName.c_str(), "READ");
+        if (!results.IsOpen()) {
+            std::cerr << "ERROR: Failed to open diagnostics file " << t_fileName << '!' << std::endl;
+            exit(1);
+        }
+        // The histograms read from the file are owned by it and deleted when it's closed.
+        TH1S *ambiguities = nullptr;
+        results.GetObject("Ambiguities", ambiguities);
+        TH1S *unmatched = nullptr;
+        results.GetObject("Unmatched", unmatched);
+        if (!ambiguities || !unmatched) {
+            std::cerr << "ERROR: Failed to find the per-event diagnostics in " << t_fileName << '!' << std::endl;
+            exit(1);
+        }
+        for (int bin = 1; bin <= ambiguities->GetNbinsX(); ++bin) {
+            m_ambiguities.push_back(static_cast<unsigned>(ambiguities->GetBinContent(bin)));
+        }
+        for (int bin = 1; bin <= unmatched->GetNbinsX(); ++bin) {
+            m_unmatched.push_back(static_cast<unsigned>(unmatched->GetBinContent(bin)));
+        }
+        for (auto histo : {&m_timePeakAcceptance, &m_timeFirstSampleAcceptance, &m_roiMaxPulses, &m_pixelMaxPulses,
+                           &m_thresholdPosPixelPeaks, &m_transparency, &m_pixelPulseWidths, &m_roiPulseWidths,
+                           &m_pixelNoiseSigmas, &m_roiNoiseSigmas}) {
+            TH1S *fileHisto = nullptr;
+            results.GetObject(histo->GetName(), fileHisto);
+            if (!fileHisto) {
+                std::cerr << "ERROR: Failed to find histogram " << histo->GetName() << " in " << t_fileName << '!'
+                          << std::endl;
+                exit(1);
+            }
+            histo->Add(fileHisto);
+        }
+        results.Close();
+    }
+}
@@ -109,16 +109,34 @@ namespace pixy_roimux {
     void KalmanFit::fit(
             const ChargeHits &t_chargeHits,
             const std::string t_treeFileName) {
-        TFile treeFile(t_treeFileName.c_str(), "RECREATE");
+        openTree(t_treeFileName);
+        fitEvents(t_chargeHits);
+        closeTree();
+    }
+
+
+    void KalmanFit::openTree(const std::string t_treeFileName) {
+        m_treeFile = std::unique_ptr<TFile>(new TFile(t_treeFileName.c_str(), "RECREATE"));
         m_tree = std::unique_ptr<TTree>(new TTree("genfitTree", "genfitTree"));
         m_tree->Branch("Track", &m_trackPtr, 64000, 0);
         m_tree->Branch("eventId", &m_eventId, "eventId/i");
+    }
+
+
+    void KalmanFit::fitEvents(const ChargeHits &t_chargeHits) {
         for (const auto& event : t_chargeHits.getEvents()) {
             std::cout << "Fitting event number " << event.eventId << "...\n";
             fitEvent(event);
         }
+    }
+
+
+    void KalmanFit::closeTree() {
+        // Other files may have been opened in the meantime, so make sure the tree is written to its own file.
+        m_treeFile->cd();
         m_tree->Write();
         m_tree.reset(nullptr);
-        treeFile.Close();
+        m_treeFile->Close();
+        m_treeFile.reset(nullptr);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,106 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "MatchedFilter.h"
+
+
+namespace pixy_roimux {
+    MatchedFilter::MatchedFilter(const RunParams &t_runParams) :
+            m_origin(t_runParams.getPixelFilterOrigin()) {
+        const std::vector<double> &kernel = t_runParams.getPixelFilterKernel();
+        if (kernel.empty() || (m_origin >= kernel.size())) {
+            std::cerr << "ERROR: Pixel filter origin " << m_origin << " outside the pixel filter kernel of "
+                      << kernel.size() << " samples!" << std::endl;
+            exit(1);
+        }
+        double sum = 0.;
+        for (const auto &value : kernel) {
+            sum += value;
+        }
+        if (!(sum > 0.)) {
+            std::cerr << "ERROR: Pixel filter kernel must have a positive sum!" << std::endl;
+            exit(1);
+        }
+        m_kernel.reserve(kernel.size());
+        for (const auto &value : kernel) {
+            m_kernel.push_back(static_cast<float>(value / sum));
+        }
+    }
+
+
+    void MatchedFilter::filterPlane(PlaneWaveforms &t_plane) {
+        if (!t_plane.getNChannels() || !t_plane.getNSamples()) {
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        for (unsigned channel = 0; channel < t_plane.getNChannels(); ++channel) {
+            filterChannel(t_plane.getChannel(channel));
+        }
+        m_time += std::chrono::steady_clock::now() - start;
+        m_nSamples += static_cast<unsigned long>(t_plane.getNChannels()) * t_plane.getNSamples();
+        ++m_nPlanes;
+    }
+
+
+    void MatchedFilter::printStats() const {
+        if (!m_nPlanes) {
+            return;
+        }
+        std::cout << "Pixel matched filter: " << m_nPlanes << " planes, " << m_time.count() * 1e6 / m_nPlanes
+                  << "us per plane, " << m_nSamples / m_time.count() / 1e6 << " MSamples/s.\n";
+    }
+
+
+    void MatchedFilter::filterChannel(const Span<int16_t> t_samples) {
+        const unsigned nSamples = static_cast<unsigned>(t_samples.size());
+        const unsigned nTaps = static_cast<unsigned>(m_kernel.size());
+        // Extended sample i is channel sample i - origin, clamped to the channel.
+        m_extended.resize(nSamples + nTaps - 1);
+        for (unsigned sample = 0; sample < m_extended.size(); ++sample) {
+            m_extended[sample] = t_samples[std::min(std::max(sample, m_origin) - m_origin, nSamples - 1)];
+        }
+        const float *const extended = m_extended.data();
+        const float *const kernel = m_kernel.data();
+        unsigned sample = 0;
+        // Output sample j is the sum of kernel[k] * extended[j + k]. The filter reads from the extended copy only, so
+        // the results can be stored in place. The rounding of the conversions matches std::nearbyint.
+#if defined(__AVX2__)
+        for (; sample + 16 <= nSamples; sample += 16) {
+            __m256 low = _mm256_setzero_ps();
+            __m256 high = _mm256_setzero_ps();
+            for (unsigned tap = 0; tap < nTaps; ++tap) {
+                const __m256 weight = _mm256_set1_ps(kernel[tap]);
+                low = _mm256_add_ps(low, _mm256_mul_ps(weight, _mm256_loadu_ps(extended + sample + tap)));
+                high = _mm256_add_ps(high, _mm256_mul_ps(weight, _mm256_loadu_ps(extended + sample + tap + 8)));
+            }
+            // packs_epi32 interleaves the 128 bit lanes of its inputs.
+            const __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(low), _mm256_cvtps_epi32(high));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(t_samples.data() + sample),
+                                _mm256_permute4x64_epi64(packed, 0xD8));
+        }
+#elif defined(__SSE2__)
+        for (; sample + 8 <= nSamples; sample += 8) {
+            __m128 low = _mm_setzero_ps();
+            __m128 high = _mm_setzero_ps();
+            for (unsigned tap = 0; tap < nTaps; ++tap) {
+                const __m128 weight = _mm_set1_ps(kernel[tap]);
+                low = _mm_add_ps(low, _mm_mul_ps(weight, _mm_loadu_ps(extended + sample + tap)));
+                high = _mm_add_ps(high, _mm_mul_ps(weight, _mm_loadu_ps(extended + sample + tap + 4)));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(t_samples.data() + sample),
+                             _mm_packs_epi32(_mm_cvtps_epi32(low), _mm_cvtps_epi32(high)));
+        }
+#endif
+        for (; sample < nSamples; ++sample) {
+            float sum = 0.f;
+            for (unsigned tap = 0; tap < nTaps; ++tap) {
+                sum += kernel[tap] * extended[sample + tap];
+            }
+            const float rounded = std::nearbyint(sum);
+            t_samples[sample] = static_cast<int16_t>(
+                    std::min(std::max(rounded, static_cast<float>(std::numeric_limits<int16_t>::min())),
+                             static_cast<float>(std::numeric_limits<int16_t>::max())));
+        }
+    }
+}
@@ -0,0 +1,240 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "NativeRawFile.h"
+#include "TFile.h"
+#include "TH2S.h"
+#include "ChargeData.h"
+
+
+namespace pixy_roimux {
+    namespace {
+        ///
+        /// Magic number at the start of every native raw waveform file.
+        ///
+        const char kNativeMagic[8] = {'P', 'X', 'R', 'A', 'W', 'W', 'F', '\0'};
+
+        static_assert(sizeof(NativeRawHeader) == 48, "Unexpected padding in NativeRawHeader!");
+        static_assert(sizeof(NativeRawEntry) == 16, "Unexpected padding in NativeRawEntry!");
+
+        ///
+        /// Round an offset up to the alignment of the waveform planes.
+        ///
+        uint64_t alignOffset(const uint64_t t_offset) {
+            return ((t_offset + PlaneWaveforms::kAlignment - 1) / PlaneWaveforms::kAlignment) *
+                   PlaneWaveforms::kAlignment;
+        }
+
+        ///
+        /// Granularity in bytes at which the pages of an event are released from the mapping. On a page fault the kernel
+        /// also maps the cached pages around the faulting one, by default within a 64 kB window, so the pages of an
+        /// event are released including that window.
+        ///
+        const uint64_t kReleaseWindow = 65536;
+    }
+
+
+    const uint32_t NativeRawFile::kVersion;
+
+
+    NativeRawFile::NativeRawFile(
+            const std::string &t_fileName,
+            const RunParams &t_runParams) :
+            m_fileName(t_fileName),
+            m_nSamples(t_runParams.getNSamples()) {
+        const int fd = open(m_fileName.c_str(), O_RDONLY);
+        struct stat fileStat;
+        if ((fd < 0) || fstat(fd, &fileStat)) {
+            std::cerr << "ERROR: Failed to open native raw file " << m_fileName << '!' << std::endl;
+            exit(1);
+        }
+        const uint64_t fileSize = static_cast<uint64_t>(fileStat.st_size);
+        if (fileSize < sizeof(NativeRawHeader)) {
+            std::cerr << "ERROR: Native raw file " << m_fileName << " is truncated!" << std::endl;
+            exit(1);
+        }
+        // Read-only mapping: getEvent() copies the waveforms out, so the mapping is never written to.
+        void *const mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "ERROR: Failed to map native raw file " << m_fileName << '!' << std::endl;
+            exit(1);
+        }
+        m_mapping = std::shared_ptr<void>(mapping, [fileSize](void *t_mapping) { munmap(t_mapping, fileSize); });
+        m_mappingSize = fileSize;
+        const char *const fileData = static_cast<const char *>(mapping);
+
+        // Check the header against the run parameters.
+        std::memcpy(&m_header, fileData, sizeof(m_header));
+        if (std::memcmp(m_header.magic, kNativeMagic, sizeof(kNativeMagic)) || (m_header.version != kVersion)) {
+            std::cerr << "ERROR: " << m_fileName << " is not a native raw file of version " << kVersion << '!'
+                      << std::endl;
+            exit(1);
+        }
+        if ((m_header.nPixels != t_runParams.getNPixels()) || (m_header.nRois != t_runParams.getNRois())
+            || (m_header.nSamples < m_nSamples) || (m_header.stride < m_header.nSamples)
+            || (m_header.stride % PlaneWaveforms::computeStride(1))) {
+            std::cerr << "ERROR: Native raw file " << m_fileName << " with " << m_header.nPixels << " pixels, "
+                      << m_header.nRois << " ROIs and " << m_header.nSamples
+                      << " samples doesn't match the run parameters!" << std::endl;
+            exit(1);
+        }
+
+        // Read the offset table.
+        const uint64_t eventSize = static_cast<uint64_t>(m_header.nPixels + m_header.nRois) * m_header.stride *
+                                   sizeof(int16_t);
+        if ((m_header.tableOffset > fileSize)
+            || (m_header.nEvents > (fileSize - m_header.tableOffset) / sizeof(NativeRawEntry))) {
+            std::cerr << "ERROR: Native raw file " << m_fileName << " is truncated!" << std::endl;
+            exit(1);
+        }
+        for (uint64_t event = 0; event < m_header.nEvents; ++event) {
+            NativeRawEntry entry;
+            std::memcpy(&entry, fileData + m_header.tableOffset + event * sizeof(NativeRawEntry), sizeof(entry));
+            if ((entry.offset % PlaneWaveforms::kAlignment) || (entry.offset > fileSize)
+                || (eventSize > fileSize - entry.offset)) {
+                std::cerr << "ERROR: Native raw file " << m_fileName << " has a corrupt entry for event ID "
+                          << entry.eventId << '!' << std::endl;
+                exit(1);
+            }
+            m_offsets[entry.eventId] = entry.offset;
+        }
+    }
+
+
+    EventWaveforms NativeRawFile::getEvent(const unsigned t_eventId) const {
+        const auto offset = m_offsets.find(t_eventId);
+        if (offset == m_offsets.cend()) {
+            std::cerr << "ERROR: Failed to load event ID " << t_eventId
+                      << " from file " << m_fileName << '!' << std::endl;
+            exit(1);
+        }
+        int16_t *const pixelData = reinterpret_cast<int16_t *>(static_cast<char *>(m_mapping.get()) + offset->second);
+        int16_t *const roiData = pixelData + static_cast<uint64_t>(m_header.nPixels) * m_header.stride;
+        // Ask the kernel to start reading the pages of this event.
+        const uint64_t eventSize = static_cast<uint64_t>(m_header.nPixels + m_header.nRois) * m_header.stride *
+                                   sizeof(int16_t);
+        const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        const uint64_t pageOffset = (offset->second / pageSize) * pageSize;
+        madvise(static_cast<char *>(m_mapping.get()) + pageOffset, offset->second + eventSize - pageOffset,
+                MADV_WILLNEED);
+        // Copy both planes into owned buffers. The views into the read-only mapping are never written to.
+        const PlaneWaveforms pixelView(m_header.nPixels, m_nSamples, m_header.stride, pixelData, m_mapping);
+        const PlaneWaveforms roiView(m_header.nRois, m_nSamples, m_header.stride, roiData, m_mapping);
+        PlaneWaveforms pixelPlane(pixelView);
+        PlaneWaveforms roiPlane(roiView);
+        EventWaveforms waveforms(t_eventId, std::move(pixelPlane), std::move(roiPlane));
+        // Release the pages of this event from the mapping again, so the mapped pages don't pile up over the run. They
+        // stay in the page cache, so releasing pages shared with the neighbouring events only costs a minor fault.
+        const uint64_t releaseOffset = (offset->second / kReleaseWindow) * kReleaseWindow;
+        const uint64_t releaseEnd = std::min(((offset->second + eventSize + kReleaseWindow - 1) / kReleaseWindow) *
+                                             kReleaseWindow, m_mappingSize);
+        madvise(static_cast<char *>(m_mapping.get()) + releaseOffset, releaseEnd - releaseOffset, MADV_DONTNEED);
+        return waveforms;
+    }
+
+
+    std::vector<unsigned> NativeRawFile::getEventIds() const {
+        std::vector<unsigned> eventIds;
+        eventIds.reserve(m_offsets.size());
+        for (const auto &offset : m_offsets) {
+            eventIds.push_back(offset.first);
+        }
+        return eventIds;
+    }
+
+
+    bool NativeRawFile::isNativeFile(const std::string &t_fileName) {
+        std::ifstream file(t_fileName, std::ifstream::binary);
+        char magic[sizeof(kNativeMagic)];
+        file.read(magic, sizeof(magic));
+        return file && !std::memcmp(magic, kNativeMagic, sizeof(kNativeMagic));
+    }
+
+
+    unsigned long NativeRawFile::convert(
+            const std::string &t_rootFileName,
+            const std::string &t_nativeFileName,
+            const RunParams &t_runParams) {
+        TFile rootFile(t_rootFileName.c_str(), "READ");
+        if (!rootFile.IsOpen()) {
+            std::cerr << "ERROR: Failed to open raw data file " << t_rootFileName << '!' << std::endl;
+            exit(1);
+        }
+        // Write to a temporary file first and move it into place once it's complete.
+        const std::string tmpFileName = t_nativeFileName + ".tmp";
+        std::ofstream nativeFile(tmpFileName, std::ofstream::binary | std::ofstream::trunc);
+        if (!nativeFile.is_open()) {
+            std::cerr << "ERROR: Failed to open native raw file " << tmpFileName << '!' << std::endl;
+            exit(1);
+        }
+        NativeRawHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, kNativeMagic, sizeof(kNativeMagic));
+        header.version = kVersion;
+        header.nPixels = t_runParams.getNPixels();
+        header.nRois = t_runParams.getNRois();
+        header.nSamples = t_runParams.getNSamples();
+        header.stride = PlaneWaveforms::computeStride(header.nSamples);
+        // Write a placeholder header, the final one is written once the offset table is known.
+        nativeFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        uint64_t fileOffset = sizeof(header);
+
+        std::vector<NativeRawEntry> table;
+        for (unsigned eventId = 0; ; ++eventId) {
+            std::string histoName;
+            histoName = "Ind_" + std::to_string(eventId);
+            TH2S *indHisto = nullptr;
+            rootFile.GetObject(histoName.c_str(), indHisto);
+            histoName = "Col_" + std::to_string(eventId);
+            TH2S *colHisto = nullptr;
+            rootFile.GetObject(histoName.c_str(), colHisto);
+            if (!indHisto || !colHisto) {
+                delete indHisto;
+                delete colHisto;
+                break;
+            }
+            std::cout << "Converting event number " << eventId << "...\n";
+            EventWaveforms waveforms(eventId, header.nPixels, header.nRois, header.nSamples);
+            ChargeData::convertEvent(*indHisto, *colHisto, t_runParams, waveforms);
+            delete indHisto;
+            delete colHisto;
+
+            // Pad up to the alignment and write both planes including the stride padding.
+            const uint64_t eventOffset = alignOffset(fileOffset);
+            const std::vector<char> padding(eventOffset - fileOffset, 0);
+            nativeFile.write(padding.data(), padding.size());
+            const auto &pixelPlane = waveforms.getPixelPlane();
+            const auto &roiPlane = waveforms.getRoiPlane();
+            const uint64_t pixelBytes = static_cast<uint64_t>(pixelPlane.getNChannels()) * pixelPlane.getStride() *
+                                        sizeof(int16_t);
+            const uint64_t roiBytes = static_cast<uint64_t>(roiPlane.getNChannels()) * roiPlane.getStride() *
+                                      sizeof(int16_t);
+            nativeFile.write(reinterpret_cast<const char *>(pixelPlane.data()), pixelBytes);
+            nativeFile.write(reinterpret_cast<const char *>(roiPlane.data()), roiBytes);
+            fileOffset = eventOffset + pixelBytes + roiBytes;
+
+            NativeRawEntry entry;
+            entry.eventId = eventId;
+            entry.reserved = 0;
+            entry.offset = eventOffset;
+            table.push_back(entry);
+        }
+        rootFile.Close();
+
+        // Append the offset table and fill in the header.
+        header.nEvents = table.size();
+        header.tableOffset = fileOffset;
+        nativeFile.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(NativeRawEntry));
+        nativeFile.seekp(0);
+        nativeFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        nativeFile.close();
+        if (!nativeFile || std::rename(tmpFileName.c_str(), t_nativeFileName.c_str())) {
+            std::cerr << "ERROR: Failed to write native raw file " << t_nativeFileName << '!' << std::endl;
+            std::remove(tmpFileName.c_str());
+            exit(1);
+        }
+        return table.size();
+    }
+}
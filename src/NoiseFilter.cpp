@@ -6,14 +6,87 @@
 
 
 namespace pixy_roimux{
-    std::pair<double, double> NoiseFilter::computeNoiseParams(std::shared_ptr<TH1D> t_channelHisto,
+    namespace {
+        ///
+        /// Add the samples within [t_low, t_high] to t_sums and count them in t_counts.
+        ///
+        void accumulateBand(
+                const int16_t *const t_samples,
+                const unsigned t_nSamples,
+                const int16_t t_low,
+                const int16_t t_high,
+                int32_t *const t_sums,
+                int16_t *const t_counts) {
+            unsigned sample = 0;
+#if defined(__SSE2__)
+            const __m128i low = _mm_set1_epi16(t_low);
+            const __m128i high = _mm_set1_epi16(t_high);
+            const __m128i one = _mm_set1_epi16(1);
+            for (; sample + 8 <= t_nSamples; sample += 8) {
+                const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(t_samples + sample));
+                const __m128i outside = _mm_or_si128(_mm_cmpgt_epi16(low, samples), _mm_cmpgt_epi16(samples, high));
+                const __m128i inBand = _mm_andnot_si128(outside, samples);
+                __m128i *const counts = reinterpret_cast<__m128i *>(t_counts + sample);
+                _mm_storeu_si128(counts, _mm_add_epi16(_mm_loadu_si128(counts), _mm_andnot_si128(outside, one)));
+                // Sign extend to 32 bits, the sum over all channels doesn't fit into 16 bits.
+                const __m128i inBandLow = _mm_srai_epi32(_mm_unpacklo_epi16(inBand, inBand), 16);
+                const __m128i inBandHigh = _mm_srai_epi32(_mm_unpackhi_epi16(inBand, inBand), 16);
+                __m128i *const sums = reinterpret_cast<__m128i *>(t_sums + sample);
+                _mm_storeu_si128(sums, _mm_add_epi32(_mm_loadu_si128(sums), inBandLow));
+                _mm_storeu_si128(sums + 1, _mm_add_epi32(_mm_loadu_si128(sums + 1), inBandHigh));
+            }
+#endif
+            for (; sample < t_nSamples; ++sample) {
+                const int16_t value = t_samples[sample];
+                const bool inBand = (value >= t_low) && (value <= t_high);
+                t_sums[sample] += inBand ? value : 0;
+                t_counts[sample] += inBand;
+            }
+        }
+
+        ///
+        /// Clamp a sample to the range of int16_t, like the saturating SIMD subtraction.
+        ///
+        int16_t saturateSample(const double t_sample) {
+            return static_cast<int16_t>(std::max(static_cast<double>(std::numeric_limits<int16_t>::min()),
+                                                 std::min(t_sample, static_cast<double>(
+                                                         std::numeric_limits<int16_t>::max()))));
+        }
+
+        ///
+        /// Subtract t_commonMode from t_samples sample by sample, saturating at the limits of int16_t.
+        ///
+        void subtractCommonMode(
+                int16_t *const t_samples,
+                const unsigned t_nSamples,
+                const int16_t *const t_commonMode) {
+            unsigned sample = 0;
+#if defined(__SSE2__)
+            for (; sample + 8 <= t_nSamples; sample += 8) {
+                __m128i *const samples = reinterpret_cast<__m128i *>(t_samples + sample);
+                const __m128i commonMode = _mm_loadu_si128(reinterpret_cast<const __m128i *>(t_commonMode + sample));
+                _mm_storeu_si128(samples, _mm_subs_epi16(_mm_loadu_si128(samples), commonMode));
+            }
+#endif
+            for (; sample < t_nSamples; ++sample) {
+                t_samples[sample] = saturateSample(t_samples[sample] - t_commonMode[sample]);
+            }
+        }
+    }
+
+
+    const unsigned NoiseFilter::kTileSize;
+
+
+    std::pair<double, double> NoiseFilter::computeNoiseParams(const Span<const int16_t> t_samples,
                                                               const bool t_fit) {
-        int histoMin = static_cast<int>(t_channelHisto->GetBinContent(t_channelHisto->GetMinimumBin())) - 1;
-        int histoMax = static_cast<int>(t_channelHisto->GetBinContent(t_channelHisto->GetMaximumBin())) + 1;
+        const auto minMax = std::minmax_element(t_samples.begin(), t_samples.end());
+        int histoMin = static_cast<int>(*minMax.first) - 1;
+        int histoMax = static_cast<int>(*minMax.second) + 1;
         unsigned nBins = static_cast<unsigned>(histoMax - histoMin);
         TH1S amplitudeSpectrum("amplitudeSpectrum", "amplitudeSpectrum", nBins, histoMin, histoMax);
-        for (unsigned sample = 0; sample < t_channelHisto->GetNbinsX(); ++sample) {
-            amplitudeSpectrum.Fill(t_channelHisto->GetBinContent(sample + 1));
+        for (const auto &sample : t_samples) {
+            amplitudeSpectrum.Fill(sample);
         }
         if (t_fit) {
             TF1 gauss("gauss", "gaus");
@@ -32,44 +105,285 @@ namespace pixy_roimux{
     }
 
 
-    void NoiseFilter::filterHisto(TH2S &t_histo) {
-        unsigned nSamples = static_cast<unsigned>(t_histo.GetNbinsX());
-        unsigned nChannels = static_cast<unsigned>(t_histo.GetNbinsY());
+    std::pair<double, double> NoiseFilter::computeNoiseParams(const Span<const int16_t> t_samples,
+                                                              const NoiseEstimator t_noiseEstimator,
+                                                              NoiseValidationStats *const t_validationStats) {
+        if (t_noiseEstimator == NoiseEstimator::fast) {
+            return estimateNoiseParams(t_samples);
+        }
+        if (t_noiseEstimator == NoiseEstimator::fit) {
+            return computeNoiseParams(t_samples, true);
+        }
+        const auto fitStart = std::chrono::steady_clock::now();
+        const std::pair<double, double> fitParams = computeNoiseParams(t_samples, true);
+        const auto fastStart = std::chrono::steady_clock::now();
+        const std::pair<double, double> fastParams = estimateNoiseParams(t_samples);
+        const auto fastStop = std::chrono::steady_clock::now();
+        const double meanDev = std::abs(fastParams.first - fitParams.first);
+        const double sigmaDev = std::abs(fastParams.second - fitParams.second) / std::max(std::abs(fitParams.second), 1e-9);
+        if (t_validationStats) {
+            ++t_validationStats->nChannels;
+            t_validationStats->sumMeanDev += meanDev;
+            t_validationStats->maxMeanDev = std::max(t_validationStats->maxMeanDev, meanDev);
+            t_validationStats->sumSigmaDev += sigmaDev;
+            t_validationStats->maxSigmaDev = std::max(t_validationStats->maxSigmaDev, sigmaDev);
+            t_validationStats->fitTime += fastStart - fitStart;
+            t_validationStats->fastTime += fastStop - fastStart;
+        }
+        return fitParams;
+    }
+
+
+    std::pair<double, double> NoiseFilter::estimateNoiseParams(const Span<const int16_t> t_samples) {
+        if (!t_samples.size()) {
+            return std::pair<double, double>(0., 0.);
+        }
+        // Reused across calls so estimating a channel doesn't allocate.
+        thread_local EnvelopePyramid envelope;
+        thread_local std::vector<unsigned> histo;
+        envelope.build(t_samples);
+        const int histoMin = envelope.getMin();
+        const unsigned nBins = static_cast<unsigned>(envelope.getMax() - histoMin + 1);
+        histo.assign(nBins, 0);
+        for (const auto &sample : t_samples) {
+            ++histo[sample - histoMin];
+        }
+
+        // Median, mode and MAD from the cumulative histogram.
+        const unsigned long nSamples = t_samples.size();
+        unsigned long count = 0;
+        unsigned medianBin = 0;
+        while ((count += histo[medianBin]) * 2 < nSamples) {
+            ++medianBin;
+        }
+        const unsigned modeBin = static_cast<unsigned>(std::max_element(histo.cbegin(), histo.cend()) - histo.cbegin());
+        // Walk outwards from the median, adding both bins at each distance, until half of the samples are covered.
+        count = histo[medianBin];
+        unsigned mad = 0;
+        while (count * 2 < nSamples) {
+            ++mad;
+            if (medianBin >= mad) {
+                count += histo[medianBin - mad];
+            }
+            if (medianBin + mad < nBins) {
+                count += histo[medianBin + mad];
+            }
+        }
+        // Integer data: a MAD of 0 still means a spread below one count.
+        const double robustSigma = 1.4826 * std::max(mad, 1u);
+        const std::pair<double, double> robustParams(histoMin + static_cast<double>(medianBin), robustSigma);
+
+        // Weighted least squares fit of ln(n) = a + b * x + c * x^2 with weights n around the mode, x relative to the
+        // mode for numerical stability. The window covers about one sigma on each side, but at least two bins.
+        const int halfWidth = std::max(static_cast<int>(std::ceil(robustSigma)), 2);
+        double s0 = 0., s1 = 0., s2 = 0., s3 = 0., s4 = 0.;
+        double t0 = 0., t1 = 0., t2 = 0.;
+        unsigned nFitBins = 0;
+        for (int x = -halfWidth; x <= halfWidth; ++x) {
+            const int bin = static_cast<int>(modeBin) + x;
+            if ((bin < 0) || (bin >= static_cast<int>(nBins)) || !histo[bin]) {
+                continue;
+            }
+            const double weight = histo[bin];
+            const double logCount = std::log(weight);
+            const double x2 = static_cast<double>(x) * x;
+            s0 += weight;
+            s1 += weight * x;
+            s2 += weight * x2;
+            s3 += weight * x2 * x;
+            s4 += weight * x2 * x2;
+            t0 += weight * logCount;
+            t1 += weight * logCount * x;
+            t2 += weight * logCount * x2;
+            ++nFitBins;
+        }
+        if (nFitBins < 3) {
+            return robustParams;
+        }
+        // Solve the normal equations with Cramer's rule.
+        const double det = s0 * (s2 * s4 - s3 * s3) - s1 * (s1 * s4 - s3 * s2) + s2 * (s1 * s3 - s2 * s2);
+        if (std::abs(det) < 1e-12) {
+            return robustParams;
+        }
+        const double b = (s0 * (t1 * s4 - s3 * t2) - t0 * (s1 * s4 - s3 * s2) + s2 * (s1 * t2 - t1 * s2)) / det;
+        const double c = (s0 * (s2 * t2 - t1 * s3) - s1 * (s1 * t2 - t1 * s2) + t0 * (s1 * s3 - s2 * s2)) / det;
+        if (c >= 0.) {
+            return robustParams;
+        }
+        const double mean = -b / (2. * c);
+        // A vertex outside the window means the peak isn't Gaussian there.
+        if (std::abs(mean) > halfWidth) {
+            return robustParams;
+        }
+        return std::pair<double, double>(histoMin + modeBin + mean, std::sqrt(-1. / (2. * c)));
+    }
+
+
+    void NoiseFilter::filterPlane(
+            PlaneWaveforms &t_plane,
+            const unsigned t_firstChannel,
+            std::chrono::duration<double> &t_scalarTime,
+            std::chrono::duration<double> &t_simdTime) {
+        unsigned nChannels = t_plane.getNChannels();
         std::vector<std::pair<double, double>> thresholds(nChannels);
+        std::vector<std::pair<double, double>> noiseParams(nChannels);
+        unsigned long nMasked = 0;
+        const auto noiseStart = std::chrono::steady_clock::now();
         for (unsigned channel = 0; channel < nChannels; ++channel) {
-            auto channelHisto = std::shared_ptr<TH1D>(t_histo.ProjectionX("channelHisto", (channel + 1), (channel + 1)));
             //std::cout << "channel: " << channel << std::endl;
-            std::pair<double, double> noiseParams = computeNoiseParams(channelHisto, true);
-            thresholds.at(channel).first = noiseParams.first - m_thrSigma * noiseParams.second;
-            thresholds.at(channel).second = noiseParams.first + m_thrSigma * noiseParams.second;
+            if (m_channelStatus && m_channelStatus->isMasked(t_firstChannel + channel)) {
+                // Empty noise band, so the channel stays out of the common mode.
+                thresholds.at(channel).first = std::numeric_limits<double>::infinity();
+                thresholds.at(channel).second = -std::numeric_limits<double>::infinity();
+                ++nMasked;
+                continue;
+            }
+            const auto samples = t_plane.getChannel(channel);
+            noiseParams.at(channel) = m_pedestals ? m_pedestals->getNoiseParams(
+                    PedestalStage::raw, t_firstChannel + channel, samples, &m_validationStats)
+                                                  : computeNoiseParams(samples, m_noiseEstimator, &m_validationStats);
+            thresholds.at(channel).first = noiseParams.at(channel).first - m_thrSigma * noiseParams.at(channel).second;
+            thresholds.at(channel).second = noiseParams.at(channel).first + m_thrSigma * noiseParams.at(channel).second;
+        }
+        if (m_channelStatus) {
+            m_channelStatus->addNoiseTime(nChannels - nMasked, nMasked, std::chrono::steady_clock::now() - noiseStart);
+            m_channelStatus->update(t_plane, t_firstChannel, noiseParams);
         }
+        if (m_commonModeKernel == CommonModeKernel::scalar) {
+            const auto scalarStart = std::chrono::steady_clock::now();
+            removeCommonModeScalar(t_plane, thresholds);
+            t_scalarTime += std::chrono::steady_clock::now() - scalarStart;
+            return;
+        }
+        // Keep a copy for the reference kernel before the plane is modified.
+        PlaneWaveforms reference;
+        if (m_commonModeKernel == CommonModeKernel::compare) {
+            reference = t_plane;
+            const auto scalarStart = std::chrono::steady_clock::now();
+            removeCommonModeScalar(reference, thresholds);
+            t_scalarTime += std::chrono::steady_clock::now() - scalarStart;
+        }
+        const auto simdStart = std::chrono::steady_clock::now();
+        removeCommonModeTiled(t_plane, thresholds);
+        t_simdTime += std::chrono::steady_clock::now() - simdStart;
+        if (m_commonModeKernel == CommonModeKernel::compare) {
+            for (unsigned channel = 0; channel < nChannels; ++channel) {
+                const auto samples = t_plane.getChannel(channel);
+                const auto referenceSamples = reference.getChannel(channel);
+                if (!std::equal(samples.begin(), samples.end(), referenceSamples.begin())) {
+                    std::cerr << "ERROR: SIMD and scalar common mode removal differ on channel " << channel << '!'
+                              << std::endl;
+                    exit(1);
+                }
+            }
+        }
+    }
+
+
+    void NoiseFilter::removeCommonModeScalar(
+            PlaneWaveforms &t_plane,
+            const std::vector<std::pair<double, double>> &t_thresholds) {
+        unsigned nSamples = t_plane.getNSamples();
+        unsigned nChannels = t_plane.getNChannels();
         for (unsigned sample = 0; sample < nSamples; ++sample) {
             double commonModeNoise = 0.;
             unsigned nCommonModeChannels = 0;
             for (unsigned channel = 0; channel < nChannels; ++channel) {
-                int binContent = static_cast<int>(t_histo.GetBinContent((sample + 1), (channel + 1)));
-                if ((binContent >= thresholds.at(channel).first) && binContent <= thresholds.at(channel).second) {
+                int binContent = t_plane.getChannel(channel)[sample];
+                if ((binContent >= t_thresholds.at(channel).first) && binContent <= t_thresholds.at(channel).second) {
                     commonModeNoise += binContent;
                     ++nCommonModeChannels;
                 }
             }
+            // Leave the sample untouched if no channel is in the noise band, the mean would be undefined.
+            if (!nCommonModeChannels) {
+                continue;
+            }
             commonModeNoise /= static_cast<double>(nCommonModeChannels);
             commonModeNoise = round(commonModeNoise);
             for (unsigned channel = 0; channel < nChannels; ++channel) {
-                t_histo.SetBinContent((sample + 1), (channel + 1),
-                                    (t_histo.GetBinContent((sample + 1), (channel + 1)) - commonModeNoise));
+                auto samples = t_plane.getChannel(channel);
+                samples[sample] = saturateSample(samples[sample] - commonModeNoise);
+            }
+        }
+    }
+
+
+    void NoiseFilter::removeCommonModeTiled(
+            PlaneWaveforms &t_plane,
+            const std::vector<std::pair<double, double>> &t_thresholds) {
+        const unsigned nSamples = t_plane.getNSamples();
+        const unsigned nChannels = t_plane.getNChannels();
+        // Integer noise bands giving the same decisions as the comparisons with the double thresholds. Empty bands have
+        // low > high, which no sample can satisfy.
+        std::vector<int16_t> bandLows(nChannels);
+        std::vector<int16_t> bandHighs(nChannels);
+        for (unsigned channel = 0; channel < nChannels; ++channel) {
+            const double low = std::ceil(t_thresholds.at(channel).first);
+            const double high = std::floor(t_thresholds.at(channel).second);
+            if (!(low <= high) || (low > std::numeric_limits<int16_t>::max()) ||
+                (high < std::numeric_limits<int16_t>::min())) {
+                bandLows.at(channel) = std::numeric_limits<int16_t>::max();
+                bandHighs.at(channel) = std::numeric_limits<int16_t>::min();
+            }
+            else {
+                bandLows.at(channel) = static_cast<int16_t>(
+                        std::max(low, static_cast<double>(std::numeric_limits<int16_t>::min())));
+                bandHighs.at(channel) = static_cast<int16_t>(
+                        std::min(high, static_cast<double>(std::numeric_limits<int16_t>::max())));
+            }
+        }
+        int32_t sums[kTileSize];
+        int16_t counts[kTileSize];
+        int16_t commonMode[kTileSize];
+        for (unsigned tileStart = 0; tileStart < nSamples; tileStart += kTileSize) {
+            const unsigned tileLength = std::min(kTileSize, nSamples - tileStart);
+            std::fill(sums, sums + tileLength, 0);
+            std::fill(counts, counts + tileLength, 0);
+            for (unsigned channel = 0; channel < nChannels; ++channel) {
+                accumulateBand(t_plane.getChannel(channel).data() + tileStart, tileLength, bandLows[channel],
+                               bandHighs[channel], sums, counts);
+            }
+            // Same rounding as the scalar kernel. Samples without any channel in the noise band are left untouched.
+            for (unsigned sample = 0; sample < tileLength; ++sample) {
+                commonMode[sample] = counts[sample] ? static_cast<int16_t>(
+                        round(static_cast<double>(sums[sample]) / static_cast<double>(counts[sample]))) : 0;
+            }
+            for (unsigned channel = 0; channel < nChannels; ++channel) {
+                subtractCommonMode(t_plane.getChannel(channel).data() + tileStart, tileLength, commonMode);
             }
         }
     }
 
 
     void NoiseFilter::filterData(ChargeData &t_data) {
-        auto eventId = t_data.getEventIds().cbegin();
-        for (auto &&histos : t_data.getReadoutHistos()) {
-            std::cout << "Filtering event number " << *eventId << "...\n";
-            filterHisto(histos.first);
-            filterHisto(histos.second);
-            ++eventId;
+        if (t_data.isCompressed() || t_data.isZeroSuppressed()) {
+            std::cerr << "ERROR: Can only filter full waveforms!" << std::endl;
+            exit(1);
+        }
+        for (auto &&waveforms : t_data.getWaveforms()) {
+            std::cout << "Filtering event number " << waveforms.getEventId() << "...\n";
+            std::chrono::duration<double> scalarTime(0.);
+            std::chrono::duration<double> simdTime(0.);
+            filterPlane(waveforms.getPixelPlane(), 0, scalarTime, simdTime);
+            filterPlane(waveforms.getRoiPlane(), waveforms.getPixelPlane().getNChannels(), scalarTime, simdTime);
+            std::cout << "Common mode removal:";
+            if (m_commonModeKernel != CommonModeKernel::simd) {
+                std::cout << " scalar " << scalarTime.count() * 1e6 << "us";
+            }
+            if (m_commonModeKernel != CommonModeKernel::scalar) {
+                std::cout << " SIMD " << simdTime.count() * 1e6 << "us";
+            }
+            std::cout << ".\n";
+            if (m_frequencyFilter) {
+                m_frequencyFilter->filterPlane(waveforms.getPixelPlane());
+                m_frequencyFilter->filterPlane(waveforms.getRoiPlane());
+            }
+            if (m_roiDeconvolution) {
+                m_roiDeconvolution->filterPlane(waveforms.getRoiPlane());
+            }
         }
+        // Estimate the noise once after the common mode removal, all later stages use this.
+        t_data.computeNoiseModels(m_pedestals, m_channelStatus);
     }
 }
@@ -0,0 +1,146 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "NoiseModel.h"
+#include "NoiseFilter.h"
+
+
+namespace pixy_roimux {
+    NoiseModel::NoiseModel(
+            const EventWaveforms &t_waveforms,
+            const RunParams &t_runParams,
+            PedestalDatabase *const t_pedestals,
+            const ChannelStatus *const t_channelStatus) :
+            m_eventId(t_waveforms.getEventId()) {
+        const auto computeNoiseParams = [&](const unsigned t_channel, const Span<const int16_t> t_samples) {
+            return t_pedestals ? t_pedestals->getNoiseParams(PedestalStage::filtered, t_channel, t_samples,
+                                                             &m_validationStats)
+                               : NoiseFilter::computeNoiseParams(t_samples, t_runParams.getNoiseEstimator(),
+                                                                 &m_validationStats);
+        };
+        const auto isMasked = [&](const unsigned t_channel) {
+            return t_channelStatus && t_channelStatus->isMasked(t_channel);
+        };
+        const PlaneWaveforms &pixelPlane = t_waveforms.getPixelPlane();
+        m_pixelNoise.reserve(pixelPlane.getNChannels());
+        for (unsigned channel = 0; channel < pixelPlane.getNChannels(); ++channel) {
+            if (isMasked(channel)) {
+                m_pixelNoise.push_back(makeMaskedNoise());
+                continue;
+            }
+            // Pixel pulses are unipolar, so the negative thresholds sit on the baseline.
+            m_pixelNoise.push_back(makeChannelNoise(
+                    computeNoiseParams(channel, pixelPlane.getChannel(channel)),
+                    t_runParams.getDiscSigmaPixelLead(),
+                    t_runParams.getDiscSigmaPixelPeak(),
+                    t_runParams.getDiscAbsPixelPeak(),
+                    t_runParams.getDiscSigmaPixelTrail(),
+                    0.,
+                    0.,
+                    0.));
+        }
+        const PlaneWaveforms &roiPlane = t_waveforms.getRoiPlane();
+        m_roiNoise.reserve(roiPlane.getNChannels());
+        for (unsigned channel = 0; channel < roiPlane.getNChannels(); ++channel) {
+            if (isMasked(pixelPlane.getNChannels() + channel)) {
+                m_roiNoise.push_back(makeMaskedNoise());
+                continue;
+            }
+            m_roiNoise.push_back(makeChannelNoise(
+                    computeNoiseParams(pixelPlane.getNChannels() + channel, roiPlane.getChannel(channel)),
+                    t_runParams.getDiscSigmaRoiPosLead(),
+                    t_runParams.getDiscSigmaRoiPosPeak(),
+                    t_runParams.getDiscAbsRoiPosPeak(),
+                    t_runParams.getDiscSigmaRoiPosTrail(),
+                    t_runParams.getDiscSigmaRoiNegPeak(),
+                    t_runParams.getDiscAbsRoiNegPeak(),
+                    t_runParams.getDiscSigmaRoiNegTrail()));
+        }
+    }
+
+
+    void NoiseModel::estimatePixelSeedNoise(
+            const PlaneWaveforms &t_seedPlane,
+            const RunParams &t_runParams,
+            const ChannelStatus *const t_channelStatus) {
+        m_pixelSeedNoise.clear();
+        m_pixelSeedNoise.reserve(t_seedPlane.getNChannels());
+        for (unsigned channel = 0; channel < t_seedPlane.getNChannels(); ++channel) {
+            if (t_channelStatus && t_channelStatus->isMasked(channel)) {
+                m_pixelSeedNoise.push_back(makeMaskedNoise());
+                continue;
+            }
+            // The pedestal database holds the unfiltered noise, so the filtered noise is always estimated.
+            m_pixelSeedNoise.push_back(makeChannelNoise(
+                    NoiseFilter::computeNoiseParams(t_seedPlane.getChannel(channel), t_runParams.getNoiseEstimator(),
+                                                    &m_validationStats),
+                    t_runParams.getDiscSigmaPixelLead(),
+                    t_runParams.getDiscSigmaPixelSeedPeak(),
+                    t_runParams.getDiscAbsPixelSeedPeak(),
+                    t_runParams.getDiscSigmaPixelTrail(),
+                    0.,
+                    0.,
+                    0.));
+        }
+    }
+
+
+    void NoiseModel::writeCsv(const std::string &t_fileName) const {
+        std::ofstream csvFile(t_fileName, std::ofstream::out);
+        if (!csvFile) {
+            std::cerr << "ERROR: Failed to open noise model file " << t_fileName << '!' << std::endl;
+            exit(1);
+        }
+        csvFile << "Plane,Channel,Mean,Sigma,ThrPosLead,ThrPosPeak,ThrPosTrail,ThrNegPeak,ThrNegTrail,Masked" << std::endl;
+        const std::pair<const char *, const std::vector<ChannelNoise> *> planes[3] = {{"Pixel", &m_pixelNoise},
+                                                                                      {"ROI", &m_roiNoise},
+                                                                                      {"PixelSeed", &m_pixelSeedNoise}};
+        for (const auto &plane : planes) {
+            unsigned channel = 0;
+            for (const auto &noise : *plane.second) {
+                csvFile << plane.first << ',' << channel << ',' << noise.mean << ',' << noise.sigma << ','
+                        << noise.thrPosLead << ',' << noise.thrPosPeak << ',' << noise.thrPosTrail << ','
+                        << noise.thrNegPeak << ',' << noise.thrNegTrail << ',' << noise.masked << '\n';
+                ++channel;
+            }
+        }
+        csvFile.close();
+    }
+
+
+    ChannelNoise NoiseModel::makeChannelNoise(
+            const std::pair<double, double> &t_noiseParams,
+            const double t_discSigmaPosLead,
+            const double t_discSigmaPosPeak,
+            const double t_discAbsPosPeak,
+            const double t_discSigmaPosTrail,
+            const double t_discSigmaNegPeak,
+            const double t_discAbsNegPeak,
+            const double t_discSigmaNegTrail) {
+        ChannelNoise noise;
+        noise.mean = t_noiseParams.first;
+        noise.sigma = t_noiseParams.second;
+        noise.thrPosLead = noise.mean + t_discSigmaPosLead * noise.sigma;
+        noise.thrPosPeak = noise.mean + std::max(t_discSigmaPosPeak * noise.sigma, t_discAbsPosPeak);
+        noise.thrPosTrail = noise.mean + t_discSigmaPosTrail * noise.sigma;
+        noise.thrNegPeak = noise.mean - std::max(t_discSigmaNegPeak * noise.sigma, t_discAbsNegPeak);
+        noise.thrNegTrail = noise.mean - t_discSigmaNegTrail * noise.sigma;
+        noise.masked = false;
+        return noise;
+    }
+
+
+    ChannelNoise NoiseModel::makeMaskedNoise() {
+        ChannelNoise noise;
+        noise.mean = 0.;
+        noise.sigma = 0.;
+        noise.thrPosLead = std::numeric_limits<double>::infinity();
+        noise.thrPosPeak = std::numeric_limits<double>::infinity();
+        noise.thrPosTrail = std::numeric_limits<double>::infinity();
+        noise.thrNegPeak = -std::numeric_limits<double>::infinity();
+        noise.thrNegTrail = -std::numeric_limits<double>::infinity();
+        noise.masked = true;
+        return noise;
+    }
+}
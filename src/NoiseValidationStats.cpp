@@ -0,0 +1,33 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "NoiseValidationStats.h"
+
+
+namespace pixy_roimux {
+    void NoiseValidationStats::add(const NoiseValidationStats &t_other) {
+        nChannels += t_other.nChannels;
+        sumMeanDev += t_other.sumMeanDev;
+        maxMeanDev = std::max(maxMeanDev, t_other.maxMeanDev);
+        sumSigmaDev += t_other.sumSigmaDev;
+        maxSigmaDev = std::max(maxSigmaDev, t_other.maxSigmaDev);
+        fitTime += t_other.fitTime;
+        fastTime += t_other.fastTime;
+    }
+
+
+    void NoiseValidationStats::print() const {
+        if (!nChannels) {
+            return;
+        }
+        const double nCompared = nChannels;
+        std::cout << "Noise estimator validation: " << nChannels << " channels.\n";
+        std::cout << "Noise estimator validation: mean deviation " << sumMeanDev / nCompared << " ADC average, "
+                  << maxMeanDev << " ADC max.\n";
+        std::cout << "Noise estimator validation: sigma deviation " << 100. * sumSigmaDev / nCompared
+                  << "% average, " << 100. * maxSigmaDev << "% max.\n";
+        std::cout << "Noise estimator validation: fit " << fitTime.count() * 1e6 / nCompared << "us, fast "
+                  << fastTime.count() * 1e6 / nCompared << "us per channel.\n";
+    }
+}
@@ -0,0 +1,175 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "PedestalDatabase.h"
+#include "NoiseFilter.h"
+
+
+namespace pixy_roimux {
+    PedestalDatabase::PedestalDatabase(const RunParams &t_runParams) :
+            m_fileName(t_runParams.getPedestalDatabase()),
+            m_runId(t_runParams.getRunId()),
+            m_noiseEstimator(t_runParams.getNoiseEstimator()),
+            m_alpha(t_runParams.getPedestalAlpha()),
+            m_meanTolerance(t_runParams.getPedestalMeanTolerance()),
+            m_sigmaTolerance(t_runParams.getPedestalSigmaTolerance()) {
+        if (load(m_fileName)) {
+            std::cout << "Loaded " << m_pedestals.size() << " pedestals from " << m_fileName << ".\n";
+        }
+        else {
+            std::cout << "Pedestal database " << m_fileName << " not found, starting cold.\n";
+        }
+    }
+
+
+    std::pair<double, double> PedestalDatabase::getNoiseParams(
+            const PedestalStage t_stage,
+            const unsigned t_channel,
+            const Span<const int16_t> t_samples,
+            NoiseValidationStats *const t_validationStats) {
+        Pedestal *const pedestal = findPedestal(static_cast<unsigned>(t_stage), t_channel);
+        if (pedestal) {
+            // The fast estimator is robust against pulses, so it's good enough to check and update the pedestal.
+            const std::pair<double, double> eventParams = NoiseFilter::estimateNoiseParams(t_samples);
+            if ((std::abs(eventParams.first - pedestal->mean) <= m_meanTolerance * pedestal->sigma) &&
+                (std::abs(eventParams.second - pedestal->sigma) <= m_sigmaTolerance * pedestal->sigma)) {
+                pedestal->mean += m_alpha * (eventParams.first - pedestal->mean);
+                pedestal->sigma += m_alpha * (eventParams.second - pedestal->sigma);
+                ++pedestal->nUpdates;
+                m_updatedKeys.insert(Key(m_runId, static_cast<unsigned>(t_stage), t_channel));
+                ++m_nWarm;
+                return std::pair<double, double>(pedestal->mean, pedestal->sigma);
+            }
+        }
+        // New or drifted channel: estimate from the event and restart the running estimate from there.
+        const std::pair<double, double> noiseParams = NoiseFilter::computeNoiseParams(t_samples, m_noiseEstimator,
+                                                                                      t_validationStats);
+        const Key key(m_runId, static_cast<unsigned>(t_stage), t_channel);
+        Pedestal &newPedestal = m_pedestals[key];
+        newPedestal.mean = noiseParams.first;
+        newPedestal.sigma = noiseParams.second;
+        newPedestal.nUpdates = 1;
+        m_updatedKeys.insert(key);
+        ++m_nEstimated;
+        return noiseParams;
+    }
+
+
+    void PedestalDatabase::save() const {
+        write(m_fileName, false);
+    }
+
+
+    void PedestalDatabase::saveShard(const std::string &t_fileName) const {
+        write(t_fileName, true);
+    }
+
+
+    bool PedestalDatabase::addShard(const std::string &t_fileName) {
+        return load(t_fileName);
+    }
+
+
+    void PedestalDatabase::printStats() const {
+        const unsigned long nChannels = m_nWarm + m_nEstimated;
+        if (!nChannels) {
+            return;
+        }
+        std::cout << "Pedestal database: " << m_nWarm << " of " << nChannels << " channels ("
+                  << 100. * m_nWarm / nChannels << "%) used the stored pedestal, " << m_nEstimated
+                  << " were estimated from the event.\n";
+    }
+
+
+    bool PedestalDatabase::load(const std::string &t_fileName) {
+        std::ifstream databaseFile(t_fileName);
+        if (!databaseFile.is_open()) {
+            return false;
+        }
+        std::string line;
+        unsigned long lineNumber = 0;
+        while (std::getline(databaseFile, line)) {
+            ++lineNumber;
+            if (line.empty() || (line.front() == '#')) {
+                continue;
+            }
+            std::istringstream lineStream(line);
+            unsigned runId;
+            std::string stage;
+            unsigned channel;
+            Pedestal pedestal;
+            lineStream >> runId >> stage >> channel >> pedestal.mean >> pedestal.sigma >> pedestal.nUpdates;
+            if (!lineStream || ((stage != "raw") && (stage != "filtered"))) {
+                std::cerr << "ERROR: Malformed line " << lineNumber << " in pedestal database " << t_fileName << '!'
+                          << std::endl;
+                exit(1);
+            }
+            const PedestalStage pedestalStage = (stage == "raw") ? PedestalStage::raw : PedestalStage::filtered;
+            m_pedestals[Key(runId, static_cast<unsigned>(pedestalStage), channel)] = pedestal;
+        }
+        return true;
+    }
+
+
+    void PedestalDatabase::write(
+            const std::string &t_fileName,
+            const bool t_updatedOnly) const {
+        // Write to a temporary file first and move it into place, so a crash never leaves a partial database.
+        const std::string tmpFileName = t_fileName + ".tmp";
+        std::ofstream databaseFile(tmpFileName, std::ofstream::trunc);
+        if (!databaseFile.is_open()) {
+            std::cerr << "WARNING: Failed to write pedestal database " << t_fileName << '.' << std::endl;
+            return;
+        }
+        databaseFile << "# runId stage channel mean sigma nUpdates\n";
+        databaseFile.precision(9);
+        for (const auto &entry : m_pedestals) {
+            if (t_updatedOnly && !m_updatedKeys.count(entry.first)) {
+                continue;
+            }
+            databaseFile << std::get<0>(entry.first) << ' '
+                         << ((std::get<1>(entry.first) == static_cast<unsigned>(PedestalStage::raw)) ? "raw"
+                                                                                                    : "filtered")
+                         << ' ' << std::get<2>(entry.first) << ' ' << entry.second.mean << ' ' << entry.second.sigma
+                         << ' ' << entry.second.nUpdates << '\n';
+        }
+        databaseFile.close();
+        if (!databaseFile || std::rename(tmpFileName.c_str(), t_fileName.c_str())) {
+            std::cerr << "WARNING: Failed to write pedestal database " << t_fileName << '.' << std::endl;
+            std::remove(tmpFileName.c_str());
+        }
+    }
+
+
+    PedestalDatabase::Pedestal *PedestalDatabase::findPedestal(
+            const unsigned t_stage,
+            const unsigned t_channel) {
+        const Key key(m_runId, t_stage, t_channel);
+        auto pedestal = m_pedestals.find(key);
+        if (pedestal != m_pedestals.end()) {
+            return &pedestal->second;
+        }
+        // Warm start from the latest earlier run, or from the earliest later run if there's none before this one.
+        const Pedestal *seed = nullptr;
+        std::pair<bool, unsigned> seedDistance;
+        for (const auto &entry : m_pedestals) {
+            const unsigned runId = std::get<0>(entry.first);
+            if ((std::get<1>(entry.first) != t_stage) || (std::get<2>(entry.first) != t_channel)) {
+                continue;
+            }
+            const std::pair<bool, unsigned> distance(runId > m_runId,
+                                                     (runId < m_runId) ? (m_runId - runId) : (runId - m_runId));
+            if (!seed || (distance < seedDistance)) {
+                seed = &entry.second;
+                seedDistance = distance;
+            }
+        }
+        if (!seed) {
+            return nullptr;
+        }
+        Pedestal &newPedestal = m_pedestals[key];
+        newPedestal = *seed;
+        return &newPedestal;
+    }
+}
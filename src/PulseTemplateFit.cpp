@@ -0,0 +1,302 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "PulseTemplateFit.h"
+
+
+namespace pixy_roimux {
+    namespace {
+        ///
+        /// Number of zeros before and after the template.
+        ///
+        const int kTemplatePadding = 3;
+
+        ///
+        /// Change of the time in samples below which a fit has converged.
+        ///
+        const float kTimeTolerance = 1e-3f;
+
+        ///
+        /// Sums of the normal equations of a hit: template T and its derivative D at the samples of the hit, and the
+        /// samples y.
+        ///
+        struct TemplateSums {
+            float tt;
+            float td;
+            float dd;
+            float yt;
+            float yd;
+        };
+
+#if defined(__AVX2__)
+        ///
+        /// Sum the lanes of a register.
+        ///
+        float sumLanes(const __m256 t_values) {
+            const __m128 half = _mm_add_ps(_mm256_castps256_ps128(t_values), _mm256_extractf128_ps(t_values, 1));
+            const __m128 quarter = _mm_add_ps(half, _mm_movehl_ps(half, half));
+            return _mm_cvtss_f32(_mm_add_ss(quarter, _mm_shuffle_ps(quarter, quarter, 1)));
+        }
+#elif defined(__SSE2__)
+        ///
+        /// Sum the lanes of a register.
+        ///
+        float sumLanes(const __m128 t_values) {
+            const __m128 half = _mm_add_ps(t_values, _mm_movehl_ps(t_values, t_values));
+            return _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+        }
+#endif
+
+        ///
+        /// Convert t_nSamples raw samples to float.
+        ///
+        void convertSamples(
+                const int16_t *const t_raw,
+                const unsigned t_nSamples,
+                float *const t_samples) {
+            unsigned sample = 0;
+#if defined(__AVX2__)
+            for (; sample + 8 <= t_nSamples; sample += 8) {
+                _mm256_storeu_ps(t_samples + sample, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+                        _mm_loadu_si128(reinterpret_cast<const __m128i *>(t_raw + sample)))));
+            }
+#elif defined(__SSE2__)
+            for (; sample + 4 <= t_nSamples; sample += 4) {
+                // Sign extend to 32 bits by moving each sample to the upper half and shifting it back.
+                const __m128i raw = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(t_raw + sample));
+                _mm_storeu_ps(t_samples + sample, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16)));
+            }
+#endif
+            for (; sample < t_nSamples; ++sample) {
+                t_samples[sample] = static_cast<float>(t_raw[sample]);
+            }
+        }
+
+        ///
+        /// Compute the sums of the normal equations for t_nSamples samples, with sample l at the template position
+        /// l + t_shift. t_template points to the padded template of t_nTemplateSamples samples. Only the samples
+        /// within the support of the interpolated template contribute.
+        ///
+        TemplateSums computeSums(
+                const float *const t_samples,
+                const unsigned t_nSamples,
+                const float *const t_template,
+                const unsigned t_nTemplateSamples,
+                const float t_shift) {
+            const float floorShift = std::floor(t_shift);
+            const int shift = static_cast<int>(floorShift);
+            const float g = t_shift - floorShift;
+            // Catmull-Rom weights of the template samples shift - 1 to shift + 2 after sample l and their derivatives.
+            const float weights[4] = {0.5f * ((-g + 2.f) * g - 1.f) * g,
+                                      0.5f * ((3.f * g - 5.f) * g * g + 2.f),
+                                      0.5f * (((-3.f * g + 4.f) * g + 1.f) * g),
+                                      0.5f * (g - 1.f) * g * g};
+            const float derivatives[4] = {0.5f * ((-3.f * g + 4.f) * g - 1.f),
+                                          0.5f * (9.f * g - 10.f) * g,
+                                          0.5f * ((-9.f * g + 8.f) * g + 1.f),
+                                          0.5f * (3.f * g - 2.f) * g};
+            // The template is 0 outside of the samples -2 to nTemplateSamples.
+            const int start = std::max(-2 - shift, 0);
+            const int stop = std::min(static_cast<int>(t_nTemplateSamples) + 1 - shift, static_cast<int>(t_nSamples));
+            TemplateSums sums = {0.f, 0.f, 0.f, 0.f, 0.f};
+            if (start >= stop) {
+                return sums;
+            }
+            // Samples from the start of the support and the padded template from template sample start + shift - 1.
+            const float *const samples = t_samples + start;
+            const float *const values = t_template + (kTemplatePadding - 1 + shift + start);
+            const int nSamples = stop - start;
+            int sample = 0;
+#if defined(__AVX2__)
+            __m256 tt = _mm256_setzero_ps();
+            __m256 td = _mm256_setzero_ps();
+            __m256 dd = _mm256_setzero_ps();
+            __m256 yt = _mm256_setzero_ps();
+            __m256 yd = _mm256_setzero_ps();
+            for (; sample + 8 <= nSamples; sample += 8) {
+                __m256 t = _mm256_setzero_ps();
+                __m256 d = _mm256_setzero_ps();
+                for (unsigned tap = 0; tap < 4; ++tap) {
+                    const __m256 value = _mm256_loadu_ps(values + sample + tap);
+                    t = _mm256_add_ps(t, _mm256_mul_ps(_mm256_set1_ps(weights[tap]), value));
+                    d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(derivatives[tap]), value));
+                }
+                const __m256 y = _mm256_loadu_ps(samples + sample);
+                tt = _mm256_add_ps(tt, _mm256_mul_ps(t, t));
+                td = _mm256_add_ps(td, _mm256_mul_ps(t, d));
+                dd = _mm256_add_ps(dd, _mm256_mul_ps(d, d));
+                yt = _mm256_add_ps(yt, _mm256_mul_ps(y, t));
+                yd = _mm256_add_ps(yd, _mm256_mul_ps(y, d));
+            }
+            sums = {sumLanes(tt), sumLanes(td), sumLanes(dd), sumLanes(yt), sumLanes(yd)};
+#elif defined(__SSE2__)
+            __m128 tt = _mm_setzero_ps();
+            __m128 td = _mm_setzero_ps();
+            __m128 dd = _mm_setzero_ps();
+            __m128 yt = _mm_setzero_ps();
+            __m128 yd = _mm_setzero_ps();
+            for (; sample + 4 <= nSamples; sample += 4) {
+                __m128 t = _mm_setzero_ps();
+                __m128 d = _mm_setzero_ps();
+                for (unsigned tap = 0; tap < 4; ++tap) {
+                    const __m128 value = _mm_loadu_ps(values + sample + tap);
+                    t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(weights[tap]), value));
+                    d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(derivatives[tap]), value));
+                }
+                const __m128 y = _mm_loadu_ps(samples + sample);
+                tt = _mm_add_ps(tt, _mm_mul_ps(t, t));
+                td = _mm_add_ps(td, _mm_mul_ps(t, d));
+                dd = _mm_add_ps(dd, _mm_mul_ps(d, d));
+                yt = _mm_add_ps(yt, _mm_mul_ps(y, t));
+                yd = _mm_add_ps(yd, _mm_mul_ps(y, d));
+            }
+            sums = {sumLanes(tt), sumLanes(td), sumLanes(dd), sumLanes(yt), sumLanes(yd)};
+#endif
+            for (; sample < nSamples; ++sample) {
+                float t = 0.f;
+                float d = 0.f;
+                for (unsigned tap = 0; tap < 4; ++tap) {
+                    t += weights[tap] * values[sample + tap];
+                    d += derivatives[tap] * values[sample + tap];
+                }
+                const float y = samples[sample];
+                sums.tt += t * t;
+                sums.td += t * d;
+                sums.dd += d * d;
+                sums.yt += y * t;
+                sums.yd += y * d;
+            }
+            return sums;
+        }
+    }
+
+
+    PulseTemplateFit::PulseTemplateFit(const RunParams &t_runParams) :
+            m_origin(t_runParams.getPixelPulseTemplateOrigin()),
+            m_nIterations(t_runParams.getPulseTemplateFitIterations()) {
+        const std::vector<double> &pulseTemplate = t_runParams.getPixelPulseTemplate();
+        if (pulseTemplate.empty() || (m_origin >= pulseTemplate.size())) {
+            std::cerr << "ERROR: Pixel pulse template origin " << m_origin << " outside the pixel pulse template of "
+                      << pulseTemplate.size() << " samples!" << std::endl;
+            exit(1);
+        }
+        const auto peak = std::max_element(pulseTemplate.cbegin(), pulseTemplate.cend());
+        if (!(*peak > 0.)) {
+            std::cerr << "ERROR: Pixel pulse template must have a positive maximum!" << std::endl;
+            exit(1);
+        }
+        m_nTemplateSamples = static_cast<unsigned>(pulseTemplate.size());
+        m_peak = static_cast<unsigned>(peak - pulseTemplate.cbegin());
+        m_template.assign(m_nTemplateSamples + 2 * kTemplatePadding, 0.f);
+        for (unsigned sample = 0; sample < m_nTemplateSamples; ++sample) {
+            m_template[kTemplatePadding + sample] = static_cast<float>(pulseTemplate[sample] / *peak);
+        }
+    }
+
+
+    void PulseTemplateFit::fitHits(Event &t_event) {
+        std::vector<Hit2d> &hits = t_event.pixelHits;
+        const auto start = std::chrono::steady_clock::now();
+        // Gather the raw pulses and the start values of the batch.
+        m_samples.clear();
+        m_offsets.clear();
+        m_lengths.clear();
+        m_amplitudes.clear();
+        m_times.clear();
+        m_activeHits.clear();
+        unsigned nBatchSamples = 0;
+        for (const auto &hit : hits) {
+            m_offsets.push_back(nBatchSamples);
+            m_lengths.push_back(hit.pulseLength);
+            nBatchSamples += m_lengths.back();
+        }
+        m_samples.resize(nBatchSamples);
+        for (unsigned hitIdx = 0; hitIdx < hits.size(); ++hitIdx) {
+            const Hit2d &hit = hits[hitIdx];
+            const unsigned nSamples = m_lengths[hitIdx];
+            convertSamples(t_event.getPulse(hit).data(), nSamples, m_samples.data() + m_offsets[hitIdx]);
+            // The template maximum starts at the peak of the parabola through the peak sample and its neighbours.
+            const unsigned peakSample = hit.posPeakSample - hit.firstSample;
+            float peakTime = static_cast<float>(peakSample);
+            if ((peakSample > 0) && (peakSample + 1 < nSamples)) {
+                const float *const samples = m_samples.data() + m_offsets[hitIdx] + peakSample;
+                const float curvature = samples[-1] - 2.f * samples[0] + samples[1];
+                if (curvature < 0.f) {
+                    peakTime += 0.5f * (samples[-1] - samples[1]) / curvature;
+                }
+            }
+            m_amplitudes.push_back(static_cast<float>(hit.posPulseHeight));
+            m_times.push_back(peakTime + static_cast<float>(m_origin) - static_cast<float>(m_peak));
+            if ((hit.posPulseHeight > 0) && (peakSample < nSamples)) {
+                m_activeHits.push_back(hitIdx);
+            }
+            else {
+                m_amplitudes.back() = 0.f;
+            }
+        }
+        // One Gauss-Newton step for all hits still being fitted per iteration.
+        for (unsigned iteration = 0; (iteration < m_nIterations) && !m_activeHits.empty(); ++iteration) {
+            m_nSteps += m_activeHits.size();
+            unsigned nActiveHits = 0;
+            for (const auto hitIdx : m_activeHits) {
+                if (step(hitIdx)) {
+                    m_activeHits[nActiveHits] = hitIdx;
+                    ++nActiveHits;
+                }
+            }
+            m_activeHits.resize(nActiveHits);
+        }
+        // Hits that didn't converge within the iterations keep their last time.
+        for (unsigned hitIdx = 0; hitIdx < hits.size(); ++hitIdx) {
+            if (m_amplitudes[hitIdx] > 0.f) {
+                hits[hitIdx].posPeakTime = static_cast<float>(hits[hitIdx].firstSample) + m_times[hitIdx];
+                ++m_nFittedHits;
+            }
+        }
+        m_nHits += hits.size();
+        ++m_nEvents;
+        m_time += std::chrono::steady_clock::now() - start;
+    }
+
+
+    void PulseTemplateFit::printStats() const {
+        if (!m_nEvents) {
+            return;
+        }
+        std::cout << "Pulse template fit: " << m_nFittedHits << " of " << m_nHits << " pixel hits fitted, "
+                  << m_time.count() * 1e6 / m_nEvents << "us per event, "
+                  << (m_nHits ? static_cast<double>(m_nSteps) / m_nHits : 0.) << " steps per hit.\n";
+    }
+
+
+    bool PulseTemplateFit::step(const unsigned t_hitIdx) {
+        float &amplitude = m_amplitudes[t_hitIdx];
+        float &time = m_times[t_hitIdx];
+        const unsigned nSamples = m_lengths[t_hitIdx];
+        // Sample l is at the template position l - time + origin.
+        const TemplateSums sums = computeSums(m_samples.data() + m_offsets[t_hitIdx], nSamples, m_template.data(),
+                                              m_nTemplateSamples, static_cast<float>(m_origin) - time);
+        // Normal equations of the residuals y - amplitude * T, whose derivatives are -T by the amplitude and
+        // amplitude * D by the time.
+        const float aa = sums.tt;
+        const float ab = -amplitude * sums.td;
+        const float bb = amplitude * amplitude * sums.dd;
+        const float ar = sums.yt - amplitude * sums.tt;
+        const float br = -amplitude * (sums.yd - amplitude * sums.td);
+        const float determinant = aa * bb - ab * ab;
+        if (!(determinant > 0.f)) {
+            amplitude = 0.f;
+            return false;
+        }
+        // Steps of more than a sample leave the range the linearisation holds in.
+        const float timeStep = std::max(std::min((aa * br - ab * ar) / determinant, 1.f), -1.f);
+        amplitude += (bb * ar - ab * br) / determinant;
+        time += timeStep;
+        if (!(amplitude > 0.f) || (time < 0.f) || (time > static_cast<float>(nSamples - 1))) {
+            amplitude = 0.f;
+            return false;
+        }
+        return std::fabs(timeStep) >= kTimeTolerance;
+    }
+}
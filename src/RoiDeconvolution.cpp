@@ -0,0 +1,96 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "RoiDeconvolution.h"
+
+
+namespace pixy_roimux {
+    RoiDeconvolution::RoiDeconvolution(const RunParams &t_runParams) :
+            m_sampleTime(t_runParams.getSampleTime()),
+            m_response(t_runParams.getRoiResponse()),
+            m_responseOrigin(t_runParams.getRoiResponseOrigin()),
+            m_cutoff(t_runParams.getDeconvolutionCutoff()),
+            m_noiseLevel(t_runParams.getDeconvolutionNoise()) {
+        if (m_sampleTime <= 0.) {
+            std::cerr << "ERROR: ROI deconvolution needs a positive sample time!" << std::endl;
+            exit(1);
+        }
+        if (m_response.empty() || (m_responseOrigin >= m_response.size())) {
+            std::cerr << "ERROR: ROI response origin " << m_responseOrigin << " outside the ROI response of "
+                      << m_response.size() << " samples!" << std::endl;
+            exit(1);
+        }
+        if ((m_cutoff <= 0.) || (m_noiseLevel <= 0.)) {
+            std::cerr << "ERROR: ROI deconvolution needs a positive cutoff and noise level!" << std::endl;
+            exit(1);
+        }
+        double peak = 0.;
+        for (const auto &value : m_response) {
+            peak = std::max(peak, std::abs(value));
+        }
+        if (peak == 0.) {
+            std::cerr << "ERROR: ROI response is 0!" << std::endl;
+            exit(1);
+        }
+        for (auto &&value : m_response) {
+            value /= peak;
+        }
+    }
+
+
+    const std::vector<std::complex<double>> &RoiDeconvolution::getFilter(const unsigned t_nSamples) {
+        auto filterItr = m_filters.find(t_nSamples);
+        if (filterItr != m_filters.end()) {
+            return filterItr->second;
+        }
+        const unsigned nBins = BatchedFft::getNBins(t_nSamples);
+        // Spectrum of the response with its origin moved to sample 0. The response is short, so a direct DFT is fine.
+        std::vector<std::complex<double>> response(nBins);
+        double peakPower = 0.;
+        for (unsigned bin = 0; bin < nBins; ++bin) {
+            for (unsigned sample = 0; sample < m_response.size(); ++sample) {
+                const double phase = -2. * M_PI * bin * (static_cast<double>(sample) - m_responseOrigin) / t_nSamples;
+                response.at(bin) += m_response.at(sample) * std::polar(1., phase);
+            }
+            peakPower = std::max(peakPower, std::norm(response.at(bin)));
+        }
+        std::vector<std::complex<double>> &filter = m_filters[t_nSamples];
+        filter.resize(nBins);
+        filter.at(0) = 1. / t_nSamples;
+        // Bin k is at k / (nSamples * sampleTime) MHz with the sample time in us.
+        const double binWidth = 1. / (t_nSamples * m_sampleTime);
+        for (unsigned bin = 1; bin < nBins; ++bin) {
+            const double frequency = bin * binWidth;
+            const double lowPass = std::exp(-0.5 * frequency * frequency / (m_cutoff * m_cutoff));
+            filter.at(bin) = lowPass * std::conj(response.at(bin)) /
+                             ((std::norm(response.at(bin)) + m_noiseLevel * peakPower) * t_nSamples);
+        }
+        return filter;
+    }
+
+
+    void RoiDeconvolution::filterPlane(PlaneWaveforms &t_plane) {
+        if (!t_plane.getNChannels() || !t_plane.getNSamples()) {
+            return;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const std::vector<std::complex<double>> &filter = getFilter(t_plane.getNSamples());
+        m_fft.load(t_plane);
+        m_fft.forward();
+        m_fft.multiply(filter);
+        m_fft.inverse();
+        m_fft.store(t_plane);
+        m_time += std::chrono::steady_clock::now() - start;
+        ++m_nPlanes;
+    }
+
+
+    void RoiDeconvolution::printStats() const {
+        if (!m_nPlanes) {
+            return;
+        }
+        std::cout << "ROI deconvolution: " << m_nPlanes << " planes, " << m_time.count() * 1e6 / m_nPlanes
+                  << "us per plane, planning " << m_fft.getPlanTime().count() * 1e3 << "ms.\n";
+    }
+}
@@ -6,7 +6,9 @@
 
 
 namespace pixy_roimux {
-    
+    const unsigned RunParams::kAnyArraySize;
+
+
     ///RunParams Constructor, runParamsFile as input
     RunParams::RunParams(const std::string t_runParamsFileName) {
         FILE *runParamsFile = fopen(t_runParamsFileName.c_str(), "r");
@@ -56,6 +58,7 @@ namespace pixy_roimux {
         m_discSigmaRoiNegPeak   = getJsonMember("discSigmaRoiNegPeak", rapidjson::kNumberType).GetDouble();
         m_discAbsRoiNegPeak     = getJsonMember("discAbsRoiNegPeak", rapidjson::kNumberType).GetDouble();
         m_discSigmaRoiNegTrail  = getJsonMember("discSigmaRoiNegTrail", rapidjson::kNumberType).GetDouble();
+        m_discRange             = getJsonMember("discRange", rapidjson::kNumberType).GetUint();
         m_pcaScaleFactor        = getJsonMember("pcaScaleFactor", rapidjson::kNumberType).GetDouble();
         m_pcaMaxIterations      = getJsonMember("pcaMaxIterations", rapidjson::kNumberType).GetUint();
         m_kalmanRngSeed         = getJsonMember("kalmanRngSeed", rapidjson::kNumberType).GetUint();
@@ -65,6 +68,83 @@ namespace pixy_roimux {
         m_kalmanDeltaWeight     = getJsonMember("kalmanDeltaWeight", rapidjson::kNumberType).GetDouble();
         m_kalmanPdgCode         = getJsonMember("kalmanPdgCode", rapidjson::kNumberType).GetInt();
         m_kalmanMomMag          = getJsonMember("kalmanMomMag", rapidjson::kNumberType).GetDouble();
+        m_streamWindow          = getJsonMember("streamWindow", rapidjson::kNumberType).GetUint();
+        m_readerThreads         = getJsonMember("readerThreads", rapidjson::kNumberType).GetUint();
+        m_readerQueueSize       = getJsonMember("readerQueueSize", rapidjson::kNumberType).GetUint();
+        m_compressWaveforms     = getJsonMember("compressWaveforms", rapidjson::kTrueType).GetBool();
+        m_zeroSuppress          = getJsonMember("zeroSuppress", rapidjson::kTrueType).GetBool();
+        m_nWorkers              = getJsonMember("nWorkers", rapidjson::kNumberType).GetUint();
+        const std::string noiseEstimator = getJsonMember("noiseEstimator", rapidjson::kStringType).GetString();
+        if (noiseEstimator == "fit") {
+            m_noiseEstimator = NoiseEstimator::fit;
+        }
+        else if (noiseEstimator == "fast") {
+            m_noiseEstimator = NoiseEstimator::fast;
+        }
+        else if (noiseEstimator == "validate") {
+            m_noiseEstimator = NoiseEstimator::validate;
+        }
+        else {
+            std::cerr << "ERROR: Unknown noise estimator \"" << noiseEstimator << "\" in run parameter file!" << std::endl;
+            std::cerr << "Expected \"fit\", \"fast\" or \"validate\"." << std::endl;
+            exit(1);
+        }
+        const std::string commonModeKernel = getJsonMember("commonModeKernel", rapidjson::kStringType).GetString();
+        if (commonModeKernel == "scalar") {
+            m_commonModeKernel = CommonModeKernel::scalar;
+        }
+        else if (commonModeKernel == "simd") {
+            m_commonModeKernel = CommonModeKernel::simd;
+        }
+        else if (commonModeKernel == "compare") {
+            m_commonModeKernel = CommonModeKernel::compare;
+        }
+        else {
+            std::cerr << "ERROR: Unknown common mode kernel \"" << commonModeKernel << "\" in run parameter file!"
+                      << std::endl;
+            std::cerr << "Expected \"scalar\", \"simd\" or \"compare\"." << std::endl;
+            exit(1);
+        }
+        m_pedestalDatabase      = getJsonMember("pedestalDatabase", rapidjson::kStringType).GetString();
+        m_pedestalAlpha         = getJsonMember("pedestalAlpha", rapidjson::kNumberType).GetDouble();
+        m_pedestalMeanTolerance = getJsonMember("pedestalMeanTolerance", rapidjson::kNumberType).GetDouble();
+        m_pedestalSigmaTolerance = getJsonMember("pedestalSigmaTolerance", rapidjson::kNumberType).GetDouble();
+        m_frequencyFilter       = getJsonMember("frequencyFilter", rapidjson::kTrueType).GetBool();
+        m_lowPassCutoff         = getJsonMember("lowPassCutoff", rapidjson::kNumberType).GetDouble();
+        for (const auto &frequency : getJsonMember("notchFrequencies", rapidjson::kArrayType, kAnyArraySize,
+                                                   rapidjson::kNumberType).GetArray()) {
+            m_notchFrequencies.push_back(frequency.GetDouble());
+        }
+        m_notchWidth            = getJsonMember("notchWidth", rapidjson::kNumberType).GetDouble();
+        m_roiDeconvolution      = getJsonMember("roiDeconvolution", rapidjson::kTrueType).GetBool();
+        for (const auto &value : getJsonMember("roiResponse", rapidjson::kArrayType, kAnyArraySize,
+                                               rapidjson::kNumberType).GetArray()) {
+            m_roiResponse.push_back(value.GetDouble());
+        }
+        m_roiResponseOrigin     = getJsonMember("roiResponseOrigin", rapidjson::kNumberType).GetUint();
+        m_deconvolutionCutoff   = getJsonMember("deconvolutionCutoff", rapidjson::kNumberType).GetDouble();
+        m_deconvolutionNoise    = getJsonMember("deconvolutionNoise", rapidjson::kNumberType).GetDouble();
+        m_channelMasking        = getJsonMember("channelMasking", rapidjson::kTrueType).GetBool();
+        m_channelStatusFile     = getJsonMember("channelStatusFile", rapidjson::kStringType).GetString();
+        m_deadSigma             = getJsonMember("deadSigma", rapidjson::kNumberType).GetDouble();
+        m_noisySigmaFactor      = getJsonMember("noisySigmaFactor", rapidjson::kNumberType).GetDouble();
+        m_channelStatusMinEvents = getJsonMember("channelStatusMinEvents", rapidjson::kNumberType).GetUint();
+        m_hitFinderThreads      = getJsonMember("hitFinderThreads", rapidjson::kNumberType).GetUint();
+        m_pixelMatchedFilter    = getJsonMember("pixelMatchedFilter", rapidjson::kTrueType).GetBool();
+        for (const auto &value : getJsonMember("pixelFilterKernel", rapidjson::kArrayType, kAnyArraySize,
+                                               rapidjson::kNumberType).GetArray()) {
+            m_pixelFilterKernel.push_back(value.GetDouble());
+        }
+        m_pixelFilterOrigin     = getJsonMember("pixelFilterOrigin", rapidjson::kNumberType).GetUint();
+        m_discSigmaPixelSeedPeak = getJsonMember("discSigmaPixelSeedPeak", rapidjson::kNumberType).GetDouble();
+        m_discAbsPixelSeedPeak  = getJsonMember("discAbsPixelSeedPeak", rapidjson::kNumberType).GetDouble();
+        m_pulseTemplateFit      = getJsonMember("pulseTemplateFit", rapidjson::kTrueType).GetBool();
+        for (const auto &value : getJsonMember("pixelPulseTemplate", rapidjson::kArrayType, kAnyArraySize,
+                                               rapidjson::kNumberType).GetArray()) {
+            m_pixelPulseTemplate.push_back(value.GetDouble());
+        }
+        m_pixelPulseTemplateOrigin = getJsonMember("pixelPulseTemplateOrigin", rapidjson::kNumberType).GetUint();
+        m_pulseTemplateFitIterations = getJsonMember("pulseTemplateFitIterations", rapidjson::kNumberType).GetUint();
         
         m_kalmanPosErr = std::vector<double>(3);
         jsonArrayItr = getJsonMember("kalmanPosErr", rapidjson::kArrayType, 3, rapidjson::kNumberType).Begin();
@@ -95,6 +175,20 @@ namespace pixy_roimux {
             ++jsonArrayItr;
         }
         
+        //Gather plan used to convert the DAQ histograms to readout channels
+        m_gatherPlan = std::vector<ChannelGather>(m_nChans);
+        for (unsigned readoutChan = 0; readoutChan < m_nChans; ++readoutChan) {
+            const unsigned daqChan = m_readout2daq.at(readoutChan);
+            if (daqChan >= m_nChans) {
+                std::cerr << "ERROR: DAQ channel " << daqChan << " of readout channel " << readoutChan
+                          << " in run parameter file out of range!" << std::endl;
+                exit(1);
+            }
+            // DAQ channels 0 to nChans/2 - 1 are in the "Ind_x" histogram, the rest in the "Col_x" histogram.
+            m_gatherPlan.at(readoutChan).daqHisto = (daqChan < m_nChans / 2) ? 0 : 1;
+            m_gatherPlan.at(readoutChan).daqRow = daqChan - m_gatherPlan.at(readoutChan).daqHisto * (m_nChans / 2);
+        }
+        
         //Pixel Coordinates (X, Y)
         m_pixelCoor = std::vector<std::vector<int>>(m_nPixels, std::vector<int>(2));
         jsonArrayItr = getJsonMember("pixelCoorX", rapidjson::kArrayType, m_nPixels, rapidjson::kNumberType).Begin();
@@ -139,14 +233,16 @@ namespace pixy_roimux {
         ///Get the value specified for memberName
         rapidjson::Value &member = m_jsonDoc[t_memberName.c_str()];
         
-        if (((t_memberType == rapidjson::kTrueType) || (t_memberType == rapidjson::kFalseType)) &&
-                !((member.GetType() == rapidjson::kTrueType) || (member.GetType() == rapidjson::kFalseType))) {
-            std::cerr << "ERROR: Entry \"" << t_memberName << "\" in run parameter file has wrong type!"
-                      << std::endl;
-            std::cerr << "Expected " << m_jsonTypes.at(rapidjson::kTrueType)
-                      << " or " << m_jsonTypes.at(rapidjson::kFalseType)
-                      << ", got " << m_jsonTypes.at(member.GetType()) << '.' << std::endl;
-            exit(1);
+        ///A bool is requested as either kTrueType or kFalseType and matches both
+        if ((t_memberType == rapidjson::kTrueType) || (t_memberType == rapidjson::kFalseType)) {
+            if (!member.IsBool()) {
+                std::cerr << "ERROR: Entry \"" << t_memberName << "\" in run parameter file has wrong type!"
+                          << std::endl;
+                std::cerr << "Expected " << m_jsonTypes.at(rapidjson::kTrueType)
+                          << " or " << m_jsonTypes.at(rapidjson::kFalseType)
+                          << ", got " << m_jsonTypes.at(member.GetType()) << '.' << std::endl;
+                exit(1);
+            }
         }
         else if (member.GetType() != t_memberType) {
             std::cerr << "ERROR: Entry \"" << t_memberName << "\" in run parameter file has wrong type!"
@@ -156,7 +252,7 @@ namespace pixy_roimux {
             exit(1);
         }
         if (member.GetType() == rapidjson::kArrayType) {
-            if (member.Size() != t_arraySize) {
+            if ((t_arraySize != kAnyArraySize) && (member.Size() != t_arraySize)) {
                 std::cerr << "ERROR: Size mismatch for array \"" << t_memberName << "\" in run parameter file!"
                           << std::endl;
                 std::cerr << "Expected " << t_arraySize << ", got " << member.Size() << '.' << std::endl;
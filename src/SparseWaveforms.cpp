@@ -0,0 +1,81 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "SparseWaveforms.h"
+
+
+namespace pixy_roimux {
+    SparsePlane::SparsePlane(
+            const PlaneWaveforms &t_plane,
+            const std::vector<ChannelNoise> &t_noise,
+            const unsigned t_padBefore,
+            const unsigned t_padAfter,
+            const PlaneWaveforms *const t_seedPlane) :
+            m_nChannels(t_plane.getNChannels()),
+            m_nSamples(t_plane.getNSamples()) {
+        m_channelSegments.reserve(m_nChannels + 1);
+        for (unsigned channel = 0; channel < m_nChannels; ++channel) {
+            m_channelSegments.push_back(static_cast<unsigned>(m_segments.size()));
+            // Masked channels keep no samples.
+            if (t_noise.at(channel).masked) {
+                continue;
+            }
+            const auto samples = t_plane.getChannel(channel);
+            const auto seeds = t_seedPlane ? t_seedPlane->getChannel(channel) : samples;
+            const double thrPosPeak = t_noise.at(channel).thrPosPeak;
+            // Open segment, if any.
+            bool inSegment = false;
+            unsigned segmentStart = 0;
+            unsigned segmentStop = 0;
+            for (unsigned sample = 0; sample < m_nSamples; ++sample) {
+                if (seeds[sample] < thrPosPeak) {
+                    continue;
+                }
+                const unsigned seedStart = (sample > t_padBefore) ? (sample - t_padBefore) : 0;
+                const unsigned seedStop = std::min(sample + t_padAfter + 1, m_nSamples);
+                // Extend the open segment if the seed window overlaps or touches it, otherwise close it.
+                if (inSegment && (seedStart <= segmentStop)) {
+                    segmentStop = std::max(segmentStop, seedStop);
+                    continue;
+                }
+                if (inSegment) {
+                    WaveformSegment segment;
+                    segment.start = segmentStart;
+                    segment.length = segmentStop - segmentStart;
+                    segment.offset = static_cast<unsigned>(m_samples.size());
+                    m_segments.push_back(segment);
+                    m_samples.insert(m_samples.end(), samples.begin() + segmentStart, samples.begin() + segmentStop);
+                }
+                inSegment = true;
+                segmentStart = seedStart;
+                segmentStop = seedStop;
+            }
+            if (inSegment) {
+                WaveformSegment segment;
+                segment.start = segmentStart;
+                segment.length = segmentStop - segmentStart;
+                segment.offset = static_cast<unsigned>(m_samples.size());
+                m_segments.push_back(segment);
+                m_samples.insert(m_samples.end(), samples.begin() + segmentStart, samples.begin() + segmentStop);
+            }
+        }
+        m_channelSegments.push_back(static_cast<unsigned>(m_segments.size()));
+        m_segments.shrink_to_fit();
+        m_samples.shrink_to_fit();
+    }
+
+
+    std::unique_ptr<TH1D> SparsePlane::makeChannelHisto(
+            const std::string &t_name,
+            const unsigned t_channel) const {
+        std::unique_ptr<TH1D> histo(new TH1D(t_name.c_str(), t_name.c_str(), m_nSamples, 0, m_nSamples));
+        for (const auto &segment : getSegments(t_channel)) {
+            const auto samples = getSamples(segment);
+            for (unsigned sample = 0; sample < segment.length; ++sample) {
+                histo->SetBinContent((segment.start + sample + 1), samples[sample]);
+            }
+        }
+        return histo;
+    }
+}
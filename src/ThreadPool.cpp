@@ -0,0 +1,81 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include "ThreadPool.h"
+
+
+namespace pixy_roimux {
+    ThreadPool::ThreadPool(const unsigned t_nThreads) {
+        for (unsigned worker = 1; worker < t_nThreads; ++worker) {
+            m_threads.emplace_back(&ThreadPool::workLoop, this, worker);
+        }
+    }
+
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_started.notify_all();
+        for (auto &&thread : m_threads) {
+            thread.join();
+        }
+    }
+
+
+    void ThreadPool::run(
+            const unsigned t_nTasks,
+            const std::function<void(unsigned, unsigned)> &t_task) {
+        if (m_threads.empty()) {
+            for (unsigned task = 0; task < t_nTasks; ++task) {
+                t_task(task, 0);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task = &t_task;
+            m_nTasks = t_nTasks;
+            m_nextTask = 0;
+            m_nBusy = static_cast<unsigned>(m_threads.size());
+            ++m_nBatches;
+        }
+        m_started.notify_all();
+        // The calling thread is worker 0.
+        work(0);
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_finished.wait(lock, [this] { return !m_nBusy; });
+        m_task = nullptr;
+    }
+
+
+    void ThreadPool::workLoop(const unsigned t_worker) {
+        unsigned long nBatches = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_started.wait(lock, [&] { return m_stop || (m_nBatches != nBatches); });
+                if (m_stop) {
+                    return;
+                }
+                nBatches = m_nBatches;
+            }
+            work(t_worker);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_nBusy;
+            }
+            m_finished.notify_one();
+        }
+    }
+
+
+    void ThreadPool::work(const unsigned t_worker) {
+        // m_task and m_nTasks were set under the mutex before the batch started and don't change until it's finished.
+        for (unsigned task = m_nextTask++; task < m_nTasks; task = m_nextTask++) {
+            (*m_task)(task, t_worker);
+        }
+    }
+}
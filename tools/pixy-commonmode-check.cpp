@@ -0,0 +1,183 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "EventWaveforms.h"
+#include "NoiseFilter.h"
+
+
+namespace {
+    ///
+    /// Synthetic plane with the noise bands of its channels.
+    ///
+    struct CheckPlane {
+        pixy_roimux::PlaneWaveforms plane;
+        std::vector<std::pair<double, double>> thresholds;
+    };
+
+    ///
+    /// Kind of noise band of a channel in a check plane.
+    ///
+    enum class BandKind {
+        ///
+        /// Band of about one sigma around the baseline.
+        ///
+        normal,
+
+        ///
+        /// Band far away from all samples, so the channel never contributes to the common mode.
+        ///
+        outOfRange,
+
+        ///
+        /// NaN as the lower, the upper or both thresholds.
+        ///
+        nan,
+
+        ///
+        /// Empty band of a masked channel, +inf to -inf.
+        ///
+        masked,
+
+        ///
+        /// Unbounded band, -inf to +inf.
+        ///
+        unbounded,
+
+        ///
+        /// Band with fractional thresholds close to the samples, testing the integer conversion of the bounds.
+        ///
+        fractional
+    };
+
+    ///
+    /// Generate a plane of Gaussian noise around t_baseline with a random band kind per channel. If t_rails is set,
+    /// some samples are pushed onto the int16_t limits, so subtracting the common mode saturates.
+    ///
+    CheckPlane makePlane(
+            std::mt19937 &t_generator,
+            const unsigned t_nChannels,
+            const unsigned t_nSamples,
+            const double t_baseline,
+            const bool t_rails) {
+        const double sigma = 3.;
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        const double inf = std::numeric_limits<double>::infinity();
+        CheckPlane check{pixy_roimux::PlaneWaveforms(t_nChannels, t_nSamples),
+                         std::vector<std::pair<double, double>>(t_nChannels)};
+        std::normal_distribution<double> noise(t_baseline, sigma);
+        std::uniform_int_distribution<int> kind(0, 5);
+        std::uniform_int_distribution<int> rail(0, 15);
+        std::uniform_real_distribution<double> fraction(0., 1.);
+        for (unsigned channel = 0; channel < t_nChannels; ++channel) {
+            auto samples = check.plane.getChannel(channel);
+            for (auto &&sample : samples) {
+                sample = static_cast<int16_t>(std::max(-32768., std::min(32767., std::round(noise(t_generator)))));
+                if (t_rails && !rail(t_generator)) {
+                    sample = (fraction(t_generator) < 0.5) ? std::numeric_limits<int16_t>::min()
+                                                           : std::numeric_limits<int16_t>::max();
+                }
+            }
+            auto &thresholds = check.thresholds.at(channel);
+            switch (static_cast<BandKind>(kind(t_generator))) {
+                case BandKind::normal:
+                    thresholds = std::make_pair(t_baseline - sigma, t_baseline + sigma);
+                    break;
+                case BandKind::outOfRange:
+                    thresholds = std::make_pair(t_baseline + 1000., t_baseline + 2000.);
+                    break;
+                case BandKind::nan:
+                    thresholds = (fraction(t_generator) < 0.3) ? std::make_pair(nan, t_baseline + sigma) :
+                                 (fraction(t_generator) < 0.5) ? std::make_pair(t_baseline - sigma, nan) :
+                                 std::make_pair(nan, nan);
+                    break;
+                case BandKind::masked:
+                    thresholds = std::make_pair(inf, -inf);
+                    break;
+                case BandKind::unbounded:
+                    thresholds = std::make_pair(-inf, inf);
+                    break;
+                case BandKind::fractional:
+                    thresholds = std::make_pair(t_baseline - sigma * fraction(t_generator),
+                                                t_baseline + sigma * fraction(t_generator));
+                    break;
+            }
+        }
+        return check;
+    }
+
+    ///
+    /// Run both common mode kernels on copies of a plane and compare them sample by sample. Returns the number of
+    /// differing samples.
+    ///
+    unsigned long comparePlane(const CheckPlane &t_check) {
+        pixy_roimux::PlaneWaveforms scalarPlane(t_check.plane);
+        pixy_roimux::PlaneWaveforms tiledPlane(t_check.plane);
+        pixy_roimux::NoiseFilter::removeCommonModeScalar(scalarPlane, t_check.thresholds);
+        pixy_roimux::NoiseFilter::removeCommonModeTiled(tiledPlane, t_check.thresholds);
+        unsigned long nDiffering = 0;
+        for (unsigned channel = 0; channel < t_check.plane.getNChannels(); ++channel) {
+            const auto scalarSamples = scalarPlane.getChannel(channel);
+            const auto tiledSamples = tiledPlane.getChannel(channel);
+            for (unsigned sample = 0; sample < t_check.plane.getNSamples(); ++sample) {
+                if (scalarSamples[sample] != tiledSamples[sample]) {
+                    if (!nDiffering) {
+                        std::cerr << "ERROR: Channel " << channel << " sample " << sample << ": scalar "
+                                  << scalarSamples[sample] << ", tiled " << tiledSamples[sample] << '.' << std::endl;
+                    }
+                    ++nDiffering;
+                }
+            }
+        }
+        return nDiffering;
+    }
+}
+
+
+///
+/// Regression check of the tiled SIMD common mode removal against the scalar reference. Both kernels run on synthetic
+/// planes with channels without in-band samples, NaN and infinite noise bands and samples on the int16_t limits, and
+/// must give identical results. Returns non-zero on any difference.
+///
+int main(int argc, char** argv) {
+    const unsigned nPlanes = (argc > 1) ? static_cast<unsigned>(std::stoul(argv[1])) : 200;
+    if (!nPlanes) {
+        std::cerr << "Usage: " << argv[0] << " [nPlanes]" << std::endl;
+        exit(1);
+    }
+    std::mt19937 generator(1);
+    // Odd sizes exercise the partial tiles and the scalar tails of the SIMD loops.
+    std::uniform_int_distribution<unsigned> nChannels(1, 80);
+    std::uniform_int_distribution<unsigned> nSamples(1, 1100);
+    std::uniform_real_distribution<double> baseline(-32000., 32000.);
+    unsigned long nFailed = 0;
+    for (unsigned plane = 0; plane < nPlanes; ++plane) {
+        // Alternate between planes near zero, planes at random baselines and planes with samples on the rails.
+        const double planeBaseline = (plane % 3) ? baseline(generator) : 0.;
+        const bool rails = (plane % 3) == 2;
+        const CheckPlane check = makePlane(generator, nChannels(generator), nSamples(generator), planeBaseline, rails);
+        const unsigned long nDiffering = comparePlane(check);
+        if (nDiffering) {
+            std::cerr << "ERROR: " << nDiffering << " samples differ in plane " << plane << " with "
+                      << check.plane.getNChannels() << " channels of " << check.plane.getNSamples() << " samples!"
+                      << std::endl;
+            ++nFailed;
+        }
+    }
+    if (nFailed) {
+        std::cerr << "ERROR: Tiled and scalar common mode removal differ in " << nFailed << " of " << nPlanes
+                  << " planes!" << std::endl;
+        return 1;
+    }
+    std::cout << "Tiled and scalar common mode removal agree on " << nPlanes << " planes.\n";
+
+    return 0;
+}
@@ -0,0 +1,33 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "NativeRawFile.h"
+#include "RunParams.h"
+
+
+///
+/// Convert a DAQ ROOT file to a native raw waveform file which can be passed to pixy instead of the ROOT file.
+///
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " runParamsFileName dataFileName nativeFileName" << std::endl;
+        exit(1);
+    }
+    const std::string runParamsFileName = std::string(argv[1]);
+    const std::string dataFileName = std::string(argv[2]);
+    const std::string nativeFileName = std::string(argv[3]);
+
+    auto clkStart = std::chrono::high_resolution_clock::now();
+    const pixy_roimux::RunParams runParams(runParamsFileName);
+    const unsigned long nEvents = pixy_roimux::NativeRawFile::convert(dataFileName, nativeFileName, runParams);
+    auto clkStop = std::chrono::high_resolution_clock::now();
+    auto clkDuration = std::chrono::duration_cast<std::chrono::milliseconds>(clkStop - clkStart);
+    std::cout << "Converted " << nEvents << " events to " << nativeFileName << " in " << clkDuration.count()
+              << "ms\n";
+
+    return 0;
+}
@@ -0,0 +1,388 @@
+//
+// Created by agent on 10/18/26.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "TH1.h"
+#include "TH2S.h"
+#include "ChargeData.h"
+#include "CrossingDetector.h"
+#include "EnvelopePyramid.h"
+#include "EventWaveforms.h"
+#include "NoiseModel.h"
+#include "RunParams.h"
+
+
+namespace {
+    ///
+    /// Synthetic plane of channel-major samples with the noise parameters of its channels.
+    ///
+    struct BenchPlane {
+        unsigned nChannels;
+        unsigned nSamples;
+        std::vector<int16_t> samples;
+        std::vector<pixy_roimux::ChannelNoise> noise;
+    };
+
+    ///
+    /// Pulse edges found by the discrimination of one peak. -1 if not found.
+    ///
+    struct Edges {
+        int firstSample;
+        int lastSample;
+        int zeroCrossSample;
+    };
+
+    ///
+    /// Generate a plane of Gaussian noise with t_nPulses pulses per channel. Bipolar pulses get a negative lobe.
+    ///
+    BenchPlane makePlane(
+            const unsigned t_nChannels,
+            const unsigned t_nSamples,
+            const unsigned t_nPulses,
+            const bool t_bipolar) {
+        const double sigma = 3.;
+        BenchPlane plane{t_nChannels, t_nSamples, std::vector<int16_t>(t_nChannels * t_nSamples),
+                         std::vector<pixy_roimux::ChannelNoise>(t_nChannels)};
+        std::mt19937 generator(t_nPulses);
+        std::normal_distribution<double> noise(0., sigma);
+        std::uniform_int_distribution<unsigned> position(0, t_nSamples - 1);
+        std::uniform_real_distribution<double> amplitude(20., 200.);
+        std::vector<double> waveform(t_nSamples);
+        for (unsigned channel = 0; channel < t_nChannels; ++channel) {
+            for (auto &&sample : waveform) {
+                sample = noise(generator);
+            }
+            for (unsigned pulse = 0; pulse < t_nPulses; ++pulse) {
+                const int peak = static_cast<int>(position(generator));
+                const double height = amplitude(generator);
+                for (int offset = -6; offset <= 6; ++offset) {
+                    const double shape = height * std::exp(-offset * offset / 8.);
+                    if ((peak + offset >= 0) && (peak + offset < static_cast<int>(t_nSamples))) {
+                        waveform.at(peak + offset) += shape;
+                    }
+                    if (t_bipolar && (peak + offset + 8 >= 0) && (peak + offset + 8 < static_cast<int>(t_nSamples))) {
+                        waveform.at(peak + offset + 8) -= 0.8 * shape;
+                    }
+                }
+            }
+            for (unsigned sample = 0; sample < t_nSamples; ++sample) {
+                plane.samples.at(channel * t_nSamples + sample) =
+                        static_cast<int16_t>(std::lround(waveform.at(sample)));
+            }
+            plane.noise.at(channel) = pixy_roimux::ChannelNoise{0.3, sigma, 2.5 * sigma, 5. * sigma, 2.5 * sigma,
+                                                               -4. * sigma, -sigma, false};
+        }
+        return plane;
+    }
+
+    ///
+    /// Discriminate the pulse around a peak one sample at a time, like the hit finder did before the crossing detector.
+    ///
+    Edges discriminateScalar(
+            const int16_t *const t_samples,
+            const int t_nSamples,
+            const int t_peak,
+            const int t_discRange,
+            const pixy_roimux::ChannelNoise &t_noise,
+            const bool t_bipolar) {
+        Edges edges{-1, -1, -1};
+        for (int sample = t_peak - 1; sample >= std::max(t_peak - t_discRange, 0); --sample) {
+            if (t_samples[sample] < t_noise.thrPosLead) {
+                edges.firstSample = sample;
+                break;
+            }
+        }
+        for (int sample = t_peak + 1; sample <= std::min(t_peak + t_discRange, t_nSamples - 1); ++sample) {
+            if (t_samples[sample] < t_noise.thrPosTrail) {
+                edges.lastSample = sample;
+                break;
+            }
+        }
+        if (t_bipolar && (edges.lastSample >= 0)) {
+            const int searchStop = std::min(t_peak + 3 * t_discRange, t_nSamples - 1);
+            bool crossedThrNegPeak = false;
+            int lastSample = -1;
+            for (int sample = edges.lastSample; sample <= searchStop; ++sample) {
+                if (edges.zeroCrossSample < 0) {
+                    if (t_samples[sample] < t_noise.mean) {
+                        edges.zeroCrossSample = sample;
+                    }
+                }
+                else if (!crossedThrNegPeak) {
+                    crossedThrNegPeak = (t_samples[sample] <= t_noise.thrNegPeak);
+                }
+                if (crossedThrNegPeak && (t_samples[sample] > t_noise.thrNegTrail)) {
+                    lastSample = sample;
+                    break;
+                }
+            }
+            edges.lastSample = lastSample;
+        }
+        return edges;
+    }
+
+    ///
+    /// Discriminate the pulse around a peak with the bitmaps of the crossing detector, like the hit finder.
+    ///
+    Edges discriminateBitmaps(
+            const pixy_roimux::CrossingDetector &t_crossings,
+            const int t_nSamples,
+            const int t_peak,
+            const int t_discRange,
+            const bool t_bipolar) {
+        using pixy_roimux::CrossingDetector;
+        Edges edges{-1, -1, -1};
+        edges.firstSample = t_crossings.findLast(CrossingDetector::kBelowLead,
+                                                 std::max(t_peak - t_discRange, 0), t_peak - 1);
+        edges.lastSample = t_crossings.findFirst(CrossingDetector::kBelowTrail,
+                                                 t_peak + 1, std::min(t_peak + t_discRange, t_nSamples - 1));
+        if (t_bipolar && (edges.lastSample >= 0)) {
+            const int searchStop = std::min(t_peak + 3 * t_discRange, t_nSamples - 1);
+            edges.zeroCrossSample = t_crossings.findFirst(CrossingDetector::kBelowBaseline,
+                                                          edges.lastSample, searchStop);
+            const int negPeakCrossSample = (edges.zeroCrossSample < 0) ? -1 :
+                                           t_crossings.findFirst(CrossingDetector::kBelowNegPeak,
+                                                                 edges.zeroCrossSample + 1, searchStop);
+            edges.lastSample = (negPeakCrossSample < 0) ? -1 :
+                               t_crossings.findFirst(CrossingDetector::kAboveNegTrail, negPeakCrossSample, searchStop);
+        }
+        return edges;
+    }
+
+    ///
+    /// Run the discriminations over all samples at or above the peak threshold of a plane and print their times. The
+    /// coarse-to-fine search only scans the samples around the envelope blocks reaching the peak threshold.
+    ///
+    template <bool Bipolar>
+    void benchPlane(
+            const std::string &t_name,
+            const BenchPlane &t_plane,
+            const unsigned t_nRepetitions) {
+        const int discRange = 10;
+        const int nSamples = static_cast<int>(t_plane.nSamples);
+        pixy_roimux::CrossingDetector crossings(t_plane.nSamples);
+        std::chrono::duration<double> scalarScanTime(0.);
+        std::chrono::duration<double> simdScanTime(0.);
+        std::chrono::duration<double> scalarTime(0.);
+        std::chrono::duration<double> bitmapTime(0.);
+        std::chrono::duration<double> coarseTime(0.);
+        unsigned long nPeaks = 0;
+        unsigned long nScannedSamples = 0;
+        long scalarChecksum = 0;
+        long bitmapChecksum = 0;
+        long coarseChecksum = 0;
+        const unsigned trailRange = Bipolar ? 3 * discRange : discRange;
+        pixy_roimux::EnvelopePyramid envelope;
+        std::vector<unsigned> hotBlocks;
+        std::vector<unsigned> peakSamples;
+        for (unsigned repetition = 0; repetition < t_nRepetitions; ++repetition) {
+            for (unsigned channel = 0; channel < t_plane.nChannels; ++channel) {
+                const int16_t *const samples = t_plane.samples.data() + channel * t_plane.nSamples;
+                const pixy_roimux::ChannelNoise &noise = t_plane.noise.at(channel);
+                const auto thresholds = pixy_roimux::CrossingDetector::makeThresholds(noise);
+                crossings.setThresholds(thresholds);
+
+                auto start = std::chrono::steady_clock::now();
+                crossings.scanScalar<Bipolar>(samples, samples, 0, t_plane.nSamples);
+                scalarScanTime += std::chrono::steady_clock::now() - start;
+
+                // Reference: compare every sample against the peak threshold and walk the edges sample by sample.
+                start = std::chrono::steady_clock::now();
+                for (int sample = 0; sample < nSamples; ++sample) {
+                    if (samples[sample] >= noise.thrPosPeak) {
+                        const Edges edges = discriminateScalar(samples, nSamples, sample, discRange, noise, Bipolar);
+                        scalarChecksum += edges.firstSample + 3 * edges.lastSample + 7 * edges.zeroCrossSample;
+                        ++nPeaks;
+                    }
+                }
+                scalarTime += std::chrono::steady_clock::now() - start;
+
+                start = std::chrono::steady_clock::now();
+                crossings.scan<Bipolar>(samples, samples, 0, t_plane.nSamples);
+                const auto scanStop = std::chrono::steady_clock::now();
+                simdScanTime += scanStop - start;
+                peakSamples.clear();
+                crossings.findAll(pixy_roimux::CrossingDetector::kAbovePeak, 0, t_plane.nSamples - 1, peakSamples);
+                for (const auto sample : peakSamples) {
+                    const Edges edges = discriminateBitmaps(crossings, nSamples, static_cast<int>(sample), discRange,
+                                                            Bipolar);
+                    bitmapChecksum += edges.firstSample + 3 * edges.lastSample + 7 * edges.zeroCrossSample;
+                }
+                bitmapTime += std::chrono::steady_clock::now() - start;
+
+                start = std::chrono::steady_clock::now();
+                envelope.build(pixy_roimux::Span<const int16_t>(samples, t_plane.nSamples));
+                hotBlocks.clear();
+                envelope.findBlocksAbove(thresholds.bands[pixy_roimux::CrossingDetector::kAbovePeak].low, hotBlocks);
+                const unsigned wordSamples = pixy_roimux::CrossingDetector::kWordSamples;
+                unsigned windowStart = 0;
+                unsigned windowStop = 0;
+                const auto searchWindow = [&]() {
+                    if (windowStart < windowStop) {
+                        crossings.scan<Bipolar>(samples, samples, windowStart, windowStop);
+                        nScannedSamples += windowStop - windowStart;
+                        peakSamples.clear();
+                        crossings.findAll(pixy_roimux::CrossingDetector::kAbovePeak, windowStart, windowStop - 1,
+                                          peakSamples);
+                        for (const auto sample : peakSamples) {
+                            const Edges edges = discriminateBitmaps(crossings, nSamples, static_cast<int>(sample),
+                                                                    discRange, Bipolar);
+                            coarseChecksum += edges.firstSample + 3 * edges.lastSample + 7 * edges.zeroCrossSample;
+                        }
+                    }
+                };
+                for (const auto block : hotBlocks) {
+                    const unsigned blockStart = block * pixy_roimux::EnvelopePyramid::kBlockSize;
+                    const unsigned start = (blockStart - std::min<unsigned>(discRange, blockStart)) / wordSamples *
+                                           wordSamples;
+                    if (start > windowStop) {
+                        searchWindow();
+                        windowStart = start;
+                    }
+                    windowStop = std::min((blockStart + pixy_roimux::EnvelopePyramid::kBlockSize + trailRange +
+                                           wordSamples - 1) / wordSamples * wordSamples, t_plane.nSamples);
+                }
+                searchWindow();
+                coarseTime += std::chrono::steady_clock::now() - start;
+            }
+        }
+        if ((scalarChecksum != bitmapChecksum) || (scalarChecksum != coarseChecksum)) {
+            std::cerr << "ERROR: Crossing detector and scalar discrimination disagree on the " << t_name
+                      << " plane!" << std::endl;
+            exit(1);
+        }
+        const double nPlaneSamples = static_cast<double>(t_nRepetitions) * t_plane.nChannels * t_plane.nSamples;
+        std::cout << t_name << (Bipolar ? " bipolar" : " unipolar") << ": "
+                  << nPeaks / t_nRepetitions << " samples above the peak threshold per plane.\n"
+                  << "  scan: scalar " << scalarScanTime.count() * 1e9 / nPlaneSamples << "ns, SIMD "
+                  << simdScanTime.count() * 1e9 / nPlaneSamples << "ns per sample.\n"
+                  << "  discrimination: scalar " << scalarTime.count() * 1e9 / nPlaneSamples << "ns, bitmaps "
+                  << bitmapTime.count() * 1e9 / nPlaneSamples << "ns per sample, speedup "
+                  << scalarTime.count() / bitmapTime.count() << ".\n"
+                  << "  scan and discrimination: full " << (simdScanTime + bitmapTime).count() * 1e9 / nPlaneSamples
+                  << "ns, coarse-to-fine " << coarseTime.count() * 1e9 / nPlaneSamples << "ns per sample, "
+                  << 100. * nScannedSamples / nPlaneSamples << "% of the samples scanned.\n";
+    }
+
+    ///
+    /// Convert the DAQ histograms of an event one sample at a time into readout histograms, like ChargeData did before
+    /// the waveform planes and the gather plan.
+    ///
+    void convertPerSample(
+            const TH2S &t_indHisto,
+            const TH2S &t_colHisto,
+            const pixy_roimux::RunParams &t_runParams,
+            TH2S &t_pixelHisto,
+            TH2S &t_roiHisto) {
+        for (unsigned pixel = 0; pixel < t_runParams.getNPixels(); ++pixel) {
+            for (unsigned sample = 0; sample < t_runParams.getNSamples(); ++sample) {
+                if (t_runParams.pixel2daq(pixel) < (t_runParams.getNChans() / 2)) {
+                    t_pixelHisto.SetBinContent((sample + 1), (pixel + 1), t_indHisto.GetBinContent(
+                            (sample + 1), (t_runParams.pixel2daq(pixel) + 1)));
+                }
+                else {
+                    t_pixelHisto.SetBinContent((sample + 1), (pixel + 1), t_colHisto.GetBinContent(
+                            (sample + 1), (t_runParams.pixel2daq(pixel) - t_runParams.getNChans() / 2 + 1)));
+                }
+            }
+        }
+        for (unsigned roi = 0; roi < t_runParams.getNRois(); ++roi) {
+            for (unsigned sample = 0; sample < t_runParams.getNSamples(); ++sample) {
+                t_roiHisto.SetBinContent((sample + 1), (roi + 1), t_colHisto.GetBinContent(
+                        (sample + 1), (t_runParams.roi2daq(roi) - t_runParams.getNChans() / 2 + 1)));
+            }
+        }
+    }
+
+    ///
+    /// Time the conversion of a synthetic pair of DAQ histograms per sample into readout histograms against
+    /// ChargeData::convertEvent() into waveform planes, both including the allocation of the output.
+    ///
+    void benchConversion(
+            const pixy_roimux::RunParams &t_runParams,
+            const unsigned t_nRepetitions) {
+        const unsigned nSamples = t_runParams.getNSamples();
+        const unsigned nDaqChannels = t_runParams.getNChans() / 2;
+        TH1::AddDirectory(false);
+        TH2S indHisto("Ind_0", "Ind_0", nSamples, 0, nSamples, nDaqChannels, 0, nDaqChannels);
+        TH2S colHisto("Col_0", "Col_0", nSamples, 0, nSamples, nDaqChannels, 0, nDaqChannels);
+        std::mt19937 generator(1);
+        std::uniform_int_distribution<int> adc(-2048, 2047);
+        for (unsigned channel = 0; channel < nDaqChannels; ++channel) {
+            for (unsigned sample = 0; sample < nSamples; ++sample) {
+                indHisto.SetBinContent(sample + 1, channel + 1, adc(generator));
+                colHisto.SetBinContent(sample + 1, channel + 1, adc(generator));
+            }
+        }
+        std::chrono::duration<double> perSampleTime(0.);
+        std::chrono::duration<double> gatherTime(0.);
+        for (unsigned repetition = 0; repetition < t_nRepetitions; ++repetition) {
+            auto start = std::chrono::steady_clock::now();
+            TH2S pixelHisto("pixelHisto_0", "pixelHisto_0", nSamples, 0, nSamples, t_runParams.getNPixels(), 0,
+                            t_runParams.getNPixels());
+            TH2S roiHisto("roiHisto_0", "roiHisto_0", nSamples, 0, nSamples, t_runParams.getNRois(), 0,
+                          t_runParams.getNRois());
+            convertPerSample(indHisto, colHisto, t_runParams, pixelHisto, roiHisto);
+            perSampleTime += std::chrono::steady_clock::now() - start;
+
+            start = std::chrono::steady_clock::now();
+            pixy_roimux::EventWaveforms waveforms(0, t_runParams.getNPixels(), t_runParams.getNRois(), nSamples);
+            pixy_roimux::ChargeData::convertEvent(indHisto, colHisto, t_runParams, waveforms);
+            gatherTime += std::chrono::steady_clock::now() - start;
+
+            if (!repetition) {
+                for (unsigned pixel = 0; pixel < t_runParams.getNPixels(); ++pixel) {
+                    for (unsigned sample = 0; sample < nSamples; ++sample) {
+                        if (waveforms.getPixelPlane().getChannel(pixel)[sample] !=
+                                pixelHisto.GetBinContent(sample + 1, pixel + 1)) {
+                            std::cerr << "ERROR: Per-sample and gather plan conversions disagree!" << std::endl;
+                            exit(1);
+                        }
+                    }
+                }
+            }
+        }
+        std::cout << "DAQ histogram conversion of " << t_runParams.getNChans() << " channels of " << nSamples
+                  << " samples: per sample " << perSampleTime.count() * 1e6 / t_nRepetitions << "us, gather plan "
+                  << gatherTime.count() * 1e6 / t_nRepetitions << "us per event, speedup "
+                  << perSampleTime.count() / gatherTime.count() << ".\n";
+    }
+}
+
+
+///
+/// Microbenchmark of the threshold crossing detector of the 2D hit finder on synthetic quiet and busy planes. With a run
+/// parameter file, the conversion of the DAQ histograms is timed as well.
+///
+int main(int argc, char** argv) {
+    const unsigned nRepetitions = (argc > 1) ? static_cast<unsigned>(std::stoul(argv[1])) : 100;
+    if (!nRepetitions) {
+        std::cerr << "Usage: " << argv[0] << " [nRepetitions] [path/to/RunParameters.json]" << std::endl;
+        exit(1);
+    }
+#if defined(__AVX2__)
+    std::cout << "Crossing detector built with AVX2.\n";
+#elif defined(__SSE2__)
+    std::cout << "Crossing detector built with SSE2.\n";
+#else
+    std::cout << "Crossing detector built without SIMD.\n";
+#endif
+    const unsigned nChannels = 64;
+    const unsigned nSamples = 2000;
+    benchPlane<false>("Quiet", makePlane(nChannels, nSamples, 2, false), nRepetitions);
+    benchPlane<false>("Busy", makePlane(nChannels, nSamples, 60, false), nRepetitions);
+    benchPlane<true>("Quiet", makePlane(nChannels, nSamples, 2, true), nRepetitions);
+    benchPlane<true>("Busy", makePlane(nChannels, nSamples, 60, true), nRepetitions);
+    if (argc > 2) {
+        benchConversion(pixy_roimux::RunParams(argv[2]), nRepetitions);
+    }
+
+    return 0;
+}